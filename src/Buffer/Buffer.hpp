@@ -304,6 +304,15 @@ public:
 	/** Return true if there's no data in the buffer. */
 	bool empty() const { return m_begin == m_end; }
 
+	/**
+	 * Return count of blocks held by the buffer. Block ids are
+	 * sequential, so it's O(1).
+	 */
+	size_t blockCount() const
+	{
+		return m_blocks.last().id - m_blocks.first().id + 1;
+	}
+
 	/** Return 0 if everythng is correct. */
 	int debugSelfCheck() const;
 
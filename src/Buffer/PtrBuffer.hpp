@@ -0,0 +1,116 @@
+#pragma once
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <cstddef>
+#include <cstring>
+
+namespace tnt {
+
+/**
+ * Read-only view of contiguous memory (for instance, a mapped file) which
+ * provides the part of Buffer interface used by msgpack decoder. Unlike
+ * Buffer iterators, iterators of the view are plain pointers: they are
+ * not registered anywhere, so they are free to copy and can be used by
+ * several threads concurrently.
+ */
+class PtrBuffer {
+public:
+	class iterator {
+	public:
+		iterator() = default;
+		explicit iterator(const char *position) : m_position(position) {}
+
+		iterator& operator ++ () { ++m_position; return *this; }
+		iterator& operator += (size_t step)
+		{
+			m_position += step;
+			return *this;
+		}
+		iterator operator + (size_t step) const
+		{
+			return iterator(m_position + step);
+		}
+		const char& operator * () const { return *m_position; }
+		bool operator == (const iterator &a) const
+		{
+			return m_position == a.m_position;
+		}
+		bool operator != (const iterator &a) const
+		{
+			return m_position != a.m_position;
+		}
+		bool operator < (const iterator &a) const
+		{
+			return m_position < a.m_position;
+		}
+		size_t operator - (const iterator &a) const
+		{
+			return m_position - a.m_position;
+		}
+		const char *data() const { return m_position; }
+	private:
+		const char *m_position = nullptr;
+	};
+
+	PtrBuffer(const char *data, size_t size) :
+		m_begin(data), m_end(data + size) {}
+	PtrBuffer(const PtrBuffer& buf) = delete;
+	PtrBuffer& operator = (const PtrBuffer& buf) = delete;
+
+	iterator begin() const { return iterator(m_begin); }
+	iterator end() const { return iterator(m_end); }
+	size_t size() const { return m_end - m_begin; }
+
+	/** Copy @a size bytes @a itr points to to @a buf. */
+	void get(const iterator &itr, char *buf, size_t size) const
+	{
+		memcpy(buf, itr.data(), size);
+	}
+	/** Read unaligned object of type T at position @a itr. */
+	template <class T>
+	T get(const iterator &itr) const
+	{
+		T t;
+		memcpy(&t, itr.data(), sizeof(T));
+		return t;
+	}
+	/** Determine whether there are @a size bytes after @a itr. */
+	bool has(const iterator &itr, size_t size) const
+	{
+		return size <= (size_t)(m_end - itr.data());
+	}
+
+private:
+	const char *m_begin;
+	const char *m_end;
+};
+
+} // namespace tnt {
@@ -0,0 +1,120 @@
+#pragma once
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "NetworkEngine.hpp"
+
+/**
+ * Cache of resolved addresses shared by connections of network provider,
+ * so reconnects don't query resolver each time. getaddrinfo() doesn't
+ * return TTL of DNS records, so entries live for the configured one.
+ * The address connected last goes first on the next connect, so a dead
+ * address doesn't delay the next connects.
+ */
+template<class NETWORK>
+class AddressCache {
+public:
+	/** Default time to live of entries, ms. */
+	static constexpr unsigned DEFAULT_TTL = 30000;
+
+	/** Drop entries and set @a ttl (ms); zero disables caching. */
+	void setTtl(unsigned ttl);
+	/** Return addresses of @a addr or nullptr if it can't be resolved. */
+	const std::vector<SockAddr> *resolve(const std::string_view &addr,
+					     unsigned port);
+	/** Move address @a idx of @a addr to the front. */
+	void promote(const std::string_view &addr, unsigned port, size_t idx);
+	/** Count of queries to resolver. */
+	size_t resolves() const { return m_Resolves; }
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	struct Entry {
+		std::vector<SockAddr> addrs;
+		clock::time_point expires;
+	};
+
+	static std::string key(const std::string_view &addr, unsigned port)
+	{
+		return std::string(addr) + ":" + std::to_string(port);
+	}
+
+	std::unordered_map<std::string, Entry> m_Entries;
+	std::chrono::milliseconds m_Ttl{DEFAULT_TTL};
+	size_t m_Resolves = 0;
+};
+
+template<class NETWORK>
+void
+AddressCache<NETWORK>::setTtl(unsigned ttl)
+{
+	m_Entries.clear();
+	m_Ttl = std::chrono::milliseconds(ttl);
+}
+
+template<class NETWORK>
+const std::vector<SockAddr> *
+AddressCache<NETWORK>::resolve(const std::string_view &addr, unsigned port)
+{
+	Entry &entry = m_Entries[key(addr, port)];
+	clock::time_point now = clock::now();
+	if (! entry.addrs.empty() && now < entry.expires)
+		return &entry.addrs;
+	m_Resolves++;
+	if (NETWORK::resolve(addr, port, entry.addrs) != 0 ||
+	    entry.addrs.empty()) {
+		m_Entries.erase(key(addr, port));
+		return nullptr;
+	}
+	entry.expires = now + m_Ttl;
+	return &entry.addrs;
+}
+
+template<class NETWORK>
+void
+AddressCache<NETWORK>::promote(const std::string_view &addr, unsigned port,
+			       size_t idx)
+{
+	auto itr = m_Entries.find(key(addr, port));
+	if (itr == m_Entries.end() || idx >= itr->second.addrs.size())
+		return;
+	std::vector<SockAddr> &addrs = itr->second.addrs;
+	std::rotate(addrs.begin(), addrs.begin() + idx,
+		    addrs.begin() + idx + 1);
+}
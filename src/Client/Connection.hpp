@@ -30,28 +30,31 @@
  * SUCH DAMAGE.
  */
 
+#include "ConnectionStat.hpp"
+#include "Credentials.hpp"
+#include "LatencyStat.hpp"
 #include "RequestEncoder.hpp"
 #include "ResponseDecoder.hpp"
+#include "Tracer.hpp"
 
 #include "../Utils/rlist.h"
 #include "../Utils/Logger.hpp"
+#include "../Utils/SmallVector.hpp"
 #include "../Utils/Wrappers.hpp"
 
 #include <sys/uio.h>
 
 #include <any>
 #include <algorithm>
+#include <chrono>
+#include <deque>
+#include <functional>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <set>
 
-/** Statistics concerning requests/responses. */
-struct ConnectionStat {
-	size_t send;
-	size_t read;
-};
-
 /** rid == request id */
 typedef size_t rid_t;
 
@@ -66,14 +69,62 @@ struct ConnectionError {
 	std::string msg;
 };
 
+/**
+ * Policy of automatic reconnect, see Connection::setReconnect(). Delay
+ * between attempts starts from @a initial_backoff and is multiplied by
+ * @a multiplier after each failed attempt up to @a max_backoff (ms).
+ */
+struct ReconnectOptions {
+	/** Failed attempts in a row before giving up; 0 is no limit. */
+	size_t max_attempts = 10;
+	int initial_backoff = 100;
+	int max_backoff = 5000;
+	double multiplier = 2;
+	/** Timeout of one connect attempt, seconds. */
+	size_t connect_timeout = 2;
+	/** Replay SELECT and PING requests lost along with connection. */
+	bool replay_reads = true;
+};
+
+/**
+ * TCP-level liveness probes, see Connector::setKeepalive(). They are
+ * answered by the kernel, so they find dead peers and broken routes but
+ * not a hung server (see HeartbeatOptions).
+ */
+struct KeepaliveOptions {
+	/** Silence before the first probe and between probes, seconds. */
+	int idle = 60;
+	int interval = 10;
+	/** Unanswered probes before the connection is dropped. */
+	int count = 3;
+	/** Max time (ms) sent data may stay unacknowledged; 0 is default. */
+	unsigned user_timeout = 0;
+};
+
+/** Code of error completing requests lost along with connection. */
+constexpr int CONNECTION_LOST_ERRCODE = 77;
+
 template <class BUFFER, class NetProvider>
 class Connector;
 
+template <class BUFFER, class NetProvider>
+class ReplicationStream;
+
+template <class BUFFER, class NetProvider, class KEY>
+class Cursor;
+
+struct CursorOptions;
+
 /** Each connection is supposed to be bound to a single socket. */
 template<class BUFFER, class NetProvider>
 class Connection {
 public:
 	using iterator = typename BUFFER::iterator;
+	using Tracer_t = typename NetProvider::Tracer_t;
+	using PushHandler_t = std::function<void(Response<BUFFER> &push)>;
+	/** Value is raw msgpack; nil if the key isn't set on server. */
+	using WatchHandler_t = std::function<void(const std::string &key,
+						  const std::string &value)>;
 
 	/**
 	 * Public wrappers to access request methods in Tarantool way:
@@ -153,6 +204,15 @@ public:
 						     index_id, limit,
 						     offset, iterator);
 			}
+			/**
+			 * Iterate over the index page by page without
+			 * rescanning skipped tuples (see Cursor.hpp).
+			 */
+			template <class T>
+			Cursor<BUFFER, NetProvider, T> cursor(const T &key);
+			template <class T>
+			Cursor<BUFFER, NetProvider, T>
+			cursor(const T &key, const CursorOptions &opts);
 		private:
 			Connection<BUFFER, NetProvider> &m_Conn;
 			Space &m_Space;
@@ -170,16 +230,98 @@ public:
 
 	std::optional<Response<BUFFER>> getResponse(rid_t future);
 	bool futureIsReady(rid_t future);
+	/**
+	 * Drop response to request @a future which is in flight or ready:
+	 * the response (and its pushes) is skipped on arrival and is never
+	 * stored. Tarantool can't cancel a request, so it's executed anyway.
+	 */
+	void discard(rid_t future);
+
+	/**
+	 * Out-of-band messages (IPROTO_CHUNK sent by box.session.push())
+	 * precede the final response of request. Register @a handler which
+	 * is invoked for each push of request @a future as soon as it's
+	 * decoded; data of the push is valid only during the call. The
+	 * handler is dropped along with the final response. It must not
+	 * register other handlers.
+	 */
+	void onPush(rid_t future, PushHandler_t handler);
+	/**
+	 * Take the oldest push of request @a future which has no handler.
+	 * Pushes hold data in the input buffer: ones not taken by the moment
+	 * the final response is taken by getResponse() are dropped.
+	 */
+	std::optional<Response<BUFFER>> getPush(rid_t future);
+	bool pushIsReady(rid_t future);
+
+	/**
+	 * Subscribe to updates of key set by box.broadcast() on server.
+	 * Events are not responses: they don't occupy futures. The latest
+	 * value is cached and is read by getWatched() with no round-trip;
+	 * @a handler (if any) is invoked on each update.
+	 * Return -1 if @a key is empty.
+	 */
+	int watch(const std::string &key, WatchHandler_t handler = nullptr);
+	void unwatch(const std::string &key);
+	/**
+	 * The latest value of watched @a key (raw msgpack) or nullptr if
+	 * it's not watched or no event has been received yet.
+	 */
+	const std::string* getWatched(const std::string &key) const;
 
 	template <class T>
 	rid_t call(const std::string &func, const T &args);
 	rid_t ping();
+	/**
+	 * Authenticate as @a creds.user() using salt of the greeting. Is
+	 * sent by Connector::connect() with credentials, but can be used
+	 * to change user of the session.
+	 */
+	rid_t auth(const Credentials &creds);
 
 	void setError(const std::string &msg);
 	std::string& getError();
 	void reset();
 
+	/**
+	 * Re-establish the connection automatically when it's lost: it's
+	 * done by Connector::wait() and waitAny() with address (and
+	 * credentials) of the last Connector::connect(). Requests which
+	 * haven't been sent are sent after reconnect; sent requests which
+	 * are not answered are replayed if they are idempotent and are
+	 * completed with CONNECTION_LOST_ERRCODE error otherwise, since
+	 * they might have been executed. Connector::close() disables it.
+	 */
+	void setReconnect(const ReconnectOptions &opts = ReconnectOptions{});
+	/**
+	 * Mark request @a future which hasn't been sent yet as safe to be
+	 * executed twice, so it's replayed on reconnect. It costs a copy
+	 * of the request. Return @a future.
+	 */
+	rid_t idempotent(rid_t future);
+	/** Count of successful automatic reconnects. */
+	size_t reconnects() const { return m_Reconnect.reconnects; }
+
+	/**
+	 * Add latency histograms of the connection to @a snap. Can be
+	 * called from any thread; to merge several connections just pass
+	 * the same snapshot.
+	 */
+	void getLatency(LatencySnapshot &snap) const;
+	/**
+	 * Type (Iproto::Type) of the request waiting for response or -1 if
+	 * there's no such request.
+	 */
+	int requestType(rid_t future);
+	/** Copy of I/O counters of the connection. Can be called from any thread. */
+	ConnectionStat snapshot() const;
+
 	BUFFER& getInBuf();
+	/**
+	 * Schema version of the latest response (0 until the first one).
+	 * Changes when DDL is made on the server.
+	 */
+	int schemaVersion() const { return m_SchemaVersion; }
 
 #ifndef NDEBUG
 	std::string toString();
@@ -217,8 +359,23 @@ public:
 	friend
 	int decodeGreeting(Connection<B, N> &conn);
 
+	/** Replication stream decodes rows right from the input buffer. */
+	template<class B, class N>
+	friend class ReplicationStream;
+
+	template<class B, class N, class K>
+	friend class Cursor;
+
+	/** Connector restores lost connection. */
+	template<class B, class N>
+	friend class Connector;
+
 	int socket;
 	ConnectionStatus status;
+	/** Updated by the connection itself and by network provider. */
+	ConnectionCounters counters;
+	/** Link Connector::m_Connections */
+	struct rlist m_in_connector;
 	/** Link Connector::m_ready_to_read */
 	struct rlist m_in_read;
 	/** Link NetworkProvider::m_ready_to_write */
@@ -243,8 +400,112 @@ private:
 	ConnectionError m_Error;
 	Greeting m_Greeting;
 
-	std::unordered_map<rid_t, Response<BUFFER>> m_Futures;
+	using Futures_t = std::unordered_map<rid_t, Response<BUFFER>>;
+	Futures_t m_Futures;
+	/**
+	 * Nodes of futures which are already returned to user. They are
+	 * reused for new responses, so there's no allocations in steady state.
+	 */
+	std::vector<typename Futures_t::node_type> m_FreeFutures;
+	std::unordered_map<rid_t, PushHandler_t> m_PushHandlers;
+	/** Pushes of requests without handler, in order of arrival. */
+	std::unordered_map<rid_t, std::deque<Response<BUFFER>>> m_Pushes;
+	/** Requests in flight which responses are dropped on arrival. */
+	std::unordered_set<rid_t> m_Discarded;
+	struct Watcher {
+		/** The latest value; empty until the first event. */
+		std::string value;
+		WatchHandler_t handler;
+	};
+	std::unordered_map<std::string, Watcher> m_Watchers;
+	LatencyStat m_Latency;
+	int m_SchemaVersion = 0;
+	/**
+	 * Count of bytes encoded to and sent from the output buffer: they
+	 * locate requests in flight in the output stream.
+	 */
+	uint64_t m_EncodedBytes = 0;
+	uint64_t m_SentBytes = 0;
+	using Replay_t = std::unordered_map<rid_t, std::string>;
+	struct Reconnect {
+		ReconnectOptions opts;
+		bool is_enabled = false;
+		/** In-flight requests are sorted out, reconnect is pending. */
+		bool is_lost = false;
+		/** Address of the last connect. */
+		std::string addr;
+		unsigned port = 0;
+		std::optional<Credentials> creds;
+		/** Failed attempts since the connection has been lost. */
+		size_t attempts = 0;
+		std::chrono::steady_clock::time_point next_attempt;
+		size_t reconnects = 0;
+		/** Copies of idempotent requests in flight. */
+		Replay_t replay;
+		/**
+		 * Nodes of copies which are already answered. Their strings
+		 * keep capacity, so copying is allocation free in steady state.
+		 */
+		std::vector<typename Replay_t::node_type> free_replay;
+		/** Output is moved aside by detachOutput(). */
+		bool is_detached = false;
+		/** Output not sent to the lost socket. */
+		std::string pending;
+		/** Stream offsets of the pending output and of its end. */
+		uint64_t pending_offset = 0;
+		uint64_t pending_end = 0;
+	} m_Reconnect;
+	/** Applied on each (re)connect. */
+	std::optional<KeepaliveOptions> m_Keepalive;
+	struct Heartbeat {
+		/** Received bytes by the previous round of heartbeat. */
+		size_t recv_mark = 0;
+		/** Pings sent since anything has been received. */
+		size_t missed = 0;
+		/** Syncs of pings waiting for response. */
+		std::unordered_set<rid_t> pings;
+	} m_Heartbeat;
+
+	void addFuture(rid_t future, Response<BUFFER> &&response);
+	/** Copy of the request to be replayed, reused node if possible. */
+	std::string &replayCopy(rid_t future);
+	void dropReplayCopy(rid_t future);
+	void addPush(rid_t future, Response<BUFFER> &&push);
+	void eventDecoded(Response<BUFFER> &event);
 
+	/** Account encoded request and schedule it to be sent. */
+	rid_t requestEncoded(size_t size, int type);
+	/** Schedule encoded message which has no response to be sent. */
+	void messageEncoded(size_t size);
+	/**
+	 * Send heartbeat ping: it's not a request, so it isn't accounted
+	 * in counters and latency, isn't replayed and its response is
+	 * dropped on arrival.
+	 */
+	void heartbeatPing();
+	/** Complete request in flight with error response. */
+	void failRequest(rid_t future, const std::string &msg);
+	/**
+	 * Socket is closed: drop the incomplete input and fail requests
+	 * which might have been executed and can't be replayed. Return
+	 * count of failed requests.
+	 */
+	size_t connectionLost();
+	/** Fail all requests in flight and drop pending output. */
+	size_t reconnectFailed(const std::string &msg);
+	/**
+	 * New socket is connected: move output aside, so that nothing but
+	 * authentication is sent until it succeeds.
+	 */
+	void detachOutput();
+	/** Authentication on the new socket has failed: undo detachOutput(). */
+	void attachOutput();
+	/**
+	 * New socket is connected (and authenticated): send pending
+	 * requests, replayed ones and subscriptions of watchers.
+	 */
+	void restoreOutput();
+	void updateBufferStat();
 	template <class T>
 	rid_t insert(const T &tuple, uint32_t space_id);
 	template <class T>
@@ -262,6 +523,10 @@ private:
 		     uint32_t space_id, uint32_t index_id = 0,
 		     uint32_t limit = UINT32_MAX,
 		     uint32_t offset = 0, IteratorType iterator = EQ);
+	template <class T>
+	rid_t selectAfter(const T &key, uint32_t space_id, uint32_t index_id,
+			  uint32_t limit, IteratorType iterator,
+			  const std::string &after_position);
 };
 
 template<class BUFFER, class NetProvider>
@@ -276,6 +541,8 @@ Connection<BUFFER, NetProvider>::Connection(Connector<BUFFER, NetProvider> &conn
 	memset(&status, 0, sizeof(status));
 	rlist_create(&m_in_write);
 	rlist_create(&m_in_read);
+	m_Connector.attach(*this);
+	updateBufferStat();
 }
 
 template<class BUFFER, class NetProvider>
@@ -293,18 +560,73 @@ Connection<BUFFER, NetProvider>::~Connection()
 		rlist_del(&m_in_read);
 		LOG_WARNING("Connection ", this, " had unread data in input buffer!");
 	}
+	m_Connector.detach(*this);
 }
 
 template<class BUFFER, class NetProvider>
 std::optional<Response<BUFFER>>
 Connection<BUFFER, NetProvider>::getResponse(rid_t future)
 {
-	auto entry = m_Futures.find(future);
-	if (entry == m_Futures.end())
+	auto node = m_Futures.extract(future);
+	if (node.empty())
 		return std::nullopt;
-	Response<BUFFER> response = std::move(entry->second);
-	m_Futures.erase(future);
-	return std::make_optional(std::move(response));
+	if (! m_Pushes.empty())
+		m_Pushes.erase(future);
+	std::optional<Response<BUFFER>> response(std::move(node.mapped()));
+	m_FreeFutures.push_back(std::move(node));
+	counters.futures_ready.set(m_Futures.size());
+	return response;
+}
+
+template<class BUFFER, class NetProvider>
+void
+Connection<BUFFER, NetProvider>::discard(rid_t future)
+{
+	if (getResponse(future) != std::nullopt)
+		return;
+	m_PushHandlers.erase(future);
+	m_Pushes.erase(future);
+	m_Discarded.insert(future);
+}
+
+template<class BUFFER, class NetProvider>
+void
+Connection<BUFFER, NetProvider>::addFuture(rid_t future,
+					   Response<BUFFER> &&response)
+{
+	if (m_FreeFutures.empty()) {
+		m_Futures.emplace(future, std::move(response));
+		return;
+	}
+	auto node = std::move(m_FreeFutures.back());
+	m_FreeFutures.pop_back();
+	node.key() = future;
+	node.mapped() = std::move(response);
+	m_Futures.insert(std::move(node));
+}
+
+template<class BUFFER, class NetProvider>
+std::string &
+Connection<BUFFER, NetProvider>::replayCopy(rid_t future)
+{
+	auto itr = m_Reconnect.replay.find(future);
+	if (itr != m_Reconnect.replay.end())
+		return itr->second;
+	if (m_Reconnect.free_replay.empty())
+		return m_Reconnect.replay[future];
+	auto node = std::move(m_Reconnect.free_replay.back());
+	m_Reconnect.free_replay.pop_back();
+	node.key() = future;
+	return m_Reconnect.replay.insert(std::move(node)).position->second;
+}
+
+template<class BUFFER, class NetProvider>
+void
+Connection<BUFFER, NetProvider>::dropReplayCopy(rid_t future)
+{
+	auto node = m_Reconnect.replay.extract(future);
+	if (! node.empty())
+		m_Reconnect.free_replay.push_back(std::move(node));
 }
 
 template<class BUFFER, class NetProvider>
@@ -314,6 +636,117 @@ Connection<BUFFER, NetProvider>::futureIsReady(rid_t future)
 	return m_Futures.find(future) != m_Futures.end();
 }
 
+template<class BUFFER, class NetProvider>
+void
+Connection<BUFFER, NetProvider>::onPush(rid_t future, PushHandler_t handler)
+{
+	m_PushHandlers[future] = std::move(handler);
+}
+
+template<class BUFFER, class NetProvider>
+std::optional<Response<BUFFER>>
+Connection<BUFFER, NetProvider>::getPush(rid_t future)
+{
+	auto itr = m_Pushes.find(future);
+	if (itr == m_Pushes.end())
+		return std::nullopt;
+	std::optional<Response<BUFFER>> push(std::move(itr->second.front()));
+	itr->second.pop_front();
+	if (itr->second.empty())
+		m_Pushes.erase(itr);
+	return push;
+}
+
+template<class BUFFER, class NetProvider>
+bool
+Connection<BUFFER, NetProvider>::pushIsReady(rid_t future)
+{
+	return m_Pushes.find(future) != m_Pushes.end();
+}
+
+template<class BUFFER, class NetProvider>
+void
+Connection<BUFFER, NetProvider>::addPush(rid_t future, Response<BUFFER> &&push)
+{
+	counters.pushes.add();
+	auto itr = m_PushHandlers.find(future);
+	if (itr != m_PushHandlers.end()) {
+		itr->second(push);
+		return;
+	}
+	m_Pushes[future].push_back(std::move(push));
+}
+
+template<class BUFFER, class NetProvider>
+int
+Connection<BUFFER, NetProvider>::watch(const std::string &key,
+				       WatchHandler_t handler)
+{
+	if (key.empty()) {
+		LOG_ERROR("Watched key must not be empty");
+		return -1;
+	}
+	auto [itr, is_new] = m_Watchers.try_emplace(key);
+	itr->second.handler = std::move(handler);
+	if (is_new)
+		messageEncoded(m_Encoder.encodeWatch(key));
+	return 0;
+}
+
+template<class BUFFER, class NetProvider>
+void
+Connection<BUFFER, NetProvider>::unwatch(const std::string &key)
+{
+	if (m_Watchers.erase(key) != 0)
+		messageEncoded(m_Encoder.encodeUnwatch(key));
+}
+
+template<class BUFFER, class NetProvider>
+const std::string*
+Connection<BUFFER, NetProvider>::getWatched(const std::string &key) const
+{
+	auto itr = m_Watchers.find(key);
+	if (itr == m_Watchers.end() || itr->second.value.empty())
+		return nullptr;
+	return &itr->second.value;
+}
+
+template<class BUFFER, class NetProvider>
+void
+Connection<BUFFER, NetProvider>::eventDecoded(Response<BUFFER> &event)
+{
+	if (event.body.event_key == std::nullopt) {
+		LOG_ERROR("Event without key, ignoring");
+		return;
+	}
+	const std::string &key = *event.body.event_key;
+	auto itr = m_Watchers.find(key);
+	/* Key is unwatched while the event is in flight. */
+	if (itr == m_Watchers.end())
+		return;
+	Watcher &watcher = itr->second;
+	if (event.body.event_data == std::nullopt) {
+		watcher.value.assign(1, '\xc0');
+	} else {
+		/* Copy the value: it outlives the input buffer. */
+		iterator begin = *event.body.event_data;
+		mpp::Dec<BUFFER> dec(m_InBuf);
+		dec.SetPosition(begin);
+		dec.SetReader(false, SkipValueReader<BUFFER>{dec});
+		if (dec.Read() != mpp::READ_SUCCESS) {
+			LOG_ERROR("Failed to decode value of event ", key);
+			return;
+		}
+		iterator end = dec.getPosition();
+		watcher.value.resize(end - begin);
+		m_InBuf.get(begin, watcher.value.data(), watcher.value.size());
+	}
+	/* Server sends the next event only after acknowledgement. */
+	messageEncoded(m_Encoder.encodeWatch(key));
+	if (watcher.handler)
+		watcher.handler(key, watcher.value);
+}
+
 template<class BUFFER, class NetProvider>
 void
 Connection<BUFFER, NetProvider>::readyToDecode()
@@ -321,23 +754,77 @@ Connection<BUFFER, NetProvider>::readyToDecode()
 	m_Connector.readyToDecode(*this);
 }
 
+template<class BUFFER, class NetProvider>
+rid_t
+Connection<BUFFER, NetProvider>::requestEncoded(size_t size, int type)
+{
+	rid_t sync = RequestEncoder<BUFFER>::getSync();
+	if (m_Reconnect.is_enabled && m_Reconnect.opts.replay_reads &&
+	    (type == Iproto::SELECT || type == Iproto::PING)) {
+		std::string &copy = replayCopy(sync);
+		copy.resize(size);
+		m_OutBuf.get(m_EndEncoded, copy.data(), size);
+	}
+	m_EndEncoded += size;
+	traceEvent<Tracer_t>(TRACE_ENCODED, socket, sync, size);
+	m_Latency.requestEncoded(sync, type, m_EncodedBytes, size);
+	m_EncodedBytes += size;
+	counters.requests.add();
+	counters.futures_pending.set(m_Latency.inflight());
+	updateBufferStat();
+	m_Connector.readyToSend(*this);
+	return sync;
+}
+
+template<class BUFFER, class NetProvider>
+void
+Connection<BUFFER, NetProvider>::messageEncoded(size_t size)
+{
+	m_EndEncoded += size;
+	m_EncodedBytes += size;
+	updateBufferStat();
+	m_Connector.readyToSend(*this);
+}
+
+template<class BUFFER, class NetProvider>
+void
+Connection<BUFFER, NetProvider>::heartbeatPing()
+{
+	messageEncoded(m_Encoder.encodePing());
+	m_Heartbeat.pings.insert(RequestEncoder<BUFFER>::getSync());
+}
+
+template<class BUFFER, class NetProvider>
+void
+Connection<BUFFER, NetProvider>::updateBufferStat()
+{
+	counters.buffer_blocks.set(m_InBuf.blockCount() +
+				   m_OutBuf.blockCount());
+}
+
 template<class BUFFER, class NetProvider>
 template <class T>
 rid_t
 Connection<BUFFER, NetProvider>::call(const std::string &func, const T &args)
 {
-	m_EndEncoded += m_Encoder.encodeCall(func, args);
-	m_Connector.readyToSend(*this);
-	return RequestEncoder<BUFFER>::getSync();
+	return requestEncoded(m_Encoder.encodeCall(func, args), Iproto::CALL);
 }
 
 template<class BUFFER, class NetProvider>
 rid_t
 Connection<BUFFER, NetProvider>::ping()
 {
-	m_EndEncoded += m_Encoder.encodePing();
-	m_Connector.readyToSend(*this);
-	return RequestEncoder<BUFFER>::getSync();
+	return requestEncoded(m_Encoder.encodePing(), Iproto::PING);
+}
+
+template<class BUFFER, class NetProvider>
+rid_t
+Connection<BUFFER, NetProvider>::auth(const Credentials &creds)
+{
+	char scramble[Iproto::SCRAMBLE_SIZE];
+	creds.scramble(m_Greeting.salt, scramble);
+	size_t size = m_Encoder.encodeAuth(creds.user(), scramble);
+	return requestEncoded(size, Iproto::AUTH);
 }
 
 template<class BUFFER, class NetProvider>
@@ -345,9 +832,8 @@ template <class T>
 rid_t
 Connection<BUFFER, NetProvider>::insert(const T &tuple, uint32_t space_id)
 {
-	m_EndEncoded += m_Encoder.encodeInsert(tuple, space_id);
-	m_Connector.readyToSend(*this);
-	return RequestEncoder<BUFFER>::getSync();
+	return requestEncoded(m_Encoder.encodeInsert(tuple, space_id),
+			      Iproto::INSERT);
 }
 
 template<class BUFFER, class NetProvider>
@@ -355,9 +841,8 @@ template <class T>
 rid_t
 Connection<BUFFER, NetProvider>::replace(const T &tuple, uint32_t space_id)
 {
-	m_EndEncoded += m_Encoder.encodeReplace(tuple, space_id);
-	m_Connector.readyToSend(*this);
-	return RequestEncoder<BUFFER>::getSync();
+	return requestEncoded(m_Encoder.encodeReplace(tuple, space_id),
+			      Iproto::REPLACE);
 }
 
 template<class BUFFER, class NetProvider>
@@ -366,9 +851,8 @@ rid_t
 Connection<BUFFER, NetProvider>::delete_(const T &key, uint32_t space_id,
 					 uint32_t index_id)
 {
-	m_EndEncoded += m_Encoder.encodeDelete(key, space_id, index_id);
-	m_Connector.readyToSend(*this);
-	return RequestEncoder<BUFFER>::getSync();
+	size_t size = m_Encoder.encodeDelete(key, space_id, index_id);
+	return requestEncoded(size, Iproto::DELETE);
 }
 
 template<class BUFFER, class NetProvider>
@@ -377,9 +861,8 @@ rid_t
 Connection<BUFFER, NetProvider>::update(const K &key, const T &tuple,
 					uint32_t space_id, uint32_t index_id)
 {
-	m_EndEncoded += m_Encoder.encodeUpdate(key, tuple, space_id, index_id);
-	m_Connector.readyToSend(*this);
-	return RequestEncoder<BUFFER>::getSync();
+	size_t size = m_Encoder.encodeUpdate(key, tuple, space_id, index_id);
+	return requestEncoded(size, Iproto::UPDATE);
 }
 
 template<class BUFFER, class NetProvider>
@@ -388,9 +871,8 @@ rid_t
 Connection<BUFFER, NetProvider>::upsert(const T &tuple, const O &ops,
 					uint32_t space_id, uint32_t index_base)
 {
-	m_EndEncoded += m_Encoder.encodeUpsert(tuple, ops, space_id, index_base);
-	m_Connector.readyToSend(*this);
-	return RequestEncoder<BUFFER>::getSync();
+	size_t size = m_Encoder.encodeUpsert(tuple, ops, space_id, index_base);
+	return requestEncoded(size, Iproto::UPSERT);
 }
 
 template<class BUFFER, class NetProvider>
@@ -400,10 +882,23 @@ Connection<BUFFER, NetProvider>::select(const T &key, uint32_t space_id,
 					uint32_t index_id, uint32_t limit,
 					uint32_t offset, IteratorType iterator)
 {
-	m_EndEncoded += m_Encoder.encodeSelect(key, space_id, index_id, limit,
-					       offset, iterator);
-	m_Connector.readyToSend(*this);
-	return RequestEncoder<BUFFER>::getSync();
+	size_t size = m_Encoder.encodeSelect(key, space_id, index_id, limit,
+					     offset, iterator);
+	return requestEncoded(size, Iproto::SELECT);
+}
+
+template<class BUFFER, class NetProvider>
+template <class T>
+rid_t
+Connection<BUFFER, NetProvider>::selectAfter(const T &key, uint32_t space_id,
+					     uint32_t index_id, uint32_t limit,
+					     IteratorType iterator,
+					     const std::string &after_position)
+{
+	size_t size = m_Encoder.encodeSelectAfter(key, space_id, index_id,
+						  limit, iterator,
+						  after_position);
+	return requestEncoded(size, Iproto::SELECT);
 }
 
 template<class BUFFER, class NetProvider>
@@ -428,6 +923,180 @@ Connection<BUFFER, NetProvider>::reset()
 	std::memset(&status, 0, sizeof(status));
 }
 
+template<class BUFFER, class NetProvider>
+void
+Connection<BUFFER, NetProvider>::setReconnect(const ReconnectOptions &opts)
+{
+	m_Reconnect.opts = opts;
+	m_Reconnect.is_enabled = true;
+}
+
+template<class BUFFER, class NetProvider>
+rid_t
+Connection<BUFFER, NetProvider>::idempotent(rid_t future)
+{
+	if (! m_Reconnect.is_enabled)
+		return future;
+	InflightRequests::Entry *e = m_Latency.inflightRequests().find(future);
+	if (e == nullptr || e->offset < m_SentBytes) {
+		LOG_WARNING("Request ", future, " is already sent, it can't "
+			    "be replayed");
+		return future;
+	}
+	iterator itr = m_OutBuf.begin();
+	itr += e->offset - m_SentBytes;
+	std::string &copy = replayCopy(future);
+	copy.resize(e->size);
+	m_OutBuf.get(itr, copy.data(), copy.size());
+	return future;
+}
+
+template<class BUFFER, class NetProvider>
+void
+Connection<BUFFER, NetProvider>::failRequest(rid_t future,
+					     const std::string &msg)
+{
+	m_Latency.requestFailed(future);
+	m_PushHandlers.erase(future);
+	dropReplayCopy(future);
+	if (m_Discarded.erase(future) != 0)
+		return;
+	Response<BUFFER> response{};
+	response.header.code = Iproto::TYPE_ERROR | CONNECTION_LOST_ERRCODE;
+	response.header.sync = future;
+	response.body.error_stack.emplace();
+	Error &err = response.body.error_stack->error;
+	err = Error{};
+	err.errcode = CONNECTION_LOST_ERRCODE;
+	err.msg_len = std::min(msg.size(), sizeof(err.msg) - 1);
+	memcpy(err.msg, msg.data(), err.msg_len);
+	response.body.error_stack->count = 1;
+	addFuture(future, std::move(response));
+	counters.futures_pending.set(m_Latency.inflight());
+	counters.futures_ready.set(m_Futures.size());
+}
+
+template<class BUFFER, class NetProvider>
+size_t
+Connection<BUFFER, NetProvider>::connectionLost()
+{
+	assert(socket < 0);
+	m_Reconnect.is_lost = true;
+	/* Tail of response which is received partially won't come. */
+	if (hasDataToDecode(*this)) {
+		m_InBuf.dropBack(m_InBuf.end() - m_EndDecoded);
+		m_Decoder.reset(m_EndDecoded);
+	}
+	status.is_ready_to_decode = false;
+	rlist_del(&m_in_read);
+	/* Requests are sent in order, so a sent one has lower offset. */
+	tnt::SmallVector<rid_t, 16> lost;
+	m_Latency.inflightRequests().forEach([&](InflightRequests::Entry &e) {
+		if (e.offset < m_SentBytes &&
+		    m_Reconnect.replay.count(e.sync) == 0)
+			lost.emplace_back(e.sync);
+	});
+	for (rid_t future : lost)
+		failRequest(future, "Connection is lost, request might have "
+			    "been executed");
+	return lost.size();
+}
+
+template<class BUFFER, class NetProvider>
+size_t
+Connection<BUFFER, NetProvider>::reconnectFailed(const std::string &msg)
+{
+	tnt::SmallVector<rid_t, 16> lost;
+	m_Latency.inflightRequests().forEach([&](InflightRequests::Entry &e) {
+		lost.emplace_back(e.sync);
+	});
+	for (rid_t future : lost)
+		failRequest(future, msg);
+	if (hasDataToSend(*this))
+		m_OutBuf.dropFront(m_EndEncoded - m_OutBuf.begin());
+	m_SentBytes = m_EncodedBytes;
+	while (! m_Reconnect.replay.empty())
+		dropReplayCopy(m_Reconnect.replay.begin()->first);
+	m_Reconnect.is_lost = false;
+	m_Reconnect.attempts = 0;
+	updateBufferStat();
+	return lost.size();
+}
+
+template<class BUFFER, class NetProvider>
+void
+Connection<BUFFER, NetProvider>::detachOutput()
+{
+	assert(! m_Reconnect.is_detached);
+	std::string &pending = m_Reconnect.pending;
+	pending.assign(m_EndEncoded - m_OutBuf.begin(), '\0');
+	if (! pending.empty()) {
+		m_OutBuf.get(m_OutBuf.begin(), pending.data(), pending.size());
+		m_OutBuf.dropFront(pending.size());
+	}
+	m_Reconnect.pending_offset = m_SentBytes;
+	m_Reconnect.pending_end = m_EncodedBytes;
+	m_SentBytes = m_EncodedBytes = 0;
+	m_Reconnect.is_detached = true;
+}
+
+template<class BUFFER, class NetProvider>
+void
+Connection<BUFFER, NetProvider>::attachOutput()
+{
+	assert(m_Reconnect.is_detached);
+	/* Nothing but authentication has been encoded since detach. */
+	if (hasDataToSend(*this))
+		m_OutBuf.dropFront(m_EndEncoded - m_OutBuf.begin());
+	std::string &pending = m_Reconnect.pending;
+	if (! pending.empty()) {
+		m_OutBuf.addBack(wrap::Data{pending});
+		m_EndEncoded += pending.size();
+	}
+	m_SentBytes = m_Reconnect.pending_offset;
+	m_EncodedBytes = m_Reconnect.pending_end;
+	pending.clear();
+	m_Reconnect.is_detached = false;
+	updateBufferStat();
+}
+
+template<class BUFFER, class NetProvider>
+void
+Connection<BUFFER, NetProvider>::restoreOutput()
+{
+	/* Nothing has been sent to the new socket yet. */
+	if (! m_Reconnect.is_detached)
+		detachOutput();
+	std::string pending = std::move(m_Reconnect.pending);
+	m_Reconnect.pending.clear();
+	m_Reconnect.is_detached = false;
+	uint64_t pending_offset = m_Reconnect.pending_offset;
+	/*
+	 * Messages (acknowledgements of events, unwatch) are dropped: the
+	 * watchers are subscribed anew.
+	 */
+	m_Latency.inflightRequests().forEach([&](InflightRequests::Entry &e) {
+		if (e.offset >= pending_offset) {
+			m_OutBuf.addBack(wrap::Data{pending.data() + e.offset -
+						    pending_offset, e.size});
+		} else {
+			auto itr = m_Reconnect.replay.find(e.sync);
+			assert(itr != m_Reconnect.replay.end());
+			m_OutBuf.addBack(wrap::Data{itr->second});
+		}
+		m_EndEncoded += e.size;
+		e.offset = m_EncodedBytes;
+		m_EncodedBytes += e.size;
+	});
+	for (auto &[key, watcher] : m_Watchers)
+		messageEncoded(m_Encoder.encodeWatch(key));
+	m_Reconnect.is_lost = false;
+	m_Reconnect.attempts = 0;
+	m_Reconnect.reconnects++;
+	updateBufferStat();
+	m_Connector.readyToSend(*this);
+}
+
 template<class BUFFER, class NetProvider>
 BUFFER&
 Connection<BUFFER, NetProvider>::getInBuf()
@@ -435,6 +1104,30 @@ Connection<BUFFER, NetProvider>::getInBuf()
 	return m_InBuf;
 }
 
+template<class BUFFER, class NetProvider>
+void
+Connection<BUFFER, NetProvider>::getLatency(LatencySnapshot &snap) const
+{
+	m_Latency.snapshot(snap);
+}
+
+template<class BUFFER, class NetProvider>
+int
+Connection<BUFFER, NetProvider>::requestType(rid_t future)
+{
+	InflightRequests::Entry *e = m_Latency.inflightRequests().find(future);
+	return e == nullptr ? -1 : e->type;
+}
+
+template<class BUFFER, class NetProvider>
+ConnectionStat
+Connection<BUFFER, NetProvider>::snapshot() const
+{
+	ConnectionStat stat;
+	counters.snapshot(stat);
+	return stat;
+}
+
 
 #ifndef NDEBUG
 template<class BUFFER, class NetProvider>
@@ -477,8 +1170,12 @@ template<class BUFFER, class NetProvider>
 void
 hasSentBytes(Connection<BUFFER, NetProvider> &conn, size_t bytes)
 {
-	if (bytes > 0)
+	if (bytes > 0) {
 		conn.m_OutBuf.dropFront(bytes);
+		conn.m_SentBytes += bytes;
+		conn.counters.bytes_sent.add(bytes);
+		conn.updateBufferStat();
+	}
 	if (! hasDataToSend(conn)) {
 		conn.status.is_ready_to_send = false;
 		rlist_del(&conn.m_in_write);
@@ -492,6 +1189,7 @@ hasNotRecvBytes(Connection<BUFFER, NetProvider> &conn, size_t bytes)
 {
 	if (bytes > 0)
 		conn.m_InBuf.dropBack(bytes);
+	conn.updateBufferStat();
 }
 
 template<class BUFFER, class NetProvider>
@@ -514,6 +1212,9 @@ decodeResponse(Connection<BUFFER, NetProvider> &conn)
 {
 	static int gc_step = 0;
 	Response<BUFFER> response;
+	/* Even the size of response may be received partially. */
+	if (! conn.m_InBuf.has(conn.m_EndDecoded, MP_RESPONSE_SIZE))
+		return DECODE_NEEDMORE;
 	response.size = conn.m_Decoder.decodeResponseSize();
 	if (response.size < 0) {
 		conn.setError("Failed to decode response size");
@@ -524,6 +1225,8 @@ decodeResponse(Connection<BUFFER, NetProvider> &conn)
 		conn.m_Decoder.reset(conn.m_EndDecoded);
 		return DECODE_NEEDMORE;
 	}
+	using Tracer_t = typename Connection<BUFFER, NetProvider>::Tracer_t;
+	traceEvent<Tracer_t>(TRACE_DECODE_START, conn.socket, 0, response.size);
 	if (conn.m_Decoder.decodeResponse(response) != 0) {
 		conn.setError("Failed to decode response, skipping bytes..");
 		conn.m_EndDecoded += response.size;
@@ -531,11 +1234,40 @@ decodeResponse(Connection<BUFFER, NetProvider> &conn)
 	}
 	LOG_DEBUG("Header: sync=", response.header.sync, ", code=",
 		  response.header.code, ", schema=", response.header.schema_id);
+	traceEvent<Tracer_t>(TRACE_DECODE_END, conn.socket,
+			     response.header.sync, response.size);
 	std::size_t response_size = response.size;
-	conn.m_Futures.insert({response.header.sync, std::move(response)});
+	rid_t sync = response.header.sync;
+	if (response.header.code == Iproto::EVENT) {
+		/* Events are unsolicited: they don't belong to any request. */
+		conn.eventDecoded(response);
+	} else if (response.header.code == Iproto::CHUNK) {
+		/* Push doesn't complete the request. */
+		if (conn.m_Discarded.empty() || conn.m_Discarded.count(sync) == 0)
+			conn.addPush(sync, std::move(response));
+	} else if (! conn.m_Heartbeat.pings.empty() &&
+		   conn.m_Heartbeat.pings.erase(sync) != 0) {
+		/* Heartbeat pings are not requests: nothing to account. */
+	} else {
+		if (! conn.m_PushHandlers.empty())
+			conn.m_PushHandlers.erase(sync);
+		conn.m_Latency.responseDecoded(sync);
+		if (! conn.m_Reconnect.replay.empty())
+			conn.dropReplayCopy(sync);
+		if (response.header.schema_id != 0)
+			conn.m_SchemaVersion = response.header.schema_id;
+		/* Latency of discarded request is still accounted. */
+		if (conn.m_Discarded.empty() || conn.m_Discarded.erase(sync) == 0)
+			conn.addFuture(sync, std::move(response));
+		conn.counters.responses.add();
+		conn.counters.futures_pending.set(conn.m_Latency.inflight());
+		conn.counters.futures_ready.set(conn.m_Futures.size());
+	}
 	conn.m_EndDecoded += response_size;
-	if ((gc_step++ % Connection<BUFFER, NetProvider>::GC_STEP_CNT) == 0)
+	if ((gc_step++ % Connection<BUFFER, NetProvider>::GC_STEP_CNT) == 0) {
 		conn.m_InBuf.flush();
+		conn.updateBufferStat();
+	}
 	if (! hasDataToDecode(conn)) {
 		conn.status.is_ready_to_decode = false;
 		rlist_del(&conn.m_in_read);
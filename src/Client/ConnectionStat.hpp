@@ -0,0 +1,147 @@
+#pragma once
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <atomic>
+#include <cstddef>
+
+/**
+ * Counter updated by a single (owner) thread and readable by any thread.
+ * Update is a plain load and store, there's no locked instructions.
+ */
+class StatCounter {
+public:
+	void add(size_t v = 1) { set(get() + v); }
+	void sub(size_t v = 1) { set(get() - v); }
+	void set(size_t v) { m_Value.store(v, std::memory_order_relaxed); }
+	size_t get() const { return m_Value.load(std::memory_order_relaxed); }
+private:
+	std::atomic<size_t> m_Value{0};
+};
+
+/**
+ * Statistics concerning requests/responses and network I/O. It is a plain
+ * copy of counters of one connection, or a sum of counters of all
+ * connections of connector (with counters of network provider).
+ */
+struct ConnectionStat {
+	/** Requests encoded into output buffer. */
+	size_t requests = 0;
+	/** Responses decoded from input buffer. */
+	size_t responses = 0;
+	/** Out-of-band messages (IPROTO_CHUNK) preceding responses. */
+	size_t pushes = 0;
+	size_t bytes_sent = 0;
+	size_t bytes_recv = 0;
+	/** sendmsg() and recvmsg() calls. */
+	size_t sendmsg_calls = 0;
+	size_t recvmsg_calls = 0;
+	/**
+	 * epoll_wait() and epoll_ctl() calls. These are counted by network
+	 * provider, so they are set only in connector snapshot. Libev
+	 * provider counts loop iterations and watcher start/stop instead.
+	 */
+	size_t epoll_wait_calls = 0;
+	size_t epoll_ctl_calls = 0;
+	/** Send or receive attempts which ended with EAGAIN. */
+	size_t eagain = 0;
+	/** sendmsg() calls which have written only part of data. */
+	size_t partial_writes = 0;
+	/** Blocks held by input and output buffers. */
+	size_t buffer_blocks = 0;
+	/** Requests which are sent but not answered yet. */
+	size_t futures_pending = 0;
+	/** Responses which are decoded but not taken by user yet. */
+	size_t futures_ready = 0;
+
+	void merge(const ConnectionStat &other)
+	{
+		requests += other.requests;
+		responses += other.responses;
+		pushes += other.pushes;
+		bytes_sent += other.bytes_sent;
+		bytes_recv += other.bytes_recv;
+		sendmsg_calls += other.sendmsg_calls;
+		recvmsg_calls += other.recvmsg_calls;
+		epoll_wait_calls += other.epoll_wait_calls;
+		epoll_ctl_calls += other.epoll_ctl_calls;
+		eagain += other.eagain;
+		partial_writes += other.partial_writes;
+		buffer_blocks += other.buffer_blocks;
+		futures_pending += other.futures_pending;
+		futures_ready += other.futures_ready;
+	}
+};
+
+/** Live counters of a connection, see ConnectionStat for description. */
+struct ConnectionCounters {
+	StatCounter requests;
+	StatCounter responses;
+	StatCounter pushes;
+	StatCounter bytes_sent;
+	StatCounter bytes_recv;
+	StatCounter sendmsg_calls;
+	StatCounter recvmsg_calls;
+	StatCounter eagain;
+	StatCounter partial_writes;
+	StatCounter buffer_blocks;
+	StatCounter futures_pending;
+	StatCounter futures_ready;
+
+	/** Add counters to @a stat. */
+	void snapshot(ConnectionStat &stat) const
+	{
+		stat.requests += requests.get();
+		stat.responses += responses.get();
+		stat.pushes += pushes.get();
+		stat.bytes_sent += bytes_sent.get();
+		stat.bytes_recv += bytes_recv.get();
+		stat.sendmsg_calls += sendmsg_calls.get();
+		stat.recvmsg_calls += recvmsg_calls.get();
+		stat.eagain += eagain.get();
+		stat.partial_writes += partial_writes.get();
+		stat.buffer_blocks += buffer_blocks.get();
+		stat.futures_pending += futures_pending.get();
+		stat.futures_ready += futures_ready.get();
+	}
+};
+
+/** Live counters of a network provider. */
+struct NetProviderCounters {
+	StatCounter epoll_wait_calls;
+	StatCounter epoll_ctl_calls;
+
+	/** Add counters to @a stat. */
+	void snapshot(ConnectionStat &stat) const
+	{
+		stat.epoll_wait_calls += epoll_wait_calls.get();
+		stat.epoll_ctl_calls += epoll_ctl_calls.get();
+	}
+};
@@ -30,9 +30,27 @@
  * SUCH DAMAGE.
  */
 #include "Connection.hpp"
+#include "Cursor.hpp"
 #include "DefaultNetProvider.hpp"
 #include "../Utils/Timer.hpp"
 
+/**
+ * Heartbeat of idle connections, see Connector::setHeartbeat(). Each
+ * @a interval (ms) connections which have received nothing since the
+ * previous round are pinged; a peer which hasn't answered @a max_missed
+ * pings in a row is considered dead and the connection is closed.
+ */
+struct HeartbeatOptions {
+	int interval = 1000;
+	size_t max_missed = 3;
+};
+
+/** Spinning of Connector::waitSync(). */
+struct SyncWaitOptions {
+	/** Time to spin on non-blocking receive before polling, us. */
+	unsigned spin_us = 50;
+};
+
 template<class BUFFER, class NetProvider = DefaultNetProvider<BUFFER, NetworkEngine>>
 class Connector
 {
@@ -45,13 +63,78 @@ public:
 	int connect(Connection<BUFFER, NetProvider> &conn,
 		    const std::string_view& addr, unsigned port,
 		    size_t timeout = DEFAULT_CONNECT_TIMEOUT);
+	/**
+	 * Connect and authenticate with @a creds (chap-sha1). The same
+	 * credentials should be shared by connections of a pool: hashes of
+	 * password are computed once on their construction.
+	 * @a timeout (seconds) limits connect and authentication each.
+	 */
+	int connect(Connection<BUFFER, NetProvider> &conn,
+		    const std::string_view& addr, unsigned port,
+		    const Credentials &creds,
+		    size_t timeout = DEFAULT_CONNECT_TIMEOUT);
 	void close(Connection<BUFFER, NetProvider> &conn);
+	/**
+	 * Ping idle connections to find dead peers before user requests
+	 * hit them. Rounds are made by wait(), waitAny() and poll(): all
+	 * the connections share one deadline, so a round is a single pass
+	 * over them. A dead connection is closed with error (and restored
+	 * if reconnect is enabled).
+	 */
+	void setHeartbeat(const HeartbeatOptions &opts);
+	/**
+	 * Enable TCP keepalive of @a conn, now and on each reconnect.
+	 * Return -1 if socket options can't be set.
+	 */
+	int setKeepalive(Connection<BUFFER, NetProvider> &conn,
+			 const KeepaliveOptions &opts);
+	/**
+	 * Set SO_BUSY_POLL of @a conn socket: the kernel busy polls the
+	 * device queue for @a usec on receive. Raising it above the system
+	 * default needs CAP_NET_ADMIN. Return -1 on error.
+	 */
+	int setBusyPoll(Connection<BUFFER, NetProvider> &conn, unsigned usec);
+	/**
+	 * Resolved addresses are cached by network provider for @a ttl
+	 * (ms, 30 seconds by default); zero disables the cache.
+	 */
+	void setAddressTtl(unsigned ttl) { m_NetProvider.setAddressTtl(ttl); }
 
+	/*
+	 * Waiting methods take either timeout in milliseconds, where zero
+	 * is infinite, or Timeout_t of any precision, where zero means a
+	 * single non-blocking poll and TIMEOUT_INFINITE - no timeout.
+	 */
 	int wait(Connection<BUFFER, NetProvider> &conn, rid_t future,
 		 int timeout = 0);
+	int wait(Connection<BUFFER, NetProvider> &conn, rid_t future,
+		 Timeout_t timeout);
 	void waitAll(Connection<BUFFER, NetProvider> &conn, rid_t *futures,
 		     size_t future_count, int timeout = 0);
+	void waitAll(Connection<BUFFER, NetProvider> &conn, rid_t *futures,
+		     size_t future_count, Timeout_t timeout);
 	Connection<BUFFER, NetProvider>* waitAny(int timeout = 0);
+	Connection<BUFFER, NetProvider>* waitAny(Timeout_t timeout);
+	/**
+	 * Low latency wait for one request in flight: requests are sent
+	 * and responses are received and decoded right on the calling
+	 * thread, spinning on non-blocking receive for @a opts.spin_us
+	 * before falling back to wait(). It burns CPU while spinning and
+	 * serves only @a conn until the fallback.
+	 */
+	int waitSync(Connection<BUFFER, NetProvider> &conn, rid_t future,
+		     int timeout = 0,
+		     const SyncWaitOptions &opts = SyncWaitOptions{});
+	int waitSync(Connection<BUFFER, NetProvider> &conn, rid_t future,
+		     Timeout_t timeout,
+		     const SyncWaitOptions &opts = SyncWaitOptions{});
+	/**
+	 * Send pending data and receive available one without decoding
+	 * responses: connections which got data are put to the ready to
+	 * read list. Used by consumers of streams (e.g. replication).
+	 */
+	int poll(int timeout = 0);
+	int poll(Timeout_t timeout);
 
 	/**
 	 * Add to @m_ready_to_read queue and parse response.
@@ -59,27 +142,64 @@ public:
 	 * */
 	void readyToDecode(Connection<BUFFER, NetProvider> &conn);
 	void readyToSend(Connection<BUFFER, NetProvider> &conn);
+	/** Add to (remove from) @m_Connections. Invoked by Connection. */
+	void attach(Connection<BUFFER, NetProvider> &conn);
+	void detach(Connection<BUFFER, NetProvider> &conn);
+
+	/**
+	 * Sum of I/O counters of all connections and network provider.
+	 * Must be called from the thread owning connector, use
+	 * Connection::snapshot() to read counters from other threads.
+	 */
+	ConnectionStat snapshot() const;
+	/** E.g. to set up responder of LoopbackNetProvider. */
+	NetProvider &getNetProvider() { return m_NetProvider; }
 
 	constexpr static size_t DEFAULT_CONNECT_TIMEOUT = 2;
 private:
+	/**
+	 * Make the next step of restoring lost connection with reconnect
+	 * enabled. Return 0 if it's restored, time (ms) till the next
+	 * attempt or -1 if attempts are exhausted.
+	 */
+	int reconnect(Connection<BUFFER, NetProvider> &conn);
+	/**
+	 * Authenticate reconnected socket before anything else is sent to
+	 * it. Return 0 on success, -1 if the credentials are rejected and
+	 * 1 if the response isn't received (the socket is closed then).
+	 */
+	int reauth(Connection<BUFFER, NetProvider> &conn);
+	/** Make the next step for each lost connection which is due. */
+	void reconnectAll();
+	/** Make a heartbeat round if it's due. */
+	void heartbeat();
+	/** Limit wait of network provider by the next heartbeat round. */
+	Timeout_t pollTimeout(Timeout_t timeout) const;
+
 	NetProvider m_NetProvider;
 	/**
 	 * Lists of asynchronous connections which are ready to send
 	 * requests or read responses.
 	 */
 	struct rlist m_ready_to_read;
+	/** All connections created with this connector. */
+	struct rlist m_Connections;
+	std::optional<HeartbeatOptions> m_Heartbeat;
+	std::chrono::steady_clock::time_point m_NextHeartbeat;
 };
 
 template<class BUFFER, class NetProvider>
 Connector<BUFFER, NetProvider>::Connector() : m_NetProvider()
 {
 	rlist_create(&m_ready_to_read);
+	rlist_create(&m_Connections);
 }
 
 template<class BUFFER, class NetProvider>
 Connector<BUFFER, NetProvider>::~Connector()
 {
 	assert(rlist_empty(&m_ready_to_read));
+	assert(rlist_empty(&m_Connections));
 }
 
 template<class BUFFER, class NetProvider>
@@ -99,6 +219,49 @@ Connector<BUFFER, NetProvider>::connect(Connection<BUFFER, NetProvider> &conn,
 		return -1;
 	}
 	LOG_DEBUG("Connected to ", addr, ':', port, " has been established");
+	conn.m_Reconnect.addr = addr;
+	conn.m_Reconnect.port = port;
+	conn.m_Reconnect.creds.reset();
+	conn.m_Heartbeat = {};
+	if (conn.m_Keepalive != std::nullopt)
+		m_NetProvider.setKeepalive(conn, *conn.m_Keepalive);
+	/* Requests can be encoded before connect or after failed reconnect. */
+	if (hasDataToSend(conn))
+		readyToSend(conn);
+	return 0;
+}
+
+template<class BUFFER, class NetProvider>
+int
+Connector<BUFFER, NetProvider>::connect(Connection<BUFFER, NetProvider> &conn,
+					const std::string_view& addr,
+					unsigned port, const Credentials &creds,
+					size_t timeout)
+{
+	if (connect(conn, addr, port, timeout) != 0)
+		return -1;
+	rid_t f = conn.auth(creds);
+	if (wait(conn, f, timeout * 1000) != 0) {
+		LOG_ERROR("Failed to authenticate as ", creds.user(), " at ",
+			  addr, ':', port);
+		conn.setError("Failed to receive response to authentication");
+		close(conn);
+		return -1;
+	}
+	std::optional<Response<BUFFER>> response = conn.getResponse(f);
+	if (response->header.code != 0) {
+		std::string msg = "Authentication has failed";
+		if (response->body.error_stack != std::nullopt) {
+			const Error &err = response->body.error_stack->error;
+			msg += ": " + std::string(err.msg, err.msg_len);
+		}
+		LOG_ERROR(msg);
+		conn.setError(msg);
+		close(conn);
+		return -1;
+	}
+	LOG_DEBUG("Authenticated as ", creds.user());
+	conn.m_Reconnect.creds.emplace(creds);
 	return 0;
 }
 
@@ -106,19 +269,225 @@ template<class BUFFER, class NetProvider>
 void
 Connector<BUFFER, NetProvider>::close(Connection<BUFFER, NetProvider> &conn)
 {
+	conn.m_Reconnect.is_enabled = false;
 	m_NetProvider.close(conn);
 }
 
+template<class BUFFER, class NetProvider>
+void
+Connector<BUFFER, NetProvider>::setHeartbeat(const HeartbeatOptions &opts)
+{
+	m_Heartbeat = opts;
+	m_NextHeartbeat = std::chrono::steady_clock::now() +
+			  std::chrono::milliseconds(opts.interval);
+}
+
+template<class BUFFER, class NetProvider>
+int
+Connector<BUFFER, NetProvider>::setKeepalive(Connection<BUFFER, NetProvider> &conn,
+					     const KeepaliveOptions &opts)
+{
+	conn.m_Keepalive = opts;
+	if (conn.socket < 0)
+		return 0;
+	return m_NetProvider.setKeepalive(conn, opts);
+}
+
+template<class BUFFER, class NetProvider>
+int
+Connector<BUFFER, NetProvider>::setBusyPoll(Connection<BUFFER, NetProvider> &conn,
+					    unsigned usec)
+{
+	return m_NetProvider.setBusyPoll(conn, usec);
+}
+
+template<class BUFFER, class NetProvider>
+void
+Connector<BUFFER, NetProvider>::heartbeat()
+{
+	if (m_Heartbeat == std::nullopt)
+		return;
+	auto now = std::chrono::steady_clock::now();
+	if (now < m_NextHeartbeat)
+		return;
+	m_NextHeartbeat = now + std::chrono::milliseconds(m_Heartbeat->interval);
+	Connection<BUFFER, NetProvider> *conn;
+	rlist_foreach_entry(conn, &m_Connections, m_in_connector) {
+		if (conn->socket < 0 || conn->status.is_failed)
+			continue;
+		auto &state = conn->m_Heartbeat;
+		size_t recv = conn->counters.bytes_recv.get();
+		if (recv != state.recv_mark) {
+			state.recv_mark = recv;
+			state.missed = 0;
+			continue;
+		}
+		if (state.missed >= m_Heartbeat->max_missed) {
+			LOG_WARNING("Connection ", conn->socket, " hasn't answered ",
+				    state.missed, " heartbeat pings");
+			conn->setError("Peer is dead: no response to heartbeat "
+				       "pings");
+			m_NetProvider.close(*conn);
+			continue;
+		}
+		conn->heartbeatPing();
+		state.missed++;
+	}
+}
+
+template<class BUFFER, class NetProvider>
+Timeout_t
+Connector<BUFFER, NetProvider>::pollTimeout(Timeout_t timeout) const
+{
+	if (m_Heartbeat == std::nullopt)
+		return timeout;
+	Timeout_t until_round = std::max(Timeout_t{0}, Timeout_t{
+		m_NextHeartbeat - std::chrono::steady_clock::now()});
+	return std::min(timeout, until_round);
+}
+
+template<class BUFFER, class NetProvider>
+int
+Connector<BUFFER, NetProvider>::reconnect(Connection<BUFFER, NetProvider> &conn)
+{
+	using namespace std::chrono;
+	auto &state = conn.m_Reconnect;
+	assert(state.is_enabled && conn.status.is_failed);
+	if (! state.is_lost) {
+		LOG_WARNING("Connection to ", state.addr, ':', state.port,
+			    " is lost: ", conn.getError());
+		/* Responses which are received completely are not lost. */
+		while (hasDataToDecode(conn)) {
+			if (decodeResponse(conn) != DECODE_SUCC)
+				break;
+		}
+		if (conn.socket >= 0)
+			m_NetProvider.close(conn);
+		/* Let waitAny() return the connection with failed requests. */
+		if (conn.connectionLost() != 0)
+			readyToDecode(conn);
+		state.next_attempt = steady_clock::now();
+	}
+	auto now = steady_clock::now();
+	if (now < state.next_attempt) {
+		auto left = duration_cast<milliseconds>(state.next_attempt - now);
+		return std::max(1, (int)left.count());
+	}
+	conn.status.is_failed = false;
+	bool is_rejected = false;
+	if (m_NetProvider.connect(conn, state.addr, state.port,
+				  state.opts.connect_timeout) == 0) {
+		int rc = state.creds == std::nullopt ? 0 : reauth(conn);
+		if (rc == 0) {
+			LOG_WARNING("Connection to ", state.addr, ':',
+				    state.port, " is restored");
+			conn.restoreOutput();
+			conn.m_Heartbeat = {};
+			if (conn.m_Keepalive != std::nullopt)
+				m_NetProvider.setKeepalive(conn,
+							   *conn.m_Keepalive);
+			return 0;
+		}
+		/* Retrying with the same credentials is pointless. */
+		is_rejected = rc < 0;
+	}
+	state.attempts++;
+	if (is_rejected || (state.opts.max_attempts != 0 &&
+			    state.attempts >= state.opts.max_attempts)) {
+		std::string msg = "Failed to reconnect to " + state.addr +
+				  ": " + conn.getError();
+		LOG_ERROR(msg);
+		if (conn.reconnectFailed(msg) != 0)
+			readyToDecode(conn);
+		conn.setError(msg);
+		return -1;
+	}
+	double backoff = state.opts.initial_backoff;
+	for (size_t i = 1; i < state.attempts && backoff < state.opts.max_backoff; i++)
+		backoff *= state.opts.multiplier;
+	int delay = std::min((int)backoff, state.opts.max_backoff);
+	state.next_attempt = steady_clock::now() + milliseconds(delay);
+	return std::max(1, delay);
+}
+
+template<class BUFFER, class NetProvider>
+int
+Connector<BUFFER, NetProvider>::reauth(Connection<BUFFER, NetProvider> &conn)
+{
+	auto &state = conn.m_Reconnect;
+	conn.detachOutput();
+	rid_t f = conn.auth(*state.creds);
+	Timer timer{Timeout_t{std::chrono::seconds{state.opts.connect_timeout}}};
+	timer.start();
+	while (! conn.futureIsReady(f) && ! conn.status.is_failed &&
+	       ! timer.isExpired()) {
+		if (m_NetProvider.wait(timer.left()) != 0)
+			break;
+		while (hasDataToDecode(conn)) {
+			if (decodeResponse(conn) != DECODE_SUCC)
+				break;
+		}
+	}
+	int rc;
+	std::string msg;
+	if (conn.futureIsReady(f)) {
+		std::optional<Response<BUFFER>> response = conn.getResponse(f);
+		if (response->header.code == 0) {
+			LOG_DEBUG("Authenticated as ", state.creds->user());
+			return 0;
+		}
+		msg = "Authentication has failed";
+		if (response->body.error_stack != std::nullopt) {
+			const Error &err = response->body.error_stack->error;
+			msg += ": " + std::string(err.msg, err.msg_len);
+		}
+		rc = -1;
+	} else {
+		msg = "Failed to receive response to authentication";
+		conn.failRequest(f, msg);
+		conn.getResponse(f);
+		rc = 1;
+	}
+	LOG_ERROR(msg);
+	if (conn.socket >= 0)
+		m_NetProvider.close(conn);
+	conn.attachOutput();
+	conn.setError(msg);
+	conn.status.is_failed = true;
+	return rc;
+}
+
+template<class BUFFER, class NetProvider>
+void
+Connector<BUFFER, NetProvider>::reconnectAll()
+{
+	Connection<BUFFER, NetProvider> *conn;
+	rlist_foreach_entry(conn, &m_Connections, m_in_connector) {
+		if (conn->status.is_failed && conn->m_Reconnect.is_enabled)
+			reconnect(*conn);
+	}
+}
+
 template<class BUFFER, class NetProvider>
 int
 Connector<BUFFER, NetProvider>::wait(Connection<BUFFER, NetProvider> &conn,
 				     rid_t future, int timeout)
 {
-	LOG_DEBUG("Waiting for the future ", future, " with timeout ", timeout);
+	return wait(conn, future, timeoutFromMs(timeout));
+}
+
+template<class BUFFER, class NetProvider>
+int
+Connector<BUFFER, NetProvider>::wait(Connection<BUFFER, NetProvider> &conn,
+				     rid_t future, Timeout_t timeout)
+{
+	LOG_DEBUG("Waiting for the future ", future, " with timeout ",
+		  timeout.count(), " ns");
 	Timer timer{timeout};
 	timer.start();
+	bool can_reconnect = conn.m_Reconnect.is_enabled;
 	while (hasDataToDecode(conn)) {
-		if (conn.status.is_failed) {
+		if (conn.status.is_failed && ! can_reconnect) {
 			LOG_ERROR("Connection has failed. Please, handle error"
 				  "and reset connection status.");
 			return -1;
@@ -129,16 +498,35 @@ Connector<BUFFER, NetProvider>::wait(Connection<BUFFER, NetProvider> &conn,
 		if (rc == DECODE_NEEDMORE)
 			break;
 	}
-	if (! m_NetProvider.check(conn)) {
+	if (! can_reconnect && ! m_NetProvider.check(conn)) {
 		LOG_ERROR("Connection has been lost: ", conn.getError(),
 			  ". Please re-connect to the host");
 		return -1;
 	}
-	while (! conn.futureIsReady(future) && !timer.isExpired()) {
-		if (m_NetProvider.wait(timeout - timer.elapsed()) != 0) {
+	/* Zero timeout still makes one non-blocking poll. */
+	bool polled = false;
+	while (! conn.futureIsReady(future) &&
+	       ! (polled && timer.isExpired())) {
+		if (conn.status.is_failed && conn.m_Reconnect.is_enabled) {
+			int rc = reconnect(conn);
+			if (rc < 0)
+				return -1;
+			/* Serve other connections till the next attempt. */
+			Timeout_t till_attempt = std::chrono::milliseconds(rc);
+			if (rc > 0 && m_NetProvider.wait(
+				std::min(till_attempt, timer.left())) != 0)
+				return -1;
+			polled = true;
+			continue;
+		}
+		heartbeat();
+		if (conn.status.is_failed && conn.m_Reconnect.is_enabled)
+			continue;
+		polled = true;
+		if (m_NetProvider.wait(pollTimeout(timer.left())) != 0) {
 			return -1;
 		}
-		if (conn.status.is_failed != 0) {
+		if (conn.status.is_failed != 0 && ! conn.m_Reconnect.is_enabled) {
 			LOG_ERROR("Connection got error during wait: ",
 				  conn.getError());
 			return -1;
@@ -162,16 +550,72 @@ Connector<BUFFER, NetProvider>::wait(Connection<BUFFER, NetProvider> &conn,
 	return 0;
 }
 
+template<class BUFFER, class NetProvider>
+int
+Connector<BUFFER, NetProvider>::waitSync(Connection<BUFFER, NetProvider> &conn,
+					 rid_t future, int timeout,
+					 const SyncWaitOptions &opts)
+{
+	return waitSync(conn, future, timeoutFromMs(timeout), opts);
+}
+
+template<class BUFFER, class NetProvider>
+int
+Connector<BUFFER, NetProvider>::waitSync(Connection<BUFFER, NetProvider> &conn,
+					 rid_t future, Timeout_t timeout,
+					 const SyncWaitOptions &opts)
+{
+	using namespace std::chrono;
+	auto start = steady_clock::now();
+	auto decode = [&conn] {
+		while (hasDataToDecode(conn)) {
+			if (decodeResponse(conn) != DECODE_SUCC)
+				break;
+		}
+	};
+	decode();
+	if (conn.futureIsReady(future))
+		return 0;
+	if (! conn.status.is_failed && conn.socket >= 0 &&
+	    (! hasDataToSend(conn) || m_NetProvider.sendNow(conn) == 0)) {
+		auto deadline = start + microseconds(opts.spin_us);
+		do {
+			int rc = m_NetProvider.recvNow(conn);
+			if (rc < 0)
+				break;
+			if (rc > 0) {
+				decode();
+				if (conn.futureIsReady(future))
+					return 0;
+			}
+		} while (steady_clock::now() < deadline);
+	}
+	if (timeout == TIMEOUT_INFINITE)
+		return wait(conn, future, TIMEOUT_INFINITE);
+	Timeout_t spent = steady_clock::now() - start;
+	return wait(conn, future, std::max(Timeout_t{0}, timeout - spent));
+}
+
 template<class BUFFER, class NetProvider>
 void
 Connector<BUFFER, NetProvider>::waitAll(Connection<BUFFER, NetProvider> &conn,
 					rid_t *futures, size_t future_count,
 					int timeout)
+{
+	waitAll(conn, futures, future_count, timeoutFromMs(timeout));
+}
+
+template<class BUFFER, class NetProvider>
+void
+Connector<BUFFER, NetProvider>::waitAll(Connection<BUFFER, NetProvider> &conn,
+					rid_t *futures, size_t future_count,
+					Timeout_t timeout)
 {
 	Timer timer{timeout};
 	timer.start();
-	for (size_t i = 0; i < future_count && !timer.isExpired(); ++i) {
-		if (wait(conn, futures[i], timeout - timer.elapsed()) != 0) {
+	/* Expiration is checked after each wait: zero timeout polls once. */
+	for (size_t i = 0; i < future_count; ++i) {
+		if (wait(conn, futures[i], timer.left()) != 0) {
 			conn.setError("Failed to poll: " + std::to_string(errno));
 			return;
 		}
@@ -189,27 +633,81 @@ Connector<BUFFER, NetProvider>::waitAll(Connection<BUFFER, NetProvider> &conn,
 template<class BUFFER, class NetProvider>
 Connection<BUFFER, NetProvider> *
 Connector<BUFFER, NetProvider>::waitAny(int timeout)
+{
+	return waitAny(timeoutFromMs(timeout));
+}
+
+template<class BUFFER, class NetProvider>
+Connection<BUFFER, NetProvider> *
+Connector<BUFFER, NetProvider>::waitAny(Timeout_t timeout)
 {
 	Timer timer{timeout};
 	timer.start();
-	while (rlist_empty(&m_ready_to_read) && !timer.isExpired()) {
-		m_NetProvider.wait(timeout - timer.elapsed());
-	}
 	using Conn_t = Connection<BUFFER, NetProvider>;
-	Connection<BUFFER, NetProvider> *conn =
-		rlist_first_entry(&m_ready_to_read, Conn_t, m_in_read);
-	assert(conn->status.is_ready_to_decode);
-	while (hasDataToDecode(*conn)) {
-		if (decodeResponse(*conn) != 0)
+	do {
+		while (rlist_empty(&m_ready_to_read)) {
+			heartbeat();
+			reconnectAll();
+			/* Requests lost along with connection are ready. */
+			if (! rlist_empty(&m_ready_to_read))
+				break;
+			m_NetProvider.wait(pollTimeout(timer.left()));
+			if (timer.isExpired())
+				break;
+		}
+		if (rlist_empty(&m_ready_to_read))
 			return nullptr;
-	}
-	return conn;
+		Connection<BUFFER, NetProvider> *conn =
+			rlist_first_entry(&m_ready_to_read, Conn_t, m_in_read);
+		assert(conn->status.is_ready_to_decode);
+		DecodeStatus rc = DECODE_SUCC;
+		while (hasDataToDecode(*conn)) {
+			rc = decodeResponse(*conn);
+			if (rc != DECODE_SUCC)
+				break;
+		}
+		if (rc == DECODE_ERR)
+			return nullptr;
+		if (rc == DECODE_SUCC) {
+			/* Requests failed on reconnect have no data. */
+			if (conn->status.is_ready_to_decode) {
+				conn->status.is_ready_to_decode = false;
+				rlist_del(&conn->m_in_read);
+			}
+			return conn;
+		}
+		/*
+		 * Tail of the response hasn't arrived yet: the connection
+		 * returns to the list as soon as the rest is received.
+		 */
+		conn->status.is_ready_to_decode = false;
+		rlist_del(&conn->m_in_read);
+	} while (!timer.isExpired());
+	return nullptr;
+}
+
+template<class BUFFER, class NetProvider>
+int
+Connector<BUFFER, NetProvider>::poll(int timeout)
+{
+	return poll(timeoutFromMs(timeout));
+}
+
+template<class BUFFER, class NetProvider>
+int
+Connector<BUFFER, NetProvider>::poll(Timeout_t timeout)
+{
+	heartbeat();
+	return m_NetProvider.wait(pollTimeout(timeout));
 }
 
 template<class BUFFER, class NetProvider>
 void
 Connector<BUFFER, NetProvider>::readyToSend(Connection<BUFFER, NetProvider> &conn)
 {
+	/* Output of disconnected connection is sent after (re)connect. */
+	if (conn.socket < 0)
+		return;
 	m_NetProvider.readyToSend(conn);
 }
 
@@ -217,7 +715,39 @@ template<class BUFFER, class NetProvider>
 void
 Connector<BUFFER, NetProvider>::readyToDecode(Connection<BUFFER, NetProvider> &conn)
 {
-	//assert(rlist_empty(&m_ready_to_read));
-	rlist_add_tail(&m_ready_to_read, &conn.m_in_read);
+	/*
+	 * More data may arrive before the previous portion is decoded:
+	 * the connection is already in the list then.
+	 */
+	if (rlist_empty(&conn.m_in_read))
+		rlist_add_tail(&m_ready_to_read, &conn.m_in_read);
 	conn.status.is_ready_to_decode = true;
 }
+
+template<class BUFFER, class NetProvider>
+void
+Connector<BUFFER, NetProvider>::attach(Connection<BUFFER, NetProvider> &conn)
+{
+	rlist_add_tail(&m_Connections, &conn.m_in_connector);
+}
+
+template<class BUFFER, class NetProvider>
+void
+Connector<BUFFER, NetProvider>::detach(Connection<BUFFER, NetProvider> &conn)
+{
+	rlist_del(&conn.m_in_connector);
+}
+
+template<class BUFFER, class NetProvider>
+ConnectionStat
+Connector<BUFFER, NetProvider>::snapshot() const
+{
+	ConnectionStat stat;
+	/* rlist API doesn't accept const lists. */
+	struct rlist *head = const_cast<struct rlist *>(&m_Connections);
+	Connection<BUFFER, NetProvider> *conn;
+	rlist_foreach_entry(conn, head, m_in_connector)
+		stat.merge(conn->snapshot());
+	m_NetProvider.counters.snapshot(stat);
+	return stat;
+}
@@ -0,0 +1,82 @@
+#pragma once
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "IprotoConstants.hpp"
+#include "../Utils/Sha1.hpp"
+
+/**
+ * User and password for chap-sha1 authentication. The password itself
+ * isn't kept: its single and double SHA-1 are computed once, so one
+ * object shared by all connections of a pool makes each (re)connect cost
+ * a single hash of the greeting salt.
+ */
+class Credentials {
+public:
+	Credentials(const std::string &user, std::string_view password);
+
+	const std::string& user() const { return m_User; }
+	/**
+	 * Write chap-sha1 scramble of the password for @a salt (the first
+	 * SCRAMBLE_SIZE bytes of salt from the greeting are used):
+	 * sha1(password) xor sha1(salt, sha1(sha1(password))).
+	 */
+	void scramble(const char *salt, char out[Iproto::SCRAMBLE_SIZE]) const;
+private:
+	std::string m_User;
+	uint8_t m_Hash1[tnt::Sha1::DIGEST_SIZE];
+	uint8_t m_Hash2[tnt::Sha1::DIGEST_SIZE];
+};
+
+static_assert(Iproto::SCRAMBLE_SIZE == tnt::Sha1::DIGEST_SIZE);
+
+inline
+Credentials::Credentials(const std::string &user, std::string_view password) :
+	m_User(user)
+{
+	tnt::sha1(password.data(), password.size(), m_Hash1);
+	tnt::sha1(m_Hash1, sizeof(m_Hash1), m_Hash2);
+}
+
+inline void
+Credentials::scramble(const char *salt, char out[Iproto::SCRAMBLE_SIZE]) const
+{
+	uint8_t hash[tnt::Sha1::DIGEST_SIZE];
+	tnt::Sha1 sha;
+	sha.update(salt, Iproto::SCRAMBLE_SIZE);
+	sha.update(m_Hash2, sizeof(m_Hash2));
+	sha.finish(hash);
+	for (size_t i = 0; i < Iproto::SCRAMBLE_SIZE; i++)
+		out[i] = m_Hash1[i] ^ hash[i];
+}
@@ -0,0 +1,331 @@
+#pragma once
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <deque>
+#include <optional>
+#include <string>
+
+#include "Connection.hpp"
+
+struct CursorOptions {
+	/** Count of tuples requested by each page. */
+	uint32_t page_size = 1000;
+	/**
+	 * Count of pages requested ahead of the caller: received but not
+	 * taken yet plus the one in flight. Each request needs position of
+	 * the previous page, so no more than one request is in flight.
+	 */
+	size_t prefetch = 2;
+	IteratorType iterator = GE;
+	enum Mode {
+		/** POSITION if server is 2.11 or newer, LAST_KEY otherwise. */
+		AUTO,
+		/** IPROTO_AFTER_POSITION returned by the previous page. */
+		POSITION,
+		/**
+		 * Key of the last tuple of the previous page with GT (LT for
+		 * descending iterators) iterator. Only ALL, GE, GT, LE and LT
+		 * iterators are supported.
+		 */
+		LAST_KEY,
+	};
+	Mode mode = AUTO;
+	/**
+	 * LAST_KEY mode: count of the leading tuple fields which form the
+	 * (unique) key of the index.
+	 */
+	uint32_t key_parts = 1;
+};
+
+/**
+ * Keyset pagination over an index: each page is selected after the last
+ * tuple of the previous one, so unlike select() with offset server never
+ * rescans skipped tuples. The next page is requested as soon as the
+ * previous one is received, so it's transferred while the caller
+ * processes the current page.
+ * Pages are responses to SELECT: they hold data in the input buffer of
+ * the connection until they are destroyed. If the cursor is abandoned
+ * before the end, the response to the request in flight (if any) stays
+ * in the connection until it's taken by getResponse().
+ */
+template<class BUFFER, class NetProvider, class KEY>
+class Cursor {
+public:
+	using Connection_t = Connection<BUFFER, NetProvider>;
+	using iterator = typename BUFFER::iterator;
+
+	Cursor(Connection_t &conn, uint32_t space_id, uint32_t index_id,
+	       const KEY &key, const CursorOptions &opts);
+	Cursor(const Cursor& cursor) = delete;
+	Cursor& operator = (const Cursor& cursor) = delete;
+
+	/**
+	 * Wait for the next page no longer than @a timeout ms (0 - no
+	 * limit). Tuples are in body.data like in response to select().
+	 * Return nullopt at the end of iteration or on error: getError()
+	 * describes the last one. After timeout the call can be repeated.
+	 */
+	std::optional<Response<BUFFER>> next(int timeout = 0);
+	/** All pages are taken (or iteration has failed). */
+	bool isEnd() const;
+	const std::string& getError() const { return m_Error; }
+	/** Resolved pagination mode: POSITION or LAST_KEY. */
+	CursorOptions::Mode mode() const { return m_Opts.mode; }
+	/** Pages which are received but not taken by next() yet. */
+	size_t pagesReady() const { return m_Pages.size(); }
+private:
+	void setFailed(const std::string &msg);
+	/** Request the next page if there's room for it. */
+	void fill();
+	/** Move received pages to m_Pages and request the following ones. */
+	void collect();
+	bool pageReceived(Response<BUFFER> &page);
+	/** Copy key of the last tuple of the page to m_After. */
+	bool copyKey(Tuple<BUFFER> &tuple);
+
+	Connection_t &m_Conn;
+	uint32_t m_SpaceId;
+	uint32_t m_IndexId;
+	KEY m_Key;
+	CursorOptions m_Opts;
+	/**
+	 * Position of the last received tuple (or its key in LAST_KEY mode);
+	 * empty until the first page is received.
+	 */
+	std::string m_After;
+	std::optional<rid_t> m_InFlight;
+	std::deque<Response<BUFFER>> m_Pages;
+	/** The last page is received, nothing to request. */
+	bool m_IsLast = false;
+	std::string m_Error;
+};
+
+template<class BUFFER, class NetProvider, class KEY>
+Cursor<BUFFER, NetProvider, KEY>::Cursor(Connection_t &conn,
+					 uint32_t space_id, uint32_t index_id,
+					 const KEY &key,
+					 const CursorOptions &opts) :
+	m_Conn(conn), m_SpaceId(space_id), m_IndexId(index_id), m_Key(key),
+	m_Opts(opts)
+{
+	if (m_Opts.mode == CursorOptions::AUTO) {
+		bool has_position =
+			m_Conn.m_Greeting.version_id >= versionId(2, 11, 0);
+		m_Opts.mode = has_position ? CursorOptions::POSITION :
+					     CursorOptions::LAST_KEY;
+	}
+	if (m_Opts.prefetch == 0)
+		m_Opts.prefetch = 1;
+	if (m_Opts.page_size == 0) {
+		setFailed("Page size must be positive");
+		return;
+	}
+	if (m_Opts.mode == CursorOptions::LAST_KEY) {
+		IteratorType it = m_Opts.iterator;
+		if (it != ALL && it != GE && it != GT && it != LE && it != LT) {
+			setFailed("Iterator " + std::to_string(it) +
+			     " isn't supported by pagination by the last key");
+			return;
+		}
+		if (m_Opts.key_parts == 0) {
+			setFailed("Key must have at least one part");
+			return;
+		}
+	}
+	fill();
+}
+
+template<class BUFFER, class NetProvider, class KEY>
+void
+Cursor<BUFFER, NetProvider, KEY>::setFailed(const std::string &msg)
+{
+	LOG_ERROR("Cursor over space ", m_SpaceId, " index ", m_IndexId,
+		  ": ", msg);
+	m_Error = msg;
+	m_IsLast = true;
+}
+
+template<class BUFFER, class NetProvider, class KEY>
+void
+Cursor<BUFFER, NetProvider, KEY>::fill()
+{
+	if (m_InFlight || m_IsLast || m_Pages.size() >= m_Opts.prefetch)
+		return;
+	uint32_t limit = m_Opts.page_size;
+	if (m_Opts.mode == CursorOptions::POSITION) {
+		m_InFlight = m_Conn.selectAfter(m_Key, m_SpaceId, m_IndexId,
+						limit, m_Opts.iterator,
+						m_After);
+	} else if (m_After.empty()) {
+		m_InFlight = m_Conn.select(m_Key, m_SpaceId, m_IndexId, limit,
+					   0, m_Opts.iterator);
+	} else {
+		bool is_desc = m_Opts.iterator == LE || m_Opts.iterator == LT;
+		m_InFlight = m_Conn.select(mpp::as_raw(m_After), m_SpaceId,
+					   m_IndexId, limit, 0,
+					   is_desc ? LT : GT);
+	}
+}
+
+template<class BUFFER, class NetProvider, class KEY>
+void
+Cursor<BUFFER, NetProvider, KEY>::collect()
+{
+	while (m_InFlight && m_Conn.futureIsReady(*m_InFlight)) {
+		Response<BUFFER> page = *m_Conn.getResponse(*m_InFlight);
+		m_InFlight.reset();
+		if (!pageReceived(page))
+			return;
+		/* The last page may happen to be empty: don't return it. */
+		if (page.body.data != std::nullopt &&
+		    !page.body.data->tuples.empty())
+			m_Pages.push_back(std::move(page));
+		fill();
+	}
+}
+
+template<class BUFFER, class NetProvider, class KEY>
+bool
+Cursor<BUFFER, NetProvider, KEY>::pageReceived(Response<BUFFER> &page)
+{
+	if (page.header.code != 0) {
+		if (page.body.error_stack != std::nullopt) {
+			const Error &err = page.body.error_stack->error;
+			setFailed(std::string(err.msg, err.msg_len));
+		} else {
+			setFailed("Request has failed with code " +
+			     std::to_string(page.header.code));
+		}
+		return false;
+	}
+	size_t count = 0;
+	if (page.body.data != std::nullopt)
+		count = page.body.data->tuples.size();
+	if (count < m_Opts.page_size)
+		m_IsLast = true;
+	if (count == 0)
+		return true;
+	if (m_Opts.mode == CursorOptions::LAST_KEY)
+		return copyKey(page.body.data->tuples[count - 1]);
+	if (page.body.position == std::nullopt) {
+		setFailed("Server hasn't returned position of the page");
+		return false;
+	}
+	m_After = std::move(*page.body.position);
+	return true;
+}
+
+template<class BUFFER, class NetProvider, class KEY>
+bool
+Cursor<BUFFER, NetProvider, KEY>::copyKey(Tuple<BUFFER> &tuple)
+{
+	uint32_t parts = m_Opts.key_parts;
+	if (tuple.field_count < parts) {
+		setFailed("Tuple has less fields than parts of key");
+		return false;
+	}
+	BUFFER &buf = m_Conn.m_InBuf;
+	iterator begin = tuple.begin;
+	uint8_t c = buf.template get<uint8_t>(begin);
+	if (c >= 0x90 && c <= 0x9f)
+		begin += 1;
+	else if (c == 0xdc)
+		begin += 3;
+	else
+		begin += 5;
+	mpp::Dec<BUFFER> dec(buf);
+	dec.SetPosition(begin);
+	for (uint32_t i = 0; i < parts; i++) {
+		dec.SetReader(false, SkipValueReader<BUFFER>{dec});
+		if (dec.Read() != mpp::READ_SUCCESS) {
+			setFailed("Failed to decode key of the last tuple");
+			return false;
+		}
+	}
+	iterator end = dec.getPosition();
+	size_t size = end - begin;
+	if (parts < 16) {
+		m_After.resize(1 + size);
+		m_After[0] = static_cast<char>(0x90 | parts);
+	} else {
+		m_After.resize(3 + size);
+		m_After[0] = static_cast<char>(0xdc);
+		m_After[1] = static_cast<char>(parts >> 8);
+		m_After[2] = static_cast<char>(parts & 0xff);
+	}
+	buf.get(begin, m_After.data() + m_After.size() - size, size);
+	return true;
+}
+
+template<class BUFFER, class NetProvider, class KEY>
+std::optional<Response<BUFFER>>
+Cursor<BUFFER, NetProvider, KEY>::next(int timeout)
+{
+	collect();
+	while (m_Pages.empty() && m_InFlight) {
+		if (m_Conn.m_Connector.wait(m_Conn, *m_InFlight, timeout) != 0) {
+			m_Error = "Failed to receive page: " + m_Conn.getError();
+			return std::nullopt;
+		}
+		collect();
+	}
+	if (m_Pages.empty())
+		return std::nullopt;
+	Response<BUFFER> page = std::move(m_Pages.front());
+	m_Pages.pop_front();
+	fill();
+	return page;
+}
+
+template<class BUFFER, class NetProvider, class KEY>
+bool
+Cursor<BUFFER, NetProvider, KEY>::isEnd() const
+{
+	return m_Pages.empty() && !m_InFlight && m_IsLast;
+}
+
+template<class BUFFER, class NetProvider>
+template <class T>
+Cursor<BUFFER, NetProvider, T>
+Connection<BUFFER, NetProvider>::Space::Index::cursor(const T &key)
+{
+	return cursor(key, CursorOptions{});
+}
+
+template<class BUFFER, class NetProvider>
+template <class T>
+Cursor<BUFFER, NetProvider, T>
+Connection<BUFFER, NetProvider>::Space::Index::cursor(const T &key,
+						       const CursorOptions &opts)
+{
+	return Cursor<BUFFER, NetProvider, T>(m_Conn, m_Space.space_id,
+					      index_id, key, opts);
+}
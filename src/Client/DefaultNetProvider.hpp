@@ -32,6 +32,7 @@
 #include <assert.h>
 #include <chrono>
 #include <sys/epoll.h>
+#include <sys/syscall.h>
 #include <errno.h>
 #include <unistd.h>
 #include <stdexcept>
@@ -39,19 +40,25 @@
 #include <string>
 #include <string_view>
 
+#include "AddressCache.hpp"
 #include "Connection.hpp"
 #include "Connector.hpp"
 #include "NetworkEngine.hpp"
+#include "Tracer.hpp"
 #include "../Utils/Timer.hpp"
 #include "../Utils/rlist.h"
 
 template<class BUFFER, class NetProvider>
 class Connector;
 
-template<class BUFFER, class NETWORK>
+/**
+ * @tparam TRACER compile-time tracer policy, see NoopTracer.
+ */
+template<class BUFFER, class NETWORK, class TRACER = NoopTracer>
 class DefaultNetProvider {
 public:
-	using NetProvider_t = DefaultNetProvider<BUFFER, NETWORK>;
+	using NetProvider_t = DefaultNetProvider<BUFFER, NETWORK, TRACER>;
+	using Tracer_t = TRACER;
 	using Conn_t = Connection<BUFFER, NetProvider_t >;
 	using Connector_t = Connector<BUFFER, NetProvider_t >;
 	DefaultNetProvider();
@@ -61,32 +68,68 @@ public:
 	void close(Conn_t &conn);
 	/** Add to @m_ready_to_write*/
 	void readyToSend(Conn_t &conn);
-	/** Read and write to sockets; polling using epoll. */
+	/**
+	 * Read and write to sockets; polling using epoll. Zero @a timeout
+	 * (ms) is the default one.
+	 */
 	int wait(int timeout);
+	/**
+	 * The same with timeout of nanosecond precision (if the kernel has
+	 * epoll_pwait2()): zero is a non-blocking poll, TIMEOUT_INFINITE is
+	 * the default timeout.
+	 */
+	int wait(Timeout_t timeout);
 
 	bool check(Conn_t &conn);
+	/** Set TCP keepalive options of the connection socket. */
+	int setKeepalive(Conn_t &conn, const KeepaliveOptions &opts);
+	/** Set SO_BUSY_POLL of the connection socket. */
+	int setBusyPoll(Conn_t &conn, unsigned usec);
+	/**
+	 * Send pending requests right away on the calling thread (unless
+	 * the socket is blocked). Return -1 if the connection has failed.
+	 */
+	int sendNow(Conn_t &conn);
+	/**
+	 * Single non-blocking receive without polling. Return count of
+	 * received bytes, 0 if there's no data or -1 on error: the
+	 * connection is closed then, whatever the error is.
+	 */
+	int recvNow(Conn_t &conn);
+	/** Time to live of resolved addresses, ms; 0 disables the cache. */
+	void setAddressTtl(unsigned ttl) { m_Addresses.setTtl(ttl); }
+	const AddressCache<NETWORK> &addresses() const { return m_Addresses; }
+
+	/** epoll_wait() and epoll_ctl() calls. */
+	NetProviderCounters counters;
 private:
 	static constexpr size_t DEFAULT_TIMEOUT = 100;
-	static constexpr size_t EVENT_POLL_COUNT_MAX = 64;
 	static constexpr size_t EPOLL_QUEUE_LEN = 1024;
 	static constexpr size_t EPOLL_EVENTS_MAX = 128;
+	/** Max size of data received by one recvNow(). */
+	static constexpr size_t RECV_NOW_SIZE = 4096;
 
 	void send(Conn_t &conn);
 	int recv(Conn_t &conn);
 
 	int poll(struct ConnectionEvent *fds, size_t *fd_count,
-		 int timeout = DEFAULT_TIMEOUT);
+		 Timeout_t timeout);
+	/** epoll_pwait2() or epoll_wait() with timeout rounded up to ms. */
+	int epollWait(struct epoll_event *events, Timeout_t timeout);
 	int setPollSetting(int socket, int setting);
 	int registerEpoll(int socket);
 
 	/** <socket : connection> map. Contains both ready to read/send connections */
 	std::unordered_map<int, Conn_t *> m_Connections;
+	AddressCache<NETWORK> m_Addresses;
 	rlist m_ready_to_write;
 	int m_EpollFd;
+	/** Whether epoll_pwait2() is available. */
+	bool m_HasPwait2 = true;
 };
 
-template<class BUFFER, class NETWORK>
-DefaultNetProvider<BUFFER, NETWORK>::DefaultNetProvider()
+template<class BUFFER, class NETWORK, class TRACER>
+DefaultNetProvider<BUFFER, NETWORK, TRACER>::DefaultNetProvider()
 {
 	m_EpollFd = epoll_create(EPOLL_QUEUE_LEN);
 	if (m_EpollFd == -1) {
@@ -96,50 +139,61 @@ DefaultNetProvider<BUFFER, NETWORK>::DefaultNetProvider()
 	rlist_create(&m_ready_to_write);
 }
 
-template<class BUFFER, class NETWORK>
-DefaultNetProvider<BUFFER, NETWORK>::~DefaultNetProvider()
+template<class BUFFER, class NETWORK, class TRACER>
+DefaultNetProvider<BUFFER, NETWORK, TRACER>::~DefaultNetProvider()
 {
 	::close(m_EpollFd);
 	m_EpollFd = 0;
 	assert(rlist_empty(&m_ready_to_write));
 }
 
-template<class BUFFER, class NETWORK>
+template<class BUFFER, class NETWORK, class TRACER>
 int
-DefaultNetProvider<BUFFER, NETWORK>::registerEpoll(int socket)
+DefaultNetProvider<BUFFER, NETWORK, TRACER>::registerEpoll(int socket)
 {
 	/* Configure epoll with new socket. */
 	assert(m_EpollFd >= 0);
 	struct epoll_event event;
 	event.events = EPOLLIN;
 	event.data.fd = socket;
+	counters.epoll_ctl_calls.add();
 	if (epoll_ctl(m_EpollFd, EPOLL_CTL_ADD, socket, &event) != 0)
 		return -1;
 	return 0;
 }
 
-template<class BUFFER, class NETWORK>
+template<class BUFFER, class NETWORK, class TRACER>
 int
-DefaultNetProvider<BUFFER, NETWORK>::setPollSetting(int socket, int setting)
+DefaultNetProvider<BUFFER, NETWORK, TRACER>::setPollSetting(int socket, int setting)
 {
 	struct epoll_event event;
 	event.events = setting;
 	event.data.fd = socket;
+	counters.epoll_ctl_calls.add();
 	if (epoll_ctl(m_EpollFd, EPOLL_CTL_MOD, socket, &event) != 0)
 		return -1;
 	return 0;
 }
 
 
-template<class BUFFER, class NETWORK>
+template<class BUFFER, class NETWORK, class TRACER>
 int
-DefaultNetProvider<BUFFER, NETWORK>::connect(Conn_t &conn,
+DefaultNetProvider<BUFFER, NETWORK, TRACER>::connect(Conn_t &conn,
 					     const std::string_view& addr,
 					     unsigned port, size_t timeout)
 {
 	int socket = -1;
-	socket = port == 0 ? NETWORK::connectUNIX(addr) :
-			NETWORK::connectINET(addr, port, timeout);
+	if (port == 0) {
+		socket = NETWORK::connectUNIX(addr);
+	} else {
+		const std::vector<SockAddr> *addrs =
+			m_Addresses.resolve(addr, port);
+		size_t winner = 0;
+		if (addrs != nullptr)
+			socket = NETWORK::connectINET(*addrs, timeout, &winner);
+		if (socket >= 0)
+			m_Addresses.promote(addr, port, winner);
+	}
 	if (socket < 0) {
 		/* There's no + operator for string and string_view ...*/
 		conn.setError(std::string("Failed to establish connection to ") +
@@ -153,21 +207,24 @@ DefaultNetProvider<BUFFER, NETWORK>::connect(Conn_t &conn,
 		inBufferToIOV(conn, Iproto::GREETING_SIZE, &iov_cnt);
 	LOG_DEBUG("Receiving greetings...");
 	int read_bytes = NETWORK::recvall(socket, iov, iov_cnt, false);
+	conn.counters.recvmsg_calls.add();
 	if (read_bytes < 0) {
 		conn.setError(std::string("Failed to receive greetings: ") +
 			      strerror(errno));
+		/* Release the space so the next attempt starts clean. */
+		hasNotRecvBytes(conn, Iproto::GREETING_SIZE);
 		::close(socket);
 		return -1;
 	}
 	LOG_DEBUG("Greetings are received, read bytes ", read_bytes);
+	conn.counters.bytes_recv.add(read_bytes);
 	if (decodeGreeting(conn) != 0) {
 		conn.setError(std::string("Failed to decode greetings"));
 		::close(socket);
 		return -1;
 	}
 	LOG_DEBUG("Greetings are decoded");
-	LOG_DEBUG("Authentication processing...");
-	//TODO: add authentication step.
+	/* Authentication (if any) is made by Connector. */
 	if (registerEpoll(socket) != 0) {
 		conn.setError(std::string("Failed to register epoll watcher"));
 		::close(socket);
@@ -178,9 +235,9 @@ DefaultNetProvider<BUFFER, NETWORK>::connect(Conn_t &conn,
 	return 0;
 }
 
-template<class BUFFER, class NETWORK>
+template<class BUFFER, class NETWORK, class TRACER>
 void
-DefaultNetProvider<BUFFER, NETWORK>::close(Conn_t &connection)
+DefaultNetProvider<BUFFER, NETWORK, TRACER>::close(Conn_t &connection)
 {
 #ifndef NDEBUG
 	struct sockaddr sa;
@@ -210,21 +267,51 @@ DefaultNetProvider<BUFFER, NETWORK>::close(Conn_t &connection)
 		 * there's other descriptors on open socket, invoke
 		 * epoll_ctl manually.
 		 */
+		counters.epoll_ctl_calls.add();
 		epoll_ctl(m_EpollFd, EPOLL_CTL_DEL, connection.socket, &event);
 	}
 	m_Connections.erase(connection.socket);
 	connection.socket = -1;
+	/* Unsent data stays in the buffer till the next connect. */
+	rlist_del(&connection.m_in_write);
+	connection.status.is_ready_to_send = false;
+	connection.status.is_send_blocked = false;
+}
+
+template<class BUFFER, class NETWORK, class TRACER>
+int
+DefaultNetProvider<BUFFER, NETWORK, TRACER>::epollWait(struct epoll_event *events,
+						       Timeout_t timeout)
+{
+	using namespace std::chrono;
+#ifdef SYS_epoll_pwait2
+	if (m_HasPwait2) {
+		struct timespec ts;
+		ts.tv_sec = duration_cast<seconds>(timeout).count();
+		ts.tv_nsec = (timeout - seconds(ts.tv_sec)).count();
+		int rc = syscall(SYS_epoll_pwait2, m_EpollFd, events,
+				 EPOLL_EVENTS_MAX, &ts, nullptr, 0);
+		/* Old kernel or the call is filtered out by seccomp. */
+		if (rc >= 0 || (errno != ENOSYS && errno != EPERM))
+			return rc;
+		LOG_DEBUG("epoll_pwait2() is unavailable: ", strerror(errno));
+		m_HasPwait2 = false;
+	}
+#endif
+	/* Round up: shorter wait would make the caller spin. */
+	return epoll_wait(m_EpollFd, events, EPOLL_EVENTS_MAX,
+			  ceil<milliseconds>(timeout).count());
 }
 
-template<class BUFFER, class NETWORK>
+template<class BUFFER, class NETWORK, class TRACER>
 int
-DefaultNetProvider<BUFFER, NETWORK>::poll(struct ConnectionEvent *fds,
-					  size_t *fd_count, int timeout)
+DefaultNetProvider<BUFFER, NETWORK, TRACER>::poll(struct ConnectionEvent *fds,
+					  size_t *fd_count, Timeout_t timeout)
 {
 	static struct epoll_event events[EPOLL_EVENTS_MAX];
 	*fd_count = 0;
-	int event_cnt = epoll_wait(m_EpollFd, events, EPOLL_EVENTS_MAX,
-				   timeout);
+	counters.epoll_wait_calls.add();
+	int event_cnt = epollWait(events, timeout);
 	if (event_cnt == -1)
 		return -1;
 	assert(event_cnt >= 0);
@@ -237,9 +324,9 @@ DefaultNetProvider<BUFFER, NETWORK>::poll(struct ConnectionEvent *fds,
 	return 0;
 }
 
-template<class BUFFER, class NETWORK>
+template<class BUFFER, class NETWORK, class TRACER>
 void
-DefaultNetProvider<BUFFER, NETWORK>::readyToSend(Conn_t &conn)
+DefaultNetProvider<BUFFER, NETWORK, TRACER>::readyToSend(Conn_t &conn)
 {
 	if (conn.status.is_send_blocked) {
 #ifndef NDEBUG
@@ -264,9 +351,9 @@ DefaultNetProvider<BUFFER, NETWORK>::readyToSend(Conn_t &conn)
 	conn.status.is_ready_to_send = true;
 }
 
-template<class BUFFER, class NETWORK>
+template<class BUFFER, class NETWORK, class TRACER>
 int
-DefaultNetProvider<BUFFER, NETWORK>::recv(Conn_t &conn)
+DefaultNetProvider<BUFFER, NETWORK, TRACER>::recv(Conn_t &conn)
 {
 	assert(! conn.status.is_failed);
 	size_t total = NETWORK::readyToRecv(conn.socket);
@@ -277,17 +364,27 @@ DefaultNetProvider<BUFFER, NETWORK>::recv(Conn_t &conn)
 	}
 	if (total == 0) {
 		LOG_DEBUG("Socket ", conn.socket, " has no data to read");
+		if (NETWORK::isClosedByPeer(conn.socket)) {
+			conn.setError("Connection is closed by peer");
+			close(conn);
+		}
 		return -1;
 	}
 	size_t iov_cnt = 0;
 	struct iovec *iov =
 		inBufferToIOV(conn, total, &iov_cnt);
 	int read_bytes = NETWORK::recvall(conn.socket, iov, iov_cnt, true);
-	hasNotRecvBytes(conn, total - read_bytes);
+	/* Failed call has read nothing: return the whole reserved space. */
+	hasNotRecvBytes(conn, total - (read_bytes > 0 ? read_bytes : 0));
+	conn.counters.recvmsg_calls.add();
+	if (read_bytes > 0)
+		traceEvent<TRACER>(TRACE_RECV, conn.socket, 0, read_bytes);
 	LOG_DEBUG("read ", read_bytes, " bytes from ", conn.socket, " socket");
 	if (read_bytes < 0) {
-		if (errno == EWOULDBLOCK || errno == EAGAIN)
+		if (errno == EWOULDBLOCK || errno == EAGAIN) {
+			conn.counters.eagain.add();
 			return -1;
+		}
 		conn.setError(std::string("Failed to receive response: ") +
 					  strerror(errno));
 		if (errno == EBADF || errno == ENOTCONN ||
@@ -296,24 +393,32 @@ DefaultNetProvider<BUFFER, NETWORK>::recv(Conn_t &conn)
 		}
 		return -1;
 	}
+	conn.counters.bytes_recv.add(read_bytes);
 	return total - read_bytes;
 }
 
-template<class BUFFER, class NETWORK>
+template<class BUFFER, class NETWORK, class TRACER>
 void
-DefaultNetProvider<BUFFER, NETWORK>::send(Conn_t &conn)
+DefaultNetProvider<BUFFER, NETWORK, TRACER>::send(Conn_t &conn)
 {
 	assert(! conn.status.is_failed);
 	while (hasDataToSend(conn)) {
 		size_t sent_bytes = 0;
+		size_t calls = 0;
 		size_t iov_cnt = 0;
 		struct iovec *iov = outBufferToIOV(conn, &iov_cnt);
 		int rc = NETWORK::sendall(conn.socket, iov, iov_cnt,
-						 &sent_bytes);
+						 &sent_bytes, &calls);
+		if (sent_bytes > 0)
+			traceEvent<TRACER>(TRACE_SEND, conn.socket, 0, sent_bytes);
 		hasSentBytes(conn, sent_bytes);
+		conn.counters.sendmsg_calls.add(calls);
+		if (calls > 1)
+			conn.counters.partial_writes.add(calls - 1);
 		LOG_DEBUG("send ", sent_bytes, " bytes to the ", conn.socket, " socket");
 		if (rc != 0) {
 			if (errno == EWOULDBLOCK || errno == EAGAIN) {
+				conn.counters.eagain.add();
 				int setting = EPOLLIN | EPOLLOUT;
 				if (setPollSetting(conn.socket, setting) != 0) {
 					LOG_ERROR("Failed to change epoll mode: "
@@ -345,14 +450,22 @@ DefaultNetProvider<BUFFER, NETWORK>::send(Conn_t &conn)
 	}
 }
 
-template<class BUFFER, class NETWORK>
+template<class BUFFER, class NETWORK, class TRACER>
 int
-DefaultNetProvider<BUFFER, NETWORK>::wait(int timeout)
+DefaultNetProvider<BUFFER, NETWORK, TRACER>::wait(int timeout)
 {
 	assert(timeout >= 0);
-	if (timeout == 0)
-		timeout = DEFAULT_TIMEOUT;
-	LOG_DEBUG("Network engine wait for ", timeout, " milliseconds");
+	return wait(timeoutFromMs(timeout));
+}
+
+template<class BUFFER, class NETWORK, class TRACER>
+int
+DefaultNetProvider<BUFFER, NETWORK, TRACER>::wait(Timeout_t timeout)
+{
+	assert(timeout >= Timeout_t{0});
+	if (timeout == TIMEOUT_INFINITE)
+		timeout = std::chrono::milliseconds(DEFAULT_TIMEOUT);
+	LOG_DEBUG("Network engine wait for ", timeout.count(), " nanoseconds");
 	/* Send pending requests. */
 	if (!rlist_empty(&m_ready_to_write)) {
 		Connection<BUFFER, DefaultNetProvider> *conn, *tmp;
@@ -361,7 +474,8 @@ DefaultNetProvider<BUFFER, NETWORK>::wait(int timeout)
 		}
 	}
 	/* Firstly poll connections to point out if there's data to read. */
-	static struct ConnectionEvent events[EVENT_POLL_COUNT_MAX];
+	/* poll() fills up to EPOLL_EVENTS_MAX entries. */
+	static struct ConnectionEvent events[EPOLL_EVENTS_MAX];
 	size_t event_cnt = 0;
 	if (poll((ConnectionEvent *)&events, &event_cnt, timeout) != 0) {
 		LOG_ERROR("Poll failed: ", strerror(errno));
@@ -376,6 +490,8 @@ DefaultNetProvider<BUFFER, NETWORK>::wait(int timeout)
 			if (recv(*conn) == 0)
 				conn->readyToDecode();
 		}
+		if (conn->status.is_failed)
+			continue;
 		if ((events[i].event & EPOLLOUT) != 0) {
 			/* We are watching only for blocked sockets. */
 			LOG_DEBUG("Registered poll event ", i, ": ",
@@ -387,9 +503,9 @@ DefaultNetProvider<BUFFER, NETWORK>::wait(int timeout)
 	return 0;
 }
 
-template<class BUFFER, class NETWORK>
+template<class BUFFER, class NETWORK, class TRACER>
 bool
-DefaultNetProvider<BUFFER, NETWORK>::check(Conn_t &connection)
+DefaultNetProvider<BUFFER, NETWORK, TRACER>::check(Conn_t &connection)
 {
 	int error = 0;
 	socklen_t len = sizeof(error);
@@ -404,3 +520,77 @@ DefaultNetProvider<BUFFER, NETWORK>::check(Conn_t &connection)
 	}
 	return true;
 }
+
+template<class BUFFER, class NETWORK, class TRACER>
+int
+DefaultNetProvider<BUFFER, NETWORK, TRACER>::setKeepalive(Conn_t &conn,
+						const KeepaliveOptions &opts)
+{
+	if (NETWORK::setKeepalive(conn.socket, opts.idle, opts.interval,
+				  opts.count, opts.user_timeout) != 0) {
+		conn.setError(std::string("Failed to set keepalive: ") +
+			      strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+template<class BUFFER, class NETWORK, class TRACER>
+int
+DefaultNetProvider<BUFFER, NETWORK, TRACER>::setBusyPoll(Conn_t &conn, unsigned usec)
+{
+	if (NETWORK::setBusyPoll(conn.socket, usec) != 0) {
+		conn.setError(std::string("Failed to set busy poll: ") +
+			      strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+template<class BUFFER, class NETWORK, class TRACER>
+int
+DefaultNetProvider<BUFFER, NETWORK, TRACER>::sendNow(Conn_t &conn)
+{
+	assert(! conn.status.is_failed);
+	if (conn.status.is_send_blocked)
+		return 0;
+	send(conn);
+	return conn.status.is_failed ? -1 : 0;
+}
+
+template<class BUFFER, class NETWORK, class TRACER>
+int
+DefaultNetProvider<BUFFER, NETWORK, TRACER>::recvNow(Conn_t &conn)
+{
+	assert(! conn.status.is_failed);
+	/*
+	 * Size of data isn't known without extra ioctl(), and reserving
+	 * space in the input buffer may cross its block, so receive to a
+	 * scratch buffer: responses of this mode are small.
+	 */
+	char buf[RECV_NOW_SIZE];
+	struct iovec iov = {buf, sizeof(buf)};
+	int read_bytes = NETWORK::recvall(conn.socket, &iov, 1, true);
+	conn.counters.recvmsg_calls.add();
+	if (read_bytes > 0) {
+		size_t iov_cnt = 0;
+		struct iovec *vecs = inBufferToIOV(conn, read_bytes, &iov_cnt);
+		for (size_t i = 0, pos = 0; i < iov_cnt; pos += vecs[i++].iov_len)
+			memcpy(vecs[i].iov_base, buf + pos, vecs[i].iov_len);
+		traceEvent<TRACER>(TRACE_RECV, conn.socket, 0, read_bytes);
+		conn.counters.bytes_recv.add(read_bytes);
+		return read_bytes;
+	}
+	if (read_bytes == 0) {
+		conn.setError("Connection is closed by peer");
+		close(conn);
+		return -1;
+	}
+	/* Spinning caller makes lots of empty reads: they aren't EAGAINs. */
+	if (netWouldBlock(errno))
+		return 0;
+	conn.setError(std::string("Failed to receive response: ") +
+		      strerror(errno));
+	close(conn);
+	return -1;
+}
@@ -0,0 +1,284 @@
+#pragma once
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
+#include "Connector.hpp"
+#include "../Utils/SmallVector.hpp"
+
+struct HedgeOptions {
+	/**
+	 * Quantile of replica's latency: if the response hasn't arrived by
+	 * then, the request is sent to another replica.
+	 */
+	double percentile = 0.95;
+	/** Delay (us) until the replica has answered min_samples requests. */
+	uint64_t initial_delay_us = 10000;
+	size_t min_samples = 100;
+	/** Lower bound of the delay (us). */
+	uint64_t min_delay_us = 1000;
+	/**
+	 * Delay of a replica is recomputed from its latency histogram once
+	 * per refresh_interval requests.
+	 */
+	size_t refresh_interval = 100;
+	/** Max count of extra requests made for one request. */
+	size_t max_hedges = 1;
+};
+
+/**
+ * Hedged requests over replicas holding the same data: it cuts the tail
+ * latency caused by one slow replica at a time (GC pause, snapshot etc).
+ * A request is sent to the next replica in round-robin order; if the
+ * response hasn't arrived within the delay of this replica, the same
+ * request is sent to the following one and so on (at once if the
+ * connection to the replica has failed). The first response wins, the
+ * other requests are discarded: their responses are dropped on arrival
+ * without being stored.
+ * The delay is the given percentile of the replica latency of requests of
+ * the same type measured by its connection (see Connection::getLatency()),
+ * so it adapts itself. Since the request may be executed several times,
+ * only idempotent requests (reads) must be hedged. All connections must
+ * be driven by the same connector.
+ */
+template<class BUFFER, class NetProvider>
+class Hedger {
+public:
+	using Connector_t = Connector<BUFFER, NetProvider>;
+	using Connection_t = Connection<BUFFER, NetProvider>;
+
+	struct Result {
+		/** Replica which has answered first: data is in its buffer. */
+		Connection_t *conn;
+		Response<BUFFER> response;
+		/** Count of replicas the request has been sent to. */
+		size_t attempts;
+	};
+
+	Hedger(Connector_t &connector, const HedgeOptions &opts = {});
+	Hedger(const Hedger& hedger) = delete;
+	Hedger& operator = (const Hedger& hedger) = delete;
+
+	/** Add (connected) replica. Returns its number. */
+	size_t addReplica(Connection_t &conn);
+	/**
+	 * Send request encoded by @a encode, which is called with
+	 * Connection_t& and returns rid_t of the request, and wait for the
+	 * first response no longer than @a timeout ms (0 - no limit).
+	 * Return nullopt on timeout, if there are no replicas or if the
+	 * connections of all replicas the request is sent to have failed.
+	 */
+	template <class F>
+	std::optional<Result> request(F &&encode, int timeout = 0);
+
+	const std::string& getError() const { return m_Error; }
+	/** Current hedging delay of requests of the type to the replica (us). */
+	uint64_t delay(size_t replica, LatencyType type = LATENCY_SELECT) const
+	{
+		return m_Replicas[replica].delay_us[type];
+	}
+	/** Count of requests made by request(). */
+	size_t requests() const { return m_Requests; }
+	/** Count of requests which have been sent to more than one replica. */
+	size_t hedged() const { return m_Hedged; }
+	/** Count of requests answered first by an extra replica. */
+	size_t hedgeWins() const { return m_HedgeWins; }
+private:
+	struct Replica {
+		Connection_t *conn;
+		/** Delay per type of request. */
+		uint64_t delay_us[LATENCY_TYPE_MAX];
+		/** Requests since the last refresh of the delay. */
+		size_t requests;
+	};
+	struct Attempt {
+		size_t replica;
+		rid_t future;
+		/** Delay of the request before the next attempt (us). */
+		uint64_t delay_us;
+	};
+
+	/** Send request to the replica, refresh its delay if it's time. */
+	template <class F>
+	Attempt send(size_t replica, F &encode);
+	void refreshDelay(Replica &replica);
+
+	Connector_t &m_Connector;
+	HedgeOptions m_Opts;
+	std::vector<Replica> m_Replicas;
+	/** Replica to send the next request to. */
+	size_t m_Next = 0;
+	std::string m_Error;
+	size_t m_Requests = 0;
+	size_t m_Hedged = 0;
+	size_t m_HedgeWins = 0;
+};
+
+template<class BUFFER, class NetProvider>
+Hedger<BUFFER, NetProvider>::Hedger(Connector_t &connector,
+				    const HedgeOptions &opts) :
+	m_Connector(connector), m_Opts(opts)
+{
+	if (m_Opts.refresh_interval == 0)
+		m_Opts.refresh_interval = 1;
+}
+
+template<class BUFFER, class NetProvider>
+size_t
+Hedger<BUFFER, NetProvider>::addReplica(Connection_t &conn)
+{
+	uint64_t delay_us = std::max(m_Opts.initial_delay_us,
+				     m_Opts.min_delay_us);
+	Replica &replica = m_Replicas.emplace_back();
+	replica.conn = &conn;
+	std::fill(std::begin(replica.delay_us), std::end(replica.delay_us),
+		  delay_us);
+	replica.requests = 0;
+	return m_Replicas.size() - 1;
+}
+
+template<class BUFFER, class NetProvider>
+void
+Hedger<BUFFER, NetProvider>::refreshDelay(Replica &replica)
+{
+	replica.requests = 0;
+	LatencySnapshot snap;
+	replica.conn->getLatency(snap);
+	for (size_t type = 0; type < LATENCY_TYPE_MAX; type++) {
+		const LatencyHistogramSnapshot_t &hist = snap.types[type];
+		if (hist.count() < m_Opts.min_samples)
+			continue;
+		uint64_t delay_us = hist.percentile(m_Opts.percentile) / 1000;
+		replica.delay_us[type] = std::max(delay_us, m_Opts.min_delay_us);
+	}
+}
+
+template<class BUFFER, class NetProvider>
+template <class F>
+typename Hedger<BUFFER, NetProvider>::Attempt
+Hedger<BUFFER, NetProvider>::send(size_t replica, F &encode)
+{
+	Replica &r = m_Replicas[replica];
+	if (++r.requests >= m_Opts.refresh_interval)
+		refreshDelay(r);
+	rid_t future = encode(*r.conn);
+	LatencyType type = latencyType(r.conn->requestType(future));
+	return {replica, future, r.delay_us[type]};
+}
+
+template<class BUFFER, class NetProvider>
+template <class F>
+std::optional<typename Hedger<BUFFER, NetProvider>::Result>
+Hedger<BUFFER, NetProvider>::request(F &&encode, int timeout)
+{
+	if (m_Replicas.empty()) {
+		m_Error = "No replicas to send request to";
+		return std::nullopt;
+	}
+	m_Requests++;
+	size_t first = m_Next;
+	m_Next = (m_Next + 1) % m_Replicas.size();
+	size_t max_attempts = std::min(m_Opts.max_hedges + 1,
+				       m_Replicas.size());
+	/* Few attempts are made, so they are kept on stack. */
+	tnt::SmallVector<Attempt, 4> attempts;
+	attempts.push_back(send(first, encode));
+	using Clock_t = std::chrono::steady_clock;
+	auto hedge_at = Clock_t::now() +
+		std::chrono::microseconds(attempts.back().delay_us);
+	Timer timer{timeout};
+	timer.start();
+	std::optional<Result> result;
+	size_t winner = SIZE_MAX;
+	while (!result) {
+		/* Attempts whose connections haven't failed. */
+		size_t alive = 0;
+		for (size_t i = 0; i < attempts.size(); i++) {
+			Connection_t &conn = *m_Replicas[attempts[i].replica].conn;
+			while (hasDataToDecode(conn)) {
+				if (decodeResponse(conn) != DECODE_SUCC)
+					break;
+			}
+			if (!conn.futureIsReady(attempts[i].future)) {
+				alive += !conn.status.is_failed;
+				continue;
+			}
+			result = Result{&conn, *conn.getResponse(attempts[i].future),
+					attempts.size()};
+			winner = i;
+			if (i != 0)
+				m_HedgeWins++;
+			break;
+		}
+		if (result)
+			break;
+		if (timeout != 0 && timer.isExpired()) {
+			m_Error = "Request has timed out";
+			break;
+		}
+		auto now = Clock_t::now();
+		/* Replica of the last attempt is dead: don't wait for it. */
+		bool is_last_failed =
+			m_Replicas[attempts.back().replica].conn->status.is_failed;
+		if (attempts.size() < max_attempts &&
+		    (now >= hedge_at || is_last_failed)) {
+			if (attempts.size() == 1)
+				m_Hedged++;
+			size_t replica = (first + attempts.size()) %
+					 m_Replicas.size();
+			attempts.push_back(send(replica, encode));
+			hedge_at = now + std::chrono::microseconds(
+				attempts.back().delay_us);
+			continue;
+		}
+		if (alive == 0) {
+			m_Error = "Connections to all replicas the request has "
+				  "been sent to have failed";
+			break;
+		}
+		/* Infinite if there's no timeout. */
+		Timeout_t wait = timer.left();
+		if (attempts.size() < max_attempts)
+			wait = std::min(wait, Timeout_t{hedge_at - now});
+		/*
+		 * Responses are decoded above: a round of network provider
+		 * returns on any event, including failure of a connection.
+		 */
+		m_Connector.poll(wait);
+	}
+	for (size_t i = 0; i < attempts.size(); i++) {
+		if (i != winner)
+			m_Replicas[attempts[i].replica].conn->discard(attempts[i].future);
+	}
+	return result;
+}
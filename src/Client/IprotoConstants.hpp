@@ -29,6 +29,7 @@
  * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
  * SUCH DAMAGE.
  */
+#include <cstdint>
 
 namespace Iproto {
 	enum {
@@ -49,6 +50,13 @@ namespace Iproto {
 		FLAG_COMMIT = 0x01,
 	};
 
+	/** Markers of xlog/snap tx blocks (stored in big endian). */
+	enum : uint32_t {
+		XLOG_ROW_MARKER = 0xd5ba0bab,
+		XLOG_ZROW_MARKER = 0xd5ba0bba,
+		XLOG_EOF_MARKER = 0xd510aded,
+	};
+
 	enum Key {
 		REQUEST_TYPE = 0x00,
 		SYNC = 0x01,
@@ -66,6 +74,7 @@ namespace Iproto {
 		OFFSET = 0x13,
 		ITERATOR = 0x14,
 		INDEX_BASE = 0x15,
+		FETCH_POSITION = 0x1f,
 		KEY = 0x20,
 		TUPLE = 0x21,
 		FUNCTION_NAME = 0x22,
@@ -78,11 +87,14 @@ namespace Iproto {
 		BALLOT = 0x29,
 		TUPLE_META = 0x2a,
 		OPTIONS = 0x2b,
+		AFTER_POSITION = 0x2e,
+		AFTER_TUPLE = 0x2f,
 		DATA = 0x30,
 		ERROR_24 = 0x31,
 		METADATA = 0x32,
 		BIND_METADATA = 0x33,
 		BIND_COUNT = 0x34,
+		POSITION = 0x35,
 		SQL_TEXT = 0x40,
 		SQL_BIND = 0x41,
 		SQL_INFO = 0x42,
@@ -90,6 +102,8 @@ namespace Iproto {
 		REPLICA_ANON = 0x50,
 		ID_FILTER = 0x51,
 		ERROR = 0x52,
+		EVENT_KEY = 0x57,
+		EVENT_DATA = 0x58,
 		KEY_MAX
 	};
 
@@ -128,6 +142,9 @@ namespace Iproto {
 		VOTE = 68,
 		FETCH_SNAPSHOT = 69,
 		REGISTER = 70,
+		WATCH = 74,
+		UNWATCH = 75,
+		EVENT = 76,
 		VY_INDEX_RUN_INFO = 100,
 		VY_INDEX_PAGE_INFO = 101,
 		VY_RUN_ROW_INDEX = 102,
@@ -0,0 +1,329 @@
+#pragma once
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "IprotoConstants.hpp"
+#include "../Utils/Histogram.hpp"
+
+/** Request types which latencies are accounted separately. */
+enum LatencyType {
+	LATENCY_PING = 0,
+	LATENCY_SELECT,
+	LATENCY_INSERT,
+	LATENCY_REPLACE,
+	LATENCY_UPDATE,
+	LATENCY_DELETE,
+	LATENCY_UPSERT,
+	LATENCY_CALL,
+	LATENCY_OTHER,
+	LATENCY_TYPE_MAX
+};
+
+static inline LatencyType
+latencyType(int request_type)
+{
+	switch (request_type) {
+		case Iproto::PING    : return LATENCY_PING;
+		case Iproto::SELECT  : return LATENCY_SELECT;
+		case Iproto::INSERT  : return LATENCY_INSERT;
+		case Iproto::REPLACE : return LATENCY_REPLACE;
+		case Iproto::UPDATE  : return LATENCY_UPDATE;
+		case Iproto::DELETE  : return LATENCY_DELETE;
+		case Iproto::UPSERT  : return LATENCY_UPSERT;
+		case Iproto::CALL    : return LATENCY_CALL;
+		default              : return LATENCY_OTHER;
+	}
+}
+
+static inline const char*
+latencyTypeToStr(LatencyType type)
+{
+	switch (type) {
+		case LATENCY_PING    : return "PING";
+		case LATENCY_SELECT  : return "SELECT";
+		case LATENCY_INSERT  : return "INSERT";
+		case LATENCY_REPLACE : return "REPLACE";
+		case LATENCY_UPDATE  : return "UPDATE";
+		case LATENCY_DELETE  : return "DELETE";
+		case LATENCY_UPSERT  : return "UPSERT";
+		case LATENCY_CALL    : return "CALL";
+		default              : return "OTHER";
+	}
+}
+
+/** Monotonic time in nanoseconds. */
+static inline uint64_t
+latencyClock()
+{
+	using namespace std::chrono;
+	return duration_cast<nanoseconds>(
+		steady_clock::now().time_since_epoch()).count();
+}
+
+/** Latencies are measured in nanoseconds: up to ~68 seconds, 6% error. */
+using LatencyHistogram_t = tnt::Histogram<4, 36>;
+using LatencyHistogramSnapshot_t = LatencyHistogram_t::Snapshot_t;
+
+/**
+ * Copy of latency histograms of one or several (after merge) connections.
+ */
+struct LatencySnapshot {
+	LatencyHistogramSnapshot_t types[LATENCY_TYPE_MAX];
+
+	void merge(const LatencySnapshot &other)
+	{
+		for (size_t i = 0; i < LATENCY_TYPE_MAX; i++)
+			types[i].merge(other.types[i]);
+	}
+	void reset()
+	{
+		for (size_t i = 0; i < LATENCY_TYPE_MAX; i++)
+			types[i].reset();
+	}
+	const LatencyHistogramSnapshot_t& operator[](LatencyType type) const
+	{
+		return types[type];
+	}
+	/** Histogram of all request types together. */
+	LatencyHistogramSnapshot_t total() const
+	{
+		LatencyHistogramSnapshot_t res;
+		for (size_t i = 0; i < LATENCY_TYPE_MAX; i++)
+			res.merge(types[i]);
+		return res;
+	}
+};
+
+/**
+ * Requests which are encoded but not answered yet. Entries are kept in
+ * a ring in order of encoding; since sync grows monotonically, the ring
+ * is sorted by sync, so a response is found with a single comparison
+ * (responses usually come in order) or with a binary search otherwise.
+ * A request which stays unanswered (e.g. a long CALL) doesn't hold the
+ * ring: when it's full of answered requests, the pending ones of its
+ * older half are moved to a sorted list of stragglers. So memory is
+ * allocated only when the count of requests in flight exceeds all
+ * previous values, and there's no allocations in steady state.
+ */
+class InflightRequests {
+public:
+	struct Entry {
+		size_t sync;
+		uint64_t start;
+		int type;
+		bool is_done;
+		/** Position of request in the output stream and its size. */
+		uint64_t offset;
+		size_t size;
+	};
+
+	void push(size_t sync, int type, uint64_t start, uint64_t offset = 0,
+		  size_t bytes = 0)
+	{
+		assert(size() == 0 || at(m_Tail - 1).sync < sync);
+		assert(m_Stragglers.empty() || m_Stragglers.back().sync < sync);
+		if (size() == m_Entries.size()) {
+			size_t ring_pending = m_Pending - m_Stragglers.size();
+			if (m_Entries.empty() || ring_pending * 2 > size())
+				grow();
+			else
+				evict();
+		}
+		at(m_Tail++) = {sync, start, type, false, offset, bytes};
+		m_Pending++;
+	}
+	/**
+	 * Find request with given sync, mark it as answered and return
+	 * pointer to its entry (valid until the next push() or complete()).
+	 * Return nullptr if there's no such request.
+	 */
+	Entry *complete(size_t sync)
+	{
+		Entry *e = find(sync);
+		if (e == nullptr)
+			return nullptr;
+		m_Pending--;
+		if (isStraggler(e)) {
+			m_Completed = *e;
+			m_Stragglers.erase(m_Stragglers.begin() +
+					   (e - m_Stragglers.data()));
+			return &m_Completed;
+		}
+		e->is_done = true;
+		while (m_Head != m_Tail && at(m_Head).is_done)
+			m_Head++;
+		return e;
+	}
+	/** Count of requests waiting for response. */
+	size_t pending() const { return m_Pending; }
+	/** Count of entries the ring can hold without growth. */
+	size_t capacity() const { return m_Entries.size(); }
+	/** Invoke @a f for each request waiting for response in sync order. */
+	template <class F>
+	void forEach(F &&f)
+	{
+		for (Entry &e : m_Stragglers)
+			f(e);
+		for (size_t pos = m_Head; pos != m_Tail; pos++) {
+			if (! at(pos).is_done)
+				f(at(pos));
+		}
+	}
+	/** Request with given sync waiting for response or nullptr. */
+	Entry *find(size_t sync)
+	{
+		if (! m_Stragglers.empty() && sync <= m_Stragglers.back().sync) {
+			auto itr = std::lower_bound(m_Stragglers.begin(),
+						    m_Stragglers.end(), sync,
+						    [](const Entry &e, size_t s) {
+							    return e.sync < s;
+						    });
+			if (itr == m_Stragglers.end() || itr->sync != sync)
+				return nullptr;
+			return &*itr;
+		}
+		if (empty())
+			return nullptr;
+		Entry &first = at(m_Head);
+		if (first.sync == sync)
+			return &first;
+		size_t lo = m_Head, hi = m_Tail;
+		while (lo < hi) {
+			size_t mid = lo + (hi - lo) / 2;
+			if (at(mid).sync < sync)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		if (lo == m_Tail || at(lo).sync != sync || at(lo).is_done)
+			return nullptr;
+		return &at(lo);
+	}
+
+private:
+	/** Count of entries including answered out of order. */
+	size_t size() const { return m_Tail - m_Head; }
+	bool empty() const { return m_Head == m_Tail; }
+	Entry &at(size_t pos) { return m_Entries[pos & (m_Entries.size() - 1)]; }
+	const Entry &at(size_t pos) const
+	{
+		return m_Entries[pos & (m_Entries.size() - 1)];
+	}
+	bool isStraggler(const Entry *e) const
+	{
+		return e >= m_Stragglers.data() &&
+		       e < m_Stragglers.data() + m_Stragglers.size();
+	}
+	void grow()
+	{
+		size_t new_cap = m_Entries.empty() ? INITIAL_CAPACITY :
+			     m_Entries.size() * 2;
+		std::vector<Entry> entries(new_cap);
+		size_t count = size();
+		for (size_t i = 0; i < count; i++)
+			entries[i] = at(m_Head + i);
+		m_Entries.swap(entries);
+		m_Head = 0;
+		m_Tail = count;
+	}
+	/** Free the older half of the ring moving pending requests away. */
+	void evict()
+	{
+		size_t end = m_Head + m_Entries.size() / 2;
+		for (; m_Head != end; m_Head++) {
+			if (! at(m_Head).is_done)
+				m_Stragglers.push_back(at(m_Head));
+		}
+		while (m_Head != m_Tail && at(m_Head).is_done)
+			m_Head++;
+	}
+
+	static constexpr size_t INITIAL_CAPACITY = 64;
+	/** Capacity is always a power of two. */
+	std::vector<Entry> m_Entries;
+	size_t m_Head = 0;
+	size_t m_Tail = 0;
+	size_t m_Pending = 0;
+	/** Pending requests older than the ones in the ring, by sync. */
+	std::vector<Entry> m_Stragglers;
+	/** Copy of the last completed straggler. */
+	Entry m_Completed;
+};
+
+/**
+ * Per connection latency accounting: time is measured from the moment
+ * request is encoded till its response is decoded. It takes one clock
+ * read on each side and no dynamic memory in steady state.
+ * Histograms can be read by other threads via snapshot().
+ */
+class LatencyStat {
+public:
+	void requestEncoded(size_t sync, int type, uint64_t offset = 0,
+			    size_t size = 0)
+	{
+		m_Inflight.push(sync, type, latencyClock(), offset, size);
+	}
+	void responseDecoded(size_t sync)
+	{
+		InflightRequests::Entry *e = m_Inflight.complete(sync);
+		if (e == nullptr)
+			return;
+		uint64_t now = latencyClock();
+		LatencyType type = latencyType(e->type);
+		m_Histograms[type].record(now > e->start ? now - e->start : 0);
+	}
+	/** Request has got no response (e.g. connection is lost). */
+	void requestFailed(size_t sync) { m_Inflight.complete(sync); }
+	/** Requests waiting for response. */
+	InflightRequests &inflightRequests() { return m_Inflight; }
+	/** Add histograms to @a snap. */
+	void snapshot(LatencySnapshot &snap) const
+	{
+		for (size_t i = 0; i < LATENCY_TYPE_MAX; i++)
+			m_Histograms[i].snapshot(snap.types[i]);
+	}
+	/** Count of requests waiting for response. */
+	size_t inflight() const { return m_Inflight.pending(); }
+	void reset()
+	{
+		for (size_t i = 0; i < LATENCY_TYPE_MAX; i++)
+			m_Histograms[i].reset();
+	}
+
+private:
+	InflightRequests m_Inflight;
+	LatencyHistogram_t m_Histograms[LATENCY_TYPE_MAX];
+};
@@ -38,13 +38,20 @@
 #include <string>
 #include <string_view>
 
+/*
+ * libev headers must go first: they include <stddef.h>, which would
+ * restore the offsetof() overridden by NetworkEngine.hpp and rlist.h.
+ */
+#include "ev.h"
+
+#include "AddressCache.hpp"
 #include "Connection.hpp"
 #include "Connector.hpp"
 #include "NetworkEngine.hpp"
+#include "Tracer.hpp"
 #include "../Utils/rlist.h"
-#include "ev.h"
 
-template<class BUFFER, class NETWORK>
+template<class BUFFER, class NetProvider>
 class Connector;
 
 struct WaitWatcher {
@@ -62,10 +69,14 @@ timerDisable(struct ev_loop *loop, struct ev_timer *timer)
 		ev_timer_stop(loop, timer);
 }
 
-template<class BUFFER, class NETWORK>
+/**
+ * @tparam TRACER compile-time tracer policy, see NoopTracer.
+ */
+template<class BUFFER, class NETWORK, class TRACER = NoopTracer>
 class LibevNetProvider {
 public:
-	using NetProvider_t = LibevNetProvider<BUFFER, NETWORK>;
+	using NetProvider_t = LibevNetProvider<BUFFER, NETWORK, TRACER>;
+	using Tracer_t = TRACER;
 	using Conn_t = Connection<BUFFER, NetProvider_t >;
 
 	LibevNetProvider(struct ev_loop *loop = nullptr);
@@ -73,18 +84,51 @@ public:
 		    size_t timeout);
 	void close(Conn_t &conn);
 	void readyToSend(Conn_t &conn);
+	/** Zero @a timeout (ms) is a non-blocking poll. */
 	int wait(int timeout);
+	/**
+	 * Zero @a timeout is a non-blocking poll, TIMEOUT_INFINITE is the
+	 * default timeout.
+	 */
+	int wait(Timeout_t timeout);
 	bool check(Conn_t &conn);
+	/** Set TCP keepalive options of the connection socket. */
+	int setKeepalive(Conn_t &conn, const KeepaliveOptions &opts);
+	/** Set SO_BUSY_POLL of the connection socket. */
+	int setBusyPoll(Conn_t &conn, unsigned usec);
+	/**
+	 * Send pending requests right away on the calling thread (unless
+	 * the socket is blocked). Return -1 if the connection has failed.
+	 */
+	int sendNow(Conn_t &conn);
+	/**
+	 * Single non-blocking receive without polling. Return count of
+	 * received bytes, 0 if there's no data or -1 on error: the
+	 * connection is closed then, whatever the error is.
+	 */
+	int recvNow(Conn_t &conn);
+	/** Time to live of resolved addresses, ms; 0 disables the cache. */
+	void setAddressTtl(unsigned ttl) { m_Addresses.setTtl(ttl); }
+	const AddressCache<NETWORK> &addresses() const { return m_Addresses; }
 
 	~LibevNetProvider();
 
+	/**
+	 * Loop iterations (as epoll_wait() calls) and watcher start/stop
+	 * calls (as epoll_ctl() ones).
+	 */
+	NetProviderCounters counters;
+
 private:
-	static constexpr float MILLISECONDS = 1000.f;
+	static constexpr size_t DEFAULT_TIMEOUT = 100;
+	/** Max size of data received by one recvNow(). */
+	static constexpr size_t RECV_NOW_SIZE = 4096;
 
 	int registerWatchers(Conn_t *conn, int fd);
 	void releaseWatchers(int fd);
 
 	std::map<int, WaitWatcher *> m_Watchers;
+	AddressCache<NETWORK> m_Addresses;
 	struct ev_loop *m_Loop;
 	struct ev_timer m_TimeoutWatcher;
 
@@ -92,22 +136,23 @@ private:
 	bool m_IsOwnLoop;
 };
 
-template<class BUFFER, class NETWORK>
+template<class BUFFER, class NETWORK, class TRACER>
 void
-LibevNetProvider<BUFFER, NETWORK>::releaseWatchers(int fd)
+LibevNetProvider<BUFFER, NETWORK, TRACER>::releaseWatchers(int fd)
 {
 	assert(fd >= 0);
 	assert(m_Watchers.find(fd) != m_Watchers.end());
 	struct WaitWatcher *watcher = m_Watchers[fd];
 	ev_io_stop(m_Loop, &watcher->in);
 	ev_io_stop(m_Loop, &watcher->out);
+	counters.epoll_ctl_calls.add(2);
 	free(watcher);
 	m_Watchers.erase(fd);
 }
 
-template<class BUFFER, class NETWORK>
+template<class BUFFER, class NETWORK, class TRACER>
 static inline int
-connectionReceive(Connection<BUFFER,  LibevNetProvider<BUFFER, NETWORK>> &conn)
+connectionReceive(Connection<BUFFER,  LibevNetProvider<BUFFER, NETWORK, TRACER>> &conn)
 {
 	assert(! conn.status.is_failed);
 	size_t total = NETWORK::readyToRecv(conn.socket);
@@ -116,27 +161,41 @@ connectionReceive(Connection<BUFFER,  LibevNetProvider<BUFFER, NETWORK>> &conn)
 			  strerror(errno));
 		return -1;
 	}
+	if (total == 0) {
+		LOG_DEBUG("Socket ", conn.socket, " has no data to read");
+		if (NETWORK::isClosedByPeer(conn.socket)) {
+			conn.setError("Connection is closed by peer");
+			return -1;
+		}
+		return 1;
+	}
 	size_t iov_cnt = 0;
 	struct iovec *iov =
 		inBufferToIOV(conn, total, &iov_cnt);
 	int read_bytes = NETWORK::recvall(conn.socket, iov, iov_cnt, true);
-	hasNotRecvBytes(conn, total - read_bytes);
+	/* Failed call has read nothing: return the whole reserved space. */
+	hasNotRecvBytes(conn, total - (read_bytes > 0 ? read_bytes : 0));
+	conn.counters.recvmsg_calls.add();
+	if (read_bytes > 0)
+		traceEvent<TRACER>(TRACE_RECV, conn.socket, 0, read_bytes);
 	if (read_bytes < 0) {
 		if (netWouldBlock(errno)) {
+			conn.counters.eagain.add();
 			return 1;
 		}
 		conn.setError(std::string("Failed to receive response: ") +
 			       strerror(errno));
 		return -1;
 	}
+	conn.counters.bytes_recv.add(read_bytes);
 	return total - read_bytes;
 }
 
-template<class BUFFER, class NETWORK>
+template<class BUFFER, class NETWORK, class TRACER>
 static void
 recv_cb(struct ev_loop *loop, struct ev_io *watcher, int /* revents */)
 {
-	using NetProvider_t = LibevNetProvider<BUFFER, NETWORK>;
+	using NetProvider_t = LibevNetProvider<BUFFER, NETWORK, TRACER>;
 	struct WaitWatcher *waitWatcher =
 		reinterpret_cast<WaitWatcher *>(watcher->data);
 	assert(&waitWatcher->in == watcher);
@@ -156,20 +215,27 @@ recv_cb(struct ev_loop *loop, struct ev_io *watcher, int /* revents */)
 		conn->readyToDecode();
 }
 
-template<class BUFFER, class NETWORK>
+template<class BUFFER, class NETWORK, class TRACER>
 static inline int
-connectionSend(Connection<BUFFER,  LibevNetProvider<BUFFER, NETWORK>> &conn)
+connectionSend(Connection<BUFFER,  LibevNetProvider<BUFFER, NETWORK, TRACER>> &conn)
 {
 	assert(! conn.status.is_failed);
 	while (hasDataToSend(conn)) {
 		size_t sent_bytes = 0;
+		size_t calls = 0;
 		size_t iov_cnt = 0;
 		struct iovec *iov = outBufferToIOV(conn, &iov_cnt);
 		int rc = NETWORK::sendall(conn.socket, iov, iov_cnt,
-					  &sent_bytes);
+					  &sent_bytes, &calls);
+		if (sent_bytes > 0)
+			traceEvent<TRACER>(TRACE_SEND, conn.socket, 0, sent_bytes);
 		hasSentBytes(conn, sent_bytes);
+		conn.counters.sendmsg_calls.add(calls);
+		if (calls > 1)
+			conn.counters.partial_writes.add(calls - 1);
 		if (rc != 0) {
 			if (netWouldBlock(errno)) {
+				conn.counters.eagain.add();
 				conn.status.is_send_blocked = true;
 				return 1;
 			}
@@ -182,22 +248,25 @@ connectionSend(Connection<BUFFER,  LibevNetProvider<BUFFER, NETWORK>> &conn)
 	return 0;
 }
 
-template<class BUFFER, class NETWORK>
+template<class BUFFER, class NETWORK, class TRACER>
 static void
 send_cb(struct ev_loop *loop, struct ev_io *watcher, int /* revents */)
 {
-	using NetProvider_t = LibevNetProvider<BUFFER, NETWORK>;
+	using NetProvider_t = LibevNetProvider<BUFFER, NETWORK, TRACER>;
 	struct WaitWatcher *waitWatcher =
 		reinterpret_cast<struct WaitWatcher *>(watcher->data);
 	assert(&waitWatcher->out == watcher);
 	Connection<BUFFER, NetProvider_t> *conn =
 		reinterpret_cast<Connection<BUFFER, NetProvider_t> *>(waitWatcher->connection);
 	assert(watcher->fd == conn->socket);
-	timerDisable(loop, waitWatcher->timer);
+	/*
+	 * Don't disable the wait timer: sent requests don't end the
+	 * wait, otherwise it would block till any data arrives.
+	 */
+	NetProvider_t *provider =
+		reinterpret_cast<NetProvider_t *>(waitWatcher->provider);
 	int rc = connectionSend(*conn);
 	if (rc < 0) {
-		NetProvider_t *provider =
-			reinterpret_cast<NetProvider_t *>(waitWatcher->provider) ;
 		provider->close(*conn);
 		return;
 	}
@@ -205,6 +274,7 @@ send_cb(struct ev_loop *loop, struct ev_io *watcher, int /* revents */)
 		/* Send is not complete, setting the write watcher. */
 		LOG_DEBUG("Send is not complete, setting the write watcher");
 		ev_io_start(loop, watcher);
+		provider->counters.epoll_ctl_calls.add();
 		return;
 	}
 	/*
@@ -213,12 +283,14 @@ send_cb(struct ev_loop *loop, struct ev_io *watcher, int /* revents */)
 	 * receive responses from that socket.
 	 */
 	assert(rc == 0);
-	if (ev_is_active(watcher))
+	if (ev_is_active(watcher)) {
 		ev_io_stop(loop, watcher);
+		provider->counters.epoll_ctl_calls.add();
+	}
 }
 
-template<class BUFFER, class NETWORK>
-LibevNetProvider<BUFFER, NETWORK>::LibevNetProvider(struct ev_loop *loop) :
+template<class BUFFER, class NETWORK, class TRACER>
+LibevNetProvider<BUFFER, NETWORK, TRACER>::LibevNetProvider(struct ev_loop *loop) :
 	m_Loop(loop), m_IsOwnLoop(false)
 {
 	if (m_Loop == nullptr) {
@@ -230,8 +302,8 @@ LibevNetProvider<BUFFER, NETWORK>::LibevNetProvider(struct ev_loop *loop) :
 	rlist_create(&m_ready_to_write);
 }
 
-template<class BUFFER, class NETWORK>
-LibevNetProvider<BUFFER, NETWORK>::~LibevNetProvider()
+template<class BUFFER, class NETWORK, class TRACER>
+LibevNetProvider<BUFFER, NETWORK, TRACER>::~LibevNetProvider()
 {
 	for (auto &w : m_Watchers) {
 		releaseWatchers(w.first);
@@ -242,9 +314,9 @@ LibevNetProvider<BUFFER, NETWORK>::~LibevNetProvider()
 	m_Loop = nullptr;
 }
 
-template<class BUFFER, class NETWORK>
+template<class BUFFER, class NETWORK, class TRACER>
 int
-LibevNetProvider<BUFFER, NETWORK>::registerWatchers(Conn_t *conn, int fd)
+LibevNetProvider<BUFFER, NETWORK, TRACER>::registerWatchers(Conn_t *conn, int fd)
 {
 	WaitWatcher *watcher = (WaitWatcher *) calloc(1, sizeof(WaitWatcher));
 	if (watcher == nullptr) {
@@ -257,24 +329,34 @@ LibevNetProvider<BUFFER, NETWORK>::registerWatchers(Conn_t *conn, int fd)
 	watcher->timer = &m_TimeoutWatcher;
 	watcher->connection = conn;
 	watcher->provider = this;
-	ev_io_init(&watcher->in, (&recv_cb<BUFFER, NETWORK>), fd, EV_READ);
-	ev_io_init(&watcher->out, (&send_cb<BUFFER, NETWORK>), fd, EV_WRITE);
+	ev_io_init(&watcher->in, (&recv_cb<BUFFER, NETWORK, TRACER>), fd, EV_READ);
+	ev_io_init(&watcher->out, (&send_cb<BUFFER, NETWORK, TRACER>), fd, EV_WRITE);
 
 	m_Watchers.insert({fd, watcher});
 	ev_io_start(m_Loop, &watcher->in);
 	ev_io_start(m_Loop ,&watcher->out);
+	counters.epoll_ctl_calls.add(2);
 	return 0;
 }
 
-template<class BUFFER, class NETWORK>
+template<class BUFFER, class NETWORK, class TRACER>
 int
-LibevNetProvider<BUFFER, NETWORK>::connect(Conn_t &conn,
+LibevNetProvider<BUFFER, NETWORK, TRACER>::connect(Conn_t &conn,
 					   const std::string_view& addr,
 					   unsigned port, size_t timeout)
 {
 	int socket = -1;
-	socket = port == 0 ? NETWORK::connectUNIX(addr) :
-		 NETWORK::connectINET(addr, port, timeout);
+	if (port == 0) {
+		socket = NETWORK::connectUNIX(addr);
+	} else {
+		const std::vector<SockAddr> *addrs =
+			m_Addresses.resolve(addr, port);
+		size_t winner = 0;
+		if (addrs != nullptr)
+			socket = NETWORK::connectINET(*addrs, timeout, &winner);
+		if (socket >= 0)
+			m_Addresses.promote(addr, port, winner);
+	}
 	if (socket < 0) {
 		conn.setError(std::string("Failed to establish connection to ") +
 			      std::string(addr));
@@ -286,13 +368,17 @@ LibevNetProvider<BUFFER, NETWORK>::connect(Conn_t &conn,
 	struct iovec *iov = inBufferToIOV(conn, Iproto::GREETING_SIZE, &iov_cnt);
 	LOG_DEBUG("Receiving greetings...");
 	int read_bytes = NETWORK::recvall(socket, iov, iov_cnt, false);
+	conn.counters.recvmsg_calls.add();
 	if (read_bytes < 0) {
 		conn.setError(std::string("Failed to receive greetings: ") +
 			      strerror(errno));
+		/* Release the space so the next attempt starts clean. */
+		hasNotRecvBytes(conn, Iproto::GREETING_SIZE);
 		::close(socket);
 		return -1;
 	}
 	LOG_DEBUG("Greetings are received, read bytes ", read_bytes);
+	conn.counters.bytes_recv.add(read_bytes);
 	if (decodeGreeting(conn) != 0) {
 		conn.setError(std::string("Failed to decode greetings"));
 		::close(socket);
@@ -310,20 +396,24 @@ LibevNetProvider<BUFFER, NETWORK>::connect(Conn_t &conn,
 	return 0;
 }
 
-template<class BUFFER, class NETWORK>
+template<class BUFFER, class NETWORK, class TRACER>
 void
-LibevNetProvider<BUFFER, NETWORK>::close(Conn_t &conn)
+LibevNetProvider<BUFFER, NETWORK, TRACER>::close(Conn_t &conn)
 {
 	NETWORK::close(conn.socket);
 	if (conn.socket >= 0) {
 		releaseWatchers(conn.socket);
 	}
 	conn.socket = -1;
+	/* Unsent data stays in the buffer till the next connect. */
+	rlist_del(&conn.m_in_write);
+	conn.status.is_ready_to_send = false;
+	conn.status.is_send_blocked = false;
 }
 
-template<class BUFFER, class NETWORK>
+template<class BUFFER, class NETWORK, class TRACER>
 void
-LibevNetProvider<BUFFER, NETWORK>::readyToSend(Conn_t &conn)
+LibevNetProvider<BUFFER, NETWORK, TRACER>::readyToSend(Conn_t &conn)
 {
 	if (conn.status.is_send_blocked)
 		return;
@@ -346,13 +436,29 @@ timeout_cb(EV_P_ ev_timer *w, int /* revents */)
 	ev_break(EV_A_ EVBREAK_ONE);
 }
 
-template<class BUFFER, class NETWORK>
+template<class BUFFER, class NETWORK, class TRACER>
 int
-LibevNetProvider<BUFFER, NETWORK>::wait(int timeout)
+LibevNetProvider<BUFFER, NETWORK, TRACER>::wait(int timeout)
 {
 	assert(timeout >= 0);
-	ev_timer_init(&m_TimeoutWatcher, &timeout_cb, timeout / MILLISECONDS, 0 /* repeat */);
-	ev_timer_start(m_Loop, &m_TimeoutWatcher);
+	return wait(Timeout_t{std::chrono::milliseconds(timeout)});
+}
+
+template<class BUFFER, class NETWORK, class TRACER>
+int
+LibevNetProvider<BUFFER, NETWORK, TRACER>::wait(Timeout_t timeout)
+{
+	assert(timeout >= Timeout_t{0});
+	if (timeout == TIMEOUT_INFINITE)
+		timeout = std::chrono::milliseconds(DEFAULT_TIMEOUT);
+	/* The timer is still active if the previous wait ended by send. */
+	ev_timer_stop(m_Loop, &m_TimeoutWatcher);
+	if (timeout != Timeout_t{0}) {
+		ev_timer_init(&m_TimeoutWatcher, &timeout_cb,
+			      std::chrono::duration<double>(timeout).count(),
+			      0 /* repeat */);
+		ev_timer_start(m_Loop, &m_TimeoutWatcher);
+	}
 	/* Queue pending connections to be send. */
 	if (! rlist_empty(&m_ready_to_write)) {
 		Connection<BUFFER, LibevNetProvider> *conn;
@@ -363,13 +469,14 @@ LibevNetProvider<BUFFER, NETWORK>::wait(int timeout)
 				ev_feed_event(m_Loop, &w->second->out, EV_WRITE);
 		}
 	}
-	ev_run(m_Loop, EVRUN_ONCE);
+	counters.epoll_wait_calls.add();
+	ev_run(m_Loop, timeout == Timeout_t{0} ? EVRUN_NOWAIT : EVRUN_ONCE);
 	return 0;
 }
 
-template<class BUFFER, class NETWORK>
+template<class BUFFER, class NETWORK, class TRACER>
 bool
-LibevNetProvider<BUFFER, NETWORK>::check(Conn_t &connection)
+LibevNetProvider<BUFFER, NETWORK, TRACER>::check(Conn_t &connection)
 {
 	int error = 0;
 	socklen_t len = sizeof(error);
@@ -384,3 +491,88 @@ LibevNetProvider<BUFFER, NETWORK>::check(Conn_t &connection)
 	}
 	return true;
 }
+
+template<class BUFFER, class NETWORK, class TRACER>
+int
+LibevNetProvider<BUFFER, NETWORK, TRACER>::setKeepalive(Conn_t &conn,
+						const KeepaliveOptions &opts)
+{
+	if (NETWORK::setKeepalive(conn.socket, opts.idle, opts.interval,
+				  opts.count, opts.user_timeout) != 0) {
+		conn.setError(std::string("Failed to set keepalive: ") +
+			      strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+template<class BUFFER, class NETWORK, class TRACER>
+int
+LibevNetProvider<BUFFER, NETWORK, TRACER>::setBusyPoll(Conn_t &conn, unsigned usec)
+{
+	if (NETWORK::setBusyPoll(conn.socket, usec) != 0) {
+		conn.setError(std::string("Failed to set busy poll: ") +
+			      strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+template<class BUFFER, class NETWORK, class TRACER>
+int
+LibevNetProvider<BUFFER, NETWORK, TRACER>::sendNow(Conn_t &conn)
+{
+	assert(! conn.status.is_failed);
+	if (conn.status.is_send_blocked)
+		return 0;
+	int rc = connectionSend(conn);
+	if (rc < 0) {
+		close(conn);
+		return -1;
+	}
+	if (rc > 0) {
+		/* The rest is sent by the write watcher. */
+		auto w = m_Watchers.find(conn.socket);
+		assert(w != m_Watchers.end());
+		ev_io_start(m_Loop, &w->second->out);
+		counters.epoll_ctl_calls.add();
+	}
+	return 0;
+}
+
+template<class BUFFER, class NETWORK, class TRACER>
+int
+LibevNetProvider<BUFFER, NETWORK, TRACER>::recvNow(Conn_t &conn)
+{
+	assert(! conn.status.is_failed);
+	/*
+	 * Size of data isn't known without extra ioctl(), and reserving
+	 * space in the input buffer may cross its block, so receive to a
+	 * scratch buffer: responses of this mode are small.
+	 */
+	char buf[RECV_NOW_SIZE];
+	struct iovec iov = {buf, sizeof(buf)};
+	int read_bytes = NETWORK::recvall(conn.socket, &iov, 1, true);
+	conn.counters.recvmsg_calls.add();
+	if (read_bytes > 0) {
+		size_t iov_cnt = 0;
+		struct iovec *vecs = inBufferToIOV(conn, read_bytes, &iov_cnt);
+		for (size_t i = 0, pos = 0; i < iov_cnt; pos += vecs[i++].iov_len)
+			memcpy(vecs[i].iov_base, buf + pos, vecs[i].iov_len);
+		traceEvent<TRACER>(TRACE_RECV, conn.socket, 0, read_bytes);
+		conn.counters.bytes_recv.add(read_bytes);
+		return read_bytes;
+	}
+	if (read_bytes == 0) {
+		conn.setError("Connection is closed by peer");
+		close(conn);
+		return -1;
+	}
+	/* Spinning caller makes lots of empty reads: they aren't EAGAINs. */
+	if (netWouldBlock(errno))
+		return 0;
+	conn.setError(std::string("Failed to receive response: ") +
+		      strerror(errno));
+	close(conn);
+	return -1;
+}
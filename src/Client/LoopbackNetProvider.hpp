@@ -0,0 +1,487 @@
+#pragma once
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <assert.h>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "Connection.hpp"
+#include "Connector.hpp"
+#include "IprotoConstants.hpp"
+#include "Tracer.hpp"
+#include "../Utils/Timer.hpp"
+#include "../Utils/rlist.h"
+
+template<class BUFFER, class NetProvider>
+class Connector;
+
+/**
+ * In-process iproto server of LoopbackNetProvider: it answers requests
+ * with canned bodies right away, without parsing their bodies. By
+ * default responses of PING and AUTH have empty body, WATCH and UNWATCH
+ * have no response and the rest of requests get empty IPROTO_DATA.
+ */
+class LoopbackResponder {
+public:
+	LoopbackResponder();
+	/**
+	 * Set raw msgpack map @a body of responses to requests of @a type.
+	 * Requests with empty body are left without response.
+	 */
+	void setBody(int type, std::string body);
+	/** Write greeting (Iproto::GREETING_SIZE bytes) to @a out. */
+	void greeting(char *out) const;
+	/**
+	 * Append responses to complete requests from @a data to @a out.
+	 * Return size of the requests (the rest is an incomplete one) or
+	 * -1 if @a data is malformed.
+	 */
+	ssize_t respond(const char *data, size_t size, std::string &out);
+	/** Count of answered requests. */
+	size_t requests() const { return m_Requests; }
+
+private:
+	static constexpr size_t TYPE_MAX = Iproto::CHUNK;
+	/** Size of MP_UINT32 length of request and response. */
+	static constexpr size_t LENGTH_SIZE = 5;
+
+	static bool decodeUint(const char *&pos, const char *end,
+			       uint64_t &value);
+
+	std::vector<std::string> m_Bodies;
+	size_t m_Requests = 0;
+};
+
+inline
+LoopbackResponder::LoopbackResponder() : m_Bodies(TYPE_MAX, "\x81\x30\x90")
+{
+	m_Bodies[Iproto::PING] = "\x80";
+	m_Bodies[Iproto::AUTH] = "\x80";
+	m_Bodies[Iproto::WATCH].clear();
+	m_Bodies[Iproto::UNWATCH].clear();
+}
+
+inline void
+LoopbackResponder::setBody(int type, std::string body)
+{
+	assert(type >= 0 && (size_t) type < TYPE_MAX);
+	m_Bodies[type] = std::move(body);
+}
+
+inline void
+LoopbackResponder::greeting(char *out) const
+{
+	std::string line1 = "Tarantool 2.11.0 (Binary) "
+			    "00000000-0000-0000-0000-000000000000";
+	std::string line2(Iproto::GREETING_MAX_SALT_SIZE - 1, 'A');
+	line2.push_back('=');
+	line1.resize(Iproto::GREETING_LINE1_SIZE - 1, ' ');
+	line2.resize(Iproto::GREETING_LINE2_SIZE - 1, ' ');
+	memcpy(out, (line1 + "\n" + line2 + "\n").data(),
+	       Iproto::GREETING_SIZE);
+}
+
+inline bool
+LoopbackResponder::decodeUint(const char *&pos, const char *end,
+			      uint64_t &value)
+{
+	if (pos >= end)
+		return false;
+	uint8_t tag = *pos++;
+	size_t size;
+	if (tag <= 0x7f) {
+		value = tag;
+		return true;
+	} else if (tag == 0xcc) {
+		size = 1;
+	} else if (tag == 0xcd) {
+		size = 2;
+	} else if (tag == 0xce) {
+		size = 4;
+	} else if (tag == 0xcf) {
+		size = 8;
+	} else {
+		return false;
+	}
+	if ((size_t)(end - pos) < size)
+		return false;
+	value = 0;
+	for (size_t i = 0; i < size; i++)
+		value = (value << 8) | (uint8_t) pos[i];
+	pos += size;
+	return true;
+}
+
+inline ssize_t
+LoopbackResponder::respond(const char *data, size_t size, std::string &out)
+{
+	const char *pos = data;
+	const char *end = data + size;
+	while ((size_t)(end - pos) >= LENGTH_SIZE) {
+		if ((uint8_t) pos[0] != 0xce)
+			return -1;
+		uint32_t length;
+		memcpy(&length, pos + 1, sizeof(length));
+		length = __builtin_bswap32(length);
+		if ((size_t)(end - pos) - LENGTH_SIZE < length)
+			break;
+		const char *header = pos + LENGTH_SIZE;
+		const char *request_end = header + length;
+		if (header == request_end || ((uint8_t) *header & 0xf0) != 0x80)
+			return -1;
+		size_t keys = (uint8_t) *header++ & 0x0f;
+		uint64_t type = UINT64_MAX;
+		uint64_t sync = 0;
+		for (size_t i = 0; i < keys; i++) {
+			uint64_t key, value;
+			if (! decodeUint(header, request_end, key) ||
+			    ! decodeUint(header, request_end, value))
+				return -1;
+			if (key == Iproto::REQUEST_TYPE)
+				type = value;
+			else if (key == Iproto::SYNC)
+				sync = value;
+		}
+		pos = request_end;
+		const std::string &body =
+			m_Bodies[type < TYPE_MAX ? type : (uint64_t) Iproto::SELECT];
+		if (body.empty())
+			continue;
+		/* Header {REQUEST_TYPE: OK, SYNC: sync, SCHEMA_VERSION: 1}. */
+		char head[] = "\xce\0\0\0\0" "\x83" "\x00\x00"
+			      "\x01\xcf\0\0\0\0\0\0\0\0" "\x05\x01";
+		constexpr size_t head_size = sizeof(head) - 1;
+		uint32_t response_size =
+			__builtin_bswap32(head_size - LENGTH_SIZE + body.size());
+		memcpy(head + 1, &response_size, sizeof(response_size));
+		uint64_t sync_be = __builtin_bswap64(sync);
+		memcpy(head + 10, &sync_be, sizeof(sync_be));
+		out.append(head, head_size);
+		out.append(body);
+		m_Requests++;
+	}
+	return pos - data;
+}
+
+/**
+ * Network provider without network: requests are handed to in-process
+ * RESPONDER (see LoopbackResponder) and its responses are put to the
+ * input buffer of connection, so only client's own CPU cost is left:
+ * encoding, scheduling and decoding. Any address can be connected.
+ * Responses of requests sent are received by the next wait() or
+ * recvNow(); wait() without any of them sleeps as polling of idle
+ * sockets would.
+ * @tparam TRACER compile-time tracer policy, see NoopTracer.
+ */
+template<class BUFFER, class RESPONDER = LoopbackResponder,
+	 class TRACER = NoopTracer>
+class LoopbackNetProvider {
+public:
+	using NetProvider_t = LoopbackNetProvider<BUFFER, RESPONDER, TRACER>;
+	using Tracer_t = TRACER;
+	using Conn_t = Connection<BUFFER, NetProvider_t >;
+	LoopbackNetProvider();
+	~LoopbackNetProvider();
+	int connect(Conn_t &conn, const std::string_view& addr, unsigned port,
+		    size_t timeout);
+	void close(Conn_t &conn);
+	/** Add to @m_ready_to_write*/
+	void readyToSend(Conn_t &conn);
+	/** Hand requests to the responder and receive its responses. */
+	int wait(int timeout);
+	int wait(Timeout_t timeout);
+	bool check(Conn_t &conn);
+	/** There are no sockets: do nothing. */
+	int setKeepalive(Conn_t &conn, const KeepaliveOptions &opts);
+	int setBusyPoll(Conn_t &conn, unsigned usec);
+	/** Hand pending requests to the responder right away. */
+	int sendNow(Conn_t &conn);
+	/** Receive responses of @a conn. Return their size. */
+	int recvNow(Conn_t &conn);
+	/** Nothing is resolved. */
+	void setAddressTtl(unsigned ttl) { (void) ttl; }
+	/** Server side of all the connections. */
+	RESPONDER &responder() { return m_Responder; }
+
+	/** wait() calls (as epoll_wait() ones). */
+	NetProviderCounters counters;
+private:
+	static constexpr size_t DEFAULT_TIMEOUT = 100;
+
+	/** Server side of connection. */
+	struct Peer {
+		Conn_t *conn;
+		/** Incomplete request. */
+		std::string in;
+		/** Responses not received yet. */
+		std::string out;
+	};
+
+	void send(Conn_t &conn);
+	size_t recv(Peer &peer);
+
+	RESPONDER m_Responder;
+	/** <socket : peer> map, sockets are just unique numbers. */
+	std::unordered_map<int, Peer> m_Peers;
+	/** Sockets having responses to receive. */
+	std::vector<int> m_ready_to_read;
+	rlist m_ready_to_write;
+	int m_NextSocket = 0;
+};
+
+template<class BUFFER, class RESPONDER, class TRACER>
+LoopbackNetProvider<BUFFER, RESPONDER, TRACER>::LoopbackNetProvider()
+{
+	rlist_create(&m_ready_to_write);
+}
+
+template<class BUFFER, class RESPONDER, class TRACER>
+LoopbackNetProvider<BUFFER, RESPONDER, TRACER>::~LoopbackNetProvider()
+{
+	assert(rlist_empty(&m_ready_to_write));
+}
+
+template<class BUFFER, class RESPONDER, class TRACER>
+int
+LoopbackNetProvider<BUFFER, RESPONDER, TRACER>::connect(Conn_t &conn,
+					const std::string_view& addr,
+					unsigned port, size_t timeout)
+{
+	(void) port;
+	(void) timeout;
+	int socket = m_NextSocket++;
+	LOG_DEBUG("Connected to ", addr, ", socket is ", socket);
+	char greeting[Iproto::GREETING_SIZE];
+	m_Responder.greeting(greeting);
+	size_t iov_cnt = 0;
+	struct iovec *iov =
+		inBufferToIOV(conn, Iproto::GREETING_SIZE, &iov_cnt);
+	for (size_t i = 0, pos = 0; i < iov_cnt; pos += iov[i++].iov_len)
+		memcpy(iov[i].iov_base, greeting + pos, iov[i].iov_len);
+	conn.counters.bytes_recv.add(Iproto::GREETING_SIZE);
+	if (decodeGreeting(conn) != 0) {
+		conn.setError(std::string("Failed to decode greetings"));
+		return -1;
+	}
+	conn.socket = socket;
+	m_Peers[socket].conn = &conn;
+	return 0;
+}
+
+template<class BUFFER, class RESPONDER, class TRACER>
+void
+LoopbackNetProvider<BUFFER, RESPONDER, TRACER>::close(Conn_t &conn)
+{
+	LOG_DEBUG("Closed connection to socket ", conn.socket);
+	/* Responses not received yet are lost as in the case of socket. */
+	m_Peers.erase(conn.socket);
+	conn.socket = -1;
+	/* Unsent data stays in the buffer till the next connect. */
+	rlist_del(&conn.m_in_write);
+	conn.status.is_ready_to_send = false;
+	conn.status.is_send_blocked = false;
+}
+
+template<class BUFFER, class RESPONDER, class TRACER>
+void
+LoopbackNetProvider<BUFFER, RESPONDER, TRACER>::readyToSend(Conn_t &conn)
+{
+	if (! rlist_empty(&conn.m_in_write))
+		return;
+	rlist_add_tail(&m_ready_to_write, &conn.m_in_write);
+	conn.status.is_ready_to_send = true;
+}
+
+template<class BUFFER, class RESPONDER, class TRACER>
+void
+LoopbackNetProvider<BUFFER, RESPONDER, TRACER>::send(Conn_t &conn)
+{
+	assert(! conn.status.is_failed);
+	Peer &peer = m_Peers.at(conn.socket);
+	bool had_responses = ! peer.out.empty();
+	while (hasDataToSend(conn)) {
+		size_t iov_cnt = 0;
+		struct iovec *iov = outBufferToIOV(conn, &iov_cnt);
+		size_t sent_bytes = 0;
+		ssize_t rc;
+		if (iov_cnt == 1 && peer.in.empty()) {
+			/* Fast path: requests are in one block. */
+			sent_bytes = iov[0].iov_len;
+			rc = m_Responder.respond((const char *) iov[0].iov_base,
+						 sent_bytes, peer.out);
+			if (rc >= 0)
+				peer.in.assign((const char *) iov[0].iov_base + rc,
+					       sent_bytes - rc);
+		} else {
+			for (size_t i = 0; i < iov_cnt; i++) {
+				peer.in.append((const char *) iov[i].iov_base,
+					       iov[i].iov_len);
+				sent_bytes += iov[i].iov_len;
+			}
+			rc = m_Responder.respond(peer.in.data(), peer.in.size(),
+						 peer.out);
+			if (rc >= 0)
+				peer.in.erase(0, rc);
+		}
+		traceEvent<TRACER>(TRACE_SEND, conn.socket, 0, sent_bytes);
+		hasSentBytes(conn, sent_bytes);
+		conn.counters.sendmsg_calls.add();
+		LOG_DEBUG("send ", sent_bytes, " bytes to the ", conn.socket, " socket");
+		if (rc < 0) {
+			conn.setError("Failed to send request: "
+				      "malformed request");
+			close(conn);
+			return;
+		}
+	}
+	if (! had_responses && ! peer.out.empty())
+		m_ready_to_read.push_back(conn.socket);
+}
+
+template<class BUFFER, class RESPONDER, class TRACER>
+size_t
+LoopbackNetProvider<BUFFER, RESPONDER, TRACER>::recv(Peer &peer)
+{
+	Conn_t &conn = *peer.conn;
+	size_t total = peer.out.size();
+	size_t done = 0;
+	/* IOVs of input buffer may cover less than requested. */
+	while (done < total) {
+		size_t iov_cnt = 0;
+		struct iovec *iov = inBufferToIOV(conn, total - done, &iov_cnt);
+		size_t copied = 0;
+		for (size_t i = 0; i < iov_cnt; i++) {
+			memcpy(iov[i].iov_base, peer.out.data() + done + copied,
+			       iov[i].iov_len);
+			copied += iov[i].iov_len;
+		}
+		hasNotRecvBytes(conn, total - done - copied);
+		done += copied;
+	}
+	peer.out.clear();
+	conn.counters.recvmsg_calls.add();
+	conn.counters.bytes_recv.add(total);
+	traceEvent<TRACER>(TRACE_RECV, conn.socket, 0, total);
+	LOG_DEBUG("read ", total, " bytes from ", conn.socket, " socket");
+	return total;
+}
+
+template<class BUFFER, class RESPONDER, class TRACER>
+int
+LoopbackNetProvider<BUFFER, RESPONDER, TRACER>::wait(int timeout)
+{
+	assert(timeout >= 0);
+	return wait(timeoutFromMs(timeout));
+}
+
+template<class BUFFER, class RESPONDER, class TRACER>
+int
+LoopbackNetProvider<BUFFER, RESPONDER, TRACER>::wait(Timeout_t timeout)
+{
+	assert(timeout >= Timeout_t{0});
+	counters.epoll_wait_calls.add();
+	if (!rlist_empty(&m_ready_to_write)) {
+		Conn_t *conn, *tmp;
+		rlist_foreach_entry_safe(conn, &m_ready_to_write, m_in_write, tmp) {
+			send(*conn);
+		}
+	}
+	if (m_ready_to_read.empty()) {
+		if (timeout == TIMEOUT_INFINITE)
+			timeout = std::chrono::milliseconds(DEFAULT_TIMEOUT);
+		std::this_thread::sleep_for(timeout);
+		return 0;
+	}
+	for (int socket : m_ready_to_read) {
+		auto peer = m_Peers.find(socket);
+		/* Responses may be received by recvNow() or lost by close(). */
+		if (peer == m_Peers.end() || peer->second.out.empty())
+			continue;
+		recv(peer->second);
+		peer->second.conn->readyToDecode();
+	}
+	m_ready_to_read.clear();
+	return 0;
+}
+
+template<class BUFFER, class RESPONDER, class TRACER>
+bool
+LoopbackNetProvider<BUFFER, RESPONDER, TRACER>::check(Conn_t &conn)
+{
+	return m_Peers.count(conn.socket) != 0;
+}
+
+template<class BUFFER, class RESPONDER, class TRACER>
+int
+LoopbackNetProvider<BUFFER, RESPONDER, TRACER>::setKeepalive(Conn_t &conn,
+						const KeepaliveOptions &opts)
+{
+	(void) conn;
+	(void) opts;
+	return 0;
+}
+
+template<class BUFFER, class RESPONDER, class TRACER>
+int
+LoopbackNetProvider<BUFFER, RESPONDER, TRACER>::setBusyPoll(Conn_t &conn,
+							    unsigned usec)
+{
+	(void) conn;
+	(void) usec;
+	return 0;
+}
+
+template<class BUFFER, class RESPONDER, class TRACER>
+int
+LoopbackNetProvider<BUFFER, RESPONDER, TRACER>::sendNow(Conn_t &conn)
+{
+	assert(! conn.status.is_failed);
+	send(conn);
+	return conn.status.is_failed ? -1 : 0;
+}
+
+template<class BUFFER, class RESPONDER, class TRACER>
+int
+LoopbackNetProvider<BUFFER, RESPONDER, TRACER>::recvNow(Conn_t &conn)
+{
+	assert(! conn.status.is_failed);
+	auto peer = m_Peers.find(conn.socket);
+	if (peer == m_Peers.end())
+		return -1;
+	if (peer->second.out.empty())
+		return 0;
+	return recv(peer->second);
+}
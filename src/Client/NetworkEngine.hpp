@@ -36,13 +36,16 @@
 #include <cstring>
 #include <string>
 #include <string_view>
+#include <vector>
+#include <chrono>
 
 #include <stdlib.h>
 #include <sys/ioctl.h>
-#include <sys/select.h>
+#include <poll.h>
 #include <sys/uio.h>
 #include <sys/un.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -61,6 +64,12 @@ struct Socket {
 	int fd;
 };
 
+/** Resolved address of peer. */
+struct SockAddr {
+	struct sockaddr_storage addr;
+	socklen_t len;
+};
+
 struct ConnectionEvent {
 	int sock;
 	uint32_t event;
@@ -83,28 +92,63 @@ netWouldBlock(int err)
 
 class NetworkEngine {
 public:
+	/** Delay of the next connection attempt (RFC 8305), ms. */
+	static constexpr int CONNECT_ATTEMPT_DELAY = 250;
+
 	static int connectINET(const std::string_view& addr_str, unsigned port,
 			       size_t timeout);
+	/**
+	 * Happy eyeballs: connect to @a addrs in parallel, starting
+	 * attempts one by one with @a delay (ms) or right after the
+	 * previous one fails. The first established connection wins and
+	 * index of its address is set to @a winner.
+	 */
+	static int connectINET(const std::vector<SockAddr> &addrs,
+			       size_t timeout, size_t *winner = nullptr,
+			       int delay = CONNECT_ATTEMPT_DELAY);
+	/**
+	 * Resolve @a addr_str of any address family. Families alternate
+	 * in @a addrs, starting with the preferred one.
+	 */
+	static int resolve(const std::string_view& addr_str, unsigned port,
+			   std::vector<SockAddr> &addrs);
 	static int connectUNIX(const std::string_view& path);
 	static void close(int socket);
 
 	static int send(int socket, struct iovec *iov, size_t iov_len);
+	/**
+	 * Send the whole iov, @a sent_bytes is set to count of sent bytes
+	 * and @a calls - to count of sendmsg() calls. Every call except
+	 * the last one has written only part of data.
+	 */
 	static int sendall(int socket, struct iovec *iov, size_t iov_len,
-			   size_t *sent_bytes);
+			   size_t *sent_bytes, size_t *calls);
 	static int recv(int socket, struct iovec *iov, size_t iov_len);
 	static int recvall(int socket, struct iovec *iov, size_t iov_len,
 			   bool dont_wait);
 	static size_t readyToRecv(int socket);
+	/** Socket is readable but has no data: peer has closed it. */
+	static bool isClosedByPeer(int socket);
+	/**
+	 * Enable TCP keepalive probes: the first one after @a idle seconds
+	 * of silence, then each @a interval seconds, @a count in total.
+	 * Non-zero @a user_timeout (ms) limits time sent data may remain
+	 * unacknowledged. Unix sockets are left intact.
+	 */
+	static int setKeepalive(int socket, int idle, int interval, int count,
+				unsigned user_timeout);
+	/** Busy poll the device queue for @a usec on blocking receive. */
+	static int setBusyPoll(int socket, unsigned usec);
 };
 
 inline int
-NetworkEngine::connectINET(const std::string_view& addr_str, unsigned port,
-			   size_t timeout)
+NetworkEngine::resolve(const std::string_view& addr_str, unsigned port,
+		       std::vector<SockAddr> &addrs)
 {
 	struct addrinfo hints, *res;
 	memset(&hints, 0, sizeof(hints));
 	hints.ai_socktype = SOCK_STREAM;
-	hints.ai_family = AF_INET;
+	hints.ai_family = AF_UNSPEC;
 	std::string service = std::to_string(port);
 	int err = getaddrinfo(std::string(addr_str).c_str(), service.c_str(),
 			      &hints, &res);
@@ -112,55 +156,131 @@ NetworkEngine::connectINET(const std::string_view& addr_str, unsigned port,
 		LOG_ERROR("getaddrinfo() failed: ", gai_strerror(err));
 		return -1;
 	}
-	Socket soc(socket(res->ai_family, res->ai_socktype, res->ai_protocol));
-	if (soc.fd < 0) {
-		LOG_ERROR("Failed to create socket: ", strerror(errno));
-		freeaddrinfo(res);
-		return -1;
+	std::vector<SockAddr> first, second;
+	for (struct addrinfo *ai = res; ai != nullptr; ai = ai->ai_next) {
+		SockAddr sa;
+		memcpy(&sa.addr, ai->ai_addr, ai->ai_addrlen);
+		sa.len = ai->ai_addrlen;
+		if (ai->ai_family == res->ai_family)
+			first.push_back(sa);
+		else
+			second.push_back(sa);
 	}
-	/* Set socket to non-blocking mode*/
-	if (fcntl(soc.fd, F_SETFL, O_NONBLOCK) != 0) {
-		LOG_ERROR("fcntl failed: ", strerror(errno));
-		freeaddrinfo(res);
-		return -1;
-	}
-	::connect(soc.fd, res->ai_addr, res->ai_addrlen);
 	freeaddrinfo(res);
-	/*
-	 * Now let's use select to timeout connect call. Once socket becomes
-	 * writable - connection is established.
-	 */
-	fd_set fdset;
-	struct timeval tv;
-	FD_ZERO(&fdset);
-	FD_SET(soc.fd, &fdset);
-	tv.tv_sec = timeout;
-	tv.tv_usec = 0;
-	int rc = select(soc.fd + 1, NULL, &fdset, NULL, &tv);
-	if (rc == -1) {
-		LOG_ERROR("select() failed: ", strerror(errno));
-		return -1;
+	addrs.clear();
+	for (size_t i = 0; i < first.size() || i < second.size(); i++) {
+		if (i < first.size())
+			addrs.push_back(first[i]);
+		if (i < second.size())
+			addrs.push_back(second[i]);
 	}
-	if (rc == 0) {
-		LOG_ERROR("connect() is timed out! Waited for ",
-			  timeout, " seconds");
-		return -1;
-	}
-	assert(rc == 1);
-	int so_error;
-	socklen_t len = sizeof(so_error);
-	if (getsockopt(soc.fd, SOL_SOCKET, SO_ERROR, &so_error, &len) != 0) {
-		LOG_ERROR("getsockopt() failed: ", strerror(errno));
-		return -1;
-	}
-	if (so_error != 0) {
-		LOG_ERROR("connect() failed: ", strerror(so_error));
+	return 0;
+}
+
+inline int
+NetworkEngine::connectINET(const std::string_view& addr_str, unsigned port,
+			   size_t timeout)
+{
+	std::vector<SockAddr> addrs;
+	if (resolve(addr_str, port, addrs) != 0)
 		return -1;
+	return connectINET(addrs, timeout);
+}
+
+inline int
+NetworkEngine::connectINET(const std::vector<SockAddr> &addrs,
+			   size_t timeout, size_t *winner, int delay)
+{
+	using namespace std::chrono;
+	auto deadline = steady_clock::now() + seconds(timeout);
+	auto next_attempt = steady_clock::now();
+	/* Attempts in progress and indexes of their addresses. */
+	std::vector<struct pollfd> pfds;
+	std::vector<size_t> indexes;
+	auto drop = [&](size_t i) {
+		::close(pfds[i].fd);
+		pfds.erase(pfds.begin() + i);
+		indexes.erase(indexes.begin() + i);
+		/* Don't wait for the delay: start the next one right away. */
+		next_attempt = steady_clock::now();
+	};
+	size_t next = 0;
+	int sock = -1;
+	while (sock < 0) {
+		auto now = steady_clock::now();
+		while (next < addrs.size() && now >= next_attempt) {
+			const SockAddr &sa = addrs[next++];
+			int fd = socket(sa.addr.ss_family, SOCK_STREAM, 0);
+			if (fd < 0) {
+				LOG_ERROR("Failed to create socket: ",
+					  strerror(errno));
+				continue;
+			}
+			/* Set socket to non-blocking mode*/
+			if (fcntl(fd, F_SETFL, O_NONBLOCK) != 0) {
+				LOG_ERROR("fcntl failed: ", strerror(errno));
+				::close(fd);
+				continue;
+			}
+			if (::connect(fd, (struct sockaddr *) &sa.addr,
+				      sa.len) != 0 && errno != EINPROGRESS) {
+				LOG_DEBUG("connect() failed: ", strerror(errno));
+				::close(fd);
+				continue;
+			}
+			pfds.push_back({fd, POLLOUT, 0});
+			indexes.push_back(next - 1);
+			next_attempt = now + milliseconds(delay);
+		}
+		/* Attempts are started till one is in progress. */
+		if (pfds.empty()) {
+			LOG_ERROR("connect() failed: no address is reachable");
+			return -1;
+		}
+		if (now >= deadline) {
+			LOG_ERROR("connect() is timed out! Waited for ",
+				  timeout, " seconds");
+			break;
+		}
+		/*
+		 * Now let's use poll to timeout connect calls. Once socket
+		 * becomes writable - connection is established.
+		 */
+		auto wake = next < addrs.size() ?
+			    std::min(deadline, next_attempt) : deadline;
+		int wait = duration_cast<milliseconds>(wake - now).count();
+		int rc = poll(pfds.data(), pfds.size(), std::max(wait, 0));
+		if (rc == -1 && errno != EINTR) {
+			LOG_ERROR("poll() failed: ", strerror(errno));
+			break;
+		}
+		for (size_t i = pfds.size(); rc > 0 && i-- > 0; ) {
+			if (pfds[i].revents == 0)
+				continue;
+			int so_error;
+			socklen_t len = sizeof(so_error);
+			if (getsockopt(pfds[i].fd, SOL_SOCKET, SO_ERROR,
+				       &so_error, &len) != 0)
+				so_error = errno;
+			if (so_error != 0) {
+				LOG_DEBUG("connect() failed: ",
+					  strerror(so_error));
+				drop(i);
+				continue;
+			}
+			sock = pfds[i].fd;
+			if (winner != nullptr)
+				*winner = indexes[i];
+			pfds.erase(pfds.begin() + i);
+			break;
+		}
 	}
-	if (fcntl(soc.fd, F_SETFL, O_NONBLOCK) != 0) {
-		LOG_ERROR("fcntl() failed: ", strerror(errno));
+	/* Attempts which have lost the race. */
+	for (struct pollfd &pfd : pfds)
+		::close(pfd.fd);
+	if (sock < 0)
 		return -1;
-	}
+	Socket soc(sock);
 	/* Set to blocking mode again...*/
 	int flags = fcntl(soc.fd, F_GETFL, NULL);
 	if (flags < 0) {
@@ -172,7 +292,6 @@ NetworkEngine::connectINET(const std::string_view& addr_str, unsigned port,
 		LOG_ERROR("fcntl() failed: ", strerror(errno));
 		return -1;
 	}
-	int sock = soc.fd;
 	soc.fd = -1;
 	return sock;
 }
@@ -213,7 +332,7 @@ NetworkEngine::send(int socket, struct iovec *iov, size_t iov_len)
 
 inline int
 NetworkEngine::sendall(int socket, struct iovec *iov, size_t iov_len,
-		       size_t *sent_bytes)
+		       size_t *sent_bytes, size_t *calls)
 {
 	struct msghdr msg;
 	memset(&msg, 0, sizeof(msg));
@@ -222,9 +341,11 @@ NetworkEngine::sendall(int socket, struct iovec *iov, size_t iov_len,
 
 	int flags = MSG_DONTWAIT;
 	*sent_bytes = 0;
+	*calls = 0;
 	size_t total_sz = IOVCountBytes(iov, iov_len);
 	while (*sent_bytes < total_sz) {
 		int rc = sendmsg(socket, &msg, flags);
+		++*calls;
 		if (rc == -1)
 			return -1;
 		*sent_bytes += rc;
@@ -282,3 +403,50 @@ NetworkEngine::readyToRecv(int socket)
 		return -1;
 	return bytes;
 }
+
+inline int
+NetworkEngine::setKeepalive(int socket, int idle, int interval, int count,
+			    unsigned user_timeout)
+{
+	struct sockaddr_storage addr;
+	socklen_t len = sizeof(addr);
+	if (getsockname(socket, (struct sockaddr *)&addr, &len) != 0)
+		return -1;
+	if (addr.ss_family == AF_UNIX)
+		return 0;
+	int one = 1;
+	if (setsockopt(socket, SOL_SOCKET, SO_KEEPALIVE, &one,
+		       sizeof(one)) != 0 ||
+	    setsockopt(socket, IPPROTO_TCP, TCP_KEEPIDLE, &idle,
+		       sizeof(idle)) != 0 ||
+	    setsockopt(socket, IPPROTO_TCP, TCP_KEEPINTVL, &interval,
+		       sizeof(interval)) != 0 ||
+	    setsockopt(socket, IPPROTO_TCP, TCP_KEEPCNT, &count,
+		       sizeof(count)) != 0)
+		return -1;
+	if (user_timeout != 0 &&
+	    setsockopt(socket, IPPROTO_TCP, TCP_USER_TIMEOUT, &user_timeout,
+		       sizeof(user_timeout)) != 0)
+		return -1;
+	return 0;
+}
+
+inline int
+NetworkEngine::setBusyPoll(int socket, unsigned usec)
+{
+#ifdef SO_BUSY_POLL
+	return setsockopt(socket, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec));
+#else
+	(void) socket;
+	(void) usec;
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
+
+inline bool
+NetworkEngine::isClosedByPeer(int socket)
+{
+	char c;
+	return ::recv(socket, &c, 1, MSG_PEEK | MSG_DONTWAIT) == 0;
+}
@@ -0,0 +1,373 @@
+#pragma once
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <cassert>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Connector.hpp"
+#include "RowDecoder.hpp"
+#include "Vclock.hpp"
+
+struct ReplicationOptions {
+	/** UUID the consumer introduces itself with; it is mandatory. */
+	std::string instance_uuid;
+	/** Expected UUID of server's replica set; empty - not checked. */
+	std::string replicaset_uuid;
+	/** Anonymous replica isn't registered in server's replica set. */
+	bool anonymous = true;
+	/** Max count of rows passed to the handler at once. */
+	size_t batch_size = 1024;
+};
+
+/**
+ * Consumer of replication stream for change data capture. It connects
+ * to server as a replica: after JOIN or SUBSCRIBE server sends rows with
+ * no requests, they are decoded in batches and passed to a handler.
+ * Rows aren't copied: tuples point into the input buffer which is not
+ * flushed until the rows are consumed. The socket isn't read while there
+ * are unconsumed rows, so a slow handler throttles server by means of
+ * TCP flow control instead of accumulating the stream in memory.
+ * Position of consumed rows is acknowledged on each server heartbeat and
+ * can be passed to subscribe() in order to resume the stream after
+ * reconnect.
+ */
+template<class BUFFER, class NetProvider = DefaultNetProvider<BUFFER, NetworkEngine>>
+class ReplicationStream {
+public:
+	using Row_t = Row<BUFFER>;
+	using Connector_t = Connector<BUFFER, NetProvider>;
+	using Connection_t = Connection<BUFFER, NetProvider>;
+
+	enum State {
+		/** Neither JOIN nor SUBSCRIBE has been sent. */
+		IDLE,
+		/** JOIN is sent, waiting for vclock of the snapshot. */
+		JOIN_WAIT,
+		/** Receiving rows of the snapshot. */
+		JOIN_INITIAL,
+		/** Receiving rows written during the initial join. */
+		JOIN_FINAL,
+		/** All rows of the join are received. */
+		JOINED,
+		SUBSCRIBED,
+		FAILED
+	};
+
+	explicit ReplicationStream(const ReplicationOptions &opts = ReplicationOptions{});
+	~ReplicationStream() = default;
+	ReplicationStream(const ReplicationStream& stream) = delete;
+	ReplicationStream& operator = (const ReplicationStream& stream) = delete;
+
+	int connect(const std::string_view& addr, unsigned port,
+		    size_t timeout = Connector_t::DEFAULT_CONNECT_TIMEOUT);
+	/** Fetch the whole data set: snapshot and rows written meanwhile. */
+	int join();
+	/** Stream rows following @a from: those which aren't covered by it. */
+	int subscribe(const Vclock &from);
+	/**
+	 * Receive and decode rows and pass them to @a handler which is
+	 * invoked as size_t handler(Row_t *rows, size_t count) and returns
+	 * count of consumed rows. Rows which are not consumed are passed
+	 * again by the next call. Network is waited for @a timeout ms
+	 * (0 - network provider's default) only if there are no rows.
+	 * Return count of consumed rows, -1 on error.
+	 */
+	template <class HANDLER>
+	int poll(HANDLER &&handler, int timeout = 0);
+	/** Send position of consumed rows to the server. */
+	void ack();
+
+	/** Position of consumed rows. */
+	const Vclock& vclock() const { return m_Vclock; }
+	/** Position of the server as far as it is known. */
+	const Vclock& serverVclock() const { return m_ServerVclock; }
+	State state() const { return m_State; }
+	std::string& getError() { return m_Conn.getError(); }
+	Connection_t& connection() { return m_Conn; }
+
+private:
+	int decodeRows();
+	int processServiceRow(const Row_t &row);
+	void releaseRows();
+	void send(size_t size);
+	void setFailed(const std::string &msg);
+
+	Connector_t m_Connector;
+	Connection_t m_Conn;
+	RowDecoder<BUFFER> m_Decoder;
+	ReplicationOptions m_Opts;
+	/** Decoded rows; the first m_Consumed of them are consumed. */
+	std::vector<Row_t> m_Rows;
+	size_t m_Consumed = 0;
+	Vclock m_Vclock;
+	Vclock m_ServerVclock;
+	State m_State = IDLE;
+};
+
+template<class BUFFER, class NetProvider>
+ReplicationStream<BUFFER, NetProvider>::ReplicationStream(const ReplicationOptions &opts) :
+	m_Connector(), m_Conn(m_Connector), m_Decoder(m_Conn.m_InBuf),
+	m_Opts(opts)
+{
+	assert(m_Opts.batch_size > 0);
+	m_Rows.reserve(m_Opts.batch_size);
+}
+
+template<class BUFFER, class NetProvider>
+int
+ReplicationStream<BUFFER, NetProvider>::connect(const std::string_view& addr,
+						unsigned port, size_t timeout)
+{
+	if (m_Connector.connect(m_Conn, addr, port, timeout) != 0)
+		return -1;
+	m_State = IDLE;
+	return 0;
+}
+
+template<class BUFFER, class NetProvider>
+void
+ReplicationStream<BUFFER, NetProvider>::send(size_t size)
+{
+	m_Conn.m_EndEncoded += size;
+	m_Conn.counters.requests.add();
+	m_Conn.updateBufferStat();
+	m_Connector.readyToSend(m_Conn);
+}
+
+template<class BUFFER, class NetProvider>
+void
+ReplicationStream<BUFFER, NetProvider>::setFailed(const std::string &msg)
+{
+	LOG_ERROR("Replication stream has failed: ", msg);
+	m_Conn.setError(msg);
+	m_State = FAILED;
+}
+
+template<class BUFFER, class NetProvider>
+int
+ReplicationStream<BUFFER, NetProvider>::join()
+{
+	if (m_State != IDLE) {
+		LOG_ERROR("JOIN is allowed only right after connect");
+		return -1;
+	}
+	if (m_Opts.instance_uuid.empty()) {
+		LOG_ERROR("Instance UUID is not set");
+		return -1;
+	}
+	send(m_Conn.m_Encoder.encodeJoin(m_Opts.instance_uuid));
+	m_State = JOIN_WAIT;
+	return 0;
+}
+
+template<class BUFFER, class NetProvider>
+int
+ReplicationStream<BUFFER, NetProvider>::subscribe(const Vclock &from)
+{
+	if (m_State != IDLE && m_State != JOINED) {
+		LOG_ERROR("SUBSCRIBE is allowed after connect or join");
+		return -1;
+	}
+	if (m_Opts.instance_uuid.empty()) {
+		LOG_ERROR("Instance UUID is not set");
+		return -1;
+	}
+	m_Vclock = from;
+	send(m_Conn.m_Encoder.encodeSubscribe(m_Opts.instance_uuid,
+					      m_Opts.replicaset_uuid, from,
+					      m_Opts.anonymous));
+	m_State = SUBSCRIBED;
+	return 0;
+}
+
+template<class BUFFER, class NetProvider>
+void
+ReplicationStream<BUFFER, NetProvider>::ack()
+{
+	if (m_State != SUBSCRIBED)
+		return;
+	send(m_Conn.m_Encoder.encodeVclock(m_Vclock));
+}
+
+template<class BUFFER, class NetProvider>
+int
+ReplicationStream<BUFFER, NetProvider>::processServiceRow(const Row_t &row)
+{
+	if ((row.header.type & Iproto::TYPE_ERROR) != 0) {
+		if (row.body.error_stack == std::nullopt) {
+			setFailed("Server has sent error " +
+			     std::to_string(row.header.type & ~Iproto::TYPE_ERROR));
+		} else {
+			const Error &e = row.body.error_stack->error;
+			setFailed(std::string(e.msg, std::min(e.msg_len, sizeof(e.msg))));
+		}
+		return -1;
+	}
+	assert(row.header.type == Iproto::OK);
+	switch (m_State) {
+		case JOIN_WAIT:
+			/* Response to JOIN: vclock of the snapshot. */
+			if (row.body.has_vclock)
+				m_ServerVclock = m_Decoder.vclock();
+			m_State = JOIN_INITIAL;
+			break;
+		case JOIN_INITIAL:
+			m_State = JOIN_FINAL;
+			break;
+		case JOIN_FINAL:
+			/* All the rows till the join vclock are consumed. */
+			if (row.body.has_vclock) {
+				m_Vclock = m_Decoder.vclock();
+				m_ServerVclock = m_Vclock;
+			}
+			m_State = JOINED;
+			break;
+		case SUBSCRIBED:
+			if (row.body.has_vclock) {
+				/* Response to SUBSCRIBE. */
+				m_ServerVclock = m_Decoder.vclock();
+			} else {
+				/* Heartbeat: server waits for an ack. */
+				ack();
+			}
+			break;
+		default:
+			setFailed("Unexpected row of type " +
+			     std::to_string(row.header.type));
+			return -1;
+	}
+	return 0;
+}
+
+template<class BUFFER, class NetProvider>
+int
+ReplicationStream<BUFFER, NetProvider>::decodeRows()
+{
+	Connection_t &conn = m_Conn;
+	while (m_Rows.size() < m_Opts.batch_size && hasDataToDecode(conn)) {
+		/* Even the size of row may be received partially. */
+		if (! conn.m_InBuf.has(conn.m_EndDecoded, MP_RESPONSE_SIZE))
+			break;
+		m_Decoder.reset(conn.m_EndDecoded);
+		int64_t size = m_Decoder.decodeRowSize();
+		if (size < 0) {
+			setFailed("Failed to decode row size");
+			return -1;
+		}
+		size += MP_RESPONSE_SIZE;
+		if (! conn.m_InBuf.has(conn.m_EndDecoded, size))
+			break;
+		iterator_t<BUFFER> end = conn.m_EndDecoded + size;
+		Row_t &row = m_Rows.emplace_back();
+		if (m_Decoder.decodeRow(row, end) != 0) {
+			m_Rows.pop_back();
+			setFailed("Failed to decode row");
+			return -1;
+		}
+		row.size = size;
+		bool is_service = row.header.type == Iproto::OK ||
+				  (row.header.type & Iproto::TYPE_ERROR) != 0;
+		if (is_service) {
+			/*
+			 * Service rows take effect on the consumed
+			 * position, so they are processed only after
+			 * all the previous rows are consumed.
+			 */
+			if (m_Rows.size() > 1) {
+				m_Rows.pop_back();
+				break;
+			}
+			int rc = processServiceRow(row);
+			m_Rows.pop_back();
+			if (rc != 0)
+				return -1;
+		} else {
+			m_ServerVclock.follow(row.header.replica_id,
+					      row.header.lsn);
+		}
+		conn.m_EndDecoded += size;
+		conn.counters.responses.add();
+	}
+	if (! hasDataToDecode(conn) && ! rlist_empty(&conn.m_in_read)) {
+		conn.status.is_ready_to_decode = false;
+		rlist_del(&conn.m_in_read);
+	}
+	return 0;
+}
+
+template<class BUFFER, class NetProvider>
+void
+ReplicationStream<BUFFER, NetProvider>::releaseRows()
+{
+	m_Rows.clear();
+	m_Consumed = 0;
+	/* Nothing but the decoders points to received data now. */
+	m_Decoder.reset(m_Conn.m_EndDecoded);
+	m_Conn.m_Decoder.reset(m_Conn.m_EndDecoded);
+	m_Conn.m_InBuf.flush();
+	m_Conn.updateBufferStat();
+}
+
+template<class BUFFER, class NetProvider>
+template <class HANDLER>
+int
+ReplicationStream<BUFFER, NetProvider>::poll(HANDLER &&handler, int timeout)
+{
+	if (m_State == FAILED)
+		return -1;
+	if (m_Consumed == m_Rows.size()) {
+		releaseRows();
+		if (decodeRows() != 0)
+			return -1;
+		if (m_Rows.empty()) {
+			if (m_Connector.poll(timeout) != 0 ||
+			    m_Conn.status.is_failed) {
+				setFailed("Failed to receive rows: " +
+				     m_Conn.getError());
+				return -1;
+			}
+			if (decodeRows() != 0)
+				return -1;
+		}
+	}
+	size_t count = m_Rows.size() - m_Consumed;
+	if (count == 0)
+		return 0;
+	Row_t *rows = m_Rows.data() + m_Consumed;
+	size_t consumed = handler(rows, count);
+	assert(consumed <= count);
+	for (size_t i = 0; i < consumed; i++)
+		m_Vclock.follow(rows[i].header.replica_id, rows[i].header.lsn);
+	m_Consumed += consumed;
+	return consumed;
+}
@@ -34,6 +34,7 @@
 #include <map>
 
 #include "IprotoConstants.hpp"
+#include "Vclock.hpp"
 #include "../mpp/mpp.hpp"
 #include "../Utils/Logger.hpp"
 
@@ -65,6 +66,9 @@ public:
 	RequestEncoder& operator = (const RequestEncoder& encoder) = delete;
 
 	size_t encodePing();
+	/** chap-sha1 authentication with precomputed @a scramble. */
+	size_t encodeAuth(const std::string &user,
+			  const char scramble[Iproto::SCRAMBLE_SIZE]);
 	template <class T>
 	size_t encodeInsert(const T &tuple, uint32_t space_id);
 	template <class T>
@@ -82,8 +86,27 @@ public:
 			    uint32_t index_id = 0,
 			    uint32_t limit = UINT32_MAX, uint32_t offset = 0,
 			    IteratorType iterator = EQ);
+	/**
+	 * SELECT of tuples following @a after_position (from the start of
+	 * iteration if it's empty) which asks server to return position
+	 * of the last selected tuple. Supported since Tarantool 2.11.
+	 */
+	template <class T>
+	size_t encodeSelectAfter(const T &key, uint32_t space_id,
+				 uint32_t index_id, uint32_t limit,
+				 IteratorType iterator,
+				 const std::string &after_position);
 	template <class T>
 	size_t encodeCall(const std::string &func, const T &args);
+	size_t encodeJoin(const std::string &instance_uuid);
+	size_t encodeSubscribe(const std::string &instance_uuid,
+			       const std::string &replicaset_uuid,
+			       const Vclock &vclock, bool anonymous);
+	/** Acknowledge the replication position @a vclock. */
+	size_t encodeVclock(const Vclock &vclock);
+	/** Subscribe to (or acknowledge an event of) box.broadcast() key. */
+	size_t encodeWatch(const std::string &key);
+	size_t encodeUnwatch(const std::string &key);
 
 	/** Sync value is used as request id. */
 	static size_t getSync() { return sync; }
@@ -119,6 +142,25 @@ RequestEncoder<BUFFER>::encodePing()
 	return request_size + PREHEADER_SIZE;
 }
 
+template<class BUFFER>
+size_t
+RequestEncoder<BUFFER>::encodeAuth(const std::string &user,
+				   const char scramble[Iproto::SCRAMBLE_SIZE])
+{
+	iterator_t<BUFFER> request_start = m_Buf.end();
+	m_Buf.addBack('\xce');
+	m_Buf.addBack(uint32_t{0});
+	encodeHeader(Iproto::AUTH);
+	std::string_view scramble_view(scramble, Iproto::SCRAMBLE_SIZE);
+	m_Enc.add(mpp::as_map(std::forward_as_tuple(
+		MPP_AS_CONST(Iproto::USER_NAME), user,
+		MPP_AS_CONST(Iproto::TUPLE),
+		std::make_tuple("chap-sha1", mpp::as_bin(scramble_view)))));
+	uint32_t request_size = (m_Buf.end() - request_start) - PREHEADER_SIZE;
+	m_Buf.set(request_start + 1, __builtin_bswap32(request_size));
+	return request_size + PREHEADER_SIZE;
+}
+
 template<class BUFFER>
 template <class T>
 size_t
@@ -236,6 +278,41 @@ RequestEncoder<BUFFER>::encodeSelect(const T &key,
 	return request_size + PREHEADER_SIZE;
 }
 
+template<class BUFFER>
+template <class T>
+size_t
+RequestEncoder<BUFFER>::encodeSelectAfter(const T &key,
+					  uint32_t space_id, uint32_t index_id,
+					  uint32_t limit, IteratorType iterator,
+					  const std::string &after_position)
+{
+	iterator_t<BUFFER> request_start = m_Buf.end();
+	m_Buf.addBack('\xce');
+	m_Buf.addBack(uint32_t{0});
+	encodeHeader(Iproto::SELECT);
+	if (after_position.empty()) {
+		m_Enc.add(mpp::as_map(std::forward_as_tuple(
+			MPP_AS_CONST(Iproto::SPACE_ID), space_id,
+			MPP_AS_CONST(Iproto::INDEX_ID), index_id,
+			MPP_AS_CONST(Iproto::LIMIT), limit,
+			MPP_AS_CONST(Iproto::ITERATOR), iterator,
+			MPP_AS_CONST(Iproto::KEY), key,
+			MPP_AS_CONST(Iproto::FETCH_POSITION), true)));
+	} else {
+		m_Enc.add(mpp::as_map(std::forward_as_tuple(
+			MPP_AS_CONST(Iproto::SPACE_ID), space_id,
+			MPP_AS_CONST(Iproto::INDEX_ID), index_id,
+			MPP_AS_CONST(Iproto::LIMIT), limit,
+			MPP_AS_CONST(Iproto::ITERATOR), iterator,
+			MPP_AS_CONST(Iproto::KEY), key,
+			MPP_AS_CONST(Iproto::AFTER_POSITION), after_position,
+			MPP_AS_CONST(Iproto::FETCH_POSITION), true)));
+	}
+	uint32_t request_size = (m_Buf.end() - request_start) - PREHEADER_SIZE;
+	m_Buf.set(request_start + 1, __builtin_bswap32(request_size));
+	return request_size + PREHEADER_SIZE;
+}
+
 template<class BUFFER>
 template <class T>
 size_t
@@ -252,3 +329,91 @@ RequestEncoder<BUFFER>::encodeCall(const std::string &func, const T &args)
 	m_Buf.set(request_start + 1, __builtin_bswap32(request_size));
 	return request_size + PREHEADER_SIZE;
 }
+
+template<class BUFFER>
+size_t
+RequestEncoder<BUFFER>::encodeJoin(const std::string &instance_uuid)
+{
+	iterator_t<BUFFER> request_start = m_Buf.end();
+	m_Buf.addBack('\xce');
+	m_Buf.addBack(uint32_t{0});
+	encodeHeader(Iproto::JOIN);
+	m_Enc.add(mpp::as_map(std::forward_as_tuple(
+		MPP_AS_CONST(Iproto::INSTANCE_UUID), instance_uuid)));
+	uint32_t request_size = (m_Buf.end() - request_start) - PREHEADER_SIZE;
+	m_Buf.set(request_start + 1, __builtin_bswap32(request_size));
+	return request_size + PREHEADER_SIZE;
+}
+
+template<class BUFFER>
+size_t
+RequestEncoder<BUFFER>::encodeSubscribe(const std::string &instance_uuid,
+					const std::string &replicaset_uuid,
+					const Vclock &vclock, bool anonymous)
+{
+	iterator_t<BUFFER> request_start = m_Buf.end();
+	m_Buf.addBack('\xce');
+	m_Buf.addBack(uint32_t{0});
+	encodeHeader(Iproto::SUBSCRIBE);
+	/* Replica set uuid is checked by server only if it is set. */
+	if (replicaset_uuid.empty()) {
+		m_Enc.add(mpp::as_map(std::forward_as_tuple(
+			MPP_AS_CONST(Iproto::INSTANCE_UUID), instance_uuid,
+			MPP_AS_CONST(Iproto::VCLOCK), vclock,
+			MPP_AS_CONST(Iproto::REPLICA_ANON), anonymous)));
+	} else {
+		m_Enc.add(mpp::as_map(std::forward_as_tuple(
+			MPP_AS_CONST(Iproto::INSTANCE_UUID), instance_uuid,
+			MPP_AS_CONST(Iproto::CLUSTER_UUID), replicaset_uuid,
+			MPP_AS_CONST(Iproto::VCLOCK), vclock,
+			MPP_AS_CONST(Iproto::REPLICA_ANON), anonymous)));
+	}
+	uint32_t request_size = (m_Buf.end() - request_start) - PREHEADER_SIZE;
+	m_Buf.set(request_start + 1, __builtin_bswap32(request_size));
+	return request_size + PREHEADER_SIZE;
+}
+
+template<class BUFFER>
+size_t
+RequestEncoder<BUFFER>::encodeVclock(const Vclock &vclock)
+{
+	iterator_t<BUFFER> request_start = m_Buf.end();
+	m_Buf.addBack('\xce');
+	m_Buf.addBack(uint32_t{0});
+	encodeHeader(Iproto::OK);
+	m_Enc.add(mpp::as_map(std::forward_as_tuple(
+		MPP_AS_CONST(Iproto::VCLOCK), vclock)));
+	uint32_t request_size = (m_Buf.end() - request_start) - PREHEADER_SIZE;
+	m_Buf.set(request_start + 1, __builtin_bswap32(request_size));
+	return request_size + PREHEADER_SIZE;
+}
+
+template<class BUFFER>
+size_t
+RequestEncoder<BUFFER>::encodeWatch(const std::string &key)
+{
+	iterator_t<BUFFER> request_start = m_Buf.end();
+	m_Buf.addBack('\xce');
+	m_Buf.addBack(uint32_t{0});
+	encodeHeader(Iproto::WATCH);
+	m_Enc.add(mpp::as_map(std::forward_as_tuple(
+		MPP_AS_CONST(Iproto::EVENT_KEY), key)));
+	uint32_t request_size = (m_Buf.end() - request_start) - PREHEADER_SIZE;
+	m_Buf.set(request_start + 1, __builtin_bswap32(request_size));
+	return request_size + PREHEADER_SIZE;
+}
+
+template<class BUFFER>
+size_t
+RequestEncoder<BUFFER>::encodeUnwatch(const std::string &key)
+{
+	iterator_t<BUFFER> request_start = m_Buf.end();
+	m_Buf.addBack('\xce');
+	m_Buf.addBack(uint32_t{0});
+	encodeHeader(Iproto::UNWATCH);
+	m_Enc.add(mpp::as_map(std::forward_as_tuple(
+		MPP_AS_CONST(Iproto::EVENT_KEY), key)));
+	uint32_t request_size = (m_Buf.end() - request_start) - PREHEADER_SIZE;
+	m_Buf.set(request_start + 1, __builtin_bswap32(request_size));
+	return request_size + PREHEADER_SIZE;
+}
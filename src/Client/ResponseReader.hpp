@@ -31,12 +31,14 @@
  */
 #include <cstdint>
 #include <optional>
+#include <string>
 #include <tuple>
 #include <vector>
 
 #include "IprotoConstants.hpp"
 #include "../mpp/mpp.hpp"
 #include "../Utils/Logger.hpp"
+#include "../Utils/SmallVector.hpp"
 
 struct Header {
 	int code;
@@ -80,7 +82,12 @@ struct Data {
 	 * scalar value). This is size of data array.
 	 */
 	size_t dimension = 0;
-	std::vector<Tuple<BUFFER>> tuples;
+	/**
+	 * Responses usually carry a few tuples: they are stored inline
+	 * without memory allocation.
+	 */
+	static constexpr size_t INLINE_TUPLES = 4;
+	tnt::SmallVector<Tuple<BUFFER>, INLINE_TUPLES> tuples;
 	iterator_t<BUFFER> end;
 };
 
@@ -88,6 +95,11 @@ template<class BUFFER>
 struct Body {
 	std::optional<ErrorStack> error_stack;
 	std::optional<Data<BUFFER>> data;
+	/** Key and value of IPROTO_EVENT (sent on box.broadcast()). */
+	std::optional<std::string> event_key;
+	std::optional<iterator_t<BUFFER>> event_data;
+	/** Position of the last tuple of SELECT with fetch_position. */
+	std::optional<std::string> position;
 };
 
 template<class BUFFER>
@@ -145,11 +157,77 @@ struct HeaderReader : mpp::SimpleReaderBase<BUFFER, mpp::MP_MAP> {
 	Header& header;
 };
 
+/** Skip value of any type including nested arrays and maps. */
+template <class BUFFER>
+struct SkipValueReader : mpp::ReaderTemplate<BUFFER> {
+
+	SkipValueReader(mpp::Dec<BUFFER>& d) : dec(d) {}
+
+	void Value(const iterator_t<BUFFER>&, mpp::compact::Type, mpp::ArrValue)
+	{
+		dec.Skip();
+	}
+	void Value(const iterator_t<BUFFER>&, mpp::compact::Type, mpp::MapValue)
+	{
+		dec.Skip();
+	}
+	template <class T>
+	void Value(const iterator_t<BUFFER>&, mpp::compact::Type, T&&) {}
+
+	mpp::Dec<BUFFER>& dec;
+};
+
+/** Remember position of value of any type and skip it. */
+template <class BUFFER>
+struct ValueViewReader : mpp::ReaderTemplate<BUFFER> {
+
+	ValueViewReader(mpp::Dec<BUFFER>& d,
+			std::optional<iterator_t<BUFFER>>& v) : dec(d), view(v) {}
+
+	void Value(iterator_t<BUFFER>& itr, mpp::compact::Type, mpp::ArrValue)
+	{
+		view.emplace(itr);
+		dec.Skip();
+	}
+	void Value(iterator_t<BUFFER>& itr, mpp::compact::Type, mpp::MapValue)
+	{
+		view.emplace(itr);
+		dec.Skip();
+	}
+	template <class T>
+	void Value(iterator_t<BUFFER>& itr, mpp::compact::Type, T&&)
+	{
+		view.emplace(itr);
+	}
+
+	mpp::Dec<BUFFER>& dec;
+	std::optional<iterator_t<BUFFER>>& view;
+};
+
+/** Read string of any length. */
+template <class BUFFER>
+struct StringReader : mpp::SimpleReaderBase<BUFFER, mpp::MP_STR> {
+
+	StringReader(std::string& s) : str(s) {}
+
+	void Value(iterator_t<BUFFER>& itr, mpp::compact::Type, const mpp::StrValue& v)
+	{
+		iterator_t<BUFFER> walker = itr;
+		walker += v.offset;
+		str.resize(v.size);
+		for (size_t i = 0; i < v.size; i++) {
+			str[i] = *walker;
+			++walker;
+		}
+	}
+	std::string& str;
+};
+
 template <class BUFFER>
 struct TupleReader : mpp::ReaderTemplate<BUFFER> {
 
 	TupleReader(mpp::Dec<BUFFER>& d, Data<BUFFER>& dt) : dec(d), data(dt) {}
-	static constexpr mpp::Type VALID_TYPES = mpp::MP_ARR | mpp::MP_UINT |
+	static constexpr mpp::Type VALID_TYPES = mpp::MP_ARR | mpp::MP_MAP | mpp::MP_UINT |
 		mpp::MP_INT | mpp::MP_BOOL | mpp::MP_DBL | mpp::MP_STR; //| mpp::MP_NIL;
 	void Value(iterator_t<BUFFER>& arg, mpp::compact::Type, mpp::ArrValue u)
 	{
@@ -384,6 +462,20 @@ struct BodyKeyReader : mpp::SimpleReaderBase<BUFFER, mpp::MP_UINT> {
 				dec.SetReader(true, Err_t{dec, error_stack});
 				break;
 			}
+			case Iproto::EVENT_KEY: {
+				body.event_key.emplace();
+				dec.SetReader(true, StringReader<BUFFER>{*body.event_key});
+				break;
+			}
+			case Iproto::EVENT_DATA: {
+				dec.SetReader(true, ValueViewReader<BUFFER>{dec, body.event_data});
+				break;
+			}
+			case Iproto::POSITION: {
+				body.position.emplace();
+				dec.SetReader(true, StringReader<BUFFER>{*body.position});
+				break;
+			}
 			default:
 				LOG_ERROR("Invalid body key: ", key);
 				dec.AbortAndSkipRead();
@@ -0,0 +1,528 @@
+#pragma once
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Connector.hpp"
+#include "../Utils/Crc32.hpp"
+
+struct RouterOptions {
+	/** Total count of buckets; bucket ids are 1..bucket_count. */
+	uint32_t bucket_count = 3000;
+	/**
+	 * Hash of a sharding key. By default it's the same as vshard's
+	 * bucket_id_strcrc32(): crc32c of the key.
+	 */
+	std::function<uint32_t(std::string_view)> hash;
+	/**
+	 * Function returning buckets stored by an instance: either array
+	 * of bucket ids or map {buckets = [...], next_from = <id>}. In the
+	 * latter case it's called again with {from = next_from} argument
+	 * until next_from is absent.
+	 */
+	std::string discovery_func = "vshard.storage.buckets_discovery";
+	/** Timeout of discovery (ms). */
+	int discovery_timeout = 1000;
+	/**
+	 * Minimal interval between discoveries triggered by requests to
+	 * unknown buckets (ms). Until it passes, such requests are not
+	 * routed. A routing error allows the next discovery right away.
+	 */
+	int discovery_interval = 1000;
+	/**
+	 * Whether error message means that the bucket is not stored by
+	 * the instance anymore. By default vshard's WRONG_BUCKET (and the
+	 * like) errors are recognized.
+	 */
+	std::function<bool(std::string_view)> is_routing_error;
+};
+
+namespace router_details {
+
+template <class BUFFER>
+struct BucketIdReader : mpp::SimpleReaderBase<BUFFER, mpp::MP_UINT> {
+
+	BucketIdReader(std::vector<uint64_t>& b) : buckets(b) {}
+
+	void Value(const iterator_t<BUFFER>&, mpp::compact::Type, uint64_t id)
+	{
+		buckets.push_back(id);
+	}
+	std::vector<uint64_t>& buckets;
+};
+
+template <class BUFFER>
+struct BucketsReader : mpp::SimpleReaderBase<BUFFER, mpp::MP_ARR> {
+
+	BucketsReader(mpp::Dec<BUFFER>& d, std::vector<uint64_t>& b) :
+		dec(d), buckets(b) {}
+
+	void Value(const iterator_t<BUFFER>&, mpp::compact::Type, mpp::ArrValue)
+	{
+		dec.SetReader(false, BucketIdReader<BUFFER>{buckets});
+	}
+	mpp::Dec<BUFFER>& dec;
+	std::vector<uint64_t>& buckets;
+};
+
+template <class BUFFER>
+struct DiscoveryKeyReader : mpp::SimpleReaderBase<BUFFER, mpp::MP_STR> {
+
+	DiscoveryKeyReader(mpp::Dec<BUFFER>& d, std::vector<uint64_t>& b,
+			   uint64_t& n) : dec(d), buckets(b), next_from(n) {}
+
+	void Value(iterator_t<BUFFER>& itr, mpp::compact::Type type,
+		   const mpp::StrValue& v)
+	{
+		std::string key;
+		StringReader<BUFFER>{key}.Value(itr, type, v);
+		using Next_t = mpp::SimpleReader<BUFFER, mpp::MP_UINT, uint64_t>;
+		if (key == "buckets")
+			dec.SetReader(true, BucketsReader<BUFFER>{dec, buckets});
+		else if (key == "next_from")
+			dec.SetReader(true, Next_t{next_from});
+		else
+			dec.SetReader(true, SkipValueReader<BUFFER>{dec});
+	}
+	mpp::Dec<BUFFER>& dec;
+	std::vector<uint64_t>& buckets;
+	uint64_t& next_from;
+};
+
+/** Result of discovery function: array of ids or map with them. */
+template <class BUFFER>
+struct DiscoveryReader : mpp::SimpleReaderBase<BUFFER, mpp::MP_ARR | mpp::MP_MAP> {
+
+	DiscoveryReader(mpp::Dec<BUFFER>& d, std::vector<uint64_t>& b,
+			uint64_t& n) : dec(d), buckets(b), next_from(n) {}
+
+	void Value(const iterator_t<BUFFER>&, mpp::compact::Type, mpp::ArrValue)
+	{
+		dec.SetReader(false, BucketIdReader<BUFFER>{buckets});
+	}
+	void Value(const iterator_t<BUFFER>&, mpp::compact::Type, mpp::MapValue)
+	{
+		dec.SetReader(false, DiscoveryKeyReader<BUFFER>{dec, buckets,
+								next_from});
+	}
+	mpp::Dec<BUFFER>& dec;
+	std::vector<uint64_t>& buckets;
+	uint64_t& next_from;
+};
+
+} // namespace router_details
+
+/**
+ * Client-side router of requests to vshard-like sharded cluster. Every
+ * key belongs to a bucket (bucketId()), every bucket is stored by one of
+ * replicasets added by addReplicaset(). Map bucket -> replicaset is
+ * discovered lazily, on the first request to unknown bucket, by calling
+ * RouterOptions::discovery_func on all replicasets. Responses with
+ * routing errors (bucket has been moved) reset the bucket, so the next
+ * request to it refreshes the map. Requests to buckets that are not
+ * found anywhere don't trigger discovery more often than once per
+ * RouterOptions::discovery_interval.
+ * sendBatch() encodes requests to the same replicaset one after another,
+ * so a multi-key lookup is sent as one pipelined burst per replicaset.
+ * All connections must be driven by the same connector.
+ */
+template<class BUFFER, class NetProvider>
+class Router {
+public:
+	using Connector_t = Connector<BUFFER, NetProvider>;
+	using Connection_t = Connection<BUFFER, NetProvider>;
+
+	/** Request sent by the router. */
+	struct Request {
+		/** nullptr if bucket of the request is not found. */
+		Connection_t *conn = nullptr;
+		rid_t future = 0;
+		uint32_t bucket_id = 0;
+		bool isRouted() const { return conn != nullptr; }
+	};
+
+	Router(Connector_t &connector, const RouterOptions &opts = {});
+	Router(const Router& router) = delete;
+	Router& operator = (const Router& router) = delete;
+
+	/** Add (connected) master of a replicaset. Returns its number. */
+	size_t addReplicaset(Connection_t &conn);
+	/** Bucket of a sharding key: hash(key) % bucket_count + 1. */
+	uint32_t bucketId(std::string_view key) const;
+	/**
+	 * Connection to the replicaset storing the bucket; bucket map is
+	 * discovered if the bucket is unknown. nullptr if it isn't found.
+	 */
+	Connection_t* route(uint32_t bucket_id);
+	/** Refresh bucket map. Returns 0 on success, -1 otherwise. */
+	int discover();
+	/**
+	 * Route request to the bucket and encode it by @a encode, which
+	 * is called with Connection_t& and returns rid_t of the request.
+	 */
+	template <class F>
+	Request send(uint32_t bucket_id, F &&encode);
+	/**
+	 * Route requests to buckets: bucket map is discovered no more than
+	 * once. @a encode is called with Connection_t& and index of the
+	 * bucket in @a bucket_ids; requests to the same replicaset are
+	 * encoded in a row. Returned requests are in order of @a bucket_ids.
+	 */
+	template <class F>
+	std::vector<Request> sendBatch(const std::vector<uint32_t> &bucket_ids,
+				       F &&encode);
+	/**
+	 * Wait for responses to all routed requests no longer than
+	 * @a timeout ms (0 - no limit). Returns 0 if all of them are ready.
+	 */
+	int wait(const std::vector<Request> &requests, int timeout = 0);
+	/**
+	 * Take the response. If it's a routing error, bucket of the request
+	 * is forgotten: the request may be resent to the new location.
+	 */
+	std::optional<Response<BUFFER>> getResponse(const Request &request);
+	/** Whether response to the request has failed with routing error. */
+	bool isRoutingError(const Response<BUFFER> &response) const;
+
+	const std::string& getError() const { return m_Error; }
+	size_t replicasetCount() const { return m_Replicasets.size(); }
+	/** Count of buckets with known location. */
+	size_t knownBuckets() const;
+	/** Count of discovery rounds made. */
+	size_t discoveries() const { return m_Discoveries; }
+	/** Count of responses with routing errors. */
+	size_t routingErrors() const { return m_RoutingErrors; }
+private:
+	static constexpr int32_t UNKNOWN = -1;
+
+	bool isKnown(uint32_t bucket_id) const;
+	/** Discover unless the last discovery was too recent. */
+	int discoverIfAllowed();
+	/** Discover buckets of one replicaset and store them to @a map. */
+	int discoverReplicaset(int32_t rs, std::vector<int32_t> &map);
+	int parseDiscovery(int32_t rs, Response<BUFFER> &response,
+			       std::vector<int32_t> &map, uint64_t &next_from);
+
+	Connector_t &m_Connector;
+	RouterOptions m_Opts;
+	std::vector<Connection_t *> m_Replicasets;
+	/** Bucket id -> number of replicaset or UNKNOWN. */
+	std::vector<int32_t> m_Buckets;
+	std::string m_Error;
+	size_t m_Discoveries = 0;
+	size_t m_RoutingErrors = 0;
+	/** Started on discovery, expires after discovery_interval. */
+	Timer m_DiscoveryTimer;
+	/** Whether the map is known to be outdated (or not discovered). */
+	bool m_IsStale = true;
+};
+
+template<class BUFFER, class NetProvider>
+Router<BUFFER, NetProvider>::Router(Connector_t &connector,
+				    const RouterOptions &opts) :
+	m_Connector(connector), m_Opts(opts),
+	m_DiscoveryTimer(Timeout_t{std::chrono::milliseconds{
+		std::max(opts.discovery_interval, 0)}})
+{
+	if (m_Opts.bucket_count == 0)
+		m_Opts.bucket_count = 1;
+	if (!m_Opts.hash) {
+		m_Opts.hash = [](std::string_view key) {
+			return tnt::crc32c(0xFFFFFFFF, key.data(), key.size());
+		};
+	}
+	if (!m_Opts.is_routing_error) {
+		m_Opts.is_routing_error = [](std::string_view msg) {
+			return msg.find("WRONG_BUCKET") != msg.npos ||
+			       msg.find("Cannot perform action with bucket") !=
+			       msg.npos;
+		};
+	}
+	m_Buckets.assign(m_Opts.bucket_count + 1, UNKNOWN);
+}
+
+template<class BUFFER, class NetProvider>
+size_t
+Router<BUFFER, NetProvider>::addReplicaset(Connection_t &conn)
+{
+	m_Replicasets.push_back(&conn);
+	return m_Replicasets.size() - 1;
+}
+
+template<class BUFFER, class NetProvider>
+uint32_t
+Router<BUFFER, NetProvider>::bucketId(std::string_view key) const
+{
+	return m_Opts.hash(key) % m_Opts.bucket_count + 1;
+}
+
+template<class BUFFER, class NetProvider>
+bool
+Router<BUFFER, NetProvider>::isKnown(uint32_t bucket_id) const
+{
+	return bucket_id != 0 && bucket_id < m_Buckets.size() &&
+	       m_Buckets[bucket_id] != UNKNOWN;
+}
+
+template<class BUFFER, class NetProvider>
+size_t
+Router<BUFFER, NetProvider>::knownBuckets() const
+{
+	size_t count = 0;
+	for (int32_t rs : m_Buckets)
+		count += rs != UNKNOWN;
+	return count;
+}
+
+template<class BUFFER, class NetProvider>
+typename Router<BUFFER, NetProvider>::Connection_t*
+Router<BUFFER, NetProvider>::route(uint32_t bucket_id)
+{
+	if (bucket_id == 0 || bucket_id > m_Opts.bucket_count) {
+		m_Error = "Bucket " + std::to_string(bucket_id) +
+			  " is out of range";
+		return nullptr;
+	}
+	if (!isKnown(bucket_id))
+		discoverIfAllowed();
+	if (!isKnown(bucket_id)) {
+		m_Error = "Bucket " + std::to_string(bucket_id) +
+			  " is not found";
+		return nullptr;
+	}
+	return m_Replicasets[m_Buckets[bucket_id]];
+}
+
+template<class BUFFER, class NetProvider>
+int
+Router<BUFFER, NetProvider>::discover()
+{
+	m_Discoveries++;
+	m_IsStale = false;
+	m_DiscoveryTimer.start();
+	std::vector<int32_t> map(m_Buckets.size(), UNKNOWN);
+	int rc = 0;
+	for (size_t rs = 0; rs < m_Replicasets.size(); rs++) {
+		if (discoverReplicaset(rs, map) == 0)
+			continue;
+		/* Keep the last known buckets of unavailable replicaset. */
+		for (size_t b = 0; b < map.size(); b++) {
+			if (m_Buckets[b] == (int32_t) rs && map[b] == UNKNOWN)
+				map[b] = rs;
+		}
+		rc = -1;
+	}
+	m_Buckets = std::move(map);
+	return rc;
+}
+
+template<class BUFFER, class NetProvider>
+int
+Router<BUFFER, NetProvider>::discoverIfAllowed()
+{
+	if (!m_IsStale && !m_DiscoveryTimer.isExpired())
+		return -1;
+	return discover();
+}
+
+template<class BUFFER, class NetProvider>
+int
+Router<BUFFER, NetProvider>::discoverReplicaset(int32_t rs,
+						std::vector<int32_t> &map)
+{
+	Connection_t &conn = *m_Replicasets[rs];
+	Timer timer{m_Opts.discovery_timeout};
+	timer.start();
+	uint64_t next_from = 0;
+	do {
+		rid_t f;
+		if (next_from == 0) {
+			f = conn.call(m_Opts.discovery_func, std::make_tuple());
+		} else {
+			auto from = std::make_tuple(std::string("from"), next_from);
+			f = conn.call(m_Opts.discovery_func,
+				      std::make_tuple(mpp::as_map(from)));
+		}
+		int timeout = m_Opts.discovery_timeout - timer.elapsed();
+		if (timer.isExpired() || m_Connector.wait(conn, f, timeout) != 0) {
+			m_Error = "Failed to discover buckets of replicaset " +
+				  std::to_string(rs) + ": " + conn.getError();
+			LOG_ERROR(m_Error);
+			return -1;
+		}
+		Response<BUFFER> response = *conn.getResponse(f);
+		next_from = 0;
+		if (parseDiscovery(rs, response, map, next_from) != 0)
+			return -1;
+	} while (next_from != 0);
+	return 0;
+}
+
+template<class BUFFER, class NetProvider>
+int
+Router<BUFFER, NetProvider>::parseDiscovery(int32_t rs,
+					    Response<BUFFER> &response,
+					    std::vector<int32_t> &map,
+					    uint64_t &next_from)
+{
+	std::string prefix = "Discovery of replicaset " + std::to_string(rs);
+	if (response.header.code != 0) {
+		m_Error = prefix + " has failed";
+		if (response.body.error_stack != std::nullopt) {
+			const Error &err = response.body.error_stack->error;
+			m_Error += ": " + std::string(err.msg, err.msg_len);
+		}
+		LOG_ERROR(m_Error);
+		return -1;
+	}
+	if (response.body.data == std::nullopt ||
+	    response.body.data->tuples.empty()) {
+		m_Error = prefix + " has returned nothing";
+		LOG_ERROR(m_Error);
+		return -1;
+	}
+	std::vector<uint64_t> buckets;
+	mpp::Dec<BUFFER> dec(m_Replicasets[rs]->getInBuf());
+	dec.SetPosition(response.body.data->tuples[0].begin);
+	using Reader_t = router_details::DiscoveryReader<BUFFER>;
+	dec.SetReader(false, Reader_t{dec, buckets, next_from});
+	if (dec.Read() != mpp::READ_SUCCESS) {
+		m_Error = prefix + ": failed to decode buckets";
+		LOG_ERROR(m_Error);
+		return -1;
+	}
+	for (uint64_t b : buckets) {
+		if (b != 0 && b < map.size())
+			map[b] = rs;
+	}
+	return 0;
+}
+
+template<class BUFFER, class NetProvider>
+template <class F>
+typename Router<BUFFER, NetProvider>::Request
+Router<BUFFER, NetProvider>::send(uint32_t bucket_id, F &&encode)
+{
+	Request request;
+	request.bucket_id = bucket_id;
+	request.conn = route(bucket_id);
+	if (request.conn != nullptr)
+		request.future = encode(*request.conn);
+	return request;
+}
+
+template<class BUFFER, class NetProvider>
+template <class F>
+std::vector<typename Router<BUFFER, NetProvider>::Request>
+Router<BUFFER, NetProvider>::sendBatch(const std::vector<uint32_t> &bucket_ids,
+				       F &&encode)
+{
+	std::vector<Request> requests(bucket_ids.size());
+	bool has_unknown = false;
+	for (size_t i = 0; i < bucket_ids.size(); i++) {
+		requests[i].bucket_id = bucket_ids[i];
+		has_unknown = has_unknown || !isKnown(bucket_ids[i]);
+	}
+	if (has_unknown)
+		discoverIfAllowed();
+	for (size_t rs = 0; rs < m_Replicasets.size(); rs++) {
+		Connection_t &conn = *m_Replicasets[rs];
+		for (size_t i = 0; i < bucket_ids.size(); i++) {
+			if (!isKnown(bucket_ids[i]) ||
+			    m_Buckets[bucket_ids[i]] != (int32_t) rs)
+				continue;
+			requests[i].conn = &conn;
+			requests[i].future = encode(conn, i);
+		}
+	}
+	for (const Request &request : requests) {
+		if (!request.isRouted()) {
+			m_Error = "Bucket " + std::to_string(request.bucket_id) +
+				  " is not found";
+			break;
+		}
+	}
+	return requests;
+}
+
+template<class BUFFER, class NetProvider>
+int
+Router<BUFFER, NetProvider>::wait(const std::vector<Request> &requests,
+				  int timeout)
+{
+	Timer timer{timeout};
+	timer.start();
+	for (const Request &request : requests) {
+		if (!request.isRouted() ||
+		    request.conn->futureIsReady(request.future))
+			continue;
+		int left = timeout - timer.elapsed();
+		if ((timeout != 0 && left <= 0) ||
+		    m_Connector.wait(*request.conn, request.future, left) != 0) {
+			m_Error = "Failed to wait for response from bucket " +
+				  std::to_string(request.bucket_id) + ": " +
+				  request.conn->getError();
+			return -1;
+		}
+	}
+	return 0;
+}
+
+template<class BUFFER, class NetProvider>
+bool
+Router<BUFFER, NetProvider>::isRoutingError(const Response<BUFFER> &response) const
+{
+	if (response.header.code == 0 || response.body.error_stack == std::nullopt)
+		return false;
+	const Error &err = response.body.error_stack->error;
+	return m_Opts.is_routing_error(std::string_view(err.msg, err.msg_len));
+}
+
+template<class BUFFER, class NetProvider>
+std::optional<Response<BUFFER>>
+Router<BUFFER, NetProvider>::getResponse(const Request &request)
+{
+	if (!request.isRouted())
+		return std::nullopt;
+	std::optional<Response<BUFFER>> response =
+		request.conn->getResponse(request.future);
+	if (response != std::nullopt && isRoutingError(*response)) {
+		m_RoutingErrors++;
+		if (isKnown(request.bucket_id))
+			m_Buckets[request.bucket_id] = UNKNOWN;
+		m_IsStale = true;
+	}
+	return response;
+}
@@ -0,0 +1,170 @@
+#pragma once
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <cstdint>
+
+#include "RowReader.hpp"
+#include "Vclock.hpp"
+#include "../Utils/Logger.hpp"
+
+/**
+ * Decoder of rows of replication stream and xlog files. Row is a pair
+ * of msgpack maps: header and optional body. The decoder doesn't copy
+ * tuples, they are returned as iterators pointing into the buffer.
+ */
+template<class BUFFER>
+class RowDecoder {
+public:
+	RowDecoder(BUFFER &buf) : m_Dec(buf) {};
+	~RowDecoder() { };
+	RowDecoder() = delete;
+	RowDecoder(const RowDecoder& decoder) = delete;
+	RowDecoder& operator = (const RowDecoder& decoder) = delete;
+
+	/** Decode msgpack uint prefixing a row in iproto stream. */
+	int64_t decodeRowSize();
+	/**
+	 * Decode a row which ends at @a end. The body is decoded only if
+	 * the header doesn't take up the whole row.
+	 */
+	int decodeRow(Row<BUFFER> &row, const iterator_t<BUFFER> &end);
+	/**
+	 * Decode a row the way they are stored in xlog tx: rows follow each
+	 * other up to @a end without size prefix and NOP rows have no body.
+	 * Size of the decoded row is stored to row.size.
+	 */
+	int decodeNextRow(Row<BUFFER> &row, const iterator_t<BUFFER> &end);
+	void reset(iterator_t<BUFFER> &itr);
+	/** Vclock of the last decoded row which had one in its body. */
+	const Vclock& vclock() const { return m_Vclock; }
+
+private:
+	int decodeHeader(RowHeader &header);
+	int decodeBody(RowBody<BUFFER> &body);
+	mpp::Dec<BUFFER> m_Dec;
+	Vclock m_Vclock;
+};
+
+template<class BUFFER>
+int64_t
+RowDecoder<BUFFER>::decodeRowSize()
+{
+	int64_t size = -1;
+	m_Dec.SetReader(false, mpp::SimpleReader<BUFFER, mpp::MP_UINT, int64_t>{size});
+	mpp::ReadResult_t res = m_Dec.Read();
+	if (res != mpp::READ_SUCCESS)
+		return -1;
+	return size;
+}
+
+template<class BUFFER>
+int
+RowDecoder<BUFFER>::decodeHeader(RowHeader &header)
+{
+	header = RowHeader{};
+	m_Dec.SetReader(false, RowHeaderReader<BUFFER>{m_Dec, header});
+	mpp::ReadResult_t res = m_Dec.Read();
+	if (res != mpp::READ_SUCCESS)
+		return -1;
+	/*
+	 * Single statement transactions are encoded without TSN and
+	 * commit flag: such a row is the whole transaction.
+	 */
+	if (header.tsn == 0) {
+		header.tsn = header.lsn;
+		header.flags |= Iproto::FLAG_COMMIT;
+	}
+	return 0;
+}
+
+template<class BUFFER>
+int
+RowDecoder<BUFFER>::decodeBody(RowBody<BUFFER> &body)
+{
+	m_Dec.SetReader(false, RowBodyReader<BUFFER>{m_Dec, body, m_Vclock});
+	mpp::ReadResult_t res = m_Dec.Read();
+	if (res != mpp::READ_SUCCESS)
+		return -1;
+	return 0;
+}
+
+template<class BUFFER>
+int
+RowDecoder<BUFFER>::decodeRow(Row<BUFFER> &row, const iterator_t<BUFFER> &end)
+{
+	row.body = RowBody<BUFFER>{};
+	if (decodeHeader(row.header) != 0) {
+		LOG_ERROR("Failed to decode row header");
+		return -1;
+	}
+	if (m_Dec.getPosition() == end)
+		return 0;
+	if (decodeBody(row.body) != 0) {
+		LOG_ERROR("Failed to decode row body");
+		return -1;
+	}
+	if (m_Dec.getPosition() != end) {
+		LOG_ERROR("Row has trailing garbage");
+		return -1;
+	}
+	return 0;
+}
+
+template<class BUFFER>
+int
+RowDecoder<BUFFER>::decodeNextRow(Row<BUFFER> &row, const iterator_t<BUFFER> &end)
+{
+	iterator_t<BUFFER> begin = m_Dec.getPosition();
+	row.body = RowBody<BUFFER>{};
+	if (decodeHeader(row.header) != 0) {
+		LOG_ERROR("Failed to decode row header");
+		return -1;
+	}
+	if (row.header.type != Iproto::NOP && m_Dec.getPosition() != end &&
+	    decodeBody(row.body) != 0) {
+		LOG_ERROR("Failed to decode row body");
+		return -1;
+	}
+	iterator_t<BUFFER> pos = m_Dec.getPosition();
+	if (end < pos) {
+		LOG_ERROR("Row crosses the end of data");
+		return -1;
+	}
+	row.size = pos - begin;
+	return 0;
+}
+
+template<class BUFFER>
+void
+RowDecoder<BUFFER>::reset(iterator_t<BUFFER> &itr)
+{
+	m_Dec.SetPosition(itr);
+}
@@ -0,0 +1,268 @@
+#pragma once
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <cstdint>
+#include <optional>
+
+#include "IprotoConstants.hpp"
+#include "ResponseReader.hpp"
+#include "Vclock.hpp"
+#include "../mpp/mpp.hpp"
+
+/**
+ * Rows are units of replication stream and xlog/snap files: DML
+ * statements and service records. Unlike responses, their header
+ * carries the position of the row in the log of its origin.
+ */
+struct RowHeader {
+	/** Request type of the row (Iproto::Type); OK for service rows. */
+	int type;
+	uint64_t sync;
+	/** Id of the instance the row was originated by. */
+	uint32_t replica_id;
+	int64_t lsn;
+	/** Time of the row creation, seconds since the epoch. */
+	double timestamp;
+	uint32_t group_id;
+	/** LSN of the first row of transaction. */
+	int64_t tsn;
+	uint64_t flags;
+	uint64_t schema_version;
+
+	/** The row is the last statement of its transaction. */
+	bool isCommit() const { return (flags & Iproto::FLAG_COMMIT) != 0; }
+};
+
+template<class BUFFER>
+struct RowBody {
+	uint32_t space_id;
+	uint32_t index_id;
+	uint32_t index_base;
+	/**
+	 * Views of msgpack values of the row: they point right into
+	 * the buffer, so they are valid until the row is consumed.
+	 */
+	std::optional<iterator_t<BUFFER>> tuple;
+	std::optional<iterator_t<BUFFER>> key;
+	std::optional<iterator_t<BUFFER>> ops;
+	/** Service row carries vclock; it is stored by decoder. */
+	bool has_vclock;
+	std::optional<ErrorStack> error_stack;
+};
+
+template<class BUFFER>
+struct Row {
+	RowHeader header;
+	RowBody<BUFFER> body;
+	/** Size of the encoded row. */
+	size_t size;
+};
+
+template <class BUFFER>
+struct RowHeaderKeyReader : mpp::SimpleReaderBase<BUFFER, mpp::MP_UINT> {
+
+	RowHeaderKeyReader(mpp::Dec<BUFFER>& d, RowHeader& h) : dec(d), header(h) {}
+
+	void Value(const iterator_t<BUFFER>&, mpp::compact::Type, uint64_t key)
+	{
+		using Int_t = mpp::SimpleReader<BUFFER, mpp::MP_UINT, int>;
+		using Uint32_t = mpp::SimpleReader<BUFFER, mpp::MP_UINT, uint32_t>;
+		using Uint64_t = mpp::SimpleReader<BUFFER, mpp::MP_UINT, uint64_t>;
+		using Lsn_t = mpp::SimpleReader<BUFFER, mpp::MP_UINT, int64_t>;
+		using Double_t = mpp::SimpleReader<BUFFER, mpp::MP_AFLT, double>;
+		switch (key) {
+			case Iproto::REQUEST_TYPE:
+				dec.SetReader(true, Int_t{header.type});
+				break;
+			case Iproto::SYNC:
+				dec.SetReader(true, Uint64_t{header.sync});
+				break;
+			case Iproto::REPLICA_ID:
+				dec.SetReader(true, Uint32_t{header.replica_id});
+				break;
+			case Iproto::LSN:
+				dec.SetReader(true, Lsn_t{header.lsn});
+				break;
+			case Iproto::TIMESTAMP:
+				dec.SetReader(true, Double_t{header.timestamp});
+				break;
+			case Iproto::SCHEMA_VERSION:
+				dec.SetReader(true, Uint64_t{header.schema_version});
+				break;
+			case Iproto::GROUP_ID:
+				dec.SetReader(true, Uint32_t{header.group_id});
+				break;
+			case Iproto::TSN:
+				dec.SetReader(true, Lsn_t{header.tsn});
+				break;
+			case Iproto::FLAGS:
+				dec.SetReader(true, Uint64_t{header.flags});
+				break;
+			default:
+				/* Newer servers may add keys: ignore them. */
+				dec.SetReader(true, SkipValueReader<BUFFER>{dec});
+		}
+	}
+	mpp::Dec<BUFFER>& dec;
+	RowHeader& header;
+};
+
+template <class BUFFER>
+struct RowHeaderReader : mpp::SimpleReaderBase<BUFFER, mpp::MP_MAP> {
+
+	RowHeaderReader(mpp::Dec<BUFFER>& d, RowHeader& h) : dec(d), header(h) {}
+
+	void Value(const iterator_t<BUFFER>&, mpp::compact::Type, mpp::MapValue)
+	{
+		dec.SetReader(false, RowHeaderKeyReader<BUFFER>{dec, header});
+	}
+
+	mpp::Dec<BUFFER>& dec;
+	RowHeader& header;
+};
+
+template <class BUFFER>
+struct VclockLsnReader : mpp::SimpleReaderBase<BUFFER, mpp::MP_UINT> {
+
+	VclockLsnReader(Vclock& v, uint32_t id) : vclock(v), replica_id(id) {}
+
+	void Value(const iterator_t<BUFFER>&, mpp::compact::Type, uint64_t lsn)
+	{
+		vclock.set(replica_id, lsn);
+	}
+	Vclock& vclock;
+	uint32_t replica_id;
+};
+
+template <class BUFFER>
+struct VclockKeyReader : mpp::SimpleReaderBase<BUFFER, mpp::MP_UINT> {
+
+	VclockKeyReader(mpp::Dec<BUFFER>& d, Vclock& v) : dec(d), vclock(v) {}
+
+	void Value(const iterator_t<BUFFER>&, mpp::compact::Type, uint64_t id)
+	{
+		if (id >= Vclock::VCLOCK_MAX) {
+			LOG_ERROR("Invalid replica id in vclock: ", id);
+			dec.AbortAndSkipRead();
+			return;
+		}
+		dec.SetReader(true, VclockLsnReader<BUFFER>{vclock, (uint32_t)id});
+	}
+	mpp::Dec<BUFFER>& dec;
+	Vclock& vclock;
+};
+
+/** Vclock is encoded as map {replica id: lsn}. */
+template <class BUFFER>
+struct VclockReader : mpp::SimpleReaderBase<BUFFER, mpp::MP_MAP> {
+
+	VclockReader(mpp::Dec<BUFFER>& d, Vclock& v) : dec(d), vclock(v) {}
+
+	void Value(const iterator_t<BUFFER>&, mpp::compact::Type, mpp::MapValue)
+	{
+		vclock.reset();
+		dec.SetReader(false, VclockKeyReader<BUFFER>{dec, vclock});
+	}
+	mpp::Dec<BUFFER>& dec;
+	Vclock& vclock;
+};
+
+template <class BUFFER>
+struct RowBodyKeyReader : mpp::SimpleReaderBase<BUFFER, mpp::MP_UINT> {
+
+	RowBodyKeyReader(mpp::Dec<BUFFER>& d, RowBody<BUFFER>& b, Vclock& v) :
+		dec(d), body(b), vclock(v) {}
+
+	void Value(const iterator_t<BUFFER>&, mpp::compact::Type, uint64_t key)
+	{
+		using Uint32_t = mpp::SimpleReader<BUFFER, mpp::MP_UINT, uint32_t>;
+		using View_t = ValueViewReader<BUFFER>;
+		using Str_t = mpp::SimpleStrReader<BUFFER, sizeof(Error{}.msg)>;
+		switch (key) {
+			case Iproto::SPACE_ID:
+				dec.SetReader(true, Uint32_t{body.space_id});
+				break;
+			case Iproto::INDEX_ID:
+				dec.SetReader(true, Uint32_t{body.index_id});
+				break;
+			case Iproto::INDEX_BASE:
+				dec.SetReader(true, Uint32_t{body.index_base});
+				break;
+			case Iproto::TUPLE:
+				dec.SetReader(true, View_t{dec, body.tuple});
+				break;
+			case Iproto::KEY:
+				dec.SetReader(true, View_t{dec, body.key});
+				break;
+			case Iproto::OPS:
+				dec.SetReader(true, View_t{dec, body.ops});
+				break;
+			case Iproto::VCLOCK:
+				body.has_vclock = true;
+				dec.SetReader(true, VclockReader<BUFFER>{dec, vclock});
+				break;
+			case Iproto::ERROR_24: {
+				if (body.error_stack == std::nullopt)
+					body.error_stack = ErrorStack();
+				dec.SetReader(true, Str_t{body.error_stack->error.msg,
+							  body.error_stack->error.msg_len});
+				break;
+			}
+			case Iproto::ERROR: {
+				if (body.error_stack == std::nullopt)
+					body.error_stack = ErrorStack();
+				dec.SetReader(true, ErrorReader<BUFFER>{dec, *body.error_stack});
+				break;
+			}
+			default:
+				dec.SetReader(true, SkipValueReader<BUFFER>{dec});
+		}
+	}
+	mpp::Dec<BUFFER>& dec;
+	RowBody<BUFFER>& body;
+	Vclock& vclock;
+};
+
+template <class BUFFER>
+struct RowBodyReader : mpp::SimpleReaderBase<BUFFER, mpp::MP_MAP> {
+
+	RowBodyReader(mpp::Dec<BUFFER>& d, RowBody<BUFFER>& b, Vclock& v) :
+		dec(d), body(b), vclock(v) {}
+
+	void Value(const iterator_t<BUFFER>&, mpp::compact::Type, mpp::MapValue)
+	{
+		dec.SetReader(false, RowBodyKeyReader<BUFFER>{dec, body, vclock});
+	}
+
+	mpp::Dec<BUFFER>& dec;
+	RowBody<BUFFER>& body;
+	Vclock& vclock;
+};
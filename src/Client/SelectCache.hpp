@@ -0,0 +1,413 @@
+#pragma once
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <chrono>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Connector.hpp"
+#include "../Buffer/PtrBuffer.hpp"
+
+struct SelectCacheOptions {
+	/** Max count of cached selects. */
+	size_t capacity = 1024;
+	/** Time to live of an entry (ms); 0 - entries don't expire. */
+	int ttl = 0;
+};
+
+/**
+ * Tuples of select served by SelectCache. They are a compact copy of
+ * response data: msgpack array of tuples which is shared with the cache,
+ * so the result stays valid after invalidation of the entry.
+ */
+struct CachedSelect {
+	using Buffer_t = tnt::PtrBuffer;
+
+	std::shared_ptr<const std::string> bytes;
+	/** Tuples point into bytes. */
+	Data<Buffer_t> data;
+	/** The result is taken from the cache, no request is made. */
+	bool is_hit;
+	/** Buffer to decode tuples with. */
+	Buffer_t buffer() const { return Buffer_t(bytes->data(), bytes->size()); }
+};
+
+/**
+ * Read-through cache of select results for rarely changing data.
+ * Entries are keyed by encoded body of SELECT request (space, index,
+ * key, iterator, limit and offset) and are evicted by CLOCK algorithm
+ * when the cache is full. Entries are invalidated:
+ *  - all at once when schema version of a connection changes (i.e.
+ *    a response with new version is received, see schemaVersion());
+ *  - after SelectCacheOptions::ttl;
+ *  - by space with invalidate(), explicitly or on update of a key
+ *    watched by invalidateOnWatch().
+ * The cache may be shared by connections to instances with the same data.
+ * Schema version is tracked per connection, so connections to instances
+ * with different versions don't invalidate entries of each other.
+ * Connections passed to invalidateOnWatch() must outlive the cache: it
+ * unwatches their keys on destruction.
+ */
+template<class BUFFER, class NetProvider>
+class SelectCache {
+public:
+	using Connector_t = Connector<BUFFER, NetProvider>;
+	using Connection_t = Connection<BUFFER, NetProvider>;
+
+	SelectCache(Connector_t &connector, const SelectCacheOptions &opts = {});
+	/** Unwatch keys registered by invalidateOnWatch(). */
+	~SelectCache();
+	SelectCache(const SelectCache& cache) = delete;
+	SelectCache& operator = (const SelectCache& cache) = delete;
+
+	/**
+	 * Return cached result of the select or make the request and wait
+	 * for its response no longer than @a timeout ms (0 - no limit).
+	 * Failed selects are not cached: nullopt is returned and
+	 * getError() describes the error.
+	 */
+	template <class T>
+	std::optional<CachedSelect> select(Connection_t &conn, const T &key,
+					   uint32_t space_id,
+					   uint32_t index_id = 0,
+					   uint32_t limit = UINT32_MAX,
+					   uint32_t offset = 0,
+					   IteratorType iterator = EQ,
+					   int timeout = 0);
+	/** Drop all entries of the space. */
+	void invalidate(uint32_t space_id);
+	void invalidateAll();
+	/**
+	 * Drop entries of the space whenever box.broadcast() key is updated
+	 * on the server. Replaces watch handler of the key, if any. The key
+	 * is unwatched when the cache is destroyed, so @a conn must be alive
+	 * by then.
+	 */
+	int invalidateOnWatch(Connection_t &conn, const std::string &event_key,
+			      uint32_t space_id);
+
+	const std::string& getError() const { return m_Error; }
+	size_t size() const { return m_Index.size(); }
+	size_t hits() const { return m_Hits; }
+	size_t misses() const { return m_Misses; }
+	size_t evictions() const { return m_Evictions; }
+private:
+	using Clock_t = std::chrono::steady_clock;
+	struct Slot {
+		std::shared_ptr<const std::string> bytes;
+		/** Key of the entry in m_Index; nullptr if the slot is free. */
+		const std::string *key = nullptr;
+		uint32_t space_id = 0;
+		Clock_t::time_point expires;
+		/** The entry is accessed since the last pass of the hand. */
+		bool is_referenced = false;
+	};
+
+	template <class T>
+	void encodeKey(const T &key, uint32_t space_id, uint32_t index_id,
+		       uint32_t limit, uint32_t offset, IteratorType iterator);
+	/** Drop everything if schema of the connection is changed. */
+	void checkSchema(const Connection_t &conn);
+	void erase(size_t slot);
+	/** Slot for a new entry: free one or evicted by CLOCK. */
+	size_t allocSlot();
+	/** Copy data of the response to msgpack array. */
+	std::shared_ptr<const std::string> copyData(Connection_t &conn,
+						    Response<BUFFER> &response);
+	static CachedSelect makeResult(std::shared_ptr<const std::string> bytes,
+				       bool is_hit);
+
+	Connector_t &m_Connector;
+	SelectCacheOptions m_Opts;
+	/** Buffer to encode keys of lookups. */
+	BUFFER m_KeyBuf;
+	mpp::Enc<BUFFER> m_KeyEnc;
+	std::string m_Key;
+	std::unordered_map<std::string, size_t> m_Index;
+	std::vector<Slot> m_Slots;
+	std::vector<size_t> m_FreeSlots;
+	size_t m_Hand = 0;
+	/** Last seen schema version of each connection. */
+	std::unordered_map<const Connection_t *, int> m_SchemaVersions;
+	std::string m_Error;
+	size_t m_Hits = 0;
+	size_t m_Misses = 0;
+	size_t m_Evictions = 0;
+	/** Keys watched by invalidateOnWatch(). */
+	std::vector<std::pair<Connection_t *, std::string>> m_Watches;
+};
+
+template<class BUFFER, class NetProvider>
+SelectCache<BUFFER, NetProvider>::SelectCache(Connector_t &connector,
+					      const SelectCacheOptions &opts) :
+	m_Connector(connector), m_Opts(opts), m_KeyBuf(), m_KeyEnc(m_KeyBuf)
+{
+	if (m_Opts.capacity == 0)
+		m_Opts.capacity = 1;
+	m_Slots.reserve(m_Opts.capacity);
+	m_Index.reserve(m_Opts.capacity);
+}
+
+template<class BUFFER, class NetProvider>
+SelectCache<BUFFER, NetProvider>::~SelectCache()
+{
+	/* Handlers refer to the cache. */
+	for (auto &[conn, key] : m_Watches)
+		conn->unwatch(key);
+}
+
+template<class BUFFER, class NetProvider>
+template <class T>
+void
+SelectCache<BUFFER, NetProvider>::encodeKey(const T &key, uint32_t space_id,
+					    uint32_t index_id, uint32_t limit,
+					    uint32_t offset,
+					    IteratorType iterator)
+{
+	/* The same as body of SELECT made by RequestEncoder. */
+	m_KeyEnc.add(mpp::as_map(std::forward_as_tuple(
+		MPP_AS_CONST(Iproto::SPACE_ID), space_id,
+		MPP_AS_CONST(Iproto::INDEX_ID), index_id,
+		MPP_AS_CONST(Iproto::LIMIT), limit,
+		MPP_AS_CONST(Iproto::OFFSET), offset,
+		MPP_AS_CONST(Iproto::ITERATOR), iterator,
+		MPP_AS_CONST(Iproto::KEY), key)));
+	size_t size = m_KeyBuf.end() - m_KeyBuf.begin();
+	m_Key.resize(size);
+	m_KeyBuf.get(m_KeyBuf.begin(), m_Key.data(), size);
+	m_KeyBuf.dropBack(size);
+}
+
+template<class BUFFER, class NetProvider>
+void
+SelectCache<BUFFER, NetProvider>::checkSchema(const Connection_t &conn)
+{
+	int version = conn.schemaVersion();
+	auto [itr, is_new] = m_SchemaVersions.emplace(&conn, version);
+	if (is_new || itr->second == version)
+		return;
+	invalidateAll();
+	itr->second = version;
+}
+
+template<class BUFFER, class NetProvider>
+void
+SelectCache<BUFFER, NetProvider>::erase(size_t slot)
+{
+	Slot &s = m_Slots[slot];
+	assert(s.key != nullptr);
+	m_Index.erase(*s.key);
+	s.key = nullptr;
+	s.bytes.reset();
+	s.is_referenced = false;
+	m_FreeSlots.push_back(slot);
+}
+
+template<class BUFFER, class NetProvider>
+void
+SelectCache<BUFFER, NetProvider>::invalidate(uint32_t space_id)
+{
+	for (size_t i = 0; i < m_Slots.size(); i++) {
+		if (m_Slots[i].key != nullptr && m_Slots[i].space_id == space_id)
+			erase(i);
+	}
+}
+
+template<class BUFFER, class NetProvider>
+void
+SelectCache<BUFFER, NetProvider>::invalidateAll()
+{
+	m_Index.clear();
+	m_Slots.clear();
+	m_FreeSlots.clear();
+	m_Hand = 0;
+}
+
+template<class BUFFER, class NetProvider>
+int
+SelectCache<BUFFER, NetProvider>::invalidateOnWatch(Connection_t &conn,
+						    const std::string &event_key,
+						    uint32_t space_id)
+{
+	int rc = conn.watch(event_key, [this, space_id](const std::string &,
+							 const std::string &) {
+		invalidate(space_id);
+	});
+	if (rc != 0)
+		return rc;
+	for (auto &[watched_conn, key] : m_Watches) {
+		if (watched_conn == &conn && key == event_key)
+			return 0;
+	}
+	m_Watches.emplace_back(&conn, event_key);
+	return 0;
+}
+
+template<class BUFFER, class NetProvider>
+size_t
+SelectCache<BUFFER, NetProvider>::allocSlot()
+{
+	if (!m_FreeSlots.empty()) {
+		size_t slot = m_FreeSlots.back();
+		m_FreeSlots.pop_back();
+		return slot;
+	}
+	if (m_Slots.size() < m_Opts.capacity) {
+		m_Slots.emplace_back();
+		return m_Slots.size() - 1;
+	}
+	/* Give a second chance to entries accessed since the last pass. */
+	while (m_Slots[m_Hand].is_referenced) {
+		m_Slots[m_Hand].is_referenced = false;
+		m_Hand = (m_Hand + 1) % m_Slots.size();
+	}
+	size_t slot = m_Hand;
+	m_Hand = (m_Hand + 1) % m_Slots.size();
+	erase(slot);
+	m_FreeSlots.pop_back();
+	m_Evictions++;
+	return slot;
+}
+
+template<class BUFFER, class NetProvider>
+std::shared_ptr<const std::string>
+SelectCache<BUFFER, NetProvider>::copyData(Connection_t &conn,
+					   Response<BUFFER> &response)
+{
+	auto bytes = std::make_shared<std::string>();
+	size_t count = 0;
+	if (response.body.data != std::nullopt)
+		count = response.body.data->tuples.size();
+	if (count < 16) {
+		bytes->push_back(static_cast<char>(0x90 | count));
+	} else {
+		uint32_t be_count = __builtin_bswap32(count);
+		bytes->push_back('\xdd');
+		bytes->append(reinterpret_cast<const char *>(&be_count),
+			      sizeof(be_count));
+	}
+	if (count == 0)
+		return bytes;
+	/* Tuples are placed in a row: copy them from the first to the last. */
+	BUFFER &buf = conn.getInBuf();
+	auto &tuples = response.body.data->tuples;
+	typename BUFFER::iterator begin = tuples[0].begin;
+	mpp::Dec<BUFFER> dec(buf);
+	dec.SetPosition(tuples[count - 1].begin);
+	dec.SetReader(false, SkipValueReader<BUFFER>{dec});
+	if (dec.Read() != mpp::READ_SUCCESS)
+		return nullptr;
+	size_t size = dec.getPosition() - begin;
+	size_t header_size = bytes->size();
+	bytes->resize(header_size + size);
+	buf.get(begin, bytes->data() + header_size, size);
+	return bytes;
+}
+
+template<class BUFFER, class NetProvider>
+CachedSelect
+SelectCache<BUFFER, NetProvider>::makeResult(std::shared_ptr<const std::string> bytes,
+					     bool is_hit)
+{
+	using Buffer_t = CachedSelect::Buffer_t;
+	Buffer_t buf(bytes->data(), bytes->size());
+	Buffer_t::iterator begin = buf.begin();
+	Buffer_t::iterator end = buf.end();
+	CachedSelect result{bytes, Data<Buffer_t>(end), is_hit};
+	mpp::Dec<Buffer_t> dec(buf);
+	dec.SetPosition(begin);
+	dec.SetReader(false, DataReader<Buffer_t>{dec, result.data});
+	mpp::ReadResult_t rc = dec.Read();
+	/* The copy is made by the cache, it can't be broken. */
+	assert(rc == mpp::READ_SUCCESS);
+	(void) rc;
+	return result;
+}
+
+template<class BUFFER, class NetProvider>
+template <class T>
+std::optional<CachedSelect>
+SelectCache<BUFFER, NetProvider>::select(Connection_t &conn, const T &key,
+					 uint32_t space_id, uint32_t index_id,
+					 uint32_t limit, uint32_t offset,
+					 IteratorType iterator, int timeout)
+{
+	checkSchema(conn);
+	encodeKey(key, space_id, index_id, limit, offset, iterator);
+	auto itr = m_Index.find(m_Key);
+	if (itr != m_Index.end()) {
+		Slot &slot = m_Slots[itr->second];
+		if (m_Opts.ttl == 0 || Clock_t::now() < slot.expires) {
+			m_Hits++;
+			slot.is_referenced = true;
+			return makeResult(slot.bytes, true);
+		}
+		erase(itr->second);
+	}
+	m_Misses++;
+	rid_t f = conn.space[space_id].index[index_id].select(key, limit,
+							      offset, iterator);
+	if (m_Connector.wait(conn, f, timeout) != 0) {
+		m_Error = "Failed to select: " + conn.getError();
+		return std::nullopt;
+	}
+	Response<BUFFER> response = *conn.getResponse(f);
+	if (response.header.code != 0) {
+		m_Error = "Select has failed";
+		if (response.body.error_stack != std::nullopt) {
+			const Error &err = response.body.error_stack->error;
+			m_Error += ": " + std::string(err.msg, err.msg_len);
+		}
+		return std::nullopt;
+	}
+	std::shared_ptr<const std::string> bytes = copyData(conn, response);
+	if (bytes == nullptr) {
+		m_Error = "Failed to decode response to select";
+		return std::nullopt;
+	}
+	/* Data of the old schema must not be cached. */
+	checkSchema(conn);
+	size_t slot = allocSlot();
+	auto [entry, is_new] = m_Index.emplace(m_Key, slot);
+	assert(is_new);
+	(void) is_new;
+	Slot &s = m_Slots[slot];
+	s.bytes = bytes;
+	s.key = &entry->first;
+	s.space_id = space_id;
+	s.is_referenced = false;
+	if (m_Opts.ttl != 0)
+		s.expires = Clock_t::now() + std::chrono::milliseconds(m_Opts.ttl);
+	return makeResult(std::move(bytes), false);
+}
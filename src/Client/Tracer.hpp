@@ -0,0 +1,128 @@
+#pragma once
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <cstddef>
+#include <cstdint>
+
+#include "LatencyStat.hpp"
+
+#if defined(TNTCXX_ENABLE_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define TNTCXX_HAS_USDT
+#endif
+#endif
+
+/** Points of request path where tracer hooks are fired. */
+enum TracePoint {
+	/** Request is encoded into output buffer. */
+	TRACE_ENCODED = 0,
+	/** Data is passed to sendmsg(). */
+	TRACE_SEND,
+	/** Data is received by recvmsg(). */
+	TRACE_RECV,
+	/** Response is found in input buffer and is going to be decoded. */
+	TRACE_DECODE_START,
+	/** Response is decoded and is ready to be taken by user. */
+	TRACE_DECODE_END,
+	TRACE_POINT_MAX
+};
+
+static inline const char *
+tracePointToStr(TracePoint point)
+{
+	switch (point) {
+		case TRACE_ENCODED      : return "encoded";
+		case TRACE_SEND         : return "send";
+		case TRACE_RECV         : return "recv";
+		case TRACE_DECODE_START : return "decode_start";
+		case TRACE_DECODE_END   : return "decode_end";
+		default                 : return "unknown";
+	}
+}
+
+/**
+ * Tracer is a compile-time policy of network provider (and connections
+ * bound to it). It must define ENABLED constant and static method
+ * trace(point, socket, sync, bytes, timestamp), where timestamp is taken
+ * from the monotonic clock in nanoseconds. sync is 0 for TRACE_SEND,
+ * TRACE_RECV and TRACE_DECODE_START since data of several requests can
+ * be sent or received by one call. The clock is not read at all if
+ * the tracer is disabled.
+ */
+struct NoopTracer {
+	static constexpr bool ENABLED = false;
+	static void trace(TracePoint, int, size_t, size_t, uint64_t) {}
+};
+
+#ifdef TNTCXX_HAS_USDT
+/**
+ * Tracer setting USDT probes tntcxx:encoded, tntcxx:send, tntcxx:recv,
+ * tntcxx:decode_start and tntcxx:decode_end with arguments
+ * (socket, sync, bytes, timestamp). Probe sites are nops until
+ * a tool like bpftrace attaches to them.
+ */
+struct UsdtTracer {
+	static constexpr bool ENABLED = true;
+	static void trace(TracePoint point, int socket, size_t sync,
+			  size_t bytes, uint64_t ts)
+	{
+		switch (point) {
+			case TRACE_ENCODED:
+				DTRACE_PROBE4(tntcxx, encoded, socket, sync, bytes, ts);
+				break;
+			case TRACE_SEND:
+				DTRACE_PROBE4(tntcxx, send, socket, sync, bytes, ts);
+				break;
+			case TRACE_RECV:
+				DTRACE_PROBE4(tntcxx, recv, socket, sync, bytes, ts);
+				break;
+			case TRACE_DECODE_START:
+				DTRACE_PROBE4(tntcxx, decode_start, socket, sync, bytes, ts);
+				break;
+			case TRACE_DECODE_END:
+				DTRACE_PROBE4(tntcxx, decode_end, socket, sync, bytes, ts);
+				break;
+			default:
+				break;
+		}
+	}
+};
+#endif
+
+/** Fire hook of TRACER, compiled out completely for disabled tracers. */
+template <class TRACER>
+static inline void
+traceEvent(TracePoint point, int socket, size_t sync, size_t bytes)
+{
+	if constexpr (TRACER::ENABLED)
+		TRACER::trace(point, socket, sync, bytes, latencyClock());
+}
@@ -0,0 +1,118 @@
+#pragma once
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+/**
+ * Vector clock: LSN of the last row applied from each replica. It is the
+ * position in the replication stream and a snapshot/xlog file signature.
+ * Components are kept sorted by replica id in a fixed array, so the object
+ * is trivially copyable and never allocates. Iteration yields pairs
+ * {replica id, lsn}, so the clock is encoded by mpp as msgpack map.
+ */
+class Vclock {
+public:
+	/** Max count of replicas in a replica set. */
+	static constexpr size_t VCLOCK_MAX = 32;
+	using Component_t = std::pair<uint32_t, int64_t>;
+
+	/** LSN of replica @a replica_id; 0 if there's no such component. */
+	int64_t get(uint32_t replica_id) const
+	{
+		size_t i = find(replica_id);
+		return i < m_Size && m_Components[i].first == replica_id ?
+		       m_Components[i].second : 0;
+	}
+	/**
+	 * Set LSN of replica @a replica_id.
+	 * Return -1 if id is out of range (can't be stored), 0 otherwise.
+	 */
+	int set(uint32_t replica_id, int64_t lsn)
+	{
+		if (replica_id >= VCLOCK_MAX)
+			return -1;
+		size_t i = find(replica_id);
+		if (i == m_Size || m_Components[i].first != replica_id) {
+			for (size_t j = m_Size; j > i; j--)
+				m_Components[j] = m_Components[j - 1];
+			m_Size++;
+		}
+		m_Components[i] = {replica_id, lsn};
+		return 0;
+	}
+	/** Advance component @a replica_id to @a lsn if it is greater. */
+	int follow(uint32_t replica_id, int64_t lsn)
+	{
+		if (lsn <= get(replica_id))
+			return 0;
+		return set(replica_id, lsn);
+	}
+	/** Sum of all components: total count of rows behind the clock. */
+	int64_t sum() const
+	{
+		int64_t res = 0;
+		for (const Component_t &c : *this)
+			res += c.second;
+		return res;
+	}
+	void reset() { m_Size = 0; }
+	bool empty() const { return m_Size == 0; }
+	size_t size() const { return m_Size; }
+	const Component_t *begin() const { return m_Components; }
+	const Component_t *end() const { return m_Components + m_Size; }
+
+	bool operator==(const Vclock &other) const
+	{
+		if (m_Size != other.m_Size)
+			return false;
+		for (size_t i = 0; i < m_Size; i++) {
+			if (m_Components[i] != other.m_Components[i])
+				return false;
+		}
+		return true;
+	}
+	bool operator!=(const Vclock &other) const { return !(*this == other); }
+
+private:
+	/** Index of the first component with id not less than @a replica_id. */
+	size_t find(uint32_t replica_id) const
+	{
+		size_t i = 0;
+		while (i < m_Size && m_Components[i].first < replica_id)
+			i++;
+		return i;
+	}
+
+	Component_t m_Components[VCLOCK_MAX];
+	size_t m_Size = 0;
+};
@@ -0,0 +1,515 @@
+#pragma once
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "IprotoConstants.hpp"
+#include "RowDecoder.hpp"
+#include "Vclock.hpp"
+#include "../Buffer/PtrBuffer.hpp"
+#include "../Utils/Crc32.hpp"
+
+/** Text meta of xlog/snap file preceding its tx blocks. */
+struct XlogMeta {
+	/** Type of the file: "XLOG", "SNAP" etc. */
+	std::string filetype;
+	/** Version of the file format, "0.13". */
+	std::string version;
+	/** Version of Tarantool which has written the file. */
+	std::string server_version;
+	std::string instance_uuid;
+	/** Vclock of the first row of the file. */
+	Vclock vclock;
+	/** Vclock of the previous xlog file, if it's known. */
+	Vclock prev_vclock;
+};
+
+/** Location of data of a tx block within the file. */
+struct XlogTx {
+	size_t offset;
+	size_t size;
+	uint32_t crc32c;
+};
+
+/**
+ * Offline reader of Tarantool xlog and snap files. The file is mapped
+ * to memory, rows are decoded right from the mapping by msgpack decoder
+ * over PtrBuffer: there's no copies, tuples of rows passed to a handler
+ * point into the mapping and remain valid until the reader is closed.
+ * Checksum of each tx block is verified before its rows are decoded.
+ * Tx blocks are independent, so they can be checked and decoded by
+ * several threads. Compressed tx blocks are not supported.
+ */
+class XlogReader {
+public:
+	using Buffer_t = tnt::PtrBuffer;
+	using Row_t = Row<Buffer_t>;
+
+	XlogReader() = default;
+	~XlogReader() { close(); }
+	XlogReader(const XlogReader& reader) = delete;
+	XlogReader& operator = (const XlogReader& reader) = delete;
+
+	/** Map file @a path and parse its meta. */
+	int open(const std::string &path);
+	void close();
+	bool isOpen() const { return m_Data != nullptr; }
+
+	/**
+	 * Invoke void handler(const Row_t &row) for each row of the file
+	 * in order. Return count of rows, -1 on error.
+	 */
+	template <class HANDLER>
+	int64_t readRows(HANDLER &&handler);
+	/**
+	 * The same as readRows(), but tx blocks are split into @a threads
+	 * ranges of similar size which are processed simultaneously. So
+	 * the handler is invoked concurrently: rows of a tx are passed in
+	 * order by the same thread, but order of tx blocks is not kept.
+	 * Nothing is passed to the handler if the file has invalid fixheader.
+	 */
+	template <class HANDLER>
+	int64_t readRowsParallel(HANDLER &&handler, size_t threads);
+	/** Find all tx blocks of the file without decoding them. */
+	int scan(std::vector<XlogTx> &txs);
+
+	const XlogMeta& meta() const { return m_Meta; }
+	/** Buffer to decode tuples of rows with. */
+	Buffer_t& buffer() { return *m_Buf; }
+	/** The file is finished by EOF marker, i.e. it was closed properly. */
+	bool hasEof() const { return m_HasEof; }
+	const std::string& getError() const { return m_Error; }
+
+private:
+	int parseMeta();
+	/**
+	 * Parse fixheader of tx block at @a offset and move the offset to
+	 * the next block. Return 1 at the end of file.
+	 */
+	int nextTx(size_t &offset, XlogTx &tx);
+	/** Verify checksum of tx @a tx and pass its rows to @a handler. */
+	template <class HANDLER>
+	int64_t readTx(RowDecoder<Buffer_t> &dec, const XlogTx &tx,
+		       HANDLER &handler, std::string &error);
+	void setError(const std::string &msg);
+
+	int m_Fd = -1;
+	const char *m_Data = nullptr;
+	size_t m_Size = 0;
+	std::optional<Buffer_t> m_Buf;
+	/** Offset of the first tx block. */
+	size_t m_DataOffset = 0;
+	XlogMeta m_Meta;
+	bool m_HasEof = false;
+	std::string m_Error;
+};
+
+namespace xlog_details {
+
+/** Decode msgpack uint from [@a pos, @a end). */
+inline bool
+readMpUint(const char *&pos, const char *end, uint64_t &value)
+{
+	if (pos == end)
+		return false;
+	uint8_t tag = *pos;
+	if (tag < 0x80) {
+		value = tag;
+		pos++;
+		return true;
+	}
+	if (tag < 0xcc || tag > 0xcf)
+		return false;
+	size_t size = 1u << (tag - 0xcc);
+	if ((size_t)(end - pos) < size + 1)
+		return false;
+	value = 0;
+	for (size_t i = 1; i <= size; i++)
+		value = (value << 8) | (uint8_t) pos[i];
+	pos += size + 1;
+	return true;
+}
+
+/** Parse vclock in text form: {1: 10, 2: 5}. */
+inline bool
+parseVclock(std::string_view str, Vclock &vclock)
+{
+	vclock.reset();
+	const char *pos = str.data();
+	const char *end = str.data() + str.size();
+	auto skipSpaces = [&]() {
+		while (pos != end && *pos == ' ')
+			pos++;
+	};
+	skipSpaces();
+	if (pos == end || *pos++ != '{')
+		return false;
+	for (;;) {
+		skipSpaces();
+		if (pos != end && *pos == '}')
+			return true;
+		uint32_t id;
+		int64_t lsn;
+		auto res = std::from_chars(pos, end, id);
+		if (res.ec != std::errc())
+			return false;
+		pos = res.ptr;
+		skipSpaces();
+		if (pos == end || *pos++ != ':')
+			return false;
+		skipSpaces();
+		res = std::from_chars(pos, end, lsn);
+		if (res.ec != std::errc() || vclock.set(id, lsn) != 0)
+			return false;
+		pos = res.ptr;
+		skipSpaces();
+		if (pos != end && *pos == ',')
+			pos++;
+		else if (pos == end || *pos != '}')
+			return false;
+	}
+}
+
+} // namespace xlog_details {
+
+inline void
+XlogReader::setError(const std::string &msg)
+{
+	LOG_ERROR(msg);
+	m_Error = msg;
+}
+
+inline int
+XlogReader::open(const std::string &path)
+{
+	close();
+	m_Fd = ::open(path.c_str(), O_RDONLY);
+	if (m_Fd < 0) {
+		setError("Failed to open " + path + ": " + strerror(errno));
+		return -1;
+	}
+	struct stat st;
+	if (fstat(m_Fd, &st) != 0) {
+		setError("Failed to stat " + path + ": " + strerror(errno));
+		close();
+		return -1;
+	}
+	m_Size = st.st_size;
+	if (m_Size == 0) {
+		setError("File " + path + " is empty");
+		close();
+		return -1;
+	}
+	void *data = mmap(nullptr, m_Size, PROT_READ, MAP_PRIVATE, m_Fd, 0);
+	if (data == MAP_FAILED) {
+		setError("Failed to map " + path + ": " + strerror(errno));
+		close();
+		return -1;
+	}
+	madvise(data, m_Size, MADV_SEQUENTIAL);
+	m_Data = (const char *) data;
+	m_Buf.emplace(m_Data, m_Size);
+	if (parseMeta() != 0) {
+		close();
+		return -1;
+	}
+	return 0;
+}
+
+inline void
+XlogReader::close()
+{
+	if (m_Data != nullptr)
+		munmap((void *) m_Data, m_Size);
+	if (m_Fd >= 0)
+		::close(m_Fd);
+	m_Data = nullptr;
+	m_Size = 0;
+	m_Fd = -1;
+	m_Buf.reset();
+	m_DataOffset = 0;
+	m_Meta = XlogMeta{};
+	m_HasEof = false;
+}
+
+inline int
+XlogReader::parseMeta()
+{
+	std::string_view text(m_Data, m_Size);
+	size_t pos = 0;
+	size_t line_no = 0;
+	for (;; line_no++) {
+		size_t eol = text.find('\n', pos);
+		if (eol == std::string_view::npos) {
+			setError("Unexpected end of file meta");
+			return -1;
+		}
+		std::string_view line = text.substr(pos, eol - pos);
+		pos = eol + 1;
+		if (line_no == 0) {
+			m_Meta.filetype = line;
+			continue;
+		}
+		if (line_no == 1) {
+			m_Meta.version = line;
+			if (line != "0.12" && line != "0.13") {
+				setError("Unsupported file format version " +
+					 m_Meta.version);
+				return -1;
+			}
+			continue;
+		}
+		if (line.empty())
+			break;
+		size_t colon = line.find(':');
+		if (colon == std::string_view::npos) {
+			setError("Invalid file meta line: " + std::string(line));
+			return -1;
+		}
+		std::string_view key = line.substr(0, colon);
+		std::string_view value = line.substr(colon + 1);
+		while (!value.empty() && value.front() == ' ')
+			value.remove_prefix(1);
+		if (key == "Version") {
+			m_Meta.server_version = value;
+		} else if (key == "Instance" || key == "Server") {
+			m_Meta.instance_uuid = value;
+		} else if (key == "VClock" || key == "PrevVClock") {
+			Vclock &vclock = key == "VClock" ? m_Meta.vclock :
+					 m_Meta.prev_vclock;
+			if (!xlog_details::parseVclock(value, vclock)) {
+				setError("Invalid vclock in file meta: " +
+					 std::string(value));
+				return -1;
+			}
+		}
+		/* Other keys are ignored. */
+	}
+	m_DataOffset = pos;
+	return 0;
+}
+
+inline int
+XlogReader::nextTx(size_t &offset, XlogTx &tx)
+{
+	size_t left = m_Size - offset;
+	if (left == 0)
+		return 1;
+	if (left < sizeof(uint32_t)) {
+		setError("Truncated tx block at offset " + std::to_string(offset));
+		return -1;
+	}
+	uint32_t magic = __builtin_bswap32(m_Buf->get<uint32_t>(m_Buf->begin() + offset));
+	if (magic == Iproto::XLOG_EOF_MARKER) {
+		m_HasEof = true;
+		if (left != sizeof(uint32_t)) {
+			setError("Data after EOF marker at offset " +
+				 std::to_string(offset));
+			return -1;
+		}
+		offset = m_Size;
+		return 1;
+	}
+	if (magic == Iproto::XLOG_ZROW_MARKER) {
+		setError("Compressed tx blocks are not supported");
+		return -1;
+	}
+	if (magic != Iproto::XLOG_ROW_MARKER) {
+		setError("Invalid tx block magic at offset " +
+			 std::to_string(offset));
+		return -1;
+	}
+	if (left < Iproto::XLOG_FIXHEADER_SIZE) {
+		setError("Truncated tx block at offset " + std::to_string(offset));
+		return -1;
+	}
+	const char *pos = m_Data + offset + sizeof(uint32_t);
+	const char *end = m_Data + offset + Iproto::XLOG_FIXHEADER_SIZE;
+	uint64_t len, crc32p, crc32c;
+	if (!xlog_details::readMpUint(pos, end, len) ||
+	    !xlog_details::readMpUint(pos, end, crc32p) ||
+	    !xlog_details::readMpUint(pos, end, crc32c) ||
+	    crc32c > UINT32_MAX) {
+		setError("Invalid fixheader at offset " + std::to_string(offset));
+		return -1;
+	}
+	/* The rest of fixheader is padding. */
+	tx.offset = offset + Iproto::XLOG_FIXHEADER_SIZE;
+	if (len > m_Size - tx.offset) {
+		setError("Truncated tx block at offset " + std::to_string(offset));
+		return -1;
+	}
+	tx.size = len;
+	tx.crc32c = crc32c;
+	offset = tx.offset + tx.size;
+	return 0;
+}
+
+inline int
+XlogReader::scan(std::vector<XlogTx> &txs)
+{
+	assert(isOpen());
+	m_HasEof = false;
+	size_t offset = m_DataOffset;
+	XlogTx tx;
+	int rc;
+	while ((rc = nextTx(offset, tx)) == 0)
+		txs.push_back(tx);
+	return rc < 0 ? -1 : 0;
+}
+
+template <class HANDLER>
+int64_t
+XlogReader::readTx(RowDecoder<Buffer_t> &dec, const XlogTx &tx,
+		   HANDLER &handler, std::string &error)
+{
+	if (tnt::crc32c(0, m_Data + tx.offset, tx.size) != tx.crc32c) {
+		error = "Checksum mismatch of tx block at offset " +
+			std::to_string(tx.offset - Iproto::XLOG_FIXHEADER_SIZE);
+		return -1;
+	}
+	Buffer_t::iterator itr = m_Buf->begin() + tx.offset;
+	Buffer_t::iterator end = itr + tx.size;
+	dec.reset(itr);
+	Row_t row;
+	int64_t count = 0;
+	while (itr != end) {
+		if (dec.decodeNextRow(row, end) != 0) {
+			error = "Failed to decode row at offset " +
+				std::to_string(itr.data() - m_Data);
+			return -1;
+		}
+		itr += row.size;
+		handler(static_cast<const Row_t &>(row));
+		count++;
+	}
+	return count;
+}
+
+template <class HANDLER>
+int64_t
+XlogReader::readRows(HANDLER &&handler)
+{
+	assert(isOpen());
+	m_HasEof = false;
+	RowDecoder<Buffer_t> dec(*m_Buf);
+	size_t offset = m_DataOffset;
+	XlogTx tx;
+	int64_t count = 0;
+	int rc;
+	while ((rc = nextTx(offset, tx)) == 0) {
+		std::string error;
+		int64_t rows = readTx(dec, tx, handler, error);
+		if (rows < 0) {
+			setError(error);
+			return -1;
+		}
+		count += rows;
+	}
+	return rc < 0 ? -1 : count;
+}
+
+template <class HANDLER>
+int64_t
+XlogReader::readRowsParallel(HANDLER &&handler, size_t threads)
+{
+	assert(isOpen());
+	if (threads <= 1)
+		return readRows(handler);
+	std::vector<XlogTx> txs;
+	if (scan(txs) != 0)
+		return -1;
+	if (txs.empty())
+		return 0;
+	size_t total = 0;
+	for (const XlogTx &tx : txs)
+		total += tx.size;
+
+	struct Part {
+		size_t begin;
+		size_t end;
+		int64_t rows;
+		std::string error;
+	};
+	/* Contiguous ranges of tx blocks with similar amount of data. */
+	std::vector<Part> parts;
+	size_t bytes = 0;
+	size_t next = 0;
+	for (size_t i = 0; i < txs.size(); i++) {
+		bytes += txs[i].size;
+		if (bytes * threads >= total * (parts.size() + 1) ||
+		    i + 1 == txs.size()) {
+			parts.push_back(Part{next, i + 1, 0, {}});
+			next = i + 1;
+		}
+	}
+	auto work = [&](Part &part) {
+		RowDecoder<Buffer_t> dec(*m_Buf);
+		for (size_t i = part.begin; i < part.end; i++) {
+			int64_t rows = readTx(dec, txs[i], handler, part.error);
+			if (rows < 0) {
+				part.rows = -1;
+				return;
+			}
+			part.rows += rows;
+		}
+	};
+	std::vector<std::thread> workers;
+	workers.reserve(parts.size() - 1);
+	for (size_t i = 1; i < parts.size(); i++)
+		workers.emplace_back(work, std::ref(parts[i]));
+	work(parts[0]);
+	for (std::thread &t : workers)
+		t.join();
+
+	int64_t count = 0;
+	for (const Part &part : parts) {
+		if (part.rows < 0) {
+			setError(part.error);
+			return -1;
+		}
+		count += part.rows;
+	}
+	return count;
+}
@@ -0,0 +1,413 @@
+#pragma once
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Log record is a fixed-size chunk of memory containing arguments of
+ * a log call in binary form and a pointer to the function which knows
+ * how to format them. So the producer only copies arguments, while
+ * formatting and writing to the stream is done by the consumer.
+ */
+struct LogRecordHeader {
+	using Format_t = void (*)(std::ostream &strm, const char *payload,
+				  size_t arg_count);
+	Format_t format;
+	std::ostream *strm;
+	/** Static string, e.g. name of log level. */
+	const char *prefix;
+	/** Count of arguments fit into payload. */
+	size_t arg_count;
+};
+
+struct LogRecord : LogRecordHeader {
+	static constexpr size_t SIZE = 256;
+	static constexpr size_t PAYLOAD_SIZE = SIZE - sizeof(LogRecordHeader);
+	char payload[PAYLOAD_SIZE];
+};
+
+static_assert(sizeof(LogRecord) == LogRecord::SIZE, "Unexpected padding");
+
+/** Strings are copied into record (and truncated if they don't fit). */
+template <class T>
+constexpr bool isLogString_v = std::is_same_v<T, const char *> ||
+			       std::is_same_v<T, char *> ||
+			       std::is_same_v<T, std::string> ||
+			       std::is_same_v<T, std::string_view>;
+
+/** Scalars are copied as is. Everything else is formatted in place. */
+template <class T>
+constexpr bool isLogScalar_v = (std::is_arithmetic_v<T> ||
+				std::is_enum_v<T> ||
+				std::is_pointer_v<T>) && !isLogString_v<T>;
+
+class LogRecordWriter {
+public:
+	explicit LogRecordWriter(LogRecord &rec) :
+		m_Rec(rec), m_Pos(rec.payload),
+		m_End(rec.payload + LogRecord::PAYLOAD_SIZE)
+	{
+		m_Rec.arg_count = 0;
+	}
+	/** Return false if there's no space left for the argument. */
+	template <class T>
+	bool put(const T &arg)
+	{
+		using U = std::decay_t<T>;
+		if constexpr (isLogScalar_v<U>) {
+			if ((size_t) (m_End - m_Pos) < sizeof(U))
+				return false;
+			U u = arg;
+			memcpy(m_Pos, &u, sizeof(U));
+			m_Pos += sizeof(U);
+			m_Rec.arg_count++;
+			return true;
+		} else if constexpr (std::is_array_v<T>) {
+			return putStr(std::string_view{arg});
+		} else if constexpr (std::is_pointer_v<U>) {
+			return putStr(arg == nullptr ? std::string_view{"(null)"} :
+				      std::string_view{arg});
+		} else if constexpr (isLogString_v<U>) {
+			return putStr(arg);
+		} else {
+			std::ostringstream strm;
+			strm << arg;
+			return putStr(strm.str());
+		}
+	}
+
+private:
+	bool putStr(std::string_view str)
+	{
+		if ((size_t) (m_End - m_Pos) < sizeof(uint16_t))
+			return false;
+		size_t left = m_End - m_Pos - sizeof(uint16_t);
+		uint16_t len = str.size() < left ? str.size() : left;
+		memcpy(m_Pos, &len, sizeof(len));
+		m_Pos += sizeof(len);
+		memcpy(m_Pos, str.data(), len);
+		m_Pos += len;
+		m_Rec.arg_count++;
+		return true;
+	}
+
+	LogRecord &m_Rec;
+	char *m_Pos;
+	char *m_End;
+};
+
+template <class T>
+static inline void
+logRecordGet(std::ostream &strm, const char *&pos)
+{
+	if constexpr (isLogScalar_v<T>) {
+		T t;
+		memcpy(&t, pos, sizeof(T));
+		pos += sizeof(T);
+		strm << t;
+	} else {
+		uint16_t len;
+		memcpy(&len, pos, sizeof(len));
+		pos += sizeof(len);
+		strm.write(pos, len);
+		pos += len;
+	}
+}
+
+/** Format first @a arg_count arguments stored by LogRecordWriter. */
+template <class... ARGS>
+static inline void
+logRecordFormat(std::ostream &strm, const char *pos, size_t arg_count)
+{
+	size_t i = 0;
+	((i++ < arg_count && (logRecordGet<ARGS>(strm, pos), true)) && ...);
+}
+
+/**
+ * Lock-free ring of log records with single producer and single consumer.
+ * Producer never waits: if the ring is full, the record is dropped.
+ */
+class LogRing {
+public:
+	/** @a capacity must be a power of two. */
+	explicit LogRing(size_t capacity) : m_Records(capacity)
+	{
+		assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+	}
+	/** Producer: get a record to fill or nullptr if the ring is full. */
+	LogRecord *reserve()
+	{
+		size_t tail = m_Tail.load(std::memory_order_relaxed);
+		if (tail - m_Head.load(std::memory_order_acquire) ==
+		    m_Records.size()) {
+			m_Dropped.store(m_Dropped.load(std::memory_order_relaxed) + 1,
+					std::memory_order_relaxed);
+			return nullptr;
+		}
+		return &m_Records[tail & (m_Records.size() - 1)];
+	}
+	/** Producer: publish the record got by reserve(). */
+	void commit()
+	{
+		size_t tail = m_Tail.load(std::memory_order_relaxed);
+		m_Tail.store(tail + 1, std::memory_order_release);
+	}
+	/** Consumer: get the oldest record or nullptr if the ring is empty. */
+	LogRecord *peek()
+	{
+		size_t head = m_Head.load(std::memory_order_relaxed);
+		if (head == m_Tail.load(std::memory_order_acquire))
+			return nullptr;
+		return &m_Records[head & (m_Records.size() - 1)];
+	}
+	/** Consumer: release the record got by peek(). */
+	void pop()
+	{
+		size_t head = m_Head.load(std::memory_order_relaxed);
+		m_Head.store(head + 1, std::memory_order_release);
+	}
+	bool empty() const
+	{
+		return m_Head.load(std::memory_order_acquire) ==
+		       m_Tail.load(std::memory_order_acquire);
+	}
+	size_t dropped() const
+	{
+		return m_Dropped.load(std::memory_order_relaxed);
+	}
+	/** Producer: no more records will be pushed (the thread exits). */
+	void release()
+	{
+		m_Released.store(true, std::memory_order_release);
+	}
+	/**
+	 * Consumer: check whether the producer has gone. Records committed
+	 * before release() are visible once it returns true.
+	 */
+	bool isReleased() const
+	{
+		return m_Released.load(std::memory_order_acquire);
+	}
+	/** Consumer: hand a drained released ring to a new producer. */
+	void reuse()
+	{
+		assert(isReleased() && empty());
+		m_Released.store(false, std::memory_order_relaxed);
+	}
+
+private:
+	static constexpr size_t CACHELINE_SIZE = 64;
+	std::vector<LogRecord> m_Records;
+	alignas(CACHELINE_SIZE) std::atomic<size_t> m_Head{0};
+	alignas(CACHELINE_SIZE) std::atomic<size_t> m_Tail{0};
+	std::atomic<size_t> m_Dropped{0};
+	std::atomic<bool> m_Released{false};
+};
+
+/**
+ * Asynchronous logger backend. Each producer thread gets its own
+ * LogRing on the first call of push(), a background thread drains all
+ * rings, formats records and writes them to their streams. Records
+ * from one thread keep their order, records from different threads
+ * may be interleaved in any order. When a thread exits, its ring is
+ * drained and then handed to the next new thread, so the count of rings
+ * is bounded by the count of simultaneously logging threads.
+ */
+class AsyncLogBackend {
+public:
+	static constexpr size_t DEFAULT_RING_CAPACITY = 1024;
+
+	explicit AsyncLogBackend(size_t ring_capacity = DEFAULT_RING_CAPACITY) :
+		m_Id(nextId()), m_RingCapacity(ring_capacity),
+		m_Thread(&AsyncLogBackend::drainLoop, this) {}
+	/** Write all pushed records and stop the thread. */
+	~AsyncLogBackend()
+	{
+		m_Stop.store(true, std::memory_order_release);
+		m_Thread.join();
+	}
+	AsyncLogBackend(const AsyncLogBackend &) = delete;
+	AsyncLogBackend &operator=(const AsyncLogBackend &) = delete;
+
+	template <class... ARGS>
+	void push(std::ostream &strm, const char *prefix, ARGS&& ...args)
+	{
+		LogRing &ring = threadRing();
+		LogRecord *rec = ring.reserve();
+		if (rec == nullptr)
+			return;
+		rec->format = &logRecordFormat<std::decay_t<ARGS>...>;
+		rec->strm = &strm;
+		rec->prefix = prefix;
+		LogRecordWriter writer(*rec);
+		(writer.put(args) && ...);
+		ring.commit();
+	}
+	/**
+	 * Wait until all records pushed by now are written (and rings of
+	 * exited threads are ready for reuse).
+	 */
+	void flush()
+	{
+		while (!allEmpty())
+			std::this_thread::sleep_for(DRAIN_INTERVAL);
+	}
+	/** Count of records dropped since rings were full. */
+	size_t dropped()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		size_t res = 0;
+		for (auto &ring : m_Rings)
+			res += ring->dropped();
+		for (auto &ring : m_FreeRings)
+			res += ring->dropped();
+		return res;
+	}
+	/** Count of allocated rings, both used and free. */
+	size_t ringCount()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_Rings.size() + m_FreeRings.size();
+	}
+
+private:
+	static constexpr std::chrono::microseconds DRAIN_INTERVAL{500};
+
+	static uint64_t nextId()
+	{
+		static std::atomic<uint64_t> id{0};
+		return ++id;
+	}
+	/**
+	 * Ring is shared with the thread: the backend may be destroyed
+	 * before the thread exits and vice versa.
+	 */
+	struct RingHolder {
+		/* Backend id rather than address: backends can be recreated. */
+		uint64_t owner = 0;
+		std::shared_ptr<LogRing> ring;
+
+		~RingHolder()
+		{
+			if (ring != nullptr)
+				ring->release();
+		}
+	};
+	LogRing &threadRing()
+	{
+		thread_local RingHolder holder;
+		if (holder.owner != m_Id) {
+			if (holder.ring != nullptr)
+				holder.ring->release();
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			if (m_FreeRings.empty()) {
+				holder.ring =
+					std::make_shared<LogRing>(m_RingCapacity);
+			} else {
+				holder.ring = std::move(m_FreeRings.back());
+				m_FreeRings.pop_back();
+				holder.ring->reuse();
+			}
+			m_Rings.push_back(holder.ring);
+			holder.owner = m_Id;
+		}
+		return *holder.ring;
+	}
+	bool allEmpty()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		for (auto &ring : m_Rings)
+			if (!ring->empty() || ring->isReleased())
+				return false;
+		return true;
+	}
+	size_t drain()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		size_t count = 0;
+		for (size_t i = 0; i < m_Rings.size();) {
+			LogRing &ring = *m_Rings[i];
+			/* Check before draining: the last records are visible. */
+			bool is_released = ring.isReleased();
+			for (LogRecord *rec = ring.peek(); rec != nullptr;
+			     rec = ring.peek()) {
+				std::ostream &strm = *rec->strm;
+				strm << rec->prefix << ": ";
+				rec->format(strm, rec->payload, rec->arg_count);
+				strm << '\n';
+				ring.pop();
+				count++;
+			}
+			if (!is_released) {
+				i++;
+				continue;
+			}
+			m_FreeRings.push_back(std::move(m_Rings[i]));
+			m_Rings[i] = std::move(m_Rings.back());
+			m_Rings.pop_back();
+		}
+		return count;
+	}
+	void drainLoop()
+	{
+		for (;;) {
+			bool is_stopped = m_Stop.load(std::memory_order_acquire);
+			if (drain() != 0)
+				continue;
+			if (is_stopped)
+				break;
+			std::this_thread::sleep_for(DRAIN_INTERVAL);
+		}
+	}
+
+	const uint64_t m_Id;
+	const size_t m_RingCapacity;
+	std::mutex m_Mutex;
+	/** Rings of alive threads (or of exited ones not drained yet). */
+	std::vector<std::shared_ptr<LogRing>> m_Rings;
+	/** Drained rings of exited threads. */
+	std::vector<std::shared_ptr<LogRing>> m_FreeRings;
+	std::atomic<bool> m_Stop{false};
+	std::thread m_Thread;
+};
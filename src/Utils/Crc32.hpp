@@ -0,0 +1,138 @@
+#pragma once
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace tnt {
+
+namespace crc32c_details {
+
+static constexpr uint32_t POLY = 0x82F63B78;
+
+struct Tables {
+	uint32_t t[8][256];
+};
+
+constexpr Tables
+makeTables()
+{
+	Tables res{};
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t crc = i;
+		for (int j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (POLY & (0u - (crc & 1)));
+		res.t[0][i] = crc;
+	}
+	for (uint32_t i = 0; i < 256; i++) {
+		for (int k = 1; k < 8; k++) {
+			uint32_t prev = res.t[k - 1][i];
+			res.t[k][i] = (prev >> 8) ^ res.t[0][prev & 0xff];
+		}
+	}
+	return res;
+}
+
+static constexpr Tables TABLES = makeTables();
+
+inline uint32_t
+crc32cSoft(uint32_t crc, const char *data, size_t size)
+{
+	const uint8_t *p = (const uint8_t *) data;
+	const auto &t = TABLES.t;
+	for (; size >= 8; size -= 8, p += 8) {
+		uint32_t lo, hi;
+		memcpy(&lo, p, sizeof(lo));
+		memcpy(&hi, p + 4, sizeof(hi));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		lo = __builtin_bswap32(lo);
+		hi = __builtin_bswap32(hi);
+#endif
+		lo ^= crc;
+		crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^
+		      t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+		      t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^
+		      t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+	}
+	for (; size > 0; size--, p++)
+		crc = (crc >> 8) ^ t[0][(crc ^ *p) & 0xff];
+	return crc;
+}
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define TNT_CRC32C_HW 1
+
+__attribute__((target("sse4.2"))) inline uint32_t
+crc32cHw(uint32_t crc, const char *data, size_t size)
+{
+	uint64_t crc64 = crc;
+	for (; size >= 8; size -= 8, data += 8) {
+		uint64_t v;
+		memcpy(&v, data, sizeof(v));
+		crc64 = __builtin_ia32_crc32di(crc64, v);
+	}
+	crc = (uint32_t) crc64;
+	for (; size > 0; size--, data++)
+		crc = __builtin_ia32_crc32qi(crc, (uint8_t) *data);
+	return crc;
+}
+
+inline bool
+hasHw()
+{
+	static const bool has = __builtin_cpu_supports("sse4.2");
+	return has;
+}
+#endif
+
+} // namespace crc32c_details {
+
+/**
+ * CRC32C (Castagnoli) as it is used by Tarantool for xlog tx blocks:
+ * reflected polynomial 0x82F63B78 with no initial and final inversion,
+ * i.e. exactly what SSE4.2 crc32 instruction computes. Checksum of data
+ * split into parts is computed by passing result of the previous part
+ * as @a crc.
+ * SSE4.2 instruction is chosen in runtime if CPU supports it, otherwise
+ * slicing-by-8 table algorithm is used.
+ */
+inline uint32_t
+crc32c(uint32_t crc, const char *data, size_t size)
+{
+#ifdef TNT_CRC32C_HW
+	if (crc32c_details::hasHw())
+		return crc32c_details::crc32cHw(crc, data, size);
+#endif
+	return crc32c_details::crc32cSoft(crc, data, size);
+}
+
+} // namespace tnt {
@@ -0,0 +1,215 @@
+#pragma once
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+namespace tnt {
+
+/**
+ * Log-linear (HDR-style) bucketing of unsigned 64-bit values.
+ * Values below 2^SUB_BITS are counted exactly. Every next power of two
+ * range [2^k, 2^(k+1)) is split into 2^SUB_BITS equal sub-buckets, so the
+ * relative error of any reported value doesn't exceed 2^-SUB_BITS.
+ * Values greater or equal to 2^MAX_BITS fall into the last bucket.
+ * @tparam SUB_BITS log2 of count of sub-buckets per power of two.
+ * @tparam MAX_BITS log2 of upper bound of values to be distinguished.
+ */
+template <size_t SUB_BITS, size_t MAX_BITS>
+struct HistogramLayout {
+	static_assert(SUB_BITS > 0 && SUB_BITS < MAX_BITS, "Wrong layout");
+	static_assert(MAX_BITS < 64, "Wrong layout");
+
+	static constexpr size_t SUB_COUNT = size_t{1} << SUB_BITS;
+	static constexpr size_t BUCKET_COUNT = (MAX_BITS - SUB_BITS + 1) * SUB_COUNT;
+	static constexpr uint64_t VALUE_MAX = (uint64_t{1} << MAX_BITS) - 1;
+
+	/** Index of bucket the value @a v is counted in. */
+	static size_t bucketIdx(uint64_t v)
+	{
+		if (v < SUB_COUNT)
+			return v;
+		if (v > VALUE_MAX)
+			v = VALUE_MAX;
+		size_t shift = 63 - __builtin_clzll(v) - SUB_BITS;
+		return ((shift + 1) << SUB_BITS) + (v >> shift) - SUB_COUNT;
+	}
+	/** The least value counted in bucket @a idx. */
+	static uint64_t bucketLow(size_t idx)
+	{
+		assert(idx < BUCKET_COUNT);
+		if (idx < SUB_COUNT)
+			return idx;
+		size_t shift = (idx >> SUB_BITS) - 1;
+		return (SUB_COUNT + (idx & (SUB_COUNT - 1))) << shift;
+	}
+	/** The greatest value counted in bucket @a idx. */
+	static uint64_t bucketHigh(size_t idx)
+	{
+		assert(idx < BUCKET_COUNT);
+		if (idx < SUB_COUNT)
+			return idx;
+		size_t shift = (idx >> SUB_BITS) - 1;
+		return bucketLow(idx) + (uint64_t{1} << shift) - 1;
+	}
+};
+
+/**
+ * Plain (non-atomic) copy of histogram counters. Can be merged with other
+ * snapshots and queried for percentiles. It is cheap to keep it on stack:
+ * no dynamic memory is used.
+ */
+template <size_t SUB_BITS = 4, size_t MAX_BITS = 36>
+class HistogramSnapshot {
+public:
+	using Layout_t = HistogramLayout<SUB_BITS, MAX_BITS>;
+	static constexpr size_t BUCKET_COUNT = Layout_t::BUCKET_COUNT;
+
+	void reset()
+	{
+		for (size_t i = 0; i < BUCKET_COUNT; i++)
+			m_Buckets[i] = 0;
+		m_Count = m_Sum = 0;
+	}
+	void merge(const HistogramSnapshot &other)
+	{
+		for (size_t i = 0; i < BUCKET_COUNT; i++)
+			m_Buckets[i] += other.m_Buckets[i];
+		m_Count += other.m_Count;
+		m_Sum += other.m_Sum;
+	}
+	/** Total count of recorded values. */
+	uint64_t count() const { return m_Count; }
+	/** Sum of recorded values (not clamped by MAX_BITS). */
+	uint64_t sum() const { return m_Sum; }
+	double mean() const
+	{
+		return m_Count == 0 ? 0 : (double) m_Sum / m_Count;
+	}
+	uint64_t bucketCount(size_t idx) const { return m_Buckets[idx]; }
+	/**
+	 * Return the greatest value of the bucket containing @a p quantile
+	 * (0 <= p <= 1). For instance, p = 0.99 gives p99.
+	 * Empty histogram gives 0.
+	 */
+	uint64_t percentile(double p) const
+	{
+		if (m_Count == 0)
+			return 0;
+		uint64_t rank = p <= 0 ? 1 : (uint64_t) (p * m_Count + 0.5);
+		if (rank == 0)
+			rank = 1;
+		if (rank > m_Count)
+			rank = m_Count;
+		uint64_t seen = 0;
+		for (size_t i = 0; i < BUCKET_COUNT; i++) {
+			seen += m_Buckets[i];
+			if (seen >= rank)
+				return Layout_t::bucketHigh(i);
+		}
+		return Layout_t::VALUE_MAX;
+	}
+	uint64_t max() const { return percentile(1); }
+
+private:
+	template <size_t S, size_t M>
+	friend class Histogram;
+
+	uint64_t m_Buckets[BUCKET_COUNT] = {};
+	uint64_t m_Count = 0;
+	uint64_t m_Sum = 0;
+};
+
+/**
+ * Histogram with fixed set of counters designed for the single writer:
+ * record() is called from the thread owning the histogram and costs
+ * a couple of plain increments - there's no locks and atomic RMW
+ * instructions. Any other thread is allowed to take a snapshot()
+ * concurrently; counters are read independently, so the snapshot may
+ * miss a value recorded at the same moment, but never sees torn counters.
+ */
+template <size_t SUB_BITS = 4, size_t MAX_BITS = 36>
+class Histogram {
+public:
+	using Layout_t = HistogramLayout<SUB_BITS, MAX_BITS>;
+	using Snapshot_t = HistogramSnapshot<SUB_BITS, MAX_BITS>;
+	static constexpr size_t BUCKET_COUNT = Layout_t::BUCKET_COUNT;
+
+	Histogram() = default;
+	Histogram(const Histogram &) = delete;
+	Histogram &operator=(const Histogram &) = delete;
+
+	void record(uint64_t v)
+	{
+		inc(m_Buckets[Layout_t::bucketIdx(v)], 1);
+		inc(m_Count, 1);
+		inc(m_Sum, v);
+	}
+	/** Add counters to the snapshot @a snap. */
+	void snapshot(Snapshot_t &snap) const
+	{
+		for (size_t i = 0; i < BUCKET_COUNT; i++)
+			snap.m_Buckets[i] += m_Buckets[i].load(std::memory_order_relaxed);
+		snap.m_Count += m_Count.load(std::memory_order_relaxed);
+		snap.m_Sum += m_Sum.load(std::memory_order_relaxed);
+	}
+	Snapshot_t snapshot() const
+	{
+		Snapshot_t snap;
+		snapshot(snap);
+		return snap;
+	}
+	/** Must be called by the writer thread. */
+	void reset()
+	{
+		for (size_t i = 0; i < BUCKET_COUNT; i++)
+			m_Buckets[i].store(0, std::memory_order_relaxed);
+		m_Count.store(0, std::memory_order_relaxed);
+		m_Sum.store(0, std::memory_order_relaxed);
+	}
+
+private:
+	/** Single writer increment: doesn't need lock prefix. */
+	static void inc(std::atomic<uint64_t> &counter, uint64_t v)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + v,
+			      std::memory_order_relaxed);
+	}
+
+	std::atomic<uint64_t> m_Buckets[BUCKET_COUNT] = {};
+	std::atomic<uint64_t> m_Count{0};
+	std::atomic<uint64_t> m_Sum{0};
+};
+
+} // namespace tnt {
@@ -32,9 +32,12 @@
 
 #include <time.h>
 
+#include <atomic>
 #include <iostream>
 #include <string_view>
 
+#include "AsyncLogger.hpp"
+
 enum LogLevel {
 	DEBUG = 0,
 	WARNING = 1,
@@ -58,6 +61,21 @@ inline std::ostream& operator<<(std::ostream& strm, LogLevel lvl)
 	return strm << logLevelToStr(lvl);
 }
 
+/**
+ * Minimal log level: LOG_* macros with lower levels compile to nothing
+ * (their arguments are not evaluated). By default it's DEBUG in debug
+ * builds and WARNING in release ones.
+ */
+#ifndef TNTCXX_LOG_LEVEL
+#ifndef NDEBUG
+#define TNTCXX_LOG_LEVEL 0
+#else
+#define TNTCXX_LOG_LEVEL 1
+#endif
+#endif
+
+constexpr LogLevel LOG_LEVEL_MIN = static_cast<LogLevel>(TNTCXX_LOG_LEVEL);
+
 class Logger {
 public:
 	Logger(LogLevel lvl) : m_LogLvl(lvl) {};
@@ -68,6 +86,13 @@ public:
 	{
 		if (!isLogPossible(log_lvl))
 			return;
+		AsyncLogBackend *backend =
+			m_Backend.load(std::memory_order_acquire);
+		if (backend != nullptr) {
+			backend->push(strm, logLevelToStr(log_lvl),
+				      std::forward<ARGS>(args)...);
+			return;
+		}
 		time_t rawTime;
 		time(&rawTime);
 		struct tm *timeInfo = localtime(&rawTime);
@@ -85,12 +110,21 @@ public:
 	{
 		m_LogLvl = lvl;
 	}
+	/**
+	 * Write logs asynchronously via @a backend, nullptr switches back
+	 * to synchronous output. The backend must outlive its usage.
+	 */
+	void setBackend(AsyncLogBackend *backend)
+	{
+		m_Backend.store(backend, std::memory_order_release);
+	}
 private:
 	bool isLogPossible(LogLevel lvl) const
 	{
 		return lvl >= m_LogLvl;
 	};
 	LogLevel m_LogLvl;
+	std::atomic<AsyncLogBackend *> m_Backend{nullptr};
 };
 
 #ifndef NDEBUG
@@ -99,6 +133,11 @@ inline Logger gLogger(DEBUG);
 inline Logger gLogger(ERROR);
 #endif
 
-#define LOG_DEBUG(...) gLogger.log(std::cout, DEBUG, __FILE__, __LINE__,  __VA_ARGS__)
-#define LOG_WARNING(...) gLogger.log(std::cout, WARNING, __FILE__, __LINE__, __VA_ARGS__)
-#define LOG_ERROR(...) gLogger.log(std::cerr, ERROR, __FILE__, __LINE__, __VA_ARGS__)
+#define LOG_IMPL(strm, lvl, ...) do {					\
+	if constexpr (lvl >= LOG_LEVEL_MIN)				\
+		gLogger.log(strm, lvl, __FILE__, __LINE__, __VA_ARGS__);\
+} while (0)
+
+#define LOG_DEBUG(...) LOG_IMPL(std::cout, DEBUG, __VA_ARGS__)
+#define LOG_WARNING(...) LOG_IMPL(std::cout, WARNING, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_IMPL(std::cerr, ERROR, __VA_ARGS__)
@@ -0,0 +1,264 @@
+#pragma once
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <cpuid.h>
+#endif
+
+namespace tnt {
+
+namespace sha1_details {
+
+static constexpr size_t BLOCK_SIZE = 64;
+
+inline uint32_t
+rol(uint32_t x, int n)
+{
+	return (x << n) | (x >> (32 - n));
+}
+
+inline uint32_t
+loadBE(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	v = __builtin_bswap32(v);
+#endif
+	return v;
+}
+
+inline void
+sha1Soft(uint32_t state[5], const uint8_t *data, size_t blocks)
+{
+	for (; blocks > 0; blocks--, data += BLOCK_SIZE) {
+		uint32_t w[16];
+		for (int i = 0; i < 16; i++)
+			w[i] = loadBE(data + 4 * i);
+		uint32_t a = state[0], b = state[1], c = state[2];
+		uint32_t d = state[3], e = state[4];
+		for (int i = 0; i < 80; i++) {
+			if (i >= 16) {
+				w[i & 15] = rol(w[(i + 13) & 15] ^ w[(i + 8) & 15] ^
+						w[(i + 2) & 15] ^ w[i & 15], 1);
+			}
+			uint32_t f, k;
+			if (i < 20) {
+				f = (b & c) | (~b & d);
+				k = 0x5A827999;
+			} else if (i < 40) {
+				f = b ^ c ^ d;
+				k = 0x6ED9EBA1;
+			} else if (i < 60) {
+				f = (b & c) | (b & d) | (c & d);
+				k = 0x8F1BBCDC;
+			} else {
+				f = b ^ c ^ d;
+				k = 0xCA62C1D6;
+			}
+			uint32_t t = rol(a, 5) + f + e + k + w[i & 15];
+			e = d;
+			d = c;
+			c = rol(b, 30);
+			b = a;
+			a = t;
+		}
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+	}
+}
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define TNT_SHA1_HW 1
+
+/**
+ * SHA-NI: each sha1rnds4 makes 4 rounds, message schedule of the next
+ * 4 words is computed by sha1msg1/sha1msg2 from the previous 16 ones.
+ * Builtins are used instead of <immintrin.h> intrinsics: the header
+ * redeclares allocation functions which may be replaced by application.
+ */
+typedef int v4si __attribute__((vector_size(16)));
+typedef char v16qi __attribute__((vector_size(16)));
+
+__attribute__((target("sha,sse4.1"))) inline void
+sha1Hw(uint32_t state[5], const uint8_t *data, size_t blocks)
+{
+	/* Reverse bytes of 16: words are big endian, lanes are reversed. */
+	const v16qi MASK = {15, 14, 13, 12, 11, 10, 9, 8,
+			    7, 6, 5, 4, 3, 2, 1, 0};
+	v4si abcd;
+	memcpy(&abcd, state, sizeof(abcd));
+	abcd = __builtin_ia32_pshufd(abcd, 0x1B);
+	v4si e0 = {0, 0, 0, (int) state[4]};
+	for (; blocks > 0; blocks--, data += BLOCK_SIZE) {
+		v4si abcd_save = abcd;
+		v4si e0_save = e0;
+		v4si w[4];
+		for (int i = 0; i < 4; i++) {
+			v16qi bytes;
+			memcpy(&bytes, data + 16 * i, sizeof(bytes));
+			w[i] = (v4si) __builtin_ia32_pshufb128(bytes, MASK);
+		}
+		v4si e = e0 + w[0];
+		v4si prev = abcd;
+		abcd = __builtin_ia32_sha1rnds4(abcd, e, 0);
+		for (int g = 1; g < 20; g++) {
+			if (g >= 4) {
+				v4si x = __builtin_ia32_sha1msg1(w[g & 3],
+								 w[(g + 1) & 3]);
+				x ^= w[(g + 2) & 3];
+				w[g & 3] = __builtin_ia32_sha1msg2(x, w[(g + 3) & 3]);
+			}
+			e = __builtin_ia32_sha1nexte(prev, w[g & 3]);
+			prev = abcd;
+			/* Round function must be an immediate. */
+			switch (g / 5) {
+			case 0: abcd = __builtin_ia32_sha1rnds4(abcd, e, 0); break;
+			case 1: abcd = __builtin_ia32_sha1rnds4(abcd, e, 1); break;
+			case 2: abcd = __builtin_ia32_sha1rnds4(abcd, e, 2); break;
+			default: abcd = __builtin_ia32_sha1rnds4(abcd, e, 3); break;
+			}
+		}
+		e0 = __builtin_ia32_sha1nexte(prev, e0_save);
+		abcd += abcd_save;
+	}
+	abcd = __builtin_ia32_pshufd(abcd, 0x1B);
+	memcpy(state, &abcd, sizeof(abcd));
+	state[4] = e0[3];
+}
+
+inline bool
+hasHw()
+{
+	static const bool has = [] {
+		unsigned eax, ebx, ecx, edx;
+		if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) ||
+		    (ecx & bit_SSE4_1) == 0)
+			return false;
+		if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+			return false;
+		return (ebx & bit_SHA) != 0;
+	}();
+	return has;
+}
+#endif
+
+inline void
+sha1Blocks(uint32_t state[5], const uint8_t *data, size_t blocks)
+{
+#ifdef TNT_SHA1_HW
+	if (hasHw())
+		return sha1Hw(state, data, blocks);
+#endif
+	sha1Soft(state, data, blocks);
+}
+
+} // namespace sha1_details {
+
+/**
+ * Incremental SHA-1. SHA-NI instructions are chosen in runtime if CPU
+ * supports them, otherwise the portable implementation is used.
+ */
+class Sha1 {
+public:
+	static constexpr size_t DIGEST_SIZE = 20;
+
+	void update(const void *data, size_t size);
+	/** Write digest to @a out; the object must not be used after. */
+	void finish(uint8_t out[DIGEST_SIZE]);
+private:
+	uint32_t m_State[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE,
+			       0x10325476, 0xC3D2E1F0};
+	uint64_t m_Size = 0;
+	uint8_t m_Block[sha1_details::BLOCK_SIZE];
+};
+
+inline void
+Sha1::update(const void *data, size_t size)
+{
+	using namespace sha1_details;
+	const uint8_t *p = (const uint8_t *) data;
+	size_t used = m_Size % BLOCK_SIZE;
+	m_Size += size;
+	if (used > 0) {
+		size_t add = BLOCK_SIZE - used < size ? BLOCK_SIZE - used : size;
+		memcpy(m_Block + used, p, add);
+		p += add;
+		size -= add;
+		if (used + add < BLOCK_SIZE)
+			return;
+		sha1Blocks(m_State, m_Block, 1);
+	}
+	sha1Blocks(m_State, p, size / BLOCK_SIZE);
+	p += size / BLOCK_SIZE * BLOCK_SIZE;
+	memcpy(m_Block, p, size % BLOCK_SIZE);
+}
+
+inline void
+Sha1::finish(uint8_t out[DIGEST_SIZE])
+{
+	using namespace sha1_details;
+	uint64_t bits = m_Size * 8;
+	size_t used = m_Size % BLOCK_SIZE;
+	m_Block[used++] = 0x80;
+	if (used > BLOCK_SIZE - 8) {
+		memset(m_Block + used, 0, BLOCK_SIZE - used);
+		sha1Blocks(m_State, m_Block, 1);
+		used = 0;
+	}
+	memset(m_Block + used, 0, BLOCK_SIZE - 8 - used);
+	for (int i = 0; i < 8; i++)
+		m_Block[BLOCK_SIZE - 1 - i] = (uint8_t) (bits >> (8 * i));
+	sha1Blocks(m_State, m_Block, 1);
+	for (int i = 0; i < 5; i++) {
+		out[4 * i] = (uint8_t) (m_State[i] >> 24);
+		out[4 * i + 1] = (uint8_t) (m_State[i] >> 16);
+		out[4 * i + 2] = (uint8_t) (m_State[i] >> 8);
+		out[4 * i + 3] = (uint8_t) m_State[i];
+	}
+}
+
+inline void
+sha1(const void *data, size_t size, uint8_t out[Sha1::DIGEST_SIZE])
+{
+	Sha1 sha;
+	sha.update(data, size);
+	sha.finish(out);
+}
+
+} // namespace tnt {
@@ -0,0 +1,169 @@
+#pragma once
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace tnt {
+
+/**
+ * Vector that keeps up to @a N elements inside the object and allocates
+ * heap memory only when the count of elements exceeds it. So containers
+ * which are usually small don't cost allocation in the common case.
+ * Elements must be move-constructible; copy of the whole vector is
+ * disabled since the elements are often not copyable (buffer iterators).
+ * Memory is allocated with operator new, std::bad_alloc is thrown on error.
+ */
+template <class T, size_t N>
+class SmallVector {
+public:
+	static_assert(N > 0, "Inline capacity must be positive");
+	using value_type = T;
+	using iterator = T *;
+	using const_iterator = const T *;
+
+	SmallVector() = default;
+	SmallVector(const SmallVector &) = delete;
+	SmallVector &operator=(const SmallVector &) = delete;
+	SmallVector(SmallVector &&other) noexcept { takeFrom(other); }
+	SmallVector &operator=(SmallVector &&other) noexcept
+	{
+		if (this != &other) {
+			clear();
+			freeHeap();
+			takeFrom(other);
+		}
+		return *this;
+	}
+	~SmallVector()
+	{
+		clear();
+		freeHeap();
+	}
+
+	template <class... ARGS>
+	T &emplace_back(ARGS&&... args)
+	{
+		if (m_Size == m_Capacity)
+			reserve(m_Capacity * 2);
+		T *res = new (m_Data + m_Size) T(std::forward<ARGS>(args)...);
+		m_Size++;
+		return *res;
+	}
+	void push_back(T &&t) { emplace_back(std::move(t)); }
+	void pop_back()
+	{
+		assert(m_Size > 0);
+		m_Data[--m_Size].~T();
+	}
+	/** Destroy elements; allocated memory is kept for reuse. */
+	void clear()
+	{
+		while (m_Size > 0)
+			pop_back();
+	}
+	void reserve(size_t capacity)
+	{
+		if (capacity <= m_Capacity)
+			return;
+		T *data = static_cast<T *>(::operator new(capacity * sizeof(T)));
+		for (size_t i = 0; i < m_Size; i++) {
+			new (data + i) T(std::move(m_Data[i]));
+			m_Data[i].~T();
+		}
+		freeHeap();
+		m_Data = data;
+		m_Capacity = capacity;
+	}
+
+	size_t size() const { return m_Size; }
+	size_t capacity() const { return m_Capacity; }
+	bool empty() const { return m_Size == 0; }
+	/** Whether elements are stored inside the object. */
+	bool isInline() const { return m_Data == inlineData(); }
+
+	T &operator[](size_t i) { assert(i < m_Size); return m_Data[i]; }
+	const T &operator[](size_t i) const { assert(i < m_Size); return m_Data[i]; }
+	T &front() { return (*this)[0]; }
+	const T &front() const { return (*this)[0]; }
+	T &back() { return (*this)[m_Size - 1]; }
+	const T &back() const { return (*this)[m_Size - 1]; }
+	T *data() { return m_Data; }
+	const T *data() const { return m_Data; }
+
+	iterator begin() { return m_Data; }
+	iterator end() { return m_Data + m_Size; }
+	const_iterator begin() const { return m_Data; }
+	const_iterator end() const { return m_Data + m_Size; }
+
+private:
+	T *inlineData() { return reinterpret_cast<T *>(m_Inline); }
+	const T *inlineData() const
+	{
+		return reinterpret_cast<const T *>(m_Inline);
+	}
+	void freeHeap()
+	{
+		if (!isInline())
+			::operator delete(m_Data);
+		m_Data = inlineData();
+		m_Capacity = N;
+	}
+	/** Steal heap memory of @a other or move its inline elements. */
+	void takeFrom(SmallVector &other)
+	{
+		assert(m_Size == 0 && isInline());
+		if (other.isInline()) {
+			for (size_t i = 0; i < other.m_Size; i++)
+				new (m_Data + i) T(std::move(other.m_Data[i]));
+			m_Size = other.m_Size;
+			other.clear();
+			return;
+		}
+		m_Data = other.m_Data;
+		m_Size = other.m_Size;
+		m_Capacity = other.m_Capacity;
+		other.m_Data = other.inlineData();
+		other.m_Size = 0;
+		other.m_Capacity = N;
+	}
+
+	alignas(T) unsigned char m_Inline[N * sizeof(T)];
+	T *m_Data = inlineData();
+	size_t m_Size = 0;
+	size_t m_Capacity = N;
+};
+
+} // namespace tnt {
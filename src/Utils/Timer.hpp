@@ -32,32 +32,50 @@
 #include <chrono>
 #include "Logger.hpp"
 
+/** Timeout with nanosecond precision; zero means "don't wait". */
+using Timeout_t = std::chrono::nanoseconds;
+constexpr Timeout_t TIMEOUT_INFINITE = Timeout_t::max();
+
+/** Convert timeout in milliseconds, where zero is infinite. */
+inline Timeout_t
+timeoutFromMs(int timeout)
+{
+	return timeout == 0 ? TIMEOUT_INFINITE :
+	       Timeout_t{std::chrono::milliseconds{timeout}};
+}
+
 class Timer {
 public:
-	Timer(int timeout) : m_Timeout{std::chrono::milliseconds{timeout}} {};
+	/** Zero @a timeout (ms) is infinite. */
+	Timer(int timeout) : m_Timeout{timeoutFromMs(timeout)} {};
+	explicit Timer(Timeout_t timeout) : m_Timeout{timeout} {};
 	void start()
 	{
 		m_Start = std::chrono::steady_clock::now();
 	}
 	bool isExpired() const
 	{
-		if (m_Timeout == std::chrono::milliseconds{0})
+		if (m_Timeout == TIMEOUT_INFINITE)
 			return false;
-		std::chrono::time_point<std::chrono::steady_clock> end =
-			std::chrono::steady_clock::now();
-		std::chrono::milliseconds elapsed =
-			std::chrono::duration_cast<std::chrono::milliseconds>(end - m_Start);
-		return elapsed >= m_Timeout;
+		return std::chrono::steady_clock::now() - m_Start >= m_Timeout;
 	}
 	int elapsed() const
 	{
-		if (m_Timeout == std::chrono::milliseconds{0})
+		if (m_Timeout == TIMEOUT_INFINITE)
 			return 0;
 		std::chrono::time_point<std::chrono::steady_clock> end =
 			std::chrono::steady_clock::now();
 		return std::chrono::duration_cast<std::chrono::milliseconds>(end - m_Start).count();
 	}
+	/** Time till expiration: zero if expired, infinite if the timer is. */
+	Timeout_t left() const
+	{
+		if (m_Timeout == TIMEOUT_INFINITE)
+			return TIMEOUT_INFINITE;
+		Timeout_t spent = std::chrono::steady_clock::now() - m_Start;
+		return spent >= m_Timeout ? Timeout_t{0} : m_Timeout - spent;
+	}
 private:
-	std::chrono::milliseconds m_Timeout;
+	Timeout_t m_Timeout;
 	std::chrono::time_point<std::chrono::steady_clock> m_Start;
 };
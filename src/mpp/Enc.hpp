@@ -496,7 +496,7 @@ Enc<BUFFER>::add_internal(CStr<C...> prefix, const T& t, const MORE&... more)
 		add_internal<compact::MP_END, false, void>(prefix.join(add), more...);
 	} else if constexpr (is_raw_v<T>) {
 		m_Buf.addBack(prefix);
-		m_Buf.addBack(std::data(t.value), std::size(t.value));
+		m_Buf.addBack(wrap::Data(std::data(t.value), std::size(t.value)));
 		add_internal<compact::MP_END, false, void>(CStr<>{}, more...);
 	} else if constexpr (is_reserve_v<T>) {
 		m_Buf.addBack(prefix);
@@ -3,6 +3,7 @@
 #include <cstring>
 
 #include "Utils/Out.hpp"
+#include "Utils/PerfReport.hpp"
 #include "Utils/PerfTimer.hpp"
 #include "../src/Buffer/Buffer.hpp"
 
@@ -254,14 +255,25 @@ contName(const tnt::Buffer<N, ALL>&)
 	return "Buffer<" + std::to_string(N) + ">";
 }
 
+/** Results of final attempts, written with --json=FILE option. */
+static PerfReport perf_report;
+static bool perf_record = false;
+
 static void
-report(const char *mode, const PerfTimer &timer, size_t data_size)
+report(const char *mode, const PerfTimer &timer, size_t data_size,
+       const PerfResult::Config_t &config)
 {
 	double Mrps = N / timer.result() / 1000000;
 	double MBps = data_size / timer.result() / 1000000;
 
 	std::cout << mode << " ";
 	OUT(Mrps, MBps);
+	if (!perf_record)
+		return;
+	std::string metric = mode;
+	std::transform(metric.begin(), metric.end(), metric.begin(), ::tolower);
+	perf_report.add(metric + "_mrps", config, "Mrps", PerfResult::HIGHER, Mrps);
+	perf_report.add(metric + "_mbps", config, "MBps", PerfResult::HIGHER, MBps);
 }
 
 template <class CONT, bool LIGHT, class T, size_t N>
@@ -275,13 +287,16 @@ bench(T (&in)[N], T (&out)[N])
 		  << " with " << dataName(in[0]) << std::endl;
 	memset(out, 0, sizeof(out));
 	PerfTimer timer;
+	PerfResult::Config_t config = {{"container", contName(cont)},
+				       {"light", LIGHT ? "true" : "false"},
+				       {"data", dataName(in[0])}};
 
 	// Write
 	timer.start();
 	for (auto& x : in)
 		write(cont, x);
 	timer.stop();
-	report("Write", timer, dataSizeTotal(in));
+	report("Write", timer, dataSizeTotal(in), config);
 
 	// Read
 	timer.start();
@@ -289,7 +304,7 @@ bench(T (&in)[N], T (&out)[N])
 	for (auto& x : out)
 		read(cont, itr, x);
 	timer.stop();
-	report("Read", timer, dataSizeTotal(in));
+	report("Read", timer, dataSizeTotal(in), config);
 
 	// Check
 	if (itr != cont.template end<LIGHT>())
@@ -318,8 +333,26 @@ doTests()
 //	bench<tnt::Buffer<1024>>(simpleDataIn, simpleDataOut);
 }
 
-int main(int, const char**)
+/**
+ * Usage: BufferPerf.test [--repeat=N] [--json=FILE]
+ * Final attempt is repeated N times (1 by default); with --json median
+ * and spread of every result over the repeats is written to FILE.
+ */
+int main(int argc, const char **argv)
 {
+	size_t repeat = 1;
+	const char *json_path = nullptr;
+	for (int i = 1; i < argc; i++) {
+		std::string_view arg = argv[i];
+		if (arg.substr(0, 9) == "--repeat=")
+			repeat = std::max(atoi(argv[i] + 9), 1);
+		else if (arg.substr(0, 7) == "--json=")
+			json_path = argv[i] + 7;
+		else {
+			std::cerr << "Unknown option " << arg << std::endl;
+			return -1;
+		}
+	}
 	// Generate random data.
 	for (auto& x : simpleDataIn)
 		gen(x);
@@ -330,6 +363,13 @@ int main(int, const char**)
 
 	std::cout << "***************** WARM UP *****************" << std::endl;
 	doTests();
-	std::cout << "************** FINAL ATTEMPT **************" << std::endl;
-	doTests();
+	perf_record = true;
+	for (size_t i = 0; i < repeat; i++) {
+		std::cout << "************** FINAL ATTEMPT **************" << std::endl;
+		doTests();
+	}
+	if (json_path != nullptr && perf_report.writeFile(json_path) != 0) {
+		std::cerr << "Failed to write results to " << json_path << std::endl;
+		return -1;
+	}
 }
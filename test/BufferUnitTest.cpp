@@ -579,6 +579,33 @@ buffer_iterator_get()
 	fail_if(buf.debugSelfCheck());
 }
 
+/**
+ * Test blockCount() method.
+ */
+template<size_t N>
+void
+buffer_block_count()
+{
+	TEST_INIT(1, N);
+	tnt::Buffer<N> buf;
+	fail_unless(buf.blockCount() == 1);
+	/* Next block is allocated as soon as the current one is full. */
+	size_t block_data_size = 0;
+	while (buf.blockCount() == 1) {
+		buf.addBack(end_marker);
+		block_data_size++;
+	}
+	fail_unless(block_data_size < N);
+	fillBuffer(buf, block_data_size * 2);
+	fail_unless(buf.blockCount() == 4);
+	buf.dropFront(block_data_size * 2);
+	fail_unless(buf.blockCount() == 2);
+	buf.dropBack(block_data_size);
+	fail_unless(buf.blockCount() == 1);
+	fail_unless(buf.empty());
+	fail_if(buf.debugSelfCheck());
+}
+
 int main()
 {
 	buffer_basic<SMALL_BLOCK_SZ>();
@@ -595,4 +622,6 @@ int main()
 	buffer_out<LARGE_BLOCK_SZ>();
 	buffer_iterator_get<SMALL_BLOCK_SZ>();
 	buffer_iterator_get<LARGE_BLOCK_SZ>();
+	buffer_block_count<SMALL_BLOCK_SZ>();
+	buffer_block_count<LARGE_BLOCK_SZ>();
 }
@@ -28,13 +28,20 @@
  * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
  * SUCH DAMAGE.
  */
+#include <cctype>
+#include <deque>
+#include <vector>
+
 #include "Utils/Helpers.hpp"
 #include "Utils/TupleReader.hpp"
 #include "Utils/System.hpp"
+#include "Utils/PerfReport.hpp"
 #include "Utils/PerfTimer.hpp"
+#include "Utils/MockServer.hpp"
 
 #include "../src/Client/Connector.hpp"
 #include "../src/Client/LibevNetProvider.hpp"
+#include "../src/Client/LoopbackNetProvider.hpp"
 
 static const char *localhost = "127.0.0.1";
 static constexpr size_t port = 3301;
@@ -52,9 +59,42 @@ static constexpr size_t GIANT_BUFFER_SIZE   = 128 * 1024;
 constexpr size_t NUM_REQ = 2000;
 constexpr size_t NUM_TEST = 500;
 
+/**
+ * Open-loop mode: requests are issued by schedule at the fixed rate, no
+ * matter how fast responses arrive, and latency is measured from the
+ * scheduled send time. So the latency includes time spent in queues when
+ * the client or the server can't keep up (coordinated omission).
+ */
+static bool open_loop = false;
+static int open_loop_request = Iproto::SELECT;
+static size_t open_loop_duration_ms = 2000;
+static std::vector<size_t> open_loop_rates =
+	{1000, 10000, 25000, 50000, 100000, 200000, 400000};
+/** Rate is considered unsustainable if less of it is achieved. */
+static constexpr double OPEN_LOOP_SATURATION = 0.9;
+/** Abort the run when so many requests are waiting for response. */
+static constexpr size_t OPEN_LOOP_MAX_INFLIGHT = 1000000;
+
+/**
+ * Requests are answered in-process by LoopbackNetProvider, so results
+ * are the cost of client alone, without kernel. Size of string field of
+ * tuple in responses to SELECT and REPLACE as the mock one has.
+ */
+static bool use_loopback = false;
+static size_t loopback_response_size = 3;
+
+/** Every test is repeated to get median and spread of results. */
+static size_t perf_repeat = 1;
+/** Written with --json=FILE option. */
+static PerfReport perf_report;
+
 struct RequestResult {
 	double rps;
 	size_t server_rps;
+	/** Client side latency percentiles, microseconds. */
+	double p50;
+	double p99;
+	double p999;
 };
 
 struct BenchResults {
@@ -63,6 +103,29 @@ struct BenchResults {
 	RequestResult select;
 };
 
+void printLatency(const RequestResult &r)
+{
+	std::cout << "+          P50/P99/P999 " << r.p50 << "/" << r.p99 <<
+		"/" << r.p999 << " US" << std::endl;
+}
+
+const char *
+requestName(int request_type)
+{
+	return latencyTypeToStr(latencyType(request_type));
+}
+
+/** Add latency and throughput to the report. */
+template <class RESULT>
+void
+recordResult(PerfResult::Config_t config, const RESULT &r)
+{
+	perf_report.add("rps", config, "rps", PerfResult::HIGHER, r.rps);
+	perf_report.add("p50", config, "us", PerfResult::LOWER, r.p50);
+	perf_report.add("p99", config, "us", PerfResult::LOWER, r.p99);
+	perf_report.add("p999", config, "us", PerfResult::LOWER, r.p999);
+}
+
 void printResults(BenchResults &r)
 {
 	std::cout << "++++++++++++++++++++++++++++++++++++++++++++++++++" << std::endl;
@@ -71,15 +134,55 @@ void printResults(BenchResults &r)
 	std::cout << "+  PING " << std::endl;
 	std::cout << "+          MRPS        " << r.ping.rps / 1000000 << std::endl;
 	std::cout << "+          SERVER RPS  " << r.ping.server_rps    << std::endl;
+	printLatency(r.ping);
 	std::cout << "+  REPLACE " << std::endl;
 	std::cout << "+          MRPS        " << r.replace.rps / 1000000 << std::endl;
 	std::cout << "+          SERVER RPS  " << r.replace.server_rps    << std::endl;
+	printLatency(r.replace);
 	std::cout << "+  SELECT " << std::endl;
 	std::cout << "+          MRPS        " << r.select.rps / 1000000 << std::endl;
 	std::cout << "+          SERVER RPS  " << r.select.server_rps    << std::endl;
+	printLatency(r.select);
 	std::cout << "++++++++++++++++++++++++++++++++++++++++++++++++++" << std::endl;
 }
 
+/** Only loopback provider needs setup. */
+template<class BUFFER, class NetProvider>
+void
+setUpResponder(Connector<BUFFER, NetProvider> &)
+{
+}
+
+/** Answer as the mock server: {DATA: [[0, "xx..x", 1.01]]}. */
+template<class BUFFER, class RESPONDER, class TRACER>
+void
+setUpResponder(Connector<BUFFER,
+	       LoopbackNetProvider<BUFFER, RESPONDER, TRACER>> &client)
+{
+	std::string body("\x81\x30\x91\x93\x00", 5);
+	size_t size = loopback_response_size;
+	if (size < 32) {
+		body.push_back(0xa0 | size);
+	} else if (size < 256) {
+		body.push_back(0xd9);
+		body.push_back(size);
+	} else {
+		size = std::min<size_t>(size, UINT16_MAX);
+		body.push_back(0xda);
+		body.push_back(size >> 8);
+		body.push_back(size & 0xff);
+	}
+	body.append(size, 'x');
+	double field = 1.01;
+	uint64_t bits;
+	memcpy(&bits, &field, sizeof(bits));
+	bits = __builtin_bswap64(bits);
+	body.push_back(0xcb);
+	body.append((const char *) &bits, sizeof(bits));
+	client.getNetProvider().responder().setBody(Iproto::SELECT, body);
+	client.getNetProvider().responder().setBody(Iproto::REPLACE, body);
+}
+
 template<class BUFFER, class NetProvider>
 rid_t
 executeRequest(Connection<BUFFER, NetProvider> &conn, int request_type, int key)
@@ -101,6 +204,7 @@ RequestResult
 testBatchRequests(int request_type)
 {
 	Connector<BUFFER, NetProvider> client;
+	setUpResponder(client);
 	Connection<BUFFER, NetProvider> conn(client);
 	int rc = client.connect(conn, localhost, port);
 	if (rc != 0) {
@@ -128,6 +232,13 @@ testBatchRequests(int request_type)
 	timer.stop();
 	RequestResult r;
 	r.rps = NUM_REQ * NUM_TEST / timer.result();
+	LatencySnapshot latency;
+	conn.getLatency(latency);
+	const LatencyHistogramSnapshot_t &hist =
+		latency[latencyType(request_type)];
+	r.p50 = hist.percentile(0.5) / 1000.;
+	r.p99 = hist.percentile(0.99) / 1000.;
+	r.p999 = hist.percentile(0.999) / 1000.;
 	r.server_rps = getServerRps(client, conn);
 	client.close(conn);
 	return r;
@@ -135,13 +246,134 @@ testBatchRequests(int request_type)
 
 template<class BUFFER, class NetProvider>
 void
-testRequestTypes()
+testRequestTypes(const char *provider)
+{
+	PerfResult::Config_t config = {
+		{"mode", "closed-loop"}, {"provider", provider},
+		{"buffer", std::to_string(BUFFER::blockSize())}};
+	for (size_t i = 0; i < perf_repeat; i++) {
+		BenchResults r;
+		r.ping = testBatchRequests<BUFFER, NetProvider>(Iproto::PING);
+		r.replace = testBatchRequests<BUFFER, NetProvider>(Iproto::REPLACE);
+		r.select = testBatchRequests<BUFFER, NetProvider>(Iproto::SELECT);
+		printResults(r);
+		config["request"] = requestName(Iproto::PING);
+		recordResult(config, r.ping);
+		config["request"] = requestName(Iproto::REPLACE);
+		recordResult(config, r.replace);
+		config["request"] = requestName(Iproto::SELECT);
+		recordResult(config, r.select);
+	}
+}
+
+struct OpenLoopResult {
+	size_t target_rps;
+	double rps;
+	/** Latency from the scheduled send time, microseconds. */
+	double p50;
+	double p99;
+	double p999;
+	double max;
+};
+
+template<class BUFFER, class NetProvider>
+OpenLoopResult
+testOpenLoop(int request_type, size_t rate)
+{
+	Connector<BUFFER, NetProvider> client;
+	setUpResponder(client);
+	Connection<BUFFER, NetProvider> conn(client);
+	int rc = client.connect(conn, localhost, port);
+	if (rc != 0) {
+		std::cerr << "Failed to connect to localhost:" << port << std::endl;
+		abort();
+	}
+	struct Pending {
+		rid_t id;
+		uint64_t scheduled;
+	};
+	std::deque<Pending> pending;
+	LatencyHistogram_t hist;
+	const size_t total = rate * open_loop_duration_ms / 1000;
+	const uint64_t interval = 1000000000 / rate;
+	const uint64_t deadline = (open_loop_duration_ms + WAIT_TIMEOUT) * 1000000ull;
+	size_t sent = 0;
+	uint64_t start = latencyClock();
+	uint64_t now = start;
+	while (sent < total || !pending.empty()) {
+		/* Late requests are sent at once and keep their schedule. */
+		while (sent < total && start + sent * interval <= now) {
+			rid_t id = executeRequest(conn, request_type, sent);
+			pending.push_back({id, start + sent * interval});
+			sent++;
+		}
+		if (pending.size() > OPEN_LOOP_MAX_INFLIGHT ||
+		    now - start > deadline) {
+			std::cerr << "Open loop test failed: " << pending.size() <<
+				" requests are not answered" << std::endl;
+			abort();
+		}
+		uint64_t next = start + sent * interval;
+		if (pending.empty() && sent < total &&
+		    next - now < 1000000) {
+			/*
+			 * Nothing to receive and waiting is limited with
+			 * milliseconds: spin till the next request.
+			 */
+			while ((now = latencyClock()) < next)
+				;
+			continue;
+		}
+		client.waitAny(1);
+		now = latencyClock();
+		while (!pending.empty() &&
+		       conn.futureIsReady(pending.front().id)) {
+			auto resp = conn.getResponse(pending.front().id);
+			if (resp->header.code != 0)
+				abort();
+			hist.record(now - pending.front().scheduled);
+			pending.pop_front();
+		}
+	}
+	client.close(conn);
+	LatencyHistogramSnapshot_t snap = hist.snapshot();
+	OpenLoopResult r;
+	r.target_rps = rate;
+	r.rps = total * 1e9 / (now - start);
+	r.p50 = snap.percentile(0.5) / 1000.;
+	r.p99 = snap.percentile(0.99) / 1000.;
+	r.p999 = snap.percentile(0.999) / 1000.;
+	r.max = snap.max() / 1000.;
+	return r;
+}
+
+/** Sweep the rates until the target rate isn't achieved. */
+template<class BUFFER, class NetProvider>
+void
+testOpenLoopRates(const char *provider)
 {
-	BenchResults r;
-	r.ping = testBatchRequests<BUFFER, NetProvider>(Iproto::PING);
-	r.replace = testBatchRequests<BUFFER, NetProvider>(Iproto::REPLACE);
-	r.select = testBatchRequests<BUFFER, NetProvider>(Iproto::SELECT);
-	printResults(r);
+	PerfResult::Config_t config = {
+		{"mode", "open-loop"}, {"provider", provider},
+		{"buffer", std::to_string(BUFFER::blockSize())},
+		{"request", requestName(open_loop_request)}};
+	std::cout << "+  TARGET RPS / ACHIEVED RPS / P50 / P99 / P999 / MAX US" << std::endl;
+	for (size_t rate : open_loop_rates) {
+		bool saturated = false;
+		config["target_rps"] = std::to_string(rate);
+		for (size_t i = 0; i < perf_repeat; i++) {
+			OpenLoopResult r = testOpenLoop<BUFFER, NetProvider>(
+				open_loop_request, rate);
+			std::cout << "+  " << r.target_rps << " / " <<
+				(size_t)r.rps << " / " << r.p50 << " / " <<
+				r.p99 << " / " << r.p999 << " / " << r.max <<
+				std::endl;
+			recordResult(config, r);
+			if (r.rps < r.target_rps * OPEN_LOOP_SATURATION)
+				saturated = true;
+		}
+		if (saturated)
+			break;
+	}
 }
 
 template<class BUFFER>
@@ -154,14 +386,31 @@ testEngines()
 	std::cout << "              BUFFER SIZE=" << BUFFER::blockSize() << std::endl;
 	using DefaultNet_t = DefaultNetProvider<BUFFER, NetworkEngine >;
 	using LibEvNet_t = LibevNetProvider<BUFFER, NetworkEngine >;
+	if (use_loopback) {
+		using LoopNet_t = LoopbackNetProvider<BUFFER>;
+		std::cout << "===================================================" << std::endl;
+		std::cout << "        STARTING TEST LOOPBACK" << std::endl;
+		std::cout << "===================================================" << std::endl;
+		if (open_loop)
+			testOpenLoopRates<BUFFER, LoopNet_t >("loopback");
+		else
+			testRequestTypes<BUFFER, LoopNet_t >("loopback");
+		return;
+	}
 	std::cout << "===================================================" << std::endl;
 	std::cout << "        STARTING TEST EPOLL" << std::endl;
 	std::cout << "===================================================" << std::endl;
-	testRequestTypes<BUFFER, DefaultNet_t >();
+	if (open_loop)
+		testOpenLoopRates<BUFFER, DefaultNet_t >("epoll");
+	else
+		testRequestTypes<BUFFER, DefaultNet_t >("epoll");
 	std::cout << "===================================================" << std::endl;
 	std::cout << "        STARTING TEST LibEV" << std::endl;
 	std::cout << "===================================================" << std::endl;
-	testRequestTypes<BUFFER, LibEvNet_t >();
+	if (open_loop)
+		testOpenLoopRates<BUFFER, LibEvNet_t >("libev");
+	else
+		testRequestTypes<BUFFER, LibEvNet_t >("libev");
 }
 
 template<class BUFFER, class NetProvider>
@@ -185,6 +434,17 @@ getServerRps(Connector<BUFFER, NetProvider> &client,
 	return tuples[0].field1;
 }
 
+/** There's no server behind loopback provider. */
+template<class BUFFER, class RESPONDER, class TRACER>
+size_t
+getServerRps(Connector<BUFFER,
+	     LoopbackNetProvider<BUFFER, RESPONDER, TRACER>> &,
+	     Connection<BUFFER,
+	     LoopbackNetProvider<BUFFER, RESPONDER, TRACER>> &)
+{
+	return 0;
+}
+
 void
 greetings()
 {
@@ -203,21 +463,124 @@ testBuffer(std::index_sequence<I...>)
 	(testEngines< tnt::Buffer<I>>(),...);
 }
 
-int main()
+static void
+usage(const char *prog)
+{
+	std::cerr << "Usage: " << prog << " [--mock [--response-size=N] "
+		"[--delay-us=N] | --loopback [--response-size=N]] "
+		"[--open-loop [--rates=N,N,...] [--duration-ms=N] "
+		"[--request=ping|select|replace]] [--repeat=N] [--json=FILE]" <<
+		std::endl;
+}
+
+/** Parse comma-separated list of positive rates. */
+static int
+parseRates(const char *str, std::vector<size_t> &rates)
+{
+	rates.clear();
+	for (const char *p = str; ; p++) {
+		char *end;
+		unsigned long rate = strtoul(p, &end, 10);
+		if (end == p || !isdigit((unsigned char) *p) || rate == 0)
+			return -1;
+		rates.push_back(rate);
+		p = end;
+		if (*p == 0)
+			return 0;
+		if (*p != ',')
+			return -1;
+	}
+}
+
+/**
+ * Usage: ClientPerfTest.test [--mock [--response-size=N] [--delay-us=N] |
+ *			       --loopback [--response-size=N]]
+ *			      [--open-loop [--rates=N,N,...] [--duration-ms=N]
+ *			       [--request=ping|select|replace]]
+ *			      [--repeat=N] [--json=FILE]
+ * With --mock requests are served by the in-process mock server instead of
+ * Tarantool, so the results reflect the cost of the client itself.
+ * With --loopback there's no network at all: only CPU cost of client
+ * (encoding, scheduling and decoding) is measured.
+ * With --open-loop latency is measured at the given request rates instead
+ * of the throughput of request batches.
+ * Every test is run N times; with --json median and spread of results
+ * over the repeats are written to FILE.
+ */
+int main(int argc, char **argv)
 {
 	greetings();
-	if (cleanDir() != 0) {
-		std::cerr << "Failed to clean-up current directory" << std::endl;
-		return -1;
+	bool use_mock = false;
+	const char *json_path = nullptr;
+	MockServerConfig mock_cfg;
+	mock_cfg.port = port;
+	for (int i = 1; i < argc; i++) {
+		std::string_view arg = argv[i];
+		if (arg == "--mock")
+			use_mock = true;
+		else if (arg == "--loopback")
+			use_loopback = true;
+		else if (arg.substr(0, 16) == "--response-size=")
+			mock_cfg.response_size = atoi(argv[i] + 16);
+		else if (arg.substr(0, 11) == "--delay-us=")
+			mock_cfg.delay_us = atoi(argv[i] + 11);
+		else if (arg == "--open-loop")
+			open_loop = true;
+		else if (arg.substr(0, 14) == "--duration-ms=")
+			open_loop_duration_ms = atoi(argv[i] + 14);
+		else if (arg.substr(0, 8) == "--rates=") {
+			if (parseRates(argv[i] + 8, open_loop_rates) != 0) {
+				std::cerr << "Invalid rates " << arg << std::endl;
+				usage(argv[0]);
+				return -1;
+			}
+		} else if (arg == "--request=ping")
+			open_loop_request = Iproto::PING;
+		else if (arg == "--request=select")
+			open_loop_request = Iproto::SELECT;
+		else if (arg == "--request=replace")
+			open_loop_request = Iproto::REPLACE;
+		else if (arg.substr(0, 9) == "--repeat=")
+			perf_repeat = std::max(atoi(argv[i] + 9), 1);
+		else if (arg.substr(0, 7) == "--json=")
+			json_path = argv[i] + 7;
+		else {
+			std::cerr << "Unknown option " << arg << std::endl;
+			usage(argv[0]);
+			return -1;
+		}
 	}
-	if (launchTarantool() != 0) {
-		std::cerr << "Failed to launch server" << std::endl;
-		return -1;
+	MockServer mock(mock_cfg);
+	loopback_response_size = mock_cfg.response_size;
+	if (use_loopback) {
+		std::cout << "          LOOPBACK: RESPONSE SIZE " <<
+			loopback_response_size << std::endl;
+	} else if (use_mock) {
+		std::cout << "          MOCK SERVER: RESPONSE SIZE " <<
+			mock_cfg.response_size << ", DELAY " <<
+			mock_cfg.delay_us << " US" << std::endl;
+		if (mock.start() != 0) {
+			std::cerr << "Failed to launch mock server" << std::endl;
+			return -1;
+		}
+	} else {
+		if (cleanDir() != 0) {
+			std::cerr << "Failed to clean-up current directory" << std::endl;
+			return -1;
+		}
+		if (launchTarantool() != 0) {
+			std::cerr << "Failed to launch server" << std::endl;
+			return -1;
+		}
+		sleep(1);
 	}
-	sleep(1);
 
 	testBuffer(std::index_sequence<SMALL_BUFFER_SIZE, AVERAGE_BUFFER_SIZE,
 				       BIG_BUFFER_SIZE, GIANT_BUFFER_SIZE>{});
 
+	if (json_path != nullptr && perf_report.writeFile(json_path) != 0) {
+		std::cerr << "Failed to write results to " << json_path << std::endl;
+		return -1;
+	}
 	return 0;
 }
@@ -0,0 +1,327 @@
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/resource.h>
+
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#include "Utils/Helpers.hpp"
+#include "Utils/System.hpp"
+#include "Utils/PerfReport.hpp"
+#include "Utils/MockServer.hpp"
+
+#include "../src/Buffer/Buffer.hpp"
+#include "../src/Client/Connector.hpp"
+#include "../src/Client/LibevNetProvider.hpp"
+
+/*
+ * Scaling of the client with count of connections: the same total count
+ * of requests in flight is spread over 1..N connections, so the results
+ * show the cost of the connection management itself.
+ */
+
+static const char *localhost = "127.0.0.1";
+static constexpr size_t port = 3301;
+static constexpr size_t space_id = 512;
+static constexpr int WAIT_TIMEOUT = 10000; //milliseconds
+static constexpr size_t BUFFER_SIZE = 16 * 1024;
+/** Results are not accounted during warm-up. */
+static constexpr uint64_t WARMUP_NS = 200000000;
+/** Descriptors reserved for anything but connections. */
+static constexpr size_t RESERVED_FDS = 64;
+
+static std::vector<size_t> connection_counts = {1, 10, 100, 1000, 10000};
+/** Total count of requests in flight over all connections. */
+static size_t window = 1000;
+static size_t duration_ms = 2000;
+static int request_type = Iproto::SELECT;
+static size_t perf_repeat = 1;
+static PerfReport perf_report;
+/** Both client and mock server sockets are in this process. */
+static bool use_mock = false;
+
+struct ScaleResult {
+	double rps;
+	/** Client thread CPU time per request, microseconds. */
+	double cpu_us;
+	/** Latency percentiles, microseconds. */
+	double p50;
+	double p99;
+};
+
+template<class BUFFER, class NetProvider>
+rid_t
+executeRequest(Connection<BUFFER, NetProvider> &conn, int request_type, int key)
+{
+	switch (request_type) {
+		case Iproto::REPLACE:
+			return conn.space[space_id].replace(std::make_tuple(key, "str", 1.01));
+		case Iproto::PING:
+			return conn.ping();
+		case Iproto::SELECT:
+			return conn.space[space_id].select(std::make_tuple(key));
+		default:
+			abort();
+	}
+}
+
+/** CPU time (user + system) consumed by the calling thread, ns. */
+static uint64_t
+threadCpuTime()
+{
+	struct rusage usage;
+	if (getrusage(RUSAGE_THREAD, &usage) != 0)
+		abort();
+	auto ns = [](const struct timeval &tv) {
+		return tv.tv_sec * 1000000000ull + tv.tv_usec * 1000ull;
+	};
+	return ns(usage.ru_utime) + ns(usage.ru_stime);
+}
+
+template<class BUFFER, class NetProvider>
+ScaleResult
+testConnections(size_t conn_count)
+{
+	using Conn_t = Connection<BUFFER, NetProvider>;
+	struct Pending {
+		rid_t id;
+		uint64_t start;
+	};
+	struct Slot {
+		explicit Slot(Connector<BUFFER, NetProvider> &client)
+			: conn(client) {}
+		Conn_t conn;
+		std::deque<Pending> pending;
+	};
+	Connector<BUFFER, NetProvider> client;
+	std::deque<Slot> slots;
+	std::unordered_map<const Conn_t *, Slot *> slot_by_conn;
+	for (size_t i = 0; i < conn_count; i++) {
+		Slot &slot = slots.emplace_back(client);
+		if (client.connect(slot.conn, localhost, port) != 0) {
+			std::cerr << "Failed to connect to localhost:" << port <<
+				": " << slot.conn.getError() << std::endl;
+			abort();
+		}
+		slot_by_conn[&slot.conn] = &slot;
+	}
+
+	LatencyHistogram_t hist;
+	size_t inflight = 0;
+	size_t completed = 0;
+	size_t next_slot = 0;
+	int key = 0;
+	uint64_t start = latencyClock();
+	uint64_t measure_start = start + WARMUP_NS;
+	uint64_t finish = measure_start + duration_ms * 1000000ull;
+	uint64_t cpu_start = 0;
+	bool is_measured = false;
+	uint64_t now = start;
+	while (now < finish) {
+		/* New requests go round-robin to involve all connections. */
+		for (; inflight < window; inflight++) {
+			Slot &slot = slots[next_slot];
+			next_slot = (next_slot + 1) % conn_count;
+			rid_t id = executeRequest(slot.conn, request_type, key++);
+			slot.pending.push_back({id, latencyClock()});
+		}
+		Conn_t *conn = client.waitAny(WAIT_TIMEOUT);
+		if (conn == nullptr) {
+			std::cerr << "Test failed: no response in " <<
+				WAIT_TIMEOUT << " ms" << std::endl;
+			abort();
+		}
+		now = latencyClock();
+		if (!is_measured && now >= measure_start) {
+			is_measured = true;
+			measure_start = now;
+			cpu_start = threadCpuTime();
+			completed = 0;
+		}
+		Slot &slot = *slot_by_conn[conn];
+		while (!slot.pending.empty() &&
+		       conn->futureIsReady(slot.pending.front().id)) {
+			auto resp = conn->getResponse(slot.pending.front().id);
+			if (resp->header.code != 0)
+				abort();
+			if (is_measured) {
+				hist.record(now - slot.pending.front().start);
+				completed++;
+			}
+			slot.pending.pop_front();
+			inflight--;
+		}
+	}
+	uint64_t cpu = threadCpuTime() - cpu_start;
+	ScaleResult r;
+	r.rps = completed * 1e9 / (now - measure_start);
+	r.cpu_us = completed == 0 ? 0 : cpu / 1000. / completed;
+	LatencyHistogramSnapshot_t snap = hist.snapshot();
+	r.p50 = snap.percentile(0.5) / 1000.;
+	r.p99 = snap.percentile(0.99) / 1000.;
+	/* Drain responses to close connections gracefully. */
+	for (Slot &s : slots) {
+		for (Pending &p : s.pending)
+			client.wait(s.conn, p.id, WAIT_TIMEOUT);
+		client.close(s.conn);
+	}
+	return r;
+}
+
+template<class BUFFER, class NetProvider>
+void
+testProvider(const char *provider)
+{
+	std::cout << "===================================================" << std::endl;
+	std::cout << "        PROVIDER " << provider << std::endl;
+	std::cout << "===================================================" << std::endl;
+	std::cout << "+  CONNECTIONS / RPS / CPU US PER REQUEST / P50 / P99 US" << std::endl;
+	struct rlimit limit;
+	getrlimit(RLIMIT_NOFILE, &limit);
+	for (size_t conn_count : connection_counts) {
+		size_t fds = conn_count * (use_mock ? 2 : 1) + RESERVED_FDS;
+		if (fds > limit.rlim_cur) {
+			std::cout << "+  " << conn_count << " / skipped: " <<
+				"open files limit " << limit.rlim_cur <<
+				" is too low" << std::endl;
+			continue;
+		}
+		PerfResult::Config_t config = {
+			{"provider", provider},
+			{"connections", std::to_string(conn_count)},
+			{"window", std::to_string(window)},
+			{"request", latencyTypeToStr(latencyType(request_type))}};
+		for (size_t i = 0; i < perf_repeat; i++) {
+			ScaleResult r =
+				testConnections<BUFFER, NetProvider>(conn_count);
+			std::cout << "+  " << conn_count << " / " <<
+				(size_t)r.rps << " / " << r.cpu_us << " / " <<
+				r.p50 << " / " << r.p99 << std::endl;
+			perf_report.add("rps", config, "rps",
+					PerfResult::HIGHER, r.rps);
+			perf_report.add("cpu_per_request", config, "us",
+					PerfResult::LOWER, r.cpu_us);
+			perf_report.add("p50", config, "us",
+					PerfResult::LOWER, r.p50);
+			perf_report.add("p99", config, "us",
+					PerfResult::LOWER, r.p99);
+		}
+	}
+}
+
+/**
+ * Usage: ClientScaleTest.test [--mock] [--connections=N,N,...] [--window=N]
+ *			   [--duration-ms=N] [--request=ping|select|replace]
+ *			   [--repeat=N] [--json=FILE]
+ * Requests are served by Tarantool launched with test_cfg.lua or, with
+ * --mock, by the in-process mock server. Every connection count is
+ * measured for both network providers.
+ */
+int main(int argc, char **argv)
+{
+	gLogger.setLogLevel(WARNING);
+	const char *json_path = nullptr;
+	for (int i = 1; i < argc; i++) {
+		std::string_view arg = argv[i];
+		if (arg == "--mock")
+			use_mock = true;
+		else if (arg.substr(0, 14) == "--connections=") {
+			connection_counts.clear();
+			for (char *p = argv[i] + 14; *p != 0; ) {
+				connection_counts.push_back(strtoul(p, &p, 10));
+				if (*p == ',')
+					p++;
+			}
+		} else if (arg.substr(0, 9) == "--window=")
+			window = std::max(atoi(argv[i] + 9), 1);
+		else if (arg.substr(0, 14) == "--duration-ms=")
+			duration_ms = atoi(argv[i] + 14);
+		else if (arg == "--request=ping")
+			request_type = Iproto::PING;
+		else if (arg == "--request=select")
+			request_type = Iproto::SELECT;
+		else if (arg == "--request=replace")
+			request_type = Iproto::REPLACE;
+		else if (arg.substr(0, 9) == "--repeat=")
+			perf_repeat = std::max(atoi(argv[i] + 9), 1);
+		else if (arg.substr(0, 7) == "--json=")
+			json_path = argv[i] + 7;
+		else {
+			std::cerr << "Unknown option " << arg << std::endl;
+			return -1;
+		}
+	}
+	/* Thousands of connections need as many descriptors. */
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+	size_t max_connections = 0;
+	for (size_t count : connection_counts)
+		max_connections = std::max(max_connections, count);
+	std::cout << "===================================================" << std::endl;
+	std::cout << "              CLIENT SCALING TEST                  " << std::endl;
+	std::cout << "          WINDOW " << window << " REQUESTS IN FLIGHT" << std::endl;
+	std::cout << "          DURATION " << duration_ms << " MILLISECONDS" << std::endl;
+
+	MockServerConfig mock_cfg;
+	mock_cfg.port = port;
+	mock_cfg.max_connections = max_connections;
+	MockServer mock(mock_cfg);
+	if (use_mock) {
+		if (mock.start() != 0) {
+			std::cerr << "Failed to launch mock server" << std::endl;
+			return -1;
+		}
+	} else {
+		if (cleanDir() != 0) {
+			std::cerr << "Failed to clean-up current directory" << std::endl;
+			return -1;
+		}
+		if (launchTarantool() != 0) {
+			std::cerr << "Failed to launch server" << std::endl;
+			return -1;
+		}
+		sleep(1);
+	}
+
+	using Buf_t = tnt::Buffer<BUFFER_SIZE>;
+	testProvider<Buf_t, DefaultNetProvider<Buf_t, NetworkEngine>>("epoll");
+	testProvider<Buf_t, LibevNetProvider<Buf_t, NetworkEngine>>("libev");
+
+	if (json_path != nullptr && perf_report.writeFile(json_path) != 0) {
+		std::cerr << "Failed to write results to " << json_path << std::endl;
+		return -1;
+	}
+	return 0;
+}
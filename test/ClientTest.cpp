@@ -557,6 +557,98 @@ single_conn_call(Connector<BUFFER, NetProvider> &client)
 	client.close(conn);
 }
 
+/** Single connection, I/O counters. */
+template <class BUFFER, class NetProvider = Net_t>
+void
+single_conn_stat(Connector<BUFFER, NetProvider> &client)
+{
+	TEST_INIT(0);
+	Connection<Buf_t, NetProvider> conn(client);
+	int rc = client.connect(conn, localhost, port);
+	fail_unless(rc == 0);
+	ConnectionStat stat = conn.snapshot();
+	fail_unless(stat.requests == 0);
+	fail_unless(stat.bytes_recv == Iproto::GREETING_SIZE);
+	fail_unless(stat.recvmsg_calls == 1);
+	fail_unless(stat.buffer_blocks >= 2);
+
+	TEST_CASE("Requests in flight");
+	static constexpr size_t REQ_CNT = 10;
+	rid_t futures[REQ_CNT];
+	for (size_t i = 0; i < REQ_CNT; ++i)
+		futures[i] = conn.ping();
+	stat = conn.snapshot();
+	fail_unless(stat.requests == REQ_CNT);
+	fail_unless(stat.futures_pending == REQ_CNT);
+	fail_unless(stat.bytes_sent == 0);
+
+	TEST_CASE("Responses are decoded");
+	client.waitAll(conn, (rid_t *) &futures, REQ_CNT, WAIT_TIMEOUT);
+	stat = conn.snapshot();
+	fail_unless(stat.responses == REQ_CNT);
+	fail_unless(stat.futures_pending == 0);
+	fail_unless(stat.futures_ready == REQ_CNT);
+	fail_unless(stat.bytes_sent > 0);
+	fail_unless(stat.bytes_recv > Iproto::GREETING_SIZE);
+	fail_unless(stat.sendmsg_calls > 0);
+	fail_unless(stat.recvmsg_calls > 1);
+	for (size_t i = 0; i < REQ_CNT; ++i)
+		fail_unless(conn.getResponse(futures[i]) != std::nullopt);
+	fail_unless(conn.snapshot().futures_ready == 0);
+
+	TEST_CASE("Connector counters");
+	ConnectionStat total = client.snapshot();
+	fail_unless(total.requests == stat.requests);
+	fail_unless(total.bytes_sent == stat.bytes_sent);
+	fail_unless(total.epoll_wait_calls > 0);
+	fail_unless(total.epoll_ctl_calls > 0);
+
+	client.close(conn);
+}
+
+/** Tracer counting fired hooks, see single_conn_trace(). */
+struct CountingTracer {
+	static constexpr bool ENABLED = true;
+	static inline size_t hits[TRACE_POINT_MAX];
+	static inline size_t bytes[TRACE_POINT_MAX];
+	static inline uint64_t last_ts;
+	static void trace(TracePoint point, int, size_t, size_t size, uint64_t ts)
+	{
+		fail_unless(ts >= last_ts);
+		last_ts = ts;
+		hits[point]++;
+		bytes[point] += size;
+	}
+};
+
+/** Single connection, tracer hooks. */
+template <class BUFFER, class NetProvider>
+void
+single_conn_trace(Connector<BUFFER, NetProvider> &client)
+{
+	TEST_INIT(0);
+	Connection<Buf_t, NetProvider> conn(client);
+	int rc = client.connect(conn, localhost, port);
+	fail_unless(rc == 0);
+	static constexpr size_t REQ_CNT = 10;
+	rid_t futures[REQ_CNT];
+	for (size_t i = 0; i < REQ_CNT; ++i)
+		futures[i] = conn.ping();
+	fail_unless(CountingTracer::hits[TRACE_ENCODED] == REQ_CNT);
+	client.waitAll(conn, (rid_t *) &futures, REQ_CNT, WAIT_TIMEOUT);
+	for (size_t i = 0; i < REQ_CNT; ++i)
+		fail_unless(conn.futureIsReady(futures[i]));
+	fail_unless(CountingTracer::hits[TRACE_SEND] > 0);
+	fail_unless(CountingTracer::bytes[TRACE_SEND] ==
+		    CountingTracer::bytes[TRACE_ENCODED]);
+	fail_unless(CountingTracer::hits[TRACE_RECV] > 0);
+	fail_unless(CountingTracer::hits[TRACE_DECODE_START] == REQ_CNT);
+	fail_unless(CountingTracer::hits[TRACE_DECODE_END] == REQ_CNT);
+	fail_unless(CountingTracer::bytes[TRACE_DECODE_END] ==
+		    CountingTracer::bytes[TRACE_RECV]);
+	client.close(conn);
+}
+
 int main()
 {
 	if (cleanDir() != 0)
@@ -576,6 +668,7 @@ int main()
 	single_conn_upsert<Buf_t>(client);
 	single_conn_select<Buf_t>(client);
 	single_conn_call<Buf_t>(client);
+	single_conn_stat<Buf_t>(client);
 
 	/* LibEv network provide */
 	using NetLibEv_t = LibevNetProvider<Buf_t, NetworkEngine>;
@@ -591,5 +684,11 @@ int main()
 	single_conn_upsert<Buf_t, NetLibEv_t>(another_client);
 	single_conn_select<Buf_t, NetLibEv_t>(another_client);
 	single_conn_call<Buf_t, NetLibEv_t>(another_client);
+	single_conn_stat<Buf_t, NetLibEv_t>(another_client);
+
+	/* Tracer hooks */
+	using NetTrace_t = DefaultNetProvider<Buf_t, NetworkEngine, CountingTracer>;
+	Connector<Buf_t, NetTrace_t> traced_client;
+	single_conn_trace<Buf_t, NetTrace_t>(traced_client);
 	return 0;
 }
@@ -0,0 +1,236 @@
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "../src/Utils/Histogram.hpp"
+#include "../src/Client/LatencyStat.hpp"
+#include "Utils/Helpers.hpp"
+
+template <size_t S, size_t M>
+void
+test_layout()
+{
+	TEST_INIT(2, S, M);
+	using Layout_t = tnt::HistogramLayout<S, M>;
+	TEST_CASE("exact values");
+	for (uint64_t v = 0; v < Layout_t::SUB_COUNT; v++) {
+		size_t idx = Layout_t::bucketIdx(v);
+		fail_unless(idx == v);
+		fail_unless(Layout_t::bucketLow(idx) == v);
+		fail_unless(Layout_t::bucketHigh(idx) == v);
+	}
+	TEST_CASE("buckets are adjacent");
+	for (size_t i = 1; i < Layout_t::BUCKET_COUNT; i++) {
+		fail_unless(Layout_t::bucketLow(i) ==
+			    Layout_t::bucketHigh(i - 1) + 1);
+		fail_unless(Layout_t::bucketIdx(Layout_t::bucketLow(i)) == i);
+		fail_unless(Layout_t::bucketIdx(Layout_t::bucketHigh(i)) == i);
+	}
+	fail_unless(Layout_t::bucketHigh(Layout_t::BUCKET_COUNT - 1) ==
+		    Layout_t::VALUE_MAX);
+	TEST_CASE("relative error");
+	for (uint64_t v = 1; v < Layout_t::VALUE_MAX; v = v * 3 + 1) {
+		size_t idx = Layout_t::bucketIdx(v);
+		uint64_t low = Layout_t::bucketLow(idx);
+		uint64_t high = Layout_t::bucketHigh(idx);
+		fail_unless(low <= v && v <= high);
+		fail_unless((high - low) * Layout_t::SUB_COUNT <= v);
+	}
+	TEST_CASE("clamp");
+	fail_unless(Layout_t::bucketIdx(UINT64_MAX) ==
+		    Layout_t::BUCKET_COUNT - 1);
+}
+
+void
+test_percentile()
+{
+	TEST_INIT(0);
+	tnt::Histogram<> hist;
+	fail_unless(hist.snapshot().count() == 0);
+	fail_unless(hist.snapshot().percentile(0.5) == 0);
+	for (uint64_t v = 1; v <= 10000; v++)
+		hist.record(v);
+	tnt::HistogramSnapshot<> snap = hist.snapshot();
+	fail_unless(snap.count() == 10000);
+	fail_unless(snap.sum() == 10000 * 10001 / 2);
+	auto near = [](uint64_t v, uint64_t expected) {
+		return v >= expected && v <= expected + expected / 16;
+	};
+	fail_unless(near(snap.percentile(0.5), 5000));
+	fail_unless(near(snap.percentile(0.99), 9900));
+	fail_unless(near(snap.percentile(0.999), 9990));
+	fail_unless(near(snap.max(), 10000));
+
+	TEST_CASE("merge");
+	tnt::Histogram<> other;
+	for (uint64_t v = 0; v < 10000; v++)
+		other.record(1000000);
+	other.snapshot(snap);
+	fail_unless(snap.count() == 20000);
+	fail_unless(near(snap.percentile(0.25), 5000));
+	fail_unless(near(snap.percentile(0.75), 1000000));
+
+	TEST_CASE("reset");
+	hist.reset();
+	fail_unless(hist.snapshot().count() == 0);
+	snap.reset();
+	fail_unless(snap.count() == 0 && snap.percentile(0.99) == 0);
+}
+
+void
+test_inflight()
+{
+	TEST_INIT(0);
+	InflightRequests inflight;
+	TEST_CASE("in order");
+	for (size_t i = 0; i < 10; i++)
+		inflight.push(i, Iproto::PING, i);
+	fail_unless(inflight.pending() == 10);
+	for (size_t i = 0; i < 10; i++) {
+		InflightRequests::Entry *e = inflight.complete(i);
+		fail_unless(e != nullptr && e->start == i);
+	}
+	fail_unless(inflight.pending() == 0);
+	fail_unless(inflight.complete(5) == nullptr);
+
+	TEST_CASE("out of order and growth");
+	constexpr size_t N = 1000;
+	for (size_t i = 100; i < 100 + N; i++)
+		inflight.push(i, Iproto::SELECT, i * 2);
+	for (size_t i = 100 + 1; i < 100 + N; i += 2) {
+		InflightRequests::Entry *e = inflight.complete(i);
+		fail_unless(e != nullptr && e->start == i * 2);
+		fail_unless(e->type == Iproto::SELECT);
+	}
+	fail_unless(inflight.pending() == N / 2);
+	fail_unless(inflight.complete(101) == nullptr);
+	fail_unless(inflight.complete(99) == nullptr);
+	fail_unless(inflight.complete(100 + N) == nullptr);
+	for (size_t i = 100 + N + 1; i < 100 + 2 * N; i++)
+		inflight.push(i, Iproto::SELECT, i * 2);
+	for (size_t i = 100; i < 100 + N; i += 2) {
+		InflightRequests::Entry *e = inflight.complete(i);
+		fail_unless(e != nullptr && e->start == i * 2);
+	}
+	fail_unless(inflight.pending() == N - 1);
+	for (size_t i = 100 + 2 * N - 1; i > 100 + N; i--)
+		fail_unless(inflight.complete(i) != nullptr);
+	fail_unless(inflight.pending() == 0);
+
+	TEST_CASE("long pending request doesn't hold the ring");
+	size_t sync = 100 + 2 * N;
+	size_t hung = sync;
+	inflight.push(sync++, Iproto::CALL, 1);
+	size_t capacity = inflight.capacity();
+	for (size_t i = 0; i < 100 * N; i++) {
+		inflight.push(sync, Iproto::SELECT, sync);
+		/* Responses are a bit late and out of order. */
+		if (i % 4 == 3) {
+			for (size_t s = sync; s > sync - 4; s--) {
+				InflightRequests::Entry *e = inflight.complete(s);
+				fail_unless(e != nullptr && e->start == s);
+			}
+		}
+		sync++;
+	}
+	fail_unless(inflight.pending() == 1);
+	fail_unless(inflight.capacity() == capacity);
+	size_t seen = 0;
+	inflight.forEach([&](InflightRequests::Entry &e) {
+		fail_unless(e.sync == hung);
+		seen++;
+	});
+	fail_unless(seen == 1);
+	fail_unless(inflight.find(hung) != nullptr);
+	fail_unless(inflight.find(hung + 1) == nullptr);
+	InflightRequests::Entry *e = inflight.complete(hung);
+	fail_unless(e != nullptr && e->type == Iproto::CALL && e->start == 1);
+	fail_unless(inflight.complete(hung) == nullptr);
+	fail_unless(inflight.pending() == 0);
+
+	TEST_CASE("stragglers keep sync order");
+	for (size_t i = 0; i < 4 * N; i++)
+		inflight.push(sync + i, Iproto::SELECT, i);
+	/* Every 100th request stays pending. */
+	for (size_t i = 0; i < 4 * N; i++) {
+		if (i % 100 != 0)
+			fail_unless(inflight.complete(sync + i) != nullptr);
+	}
+	for (size_t i = 0; i < 4 * N; i++)
+		inflight.push(sync + 4 * N + i, Iproto::SELECT, i);
+	for (size_t i = 0; i < 4 * N; i++)
+		fail_unless(inflight.complete(sync + 4 * N + i) != nullptr);
+	size_t prev = 0;
+	seen = 0;
+	inflight.forEach([&](InflightRequests::Entry &e) {
+		fail_unless(e.sync > prev && (e.sync - sync) % 100 == 0);
+		prev = e.sync;
+		seen++;
+	});
+	fail_unless(seen == 4 * N / 100);
+	for (size_t i = 0; i < 4 * N; i += 100)
+		fail_unless(inflight.complete(sync + i) != nullptr);
+	fail_unless(inflight.pending() == 0);
+}
+
+void
+test_latency_stat()
+{
+	TEST_INIT(0);
+	LatencyStat stat;
+	stat.requestEncoded(1, Iproto::PING);
+	stat.requestEncoded(2, Iproto::SELECT);
+	stat.requestEncoded(3, Iproto::EVAL);
+	fail_unless(stat.inflight() == 3);
+	stat.responseDecoded(3);
+	stat.responseDecoded(1);
+	stat.responseDecoded(2);
+	/* Unknown sync is ignored. */
+	stat.responseDecoded(4);
+	fail_unless(stat.inflight() == 0);
+	LatencySnapshot snap;
+	stat.snapshot(snap);
+	fail_unless(snap[LATENCY_PING].count() == 1);
+	fail_unless(snap[LATENCY_SELECT].count() == 1);
+	fail_unless(snap[LATENCY_OTHER].count() == 1);
+	fail_unless(snap[LATENCY_CALL].count() == 0);
+	stat.snapshot(snap);
+	fail_unless(snap.total().count() == 6);
+}
+
+int main()
+{
+	test_layout<1, 10>();
+	test_layout<4, 36>();
+	test_layout<7, 63>();
+	test_percentile();
+	test_inflight();
+	test_latency_stat();
+}
@@ -0,0 +1,212 @@
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* Only warnings and errors are compiled in. */
+#define TNTCXX_LOG_LEVEL 1
+
+#include "../src/Utils/Logger.hpp"
+#include "Utils/Helpers.hpp"
+
+#include <sstream>
+#include <thread>
+#include <vector>
+
+struct Point {
+	int x;
+	int y;
+};
+
+std::ostream &
+operator<<(std::ostream &strm, const Point &p)
+{
+	return strm << '(' << p.x << ", " << p.y << ')';
+}
+
+template <class... ARGS>
+std::string
+logSync(ARGS&& ...args)
+{
+	Logger logger(DEBUG);
+	std::ostringstream strm;
+	logger.log(strm, WARNING, __FILE__, __LINE__,
+		   std::forward<ARGS>(args)...);
+	return strm.str();
+}
+
+template <class... ARGS>
+std::string
+logAsync(ARGS&& ...args)
+{
+	AsyncLogBackend backend;
+	Logger logger(DEBUG);
+	logger.setBackend(&backend);
+	std::ostringstream strm;
+	logger.log(strm, WARNING, __FILE__, __LINE__,
+		   std::forward<ARGS>(args)...);
+	backend.flush();
+	return strm.str();
+}
+
+static size_t evaluated = 0;
+
+static int
+evaluate()
+{
+	return ++evaluated;
+}
+
+void
+test_compile_time_level()
+{
+	TEST_INIT(0);
+	LOG_DEBUG("Must not be evaluated: ", evaluate());
+	fail_unless(evaluated == 0);
+	LOG_WARNING("Must be evaluated: ", evaluate());
+	fail_unless(evaluated == 1);
+}
+
+void
+test_format()
+{
+	TEST_INIT(0);
+	std::string str = "string";
+	std::string_view view = "view";
+	char arr[] = "array";
+	const char *null_str = nullptr;
+	int i = -1;
+	Point point{1, 2};
+	TEST_CASE("Scalars");
+	fail_unless(logSync(1, ' ', 2.5, ' ', true, ' ', 7UL) ==
+		    "WARNING: 1 2.5 1 7\n");
+	fail_unless(logAsync(1, ' ', 2.5, ' ', true, ' ', 7UL) ==
+		    logSync(1, ' ', 2.5, ' ', true, ' ', 7UL));
+	fail_unless(logAsync(ERROR, &i) == logSync(ERROR, &i));
+	TEST_CASE("Strings");
+	fail_unless(logAsync("literal ", str, ' ', view, ' ', arr) ==
+		    "WARNING: literal string view array\n");
+	fail_unless(logAsync(null_str) == "WARNING: (null)\n");
+	TEST_CASE("Types with operator<<");
+	fail_unless(logAsync("point ", point) == "WARNING: point (1, 2)\n");
+	TEST_CASE("Long strings are truncated");
+	std::string long_str(LogRecord::SIZE * 2, 'x');
+	std::string res = logAsync(long_str, "tail");
+	fail_unless(res.size() > LogRecord::PAYLOAD_SIZE / 2);
+	fail_unless(res.size() < LogRecord::SIZE);
+	fail_unless(res.find("tail") == std::string::npos);
+}
+
+void
+test_threads()
+{
+	TEST_INIT(0);
+	static constexpr size_t THREAD_CNT = 4;
+	static constexpr size_t RECORD_CNT = 10000;
+	AsyncLogBackend backend(64);
+	Logger logger(DEBUG);
+	logger.setBackend(&backend);
+	std::ostringstream strms[THREAD_CNT];
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < THREAD_CNT; t++) {
+		threads.emplace_back([&, t]() {
+			for (size_t i = 0; i < RECORD_CNT; i++)
+				logger.log(strms[t], ERROR, __FILE__, __LINE__,
+					   "thread ", t, " record ", i);
+		});
+	}
+	for (auto &thread : threads)
+		thread.join();
+	backend.flush();
+	size_t written = 0;
+	for (size_t t = 0; t < THREAD_CNT; t++) {
+		std::istringstream lines(strms[t].str());
+		std::string line;
+		size_t prev = 0;
+		bool is_first = true;
+		while (std::getline(lines, line)) {
+			std::string prefix = "ERROR: thread " +
+					     std::to_string(t) + " record ";
+			fail_unless(line.compare(0, prefix.size(), prefix) == 0);
+			/* Records of one thread keep their order. */
+			size_t num = std::stoul(line.substr(prefix.size()));
+			fail_unless(is_first || num > prev);
+			prev = num;
+			is_first = false;
+			written++;
+		}
+	}
+	/* Ring is small, so some records may be dropped, but not lost. */
+	fail_unless(written + backend.dropped() == THREAD_CNT * RECORD_CNT);
+}
+
+void
+test_thread_churn()
+{
+	TEST_INIT(0);
+	static constexpr size_t THREAD_CNT = 100;
+	AsyncLogBackend backend(64);
+	Logger logger(DEBUG);
+	logger.setBackend(&backend);
+	std::ostringstream strm;
+	for (size_t t = 0; t < THREAD_CNT; t++) {
+		std::thread thread([&]() {
+			logger.log(strm, ERROR, __FILE__, __LINE__, "thread ", t);
+		});
+		thread.join();
+		backend.flush();
+		/* Ring of the exited thread is reused by the next one. */
+		fail_unless(backend.ringCount() == 1);
+	}
+	std::istringstream lines(strm.str());
+	std::string line;
+	size_t written = 0;
+	while (std::getline(lines, line))
+		fail_unless(line == "ERROR: thread " + std::to_string(written++));
+	fail_unless(written == THREAD_CNT);
+	TEST_CASE("Thread outlives the backend");
+	std::ostringstream late_strm;
+	{
+		AsyncLogBackend tmp(64);
+		logger.setBackend(&tmp);
+		logger.log(late_strm, ERROR, __FILE__, __LINE__, "first");
+	}
+	logger.setBackend(&backend);
+	logger.log(late_strm, ERROR, __FILE__, __LINE__, "second");
+	backend.flush();
+	fail_unless(late_strm.str() == "ERROR: first\nERROR: second\n");
+}
+
+int main()
+{
+	test_compile_time_level();
+	test_format();
+	test_threads();
+	test_thread_churn();
+}
@@ -0,0 +1,1416 @@
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include "Utils/Helpers.hpp"
+#include "Utils/TupleReader.hpp"
+#include "Utils/MockServer.hpp"
+
+#include "../src/Client/LibevNetProvider.hpp"
+#include "../src/Client/Connector.hpp"
+#include "../src/Client/Hedger.hpp"
+#include "../src/Client/LoopbackNetProvider.hpp"
+#include "../src/Client/Router.hpp"
+#include "../src/Client/SelectCache.hpp"
+
+static const char *localhost = "127.0.0.1";
+static constexpr unsigned port = 3305;
+/** Ports of two shards used by router test. */
+static constexpr unsigned shard_ports[] = {3308, 3309};
+/** Port of listener which doesn't complete handshakes. */
+static constexpr unsigned blackhole_port = 3310;
+static const char *unix_path = "mock_server_test.sock";
+static constexpr uint32_t space_id = 512;
+static constexpr int WAIT_TIMEOUT = 1000; //milliseconds
+
+using Net_t = DefaultNetProvider<Buf_t, NetworkEngine>;
+
+template <class BUFFER, class NetProvider>
+static std::optional<Response<BUFFER>>
+waitResponse(Connector<BUFFER, NetProvider> &client,
+	     Connection<BUFFER, NetProvider> &conn, rid_t f)
+{
+	client.wait(conn, f, WAIT_TIMEOUT);
+	fail_unless(conn.futureIsReady(f));
+	return conn.getResponse(f);
+}
+
+template <class BUFFER, class NetProvider>
+static UserTuple
+firstTuple(Connection<BUFFER, NetProvider> &conn,
+	   std::optional<Response<BUFFER>> &response)
+{
+	fail_unless(response != std::nullopt);
+	fail_unless(response->header.code == 0);
+	fail_unless(response->body.data != std::nullopt);
+	std::vector<UserTuple> tuples =
+		decodeUserTuple(conn.getInBuf(), *response->body.data);
+	fail_unless(tuples.size() == 1);
+	return tuples[0];
+}
+
+/** Canned responses over TCP and Unix sockets. */
+template <class BUFFER, class NetProvider = Net_t>
+void
+canned_responses(bool use_unix)
+{
+	TEST_INIT(1, use_unix);
+	MockServerConfig cfg;
+	cfg.port = use_unix ? 0 : port;
+	cfg.unix_path = use_unix ? unix_path : "";
+	cfg.response_size = 1000;
+	MockServer server(cfg);
+	fail_unless(server.start() == 0);
+
+	Connector<BUFFER, NetProvider> client;
+	Connection<BUFFER, NetProvider> conn(client);
+	int rc = use_unix ? client.connect(conn, unix_path, 0) :
+		 client.connect(conn, localhost, port);
+	fail_unless(rc == 0);
+
+	TEST_CASE("PING");
+	rid_t f = conn.ping();
+	std::optional<Response<BUFFER>> response = waitResponse(client, conn, f);
+	fail_unless(response != std::nullopt);
+	fail_unless(response->header.code == 0);
+	fail_unless(response->header.sync == (int)f);
+
+	TEST_CASE("SELECT");
+	f = conn.space[space_id].select(std::make_tuple(666));
+	response = waitResponse(client, conn, f);
+	UserTuple t = firstTuple(conn, response);
+	fail_unless(t.field1 == 666);
+	fail_unless(t.field2 == std::string(cfg.response_size, 'x'));
+	fail_unless(t.field3 == 1.01);
+
+	TEST_CASE("REPLACE");
+	f = conn.space[space_id].replace(std::make_tuple(7, "str", 2.5));
+	response = waitResponse(client, conn, f);
+	t = firstTuple(conn, response);
+	fail_unless(t.field1 == 7);
+	fail_unless(t.field2.size() == cfg.response_size);
+
+	TEST_CASE("Batch of requests");
+	constexpr size_t REQ_CNT = 1000;
+	rid_t futures[REQ_CNT];
+	for (size_t i = 0; i < REQ_CNT; i++)
+		futures[i] = conn.space[space_id].select(std::make_tuple(i));
+	client.waitAll(conn, futures, REQ_CNT, WAIT_TIMEOUT);
+	for (size_t i = 0; i < REQ_CNT; i++) {
+		fail_unless(conn.futureIsReady(futures[i]));
+		response = conn.getResponse(futures[i]);
+		fail_unless(firstTuple(conn, response).field1 == i);
+	}
+
+	TEST_CASE("get_rps");
+	f = conn.call("get_rps", std::make_tuple());
+	response = waitResponse(client, conn, f);
+	fail_unless(response->header.code == 0);
+	std::vector<UserTuple> rps =
+		decodeMultiReturn(conn.getInBuf(), *response->body.data);
+	fail_unless(rps[0].field1 > 0);
+	fail_unless(server.requests() == REQ_CNT + 4);
+	client.close(conn);
+}
+
+/** Echo mode returns request payload back. */
+template <class BUFFER, class NetProvider = Net_t>
+void
+echo_responses()
+{
+	TEST_INIT(0);
+	MockServerConfig cfg;
+	cfg.port = port;
+	cfg.echo = true;
+	MockServer server(cfg);
+	fail_unless(server.start() == 0);
+
+	Connector<BUFFER, NetProvider> client;
+	Connection<BUFFER, NetProvider> conn(client);
+	fail_unless(client.connect(conn, localhost, port) == 0);
+
+	TEST_CASE("REPLACE");
+	rid_t f = conn.space[space_id].replace(std::make_tuple(5, "abc", 3.5));
+	std::optional<Response<BUFFER>> response = waitResponse(client, conn, f);
+	UserTuple t = firstTuple(conn, response);
+	fail_unless(t.field1 == 5);
+	fail_unless(t.field2 == "abc");
+	fail_unless(t.field3 == 3.5);
+
+	TEST_CASE("CALL");
+	f = conn.call("echo", std::make_tuple(10, "def", 4.5));
+	response = waitResponse(client, conn, f);
+	fail_unless(response->header.code == 0);
+	std::vector<UserTuple> ret =
+		decodeMultiReturn(conn.getInBuf(), *response->body.data);
+	fail_unless(ret[0].field1 == 10);
+	fail_unless(ret[0].field2 == "def");
+	fail_unless(ret[0].field3 == 4.5);
+
+	TEST_CASE("Unsupported request");
+	f = conn.space[space_id].delete_(std::make_tuple(1));
+	response = waitResponse(client, conn, f);
+	fail_unless(response != std::nullopt);
+	fail_unless(response->header.code != 0);
+	fail_unless(response->body.error_stack != std::nullopt);
+	client.close(conn);
+}
+
+/** Responses are delayed, connections above the limit are dropped. */
+template <class BUFFER, class NetProvider = Net_t>
+void
+delay_and_limit()
+{
+	TEST_INIT(0);
+	MockServerConfig cfg;
+	cfg.port = port;
+	cfg.delay_us = 50000;
+	cfg.max_connections = 1;
+	MockServer server(cfg);
+	fail_unless(server.start() == 0);
+
+	Connector<BUFFER, NetProvider> client;
+	Connection<BUFFER, NetProvider> conn(client);
+	fail_unless(client.connect(conn, localhost, port) == 0);
+
+	TEST_CASE("Delay");
+	uint64_t start = latencyClock();
+	rid_t f = conn.ping();
+	client.wait(conn, f, WAIT_TIMEOUT);
+	fail_unless(conn.futureIsReady(f));
+	fail_unless(latencyClock() - start >= cfg.delay_us * 1000ull);
+
+	TEST_CASE("Connection limit");
+	fail_unless(server.connections() == 1);
+	Connection<BUFFER, NetProvider> conn2(client);
+	/* Server closes connection before the greeting is sent. */
+	fail_unless(client.connect(conn2, localhost, port) != 0);
+	fail_unless(server.connections() == 1);
+	client.close(conn);
+}
+
+/** Pushes precede the final response and don't complete the request. */
+template <class BUFFER, class NetProvider = Net_t>
+void
+push_messages()
+{
+	TEST_INIT(0);
+	MockServerConfig cfg;
+	cfg.port = port;
+	MockServer server(cfg);
+	fail_unless(server.start() == 0);
+
+	Connector<BUFFER, NetProvider> client;
+	Connection<BUFFER, NetProvider> conn(client);
+	fail_unless(client.connect(conn, localhost, port) == 0);
+	constexpr size_t PUSH_CNT = 100;
+
+	TEST_CASE("Queued pushes");
+	rid_t f = conn.call("push", std::make_tuple(PUSH_CNT));
+	rid_t ping = conn.ping();
+	client.wait(conn, ping, WAIT_TIMEOUT);
+	fail_unless(conn.futureIsReady(ping));
+	fail_unless(conn.futureIsReady(f));
+	for (size_t i = 1; i <= PUSH_CNT; i++) {
+		fail_unless(conn.pushIsReady(f));
+		std::optional<Response<BUFFER>> push = conn.getPush(f);
+		fail_unless(push != std::nullopt);
+		fail_unless(push->header.code == Iproto::CHUNK);
+		fail_unless(push->header.sync == (int)f);
+		std::vector<UserTuple> tuples =
+			decodeUserTuple(conn.getInBuf(), *push->body.data);
+		fail_unless(tuples.size() == 1);
+		fail_unless(tuples[0].field1 == i);
+	}
+	fail_if(conn.pushIsReady(f));
+	fail_unless(conn.getPush(f) == std::nullopt);
+	std::optional<Response<BUFFER>> response = conn.getResponse(f);
+	fail_unless(firstTuple(conn, response).field1 == PUSH_CNT);
+	fail_unless(conn.getResponse(ping) != std::nullopt);
+
+	TEST_CASE("Push handler");
+	f = conn.call("push", std::make_tuple(PUSH_CNT));
+	size_t seen = 0;
+	conn.onPush(f, [&](Response<BUFFER> &push) {
+		fail_unless(push.header.sync == (int)f);
+		std::vector<UserTuple> tuples =
+			decodeUserTuple(conn.getInBuf(), *push.body.data);
+		fail_unless(tuples[0].field1 == ++seen);
+	});
+	response = waitResponse(client, conn, f);
+	fail_unless(seen == PUSH_CNT);
+	fail_if(conn.pushIsReady(f));
+	fail_unless(firstTuple(conn, response).field1 == PUSH_CNT);
+
+	TEST_CASE("Pushes not taken are dropped");
+	f = conn.call("push", std::make_tuple(10));
+	response = waitResponse(client, conn, f);
+	fail_unless(firstTuple(conn, response).field1 == 10);
+	fail_if(conn.pushIsReady(f));
+
+	ConnectionStat stat = conn.snapshot();
+	fail_unless(stat.pushes == 2 * PUSH_CNT + 10);
+	fail_unless(stat.responses == 4);
+	fail_unless(stat.futures_pending == 0);
+	client.close(conn);
+}
+
+/** Ping until @a pred is true; events precede responses to later pings. */
+template <class BUFFER, class NetProvider, class PRED>
+static bool
+pingUntil(Connector<BUFFER, NetProvider> &client,
+	  Connection<BUFFER, NetProvider> &conn, PRED &&pred)
+{
+	for (size_t i = 0; i < 100; i++) {
+		if (pred())
+			return true;
+		rid_t f = conn.ping();
+		fail_unless(waitResponse(client, conn, f) != std::nullopt);
+	}
+	return pred();
+}
+
+/** Watched keys are updated by events, values are cached by client. */
+template <class BUFFER, class NetProvider = Net_t>
+void
+watchers()
+{
+	TEST_INIT(0);
+	MockServerConfig cfg;
+	cfg.port = port;
+	MockServer server(cfg);
+	fail_unless(server.start() == 0);
+
+	Connector<BUFFER, NetProvider> client;
+	Connection<BUFFER, NetProvider> conn(client);
+	fail_unless(client.connect(conn, localhost, port) == 0);
+
+	TEST_CASE("Initial value");
+	size_t events = 0;
+	std::string last;
+	auto handler = [&](const std::string &key, const std::string &value) {
+		fail_unless(key == "config");
+		last = value;
+		events++;
+	};
+	fail_unless(conn.getWatched("config") == nullptr);
+	fail_unless(conn.watch("", handler) == -1);
+	fail_unless(conn.watch("config", handler) == 0);
+	fail_unless(pingUntil(client, conn, [&] { return events == 1; }));
+	/* Key is not set: value is nil. */
+	fail_unless(last == "\xc0");
+	fail_unless(conn.getWatched("config") != nullptr);
+	fail_unless(*conn.getWatched("config") == "\xc0");
+
+	TEST_CASE("Update");
+	server.broadcast("config", 100000);
+	fail_unless(pingUntil(client, conn, [&] { return events == 2; }));
+	fail_unless(last == std::string("\xce\x00\x01\x86\xa0", 5));
+	fail_unless(*conn.getWatched("config") == last);
+
+	TEST_CASE("Updates are coalesced until acknowledged");
+	for (uint64_t v = 1; v <= 10; v++)
+		server.broadcast("config", v);
+	fail_unless(pingUntil(client, conn, [&] { return last == "\x0a"; }));
+	fail_unless(events > 2 && events <= 12);
+	fail_unless(*conn.getWatched("config") == "\x0a");
+
+	TEST_CASE("Several keys");
+	server.broadcast("leader", 3);
+	fail_unless(conn.watch("leader") == 0);
+	fail_unless(pingUntil(client, conn, [&] {
+		return conn.getWatched("leader") != nullptr;
+	}));
+	fail_unless(*conn.getWatched("leader") == "\x03");
+	fail_unless(*conn.getWatched("config") == "\x0a");
+
+	TEST_CASE("Unwatch");
+	conn.unwatch("config");
+	fail_unless(conn.getWatched("config") == nullptr);
+	size_t events_before = events;
+	server.broadcast("config", 7);
+	server.broadcast("leader", 4);
+	fail_unless(pingUntil(client, conn, [&] {
+		return *conn.getWatched("leader") == "\x04";
+	}));
+	fail_unless(events == events_before);
+	fail_unless(conn.getWatched("config") == nullptr);
+
+	/* Events don't occupy futures. */
+	ConnectionStat stat = conn.snapshot();
+	fail_unless(stat.responses == stat.requests);
+	fail_unless(stat.futures_pending == 0);
+	fail_unless(stat.futures_ready == 0);
+	fail_unless(server.watches() >= events + 1);
+	client.close(conn);
+}
+
+/** Keys of all tuples returned by @a cursor. */
+template <class BUFFER, class NetProvider, class CURSOR>
+static std::vector<uint64_t>
+drainCursor(Connection<BUFFER, NetProvider> &conn, CURSOR &cursor,
+	    const CursorOptions &opts)
+{
+	std::vector<uint64_t> keys;
+	while (true) {
+		std::optional<Response<BUFFER>> page = cursor.next(WAIT_TIMEOUT);
+		if (page == std::nullopt)
+			break;
+		fail_unless(page->body.data != std::nullopt);
+		fail_unless(page->body.data->tuples.size() <= opts.page_size);
+		fail_unless(cursor.pagesReady() < opts.prefetch);
+		std::vector<UserTuple> tuples =
+			decodeUserTuple(conn.getInBuf(), *page->body.data);
+		for (const UserTuple &t : tuples)
+			keys.push_back(t.field1);
+	}
+	fail_unless(cursor.getError().empty());
+	fail_unless(cursor.isEnd());
+	return keys;
+}
+
+/** Each page of cursor is selected after the last tuple of previous one. */
+template <class BUFFER, class NetProvider = Net_t>
+void
+cursors(unsigned minor)
+{
+	TEST_INIT(1, minor);
+	constexpr size_t ROWS = 1000;
+	MockServerConfig cfg;
+	cfg.port = port;
+	cfg.space_rows = ROWS;
+	cfg.version = "2." + std::to_string(minor) + ".0";
+	MockServer server(cfg);
+	fail_unless(server.start() == 0);
+
+	Connector<BUFFER, NetProvider> client;
+	Connection<BUFFER, NetProvider> conn(client);
+	fail_unless(client.connect(conn, localhost, port) == 0);
+	bool is_new = minor >= 11;
+	CursorOptions::Mode modes[] = {CursorOptions::AUTO,
+				       CursorOptions::LAST_KEY};
+
+	for (CursorOptions::Mode mode : modes) {
+		TEST_CASE("Full scan");
+		CursorOptions opts;
+		opts.page_size = 64;
+		opts.prefetch = 3;
+		opts.mode = mode;
+		size_t scanned = server.scanned();
+		auto cursor = conn.space[space_id].index[0].cursor(std::make_tuple(),
+							      opts);
+		if (mode == CursorOptions::AUTO)
+			fail_unless(cursor.mode() == (is_new ?
+				    CursorOptions::POSITION :
+				    CursorOptions::LAST_KEY));
+		std::vector<uint64_t> keys = drainCursor(conn, cursor, opts);
+		fail_unless(keys.size() == ROWS);
+		for (size_t i = 0; i < ROWS; i++)
+			fail_unless(keys[i] == i + 1);
+		/* Skipped tuples aren't rescanned. */
+		fail_unless(server.scanned() - scanned == ROWS);
+		fail_unless(cursor.next() == std::nullopt);
+
+		TEST_CASE("Descending scan from key");
+		opts.iterator = LE;
+		opts.page_size = 10;
+		opts.prefetch = 1;
+		auto desc = conn.space[space_id].index[0].cursor(std::make_tuple(95),
+							    opts);
+		keys = drainCursor(conn, desc, opts);
+		fail_unless(keys.size() == 95);
+		for (size_t i = 0; i < keys.size(); i++)
+			fail_unless(keys[i] == 95 - i);
+	}
+
+	TEST_CASE("Iterator isn't supported by last key");
+	CursorOptions opts;
+	opts.mode = CursorOptions::LAST_KEY;
+	opts.iterator = EQ;
+	auto eq = conn.space[space_id].index[0].cursor(std::make_tuple(1), opts);
+	fail_unless(eq.isEnd());
+	fail_unless(eq.next() == std::nullopt);
+	fail_if(eq.getError().empty());
+
+	ConnectionStat stat = conn.snapshot();
+	fail_unless(stat.futures_pending == 0);
+	fail_unless(stat.futures_ready == 0);
+	client.close(conn);
+}
+
+/** chap-sha1 scramble of "secret" for salt of the mock (zero bytes). */
+static const char SECRET_SCRAMBLE[] = "\x8e\x7e\x67\x8b\x27\xf7\x07\x47\xe6\x5f"
+				      "\xb2\xb3\x81\x21\x44\x27\xb0\xfc\xed\x48";
+
+/** Connector authenticates right after the greeting. */
+template <class BUFFER, class NetProvider = Net_t>
+void
+authentication()
+{
+	TEST_INIT(0);
+	MockServerConfig cfg;
+	cfg.port = port;
+	cfg.auth_user = "alice";
+	cfg.auth_scramble.assign(SECRET_SCRAMBLE, Iproto::SCRAMBLE_SIZE);
+	MockServer server(cfg);
+	fail_unless(server.start() == 0);
+	Connector<BUFFER, NetProvider> client;
+
+	TEST_CASE("Scramble");
+	Credentials creds("alice", "secret");
+	char salt[Iproto::SCRAMBLE_SIZE] = {};
+	char scramble[Iproto::SCRAMBLE_SIZE];
+	creds.scramble(salt, scramble);
+	fail_unless(memcmp(scramble, SECRET_SCRAMBLE, sizeof(scramble)) == 0);
+
+	TEST_CASE("Valid password");
+	Connection<BUFFER, NetProvider> conn(client);
+	fail_unless(client.connect(conn, localhost, port, creds) == 0);
+	fail_unless(server.auths() == 1);
+	rid_t f = conn.ping();
+	fail_unless(waitResponse(client, conn, f)->header.code == 0);
+
+	TEST_CASE("Invalid password");
+	Credentials wrong("alice", "Secret");
+	Connection<BUFFER, NetProvider> conn2(client);
+	fail_unless(client.connect(conn2, localhost, port, wrong) != 0);
+	fail_unless(conn2.getError().find("credentials are invalid") !=
+		    std::string::npos);
+	fail_unless(server.auths() == 2);
+
+	TEST_CASE("Pool shares credentials");
+	constexpr size_t POOL_SIZE = 16;
+	std::vector<std::unique_ptr<Connection<BUFFER, NetProvider>>> pool;
+	for (size_t i = 0; i < POOL_SIZE; i++) {
+		pool.emplace_back(new Connection<BUFFER, NetProvider>(client));
+		fail_unless(client.connect(*pool.back(), localhost, port,
+					   creds) == 0);
+	}
+	fail_unless(server.auths() == 2 + POOL_SIZE);
+	for (auto &c : pool)
+		client.close(*c);
+	client.close(conn);
+}
+
+/** Router discovers buckets and batches requests per shard. */
+template <class BUFFER, class NetProvider = Net_t>
+void
+router()
+{
+	TEST_INIT(0);
+	constexpr uint32_t BUCKET_COUNT = 30;
+	MockServerConfig cfg;
+	cfg.port = shard_ports[0];
+	cfg.bucket_first = 1;
+	cfg.bucket_last = 15;
+	MockServer shard0(cfg);
+	cfg.port = shard_ports[1];
+	cfg.bucket_first = 16;
+	cfg.bucket_last = 30;
+	MockServer shard1(cfg);
+	fail_unless(shard0.start() == 0);
+	fail_unless(shard1.start() == 0);
+
+	Connector<BUFFER, NetProvider> client;
+	Connection<BUFFER, NetProvider> conn0(client);
+	Connection<BUFFER, NetProvider> conn1(client);
+	fail_unless(client.connect(conn0, localhost, shard_ports[0]) == 0);
+	fail_unless(client.connect(conn1, localhost, shard_ports[1]) == 0);
+
+	using Router_t = Router<BUFFER, NetProvider>;
+	constexpr int DISCOVERY_INTERVAL = 100;
+	RouterOptions opts;
+	opts.bucket_count = BUCKET_COUNT;
+	opts.discovery_interval = DISCOVERY_INTERVAL;
+	Router_t router(client, opts);
+	fail_unless(router.addReplicaset(conn0) == 0);
+	fail_unless(router.addReplicaset(conn1) == 1);
+
+	TEST_CASE("Bucket id");
+	for (int i = 0; i < 100; i++) {
+		uint32_t id = router.bucketId(std::to_string(i));
+		fail_unless(id >= 1 && id <= BUCKET_COUNT);
+		fail_unless(id == router.bucketId(std::to_string(i)));
+	}
+	RouterOptions custom = opts;
+	custom.hash = [](std::string_view key) {
+		return (uint32_t) std::stoul(std::string(key));
+	};
+	Router_t custom_router(client, custom);
+	fail_unless(custom_router.bucketId("7") == 8);
+	fail_unless(custom_router.bucketId("30") == 1);
+
+	auto get = [](uint32_t bucket_id) {
+		return [bucket_id](Connection<BUFFER, NetProvider> &conn) {
+			return conn.call("vshard.storage.call",
+					 std::make_tuple(bucket_id,
+							 std::string("read"),
+							 std::string("get"),
+							 std::make_tuple()));
+		};
+	};
+	auto bucketOf = [&](typename Router_t::Request &request) {
+		std::optional<Response<BUFFER>> response =
+			router.getResponse(request);
+		return firstTuple(*request.conn, response).field1;
+	};
+
+	TEST_CASE("Batch is routed per shard");
+	std::vector<uint32_t> buckets;
+	for (uint32_t b = BUCKET_COUNT; b >= 1; b--)
+		buckets.push_back(b);
+	auto requests = router.sendBatch(buckets,
+		[&](Connection<BUFFER, NetProvider> &conn, size_t i) {
+			return get(buckets[i])(conn);
+		});
+	fail_unless(router.discoveries() == 1);
+	fail_unless(router.knownBuckets() == BUCKET_COUNT);
+	fail_unless(router.wait(requests, WAIT_TIMEOUT) == 0);
+	for (size_t i = 0; i < requests.size(); i++) {
+		fail_unless(requests[i].isRouted());
+		fail_unless(requests[i].conn == (buckets[i] <= 15 ? &conn0 : &conn1));
+		fail_unless(bucketOf(requests[i]) == buckets[i]);
+	}
+	/* Discovery and 15 requests per shard. */
+	fail_unless(shard0.requests() == 16);
+	fail_unless(shard1.requests() == 16);
+
+	TEST_CASE("Known bucket is not rediscovered");
+	auto request = router.send(3, get(3));
+	fail_unless(router.wait({request}, WAIT_TIMEOUT) == 0);
+	fail_unless(bucketOf(request) == 3);
+	fail_unless(router.discoveries() == 1);
+
+	TEST_CASE("Moved bucket is refreshed after routing error");
+	shard0.setBuckets(1, 20);
+	shard1.setBuckets(21, 30);
+	request = router.send(18, get(18));
+	fail_unless(request.conn == &conn1);
+	fail_unless(router.wait({request}, WAIT_TIMEOUT) == 0);
+	std::optional<Response<BUFFER>> response = router.getResponse(request);
+	fail_unless(response != std::nullopt);
+	fail_unless(router.isRoutingError(*response));
+	fail_unless(router.routingErrors() == 1);
+	fail_unless(router.knownBuckets() == BUCKET_COUNT - 1);
+	request = router.send(18, get(18));
+	fail_unless(router.discoveries() == 2);
+	fail_unless(request.conn == &conn0);
+	fail_unless(router.wait({request}, WAIT_TIMEOUT) == 0);
+	fail_unless(bucketOf(request) == 18);
+
+	TEST_CASE("Missing bucket is rediscovered no more than once per interval");
+	shard1.setBuckets(22, 30);
+	request = router.send(21, get(21));
+	fail_unless(request.conn == &conn1);
+	fail_unless(router.wait({request}, WAIT_TIMEOUT) == 0);
+	response = router.getResponse(request);
+	fail_unless(response != std::nullopt);
+	fail_unless(router.isRoutingError(*response));
+	for (int i = 0; i < 10; i++) {
+		request = router.send(21, get(21));
+		fail_if(request.isRouted());
+		fail_if(router.getError().empty());
+	}
+	/* Only the first one after routing error has rescanned the map. */
+	fail_unless(router.discoveries() == 3);
+	requests = router.sendBatch({20, 21}, [&](auto &conn, size_t i) {
+		return get(20 + i)(conn);
+	});
+	fail_unless(requests[0].isRouted());
+	fail_if(requests[1].isRouted());
+	fail_unless(router.wait(requests, WAIT_TIMEOUT) == 0);
+	fail_unless(bucketOf(requests[0]) == 20);
+	fail_unless(router.discoveries() == 3);
+	std::this_thread::sleep_for(
+		std::chrono::milliseconds(DISCOVERY_INTERVAL + 10));
+	shard1.setBuckets(21, 30);
+	request = router.send(21, get(21));
+	fail_unless(router.discoveries() == 4);
+	fail_unless(request.conn == &conn1);
+	fail_unless(router.wait({request}, WAIT_TIMEOUT) == 0);
+	fail_unless(bucketOf(request) == 21);
+
+	TEST_CASE("Unknown bucket");
+	request = router.send(BUCKET_COUNT + 1, get(BUCKET_COUNT + 1));
+	fail_if(request.isRouted());
+	fail_if(router.getError().empty());
+	client.close(conn0);
+	client.close(conn1);
+}
+
+/** Select results are served from cache until invalidation. */
+template <class BUFFER, class NetProvider = Net_t>
+void
+select_cache()
+{
+	TEST_INIT(0);
+	MockServerConfig cfg;
+	cfg.port = port;
+	MockServer server(cfg);
+	fail_unless(server.start() == 0);
+
+	Connector<BUFFER, NetProvider> client;
+	Connection<BUFFER, NetProvider> conn(client);
+	fail_unless(client.connect(conn, localhost, port) == 0);
+
+	SelectCacheOptions opts;
+	opts.capacity = 2;
+	SelectCache<BUFFER, NetProvider> cache(client, opts);
+	auto select = [&](uint64_t key, uint32_t limit = UINT32_MAX) {
+		std::optional<CachedSelect> res =
+			cache.select(conn, std::make_tuple(key), space_id, 0,
+				     limit, 0, EQ, WAIT_TIMEOUT);
+		fail_unless(res != std::nullopt);
+		fail_unless(res->data.dimension == 1);
+		auto buf = res->buffer();
+		std::vector<UserTuple> tuples = decodeUserTuple(buf, res->data);
+		fail_unless(tuples.size() == 1);
+		fail_unless(tuples[0].field1 == key);
+		return res->is_hit;
+	};
+
+	TEST_CASE("Miss and hit");
+	fail_if(select(1));
+	fail_unless(select(1));
+	fail_unless(server.requests() == 1);
+	fail_unless(cache.hits() == 1);
+	fail_unless(cache.misses() == 1);
+	fail_unless(cache.size() == 1);
+
+	TEST_CASE("Key includes all request parameters");
+	fail_if(select(1, 10));
+	fail_unless(select(1, 10));
+	fail_unless(server.requests() == 2);
+
+	TEST_CASE("CLOCK eviction");
+	/* Entry (1, 10) is referenced: entry (1) is evicted instead. */
+	fail_if(select(2));
+	fail_unless(cache.evictions() == 1);
+	fail_unless(cache.size() == 2);
+	fail_unless(select(1, 10));
+	fail_unless(select(2));
+	fail_if(select(1));
+	fail_unless(cache.evictions() == 2);
+
+	TEST_CASE("Explicit invalidation");
+	cache.invalidate(space_id + 1);
+	fail_unless(cache.size() == 2);
+	cache.invalidate(space_id);
+	fail_unless(cache.size() == 0);
+	fail_if(select(1));
+	fail_unless(select(1));
+
+	TEST_CASE("Schema change");
+	server.setSchemaVersion(2);
+	rid_t f = conn.ping();
+	fail_unless(waitResponse(client, conn, f)->header.schema_id == 2);
+	fail_unless(conn.schemaVersion() == 2);
+	fail_if(select(1));
+	fail_unless(select(1));
+
+	TEST_CASE("Connections with different schema versions");
+	{
+		MockServerConfig other_cfg;
+		other_cfg.port = shard_ports[0];
+		MockServer other(other_cfg);
+		other.setSchemaVersion(3);
+		fail_unless(other.start() == 0);
+		Connection<BUFFER, NetProvider> other_conn(client);
+		fail_unless(client.connect(other_conn, localhost,
+					   shard_ports[0]) == 0);
+		f = other_conn.ping();
+		fail_unless(waitResponse(client, other_conn, f) != std::nullopt);
+		fail_unless(other_conn.schemaVersion() == 3);
+		/* Switching between connections doesn't drop the entry. */
+		for (int i = 0; i < 3; i++) {
+			fail_unless(select(1));
+			std::optional<CachedSelect> res =
+				cache.select(other_conn, std::make_tuple(1),
+					     space_id, 0, UINT32_MAX, 0, EQ,
+					     WAIT_TIMEOUT);
+			fail_unless(res != std::nullopt);
+			fail_unless(res->is_hit);
+		}
+		fail_unless(other.requests() == 1);
+		client.close(other_conn);
+		other.stop();
+	}
+
+	TEST_CASE("Invalidation on watched key");
+	fail_unless(cache.invalidateOnWatch(conn, "config", space_id) == 0);
+	fail_unless(pingUntil(client, conn, [&] {
+		return conn.getWatched("config") != nullptr;
+	}));
+	fail_if(select(1));
+	fail_unless(select(1));
+	server.broadcast("config", 5);
+	fail_unless(pingUntil(client, conn, [&] {
+		return *conn.getWatched("config") == "\x05";
+	}));
+	fail_unless(cache.size() == 0);
+	fail_if(select(1));
+
+	TEST_CASE("Destroyed cache unwatches its keys");
+	{
+		SelectCache<BUFFER, NetProvider> tmp_cache(client, opts);
+		fail_unless(tmp_cache.invalidateOnWatch(conn, "tmp", space_id) == 0);
+		fail_unless(tmp_cache.invalidateOnWatch(conn, "tmp", space_id) == 0);
+		fail_unless(pingUntil(client, conn, [&] {
+			return conn.getWatched("tmp") != nullptr;
+		}));
+	}
+	fail_unless(conn.getWatched("tmp") == nullptr);
+	/* The event must not reach the handler of the destroyed cache. */
+	server.broadcast("tmp", 1);
+	server.broadcast("config", 6);
+	fail_unless(pingUntil(client, conn, [&] {
+		return *conn.getWatched("config") == "\x06";
+	}));
+	fail_unless(conn.getWatched("tmp") == nullptr);
+
+	TEST_CASE("TTL");
+	opts.ttl = 50;
+	SelectCache<BUFFER, NetProvider> ttl_cache(client, opts);
+	size_t requests = server.requests();
+	fail_if(ttl_cache.select(conn, std::make_tuple(3), space_id)->is_hit);
+	fail_unless(ttl_cache.select(conn, std::make_tuple(3), space_id)->is_hit);
+	std::this_thread::sleep_for(std::chrono::milliseconds(60));
+	fail_if(ttl_cache.select(conn, std::make_tuple(3), space_id)->is_hit);
+	fail_unless(server.requests() == requests + 2);
+	client.close(conn);
+}
+
+/** Request to a slow replica is hedged to another one. */
+template <class BUFFER, class NetProvider = Net_t>
+void
+hedging()
+{
+	TEST_INIT(0);
+	MockServerConfig cfg;
+	cfg.port = shard_ports[0];
+	MockServer replica0(cfg);
+	cfg.port = shard_ports[1];
+	MockServer replica1(cfg);
+	fail_unless(replica0.start() == 0);
+	fail_unless(replica1.start() == 0);
+
+	Connector<BUFFER, NetProvider> client;
+	Connection<BUFFER, NetProvider> conn0(client);
+	Connection<BUFFER, NetProvider> conn1(client);
+	fail_unless(client.connect(conn0, localhost, shard_ports[0]) == 0);
+	fail_unless(client.connect(conn1, localhost, shard_ports[1]) == 0);
+
+	HedgeOptions opts;
+	opts.initial_delay_us = 50000;
+	opts.min_samples = 10;
+	opts.refresh_interval = 10;
+	opts.min_delay_us = 1000;
+	Hedger<BUFFER, NetProvider> hedger(client, opts);
+	fail_unless(hedger.addReplica(conn0) == 0);
+	fail_unless(hedger.addReplica(conn1) == 1);
+	auto select = [](uint64_t key) {
+		return [key](Connection<BUFFER, NetProvider> &conn) {
+			return conn.space[space_id].select(std::make_tuple(key));
+		};
+	};
+
+	TEST_CASE("Fast replicas");
+	for (uint64_t i = 0; i < 40; i++) {
+		auto res = hedger.request(select(i), WAIT_TIMEOUT);
+		fail_unless(res != std::nullopt);
+		fail_unless(res->attempts == 1);
+		std::optional<Response<BUFFER>> response(std::move(res->response));
+		fail_unless(firstTuple(*res->conn, response).field1 == i);
+	}
+	fail_unless(hedger.hedged() == 0);
+	/* Delay is learned from latency of replicas. */
+	fail_unless(hedger.delay(0) < opts.initial_delay_us);
+	fail_unless(hedger.delay(1) < opts.initial_delay_us);
+
+	TEST_CASE("Slow replica is hedged");
+	constexpr unsigned SLOW_US = 300000;
+	replica0.setDelay(SLOW_US);
+	auto start = std::chrono::steady_clock::now();
+	for (uint64_t i = 0; i < 10; i++) {
+		auto res = hedger.request(select(i), WAIT_TIMEOUT);
+		fail_unless(res != std::nullopt);
+		fail_unless(res->conn == &conn1);
+		std::optional<Response<BUFFER>> response(std::move(res->response));
+		fail_unless(firstTuple(conn1, response).field1 == i);
+	}
+	auto elapsed = std::chrono::steady_clock::now() - start;
+	fail_unless(elapsed < std::chrono::microseconds(SLOW_US));
+	fail_unless(hedger.hedged() == 5);
+	fail_unless(hedger.hedgeWins() == 5);
+
+	TEST_CASE("Responses of losers are not stored");
+	replica0.setDelay(0);
+	std::this_thread::sleep_for(std::chrono::microseconds(SLOW_US));
+	rid_t f = conn0.ping();
+	fail_unless(waitResponse(client, conn0, f) != std::nullopt);
+	fail_unless(replica0.requests() == 20 + 5 + 1);
+	ConnectionStat stat = conn0.snapshot();
+	fail_unless(stat.futures_pending == 0);
+	fail_unless(stat.futures_ready == 0);
+
+	TEST_CASE("Delay is learned from requests of the same type");
+	fail_unless(hedger.delay(1, LATENCY_CALL) == opts.initial_delay_us);
+	constexpr unsigned SLOW_PING_US = 20000;
+	replica1.setDelay(SLOW_PING_US);
+	for (int i = 0; i < 20; i++) {
+		f = conn1.ping();
+		fail_unless(waitResponse(client, conn1, f) != std::nullopt);
+	}
+	replica1.setDelay(0);
+	for (uint64_t i = 0; i < 2 * opts.refresh_interval; i++)
+		fail_unless(hedger.request(select(i), WAIT_TIMEOUT) != std::nullopt);
+	/* Slow pings don't affect delay of selects. */
+	fail_unless(hedger.delay(1) < SLOW_PING_US);
+	fail_unless(hedger.delay(1, LATENCY_CALL) == opts.initial_delay_us);
+
+	TEST_CASE("Dead replica is hedged at once");
+	HedgeOptions slow_opts;
+	slow_opts.initial_delay_us = 5000000;
+	Hedger<BUFFER, NetProvider> slow_hedger(client, slow_opts);
+	slow_hedger.addReplica(conn0);
+	slow_hedger.addReplica(conn1);
+	replica0.setDelay(SLOW_US);
+	start = std::chrono::steady_clock::now();
+	std::thread killer([&replica0] {
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		replica0.stop();
+	});
+	auto res = slow_hedger.request(select(7));
+	killer.join();
+	fail_unless(res != std::nullopt);
+	fail_unless(res->conn == &conn1);
+	fail_unless(res->attempts == 2);
+	std::optional<Response<BUFFER>> response(std::move(res->response));
+	fail_unless(firstTuple(conn1, response).field1 == 7);
+	elapsed = std::chrono::steady_clock::now() - start;
+	fail_unless(elapsed < std::chrono::microseconds(SLOW_US));
+	fail_unless(conn0.status.is_failed);
+
+	TEST_CASE("No live replica is left");
+	Hedger<BUFFER, NetProvider> dead_hedger(client, slow_opts);
+	dead_hedger.addReplica(conn0);
+	fail_unless(dead_hedger.request(select(8)) == std::nullopt);
+	fail_unless(dead_hedger.getError().find("failed") != std::string::npos);
+	client.close(conn0);
+	client.close(conn1);
+}
+
+/** Lost connection is restored, requests in flight are replayed or failed. */
+template <class BUFFER, class NetProvider = Net_t>
+void
+reconnect()
+{
+	TEST_INIT(0);
+	MockServerConfig cfg;
+	cfg.port = port;
+	cfg.auth_user = "alice";
+	cfg.auth_scramble.assign(SECRET_SCRAMBLE, Iproto::SCRAMBLE_SIZE);
+	MockServer server(cfg);
+	fail_unless(server.start() == 0);
+	Connector<BUFFER, NetProvider> client;
+	Connection<BUFFER, NetProvider> conn(client);
+	Credentials creds("alice", "secret");
+	fail_unless(client.connect(conn, localhost, port, creds) == 0);
+	ReconnectOptions opts;
+	opts.initial_backoff = 10;
+	opts.max_backoff = 50;
+	opts.max_attempts = 0;
+	conn.setReconnect(opts);
+	fail_unless(conn.watch("key") == 0);
+	auto isCode = [](std::optional<Response<BUFFER>> &response, int code) {
+		fail_unless(response != std::nullopt);
+		return response->header.code == code;
+	};
+	auto call = [&conn](uint64_t key) {
+		return conn.call("get", std::make_tuple(key));
+	};
+
+	TEST_CASE("Sent requests");
+	server.setDelay(200000);
+	rid_t select = conn.space[space_id].select(std::make_tuple(1));
+	rid_t unsafe = call(2);
+	rid_t marked = conn.idempotent(call(3));
+	/* Requests are sent, responses are delayed. */
+	fail_unless(client.wait(conn, select, 50) != 0);
+	server.dropConnections();
+	server.setDelay(0);
+	std::optional<Response<BUFFER>> response = waitResponse(client, conn,
+								unsafe);
+	fail_unless(isCode(response, Iproto::TYPE_ERROR |
+				     CONNECTION_LOST_ERRCODE));
+	fail_unless(response->body.error_stack->error.errcode ==
+		    CONNECTION_LOST_ERRCODE);
+	response = waitResponse(client, conn, select);
+	fail_unless(firstTuple(conn, response).field1 == 1);
+	response = waitResponse(client, conn, marked);
+	fail_unless(firstTuple(conn, response).field1 == 3);
+	fail_unless(conn.reconnects() == 1);
+	fail_unless(server.auths() == 2);
+
+	TEST_CASE("Unsent requests");
+	server.stop();
+	rid_t f = conn.ping();
+	/* Connect attempts fail while server is down. */
+	fail_unless(client.wait(conn, f, 100) != 0);
+	fail_unless(! conn.futureIsReady(f));
+	unsafe = call(4);
+	fail_unless(server.start() == 0);
+	response = waitResponse(client, conn, unsafe);
+	fail_unless(firstTuple(conn, response).field1 == 4);
+	response = waitResponse(client, conn, f);
+	fail_unless(isCode(response, 0));
+	fail_unless(conn.reconnects() == 2);
+	fail_unless(server.auths() == 3);
+
+	TEST_CASE("Watchers are subscribed again");
+	server.broadcast("key", 42);
+	fail_unless(pingUntil(client, conn, [&conn] {
+		const std::string *value = conn.getWatched("key");
+		return value != nullptr && *value == "\x2a";
+	}));
+
+	TEST_CASE("Attempts are exhausted");
+	Connection<BUFFER, NetProvider> conn2(client);
+	fail_unless(client.connect(conn2, localhost, port) == 0);
+	opts.max_attempts = 3;
+	conn2.setReconnect(opts);
+	server.stop();
+	f = conn2.ping();
+	fail_unless(client.wait(conn2, f, WAIT_TIMEOUT) != 0);
+	response = conn2.getResponse(f);
+	fail_unless(isCode(response, Iproto::TYPE_ERROR |
+				     CONNECTION_LOST_ERRCODE));
+	fail_unless(conn2.getError().find("Failed to reconnect") !=
+		    std::string::npos);
+	fail_unless(conn2.reconnects() == 0);
+	/* Manual connect still works. */
+	fail_unless(server.start() == 0);
+	conn2.reset();
+	fail_unless(client.connect(conn2, localhost, port) == 0);
+	f = conn2.ping();
+	fail_unless(isCode(response = waitResponse(client, conn2, f), 0));
+
+	TEST_CASE("Rejected credentials");
+	server.stop();
+	MockServerConfig other_cfg = cfg;
+	other_cfg.auth_user = "bob";
+	MockServer other(other_cfg);
+	fail_unless(other.start() == 0);
+	select = conn.space[space_id].select(std::make_tuple(5));
+	fail_unless(client.wait(conn, select, WAIT_TIMEOUT) != 0);
+	response = conn.getResponse(select);
+	fail_unless(isCode(response, Iproto::TYPE_ERROR |
+				     CONNECTION_LOST_ERRCODE));
+	fail_unless(conn.getError().find("Authentication has failed") !=
+		    std::string::npos);
+	fail_unless(conn.reconnects() == 2);
+	/* The request is not replayed without authentication. */
+	fail_unless(other.auths() == 1);
+	fail_unless(other.requests() == 1);
+	client.close(conn);
+	client.close(conn2);
+}
+
+/** Idle connections are pinged, a silent peer is found dead. */
+template <class BUFFER, class NetProvider = Net_t>
+void
+heartbeat()
+{
+	TEST_INIT(0);
+	MockServerConfig cfg;
+	cfg.port = port;
+	MockServer server(cfg);
+	fail_unless(server.start() == 0);
+	Connector<BUFFER, NetProvider> client;
+	Connection<BUFFER, NetProvider> conn(client);
+	fail_unless(client.connect(conn, localhost, port) == 0);
+	HeartbeatOptions opts;
+	opts.interval = 20;
+	opts.max_missed = 2;
+	client.setHeartbeat(opts);
+	auto pollFor = [&client](std::chrono::milliseconds duration) {
+		auto end = std::chrono::steady_clock::now() + duration;
+		while (std::chrono::steady_clock::now() < end)
+			client.poll(10);
+	};
+
+	TEST_CASE("Keepalive");
+	KeepaliveOptions keepalive;
+	keepalive.idle = 5;
+	keepalive.user_timeout = 3000;
+	fail_unless(client.setKeepalive(conn, keepalive) == 0);
+	int value = 0;
+	socklen_t len = sizeof(value);
+	fail_unless(getsockopt(conn.socket, SOL_SOCKET, SO_KEEPALIVE, &value,
+			       &len) == 0 && value == 1);
+	fail_unless(getsockopt(conn.socket, IPPROTO_TCP, TCP_KEEPIDLE, &value,
+			       &len) == 0 && value == 5);
+	fail_unless(getsockopt(conn.socket, IPPROTO_TCP, TCP_USER_TIMEOUT,
+			       &value, &len) == 0 && value == 3000);
+
+	TEST_CASE("Idle connection is pinged");
+	pollFor(std::chrono::milliseconds(200));
+	fail_unless(server.requests() >= 3);
+	fail_unless(! conn.status.is_failed);
+	/* Heartbeat pings are not accounted as requests. */
+	ConnectionStat stat = conn.snapshot();
+	fail_unless(stat.requests == 0);
+	fail_unless(stat.responses == 0);
+	LatencySnapshot latency;
+	conn.getLatency(latency);
+	fail_unless(latency[LATENCY_PING].count() == 0);
+	rid_t f = conn.ping();
+	fail_unless(waitResponse(client, conn, f)->header.code == 0);
+	/* Responses to heartbeat pings are not stored. */
+	stat = conn.snapshot();
+	fail_unless(stat.futures_ready == 0);
+	fail_unless(stat.requests == 1);
+	conn.getLatency(latency);
+	fail_unless(latency[LATENCY_PING].count() == 1);
+
+	TEST_CASE("Silent peer is dead");
+	server.setDelay(1000000);
+	pollFor(std::chrono::milliseconds(200));
+	fail_unless(conn.status.is_failed);
+	fail_unless(conn.socket < 0);
+	fail_unless(conn.getError().find("heartbeat") != std::string::npos);
+	server.setDelay(0);
+
+	TEST_CASE("Dead connection is restored");
+	conn.reset();
+	fail_unless(client.connect(conn, localhost, port) == 0);
+	ReconnectOptions reconnect_opts;
+	reconnect_opts.initial_backoff = 10;
+	conn.setReconnect(reconnect_opts);
+	/* Keepalive is set again on connect. */
+	fail_unless(getsockopt(conn.socket, IPPROTO_TCP, TCP_KEEPIDLE, &value,
+			       &len) == 0 && value == 5);
+	server.setDelay(300000);
+	pollFor(std::chrono::milliseconds(200));
+	fail_unless(conn.status.is_failed);
+	server.setDelay(0);
+	size_t requests = conn.snapshot().requests;
+	f = conn.ping();
+	fail_unless(waitResponse(client, conn, f)->header.code == 0);
+	fail_unless(conn.reconnects() == 1);
+	/* Unanswered heartbeat pings are not replayed. */
+	fail_unless(conn.snapshot().requests == requests + 1);
+	fail_unless(conn.snapshot().futures_pending == 0);
+	client.close(conn);
+}
+
+/** Synchronous requests are served without polling. */
+template <class BUFFER, class NetProvider = Net_t>
+void
+sync_wait()
+{
+	TEST_INIT(0);
+	MockServerConfig cfg;
+	cfg.port = port;
+	MockServer server(cfg);
+	fail_unless(server.start() == 0);
+	Connector<BUFFER, NetProvider> client;
+	Connection<BUFFER, NetProvider> conn(client);
+	fail_unless(client.connect(conn, localhost, port) == 0);
+
+	TEST_CASE("Busy poll");
+	int rc = client.setBusyPoll(conn, 50);
+	/* Unprivileged user can't raise it. */
+	fail_unless(rc == 0 || errno == EPERM);
+
+	TEST_CASE("Spinning");
+	SyncWaitOptions opts;
+	/* Long enough to never fall back to poller. */
+	opts.spin_us = 1000000;
+	size_t polls = client.snapshot().epoll_wait_calls;
+	for (uint64_t i = 0; i < 100; i++) {
+		rid_t f = conn.space[space_id].select(std::make_tuple(i));
+		fail_unless(client.waitSync(conn, f, WAIT_TIMEOUT, opts) == 0);
+		std::optional<Response<BUFFER>> response = conn.getResponse(f);
+		fail_unless(firstTuple(conn, response).field1 == i);
+	}
+	fail_unless(client.snapshot().epoll_wait_calls == polls);
+
+	TEST_CASE("Fallback to poller");
+	server.setDelay(20000);
+	opts.spin_us = 100;
+	rid_t f = conn.ping();
+	fail_unless(client.waitSync(conn, f, WAIT_TIMEOUT, opts) == 0);
+	fail_unless(conn.getResponse(f)->header.code == 0);
+	fail_unless(client.snapshot().epoll_wait_calls > polls);
+
+	TEST_CASE("Timeout");
+	server.setDelay(200000);
+	f = conn.ping();
+	fail_unless(client.waitSync(conn, f, 20, opts) != 0);
+	fail_unless(! conn.futureIsReady(f));
+	server.setDelay(0);
+	fail_unless(waitResponse(client, conn, f)->header.code == 0);
+	client.close(conn);
+}
+
+/** Timeouts of sub-millisecond precision and non-blocking polls. */
+template <class BUFFER, class NetProvider = Net_t>
+void
+chrono_timeouts()
+{
+	TEST_INIT(0);
+	using namespace std::chrono;
+	MockServerConfig cfg;
+	cfg.port = port;
+	MockServer server(cfg);
+	fail_unless(server.start() == 0);
+	Connector<BUFFER, NetProvider> client;
+	Connection<BUFFER, NetProvider> conn(client);
+	fail_unless(client.connect(conn, localhost, port) == 0);
+	server.setDelay(50000);
+
+	TEST_CASE("Zero timeout polls once");
+	rid_t f = conn.ping();
+	size_t polls = client.snapshot().epoll_wait_calls;
+	auto start = steady_clock::now();
+	fail_unless(client.wait(conn, f, Timeout_t{0}) != 0);
+	fail_unless(client.snapshot().epoll_wait_calls == polls + 1);
+	fail_unless(client.waitAny(Timeout_t{0}) == nullptr);
+	fail_unless(client.poll(Timeout_t{0}) == 0);
+	fail_unless(steady_clock::now() - start < milliseconds(20));
+
+	TEST_CASE("Sub-millisecond timeout");
+	start = steady_clock::now();
+	fail_unless(client.wait(conn, f, microseconds(300)) != 0);
+	fail_unless(steady_clock::now() - start >= microseconds(300));
+	fail_unless(steady_clock::now() - start < milliseconds(20));
+	fail_unless(! conn.futureIsReady(f));
+
+	TEST_CASE("Response within timeout");
+	fail_unless(client.wait(conn, f, microseconds(WAIT_TIMEOUT * 1000)) == 0);
+	fail_unless(conn.getResponse(f)->header.code == 0);
+	server.setDelay(0);
+	rid_t futures[] = {conn.ping(), conn.ping()};
+	client.waitAll(conn, futures, 2, TIMEOUT_INFINITE);
+	fail_unless(conn.futureIsReady(futures[0]));
+	fail_unless(conn.futureIsReady(futures[1]));
+	f = conn.ping();
+	fail_unless(client.waitSync(conn, f, microseconds(WAIT_TIMEOUT * 1000)) == 0);
+	client.close(conn);
+}
+
+/**
+ * Listener with full accept queue: the kernel drops SYNs, so connects
+ * hang. Return listening socket and sockets filling its queue.
+ */
+static std::vector<int>
+blackhole()
+{
+	std::vector<int> fds;
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(blackhole_port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	fail_unless(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+	fail_unless(listen(fd, 0) == 0);
+	fds.push_back(fd);
+	for (int i = 0; i < 16; i++) {
+		int client = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+		connect(client, (struct sockaddr *)&addr, sizeof(addr));
+		fds.push_back(client);
+		struct pollfd pfd = {client, POLLOUT, 0};
+		if (poll(&pfd, 1, 200) == 0)
+			return fds;
+	}
+	fail_unless(false);
+	return fds;
+}
+
+/** Addresses are raced and cached. */
+template <class BUFFER, class NetProvider = Net_t>
+void
+address_cache()
+{
+	TEST_INIT(0);
+	MockServerConfig cfg;
+	cfg.port = port;
+	MockServer server(cfg);
+	fail_unless(server.start() == 0);
+
+	TEST_CASE("Dead address doesn't cost timeout");
+	std::vector<int> hole = blackhole();
+	std::vector<SockAddr> addrs, alive;
+	fail_unless(NetworkEngine::resolve(localhost, blackhole_port,
+					   addrs) == 0);
+	fail_unless(NetworkEngine::resolve(localhost, port, alive) == 0);
+	addrs.insert(addrs.end(), alive.begin(), alive.end());
+	size_t winner = 0;
+	Timer timer(1000);
+	timer.start();
+	int fd = NetworkEngine::connectINET(addrs, 2, &winner, 50);
+	fail_unless(fd >= 0);
+	fail_unless(winner == addrs.size() - 1);
+	fail_unless(! timer.isExpired());
+	NetworkEngine::close(fd);
+
+	TEST_CASE("Only dead addresses");
+	addrs.resize(1);
+	timer.start();
+	fail_unless(NetworkEngine::connectINET(addrs, 1, &winner, 50) < 0);
+	fail_unless(timer.elapsed() >= 900);
+	for (int fd : hole)
+		close(fd);
+
+	TEST_CASE("Resolved addresses are cached");
+	Connector<BUFFER, NetProvider> client;
+	Connection<BUFFER, NetProvider> conn(client);
+	fail_unless(client.connect(conn, "localhost", port) == 0);
+	fail_unless(waitResponse(client, conn, conn.ping())->header.code == 0);
+	client.close(conn);
+	fail_unless(client.connect(conn, "localhost", port) == 0);
+	client.close(conn);
+	const auto &cache = client.getNetProvider().addresses();
+	fail_unless(cache.resolves() == 1);
+
+	TEST_CASE("Cache is disabled");
+	client.setAddressTtl(0);
+	fail_unless(client.connect(conn, "localhost", port) == 0);
+	client.close(conn);
+	fail_unless(client.connect(conn, "localhost", port) == 0);
+	fail_unless(cache.resolves() == 3);
+	client.close(conn);
+}
+
+/** Requests are answered in-process by loopback provider. */
+template <class BUFFER>
+void
+loopback()
+{
+	TEST_INIT(0);
+	using NetLoop_t = LoopbackNetProvider<BUFFER>;
+	Connector<BUFFER, NetLoop_t> client;
+	Connection<BUFFER, NetLoop_t> conn(client);
+	/* {DATA: [[7, "abc", 1.5]]} */
+	client.getNetProvider().responder().setBody(Iproto::SELECT,
+		std::string("\x81\x30\x91\x93\x07\xa3" "abc"
+			    "\xcb\x3f\xf8\0\0\0\0\0\0", 18));
+	fail_unless(client.connect(conn, "any", 0) == 0);
+
+	TEST_CASE("Canned responses");
+	rid_t f = conn.ping();
+	fail_unless(waitResponse(client, conn, f)->header.code == 0);
+	f = conn.space[space_id].select(std::make_tuple(1));
+	std::optional<Response<BUFFER>> response =
+		waitResponse(client, conn, f);
+	UserTuple tuple = firstTuple(conn, response);
+	fail_unless(tuple.field1 == 7);
+	fail_unless(tuple.field2 == "abc");
+	fail_unless(tuple.field3 == 1.5);
+
+	TEST_CASE("Batch spanning buffer blocks");
+	std::vector<rid_t> futures;
+	for (size_t i = 0; i < 10000; i++)
+		futures.push_back(conn.space[space_id].replace(
+			std::make_tuple(i, std::string(100, 'x'), 1.0)));
+	client.waitAll(conn, futures.data(), futures.size(), WAIT_TIMEOUT);
+	for (rid_t id : futures) {
+		fail_unless(conn.futureIsReady(id));
+		fail_unless(conn.getResponse(id)->body.data != std::nullopt);
+	}
+	fail_unless(client.getNetProvider().responder().requests() == 10002);
+
+	TEST_CASE("Synchronous wait");
+	SyncWaitOptions opts;
+	opts.spin_us = 1000000;
+	size_t polls = client.snapshot().epoll_wait_calls;
+	f = conn.ping();
+	fail_unless(client.waitSync(conn, f, WAIT_TIMEOUT, opts) == 0);
+	fail_unless(conn.getResponse(f)->header.code == 0);
+	fail_unless(client.snapshot().epoll_wait_calls == polls);
+
+	TEST_CASE("Request without response");
+	client.getNetProvider().responder().setBody(Iproto::PING, "");
+	f = conn.ping();
+	client.wait(conn, f, 10);
+	fail_unless(! conn.futureIsReady(f));
+
+	TEST_CASE("Reconnect");
+	client.close(conn);
+	conn.reset();
+	fail_unless(client.connect(conn, "any", 0) == 0);
+	f = conn.space[space_id].select(std::make_tuple(1));
+	response = waitResponse(client, conn, f);
+	fail_unless(firstTuple(conn, response).field1 == 7);
+	client.close(conn);
+}
+
+int main()
+{
+	canned_responses<Buf_t>(false);
+	canned_responses<Buf_t>(true);
+	echo_responses<Buf_t>();
+	delay_and_limit<Buf_t>();
+	push_messages<Buf_t>();
+	watchers<Buf_t>();
+	cursors<Buf_t>(11);
+	cursors<Buf_t>(10);
+	authentication<Buf_t>();
+	router<Buf_t>();
+	select_cache<Buf_t>();
+	hedging<Buf_t>();
+	reconnect<Buf_t>();
+	heartbeat<Buf_t>();
+	sync_wait<Buf_t>();
+	loopback<Buf_t>();
+	address_cache<Buf_t>();
+	chrono_timeouts<Buf_t>();
+
+	using NetLibEv_t = LibevNetProvider<Buf_t, NetworkEngine>;
+	canned_responses<Buf_t, NetLibEv_t>(false);
+	canned_responses<Buf_t, NetLibEv_t>(true);
+	echo_responses<Buf_t, NetLibEv_t>();
+	push_messages<Buf_t, NetLibEv_t>();
+	watchers<Buf_t, NetLibEv_t>();
+	cursors<Buf_t, NetLibEv_t>(11);
+	authentication<Buf_t, NetLibEv_t>();
+	router<Buf_t, NetLibEv_t>();
+	select_cache<Buf_t, NetLibEv_t>();
+	hedging<Buf_t, NetLibEv_t>();
+	reconnect<Buf_t, NetLibEv_t>();
+	heartbeat<Buf_t, NetLibEv_t>();
+	sync_wait<Buf_t, NetLibEv_t>();
+	address_cache<Buf_t, NetLibEv_t>();
+	chrono_timeouts<Buf_t, NetLibEv_t>();
+	return 0;
+}
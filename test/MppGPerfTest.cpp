@@ -0,0 +1,399 @@
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "../src/Buffer/Buffer.hpp"
+#include "../src/mpp/mpp.hpp"
+#include "../src/Client/RequestEncoder.hpp"
+
+/**
+ * Baseline of msgpack encoder and decoder performance. Every benchmark is
+ * instantiated for several buffer block sizes: small blocks make objects
+ * cross block boundaries often and exercise slow paths of the buffer.
+ */
+
+/** Count of objects encoded/decoded in one benchmark iteration. */
+constexpr size_t BATCH = 1024;
+/** Count of elements in array that is skipped by Dec::Skip. */
+constexpr size_t BIG_ARR_SIZE = 64 * 1024;
+/** The longest string used in benchmarks. */
+constexpr size_t MAX_STR_SIZE = 64 * 1024;
+
+/** State shared by all readers that walk one msgpack object. */
+template <class BUFFER>
+struct WalkState {
+	mpp::Dec<BUFFER> &dec;
+	BUFFER &buf;
+	size_t objects = 0;
+	uint64_t checksum = 0;
+	char str[MAX_STR_SIZE] = {};
+};
+
+/**
+ * Reader that accepts msgpack of any type and descends into arrays and
+ * maps. String-like values are copied out of the buffer the same way a
+ * user's reader would do it.
+ */
+template <class BUFFER>
+struct WalkReader : mpp::SimpleReaderBase<BUFFER, mpp::MP_ANY> {
+	using BufferIterator_t = typename BUFFER::iterator;
+	explicit WalkReader(WalkState<BUFFER> &st) : m_St(st) {}
+
+	void Value(const BufferIterator_t&, mpp::compact::Type, mpp::ArrValue)
+	{
+		m_St.objects++;
+		m_St.dec.SetReader(false, WalkReader{m_St});
+	}
+	void Value(const BufferIterator_t&, mpp::compact::Type, mpp::MapValue)
+	{
+		m_St.objects++;
+		/* Keys and values of a map are read by separate readers. */
+		m_St.dec.SetReader(false, WalkReader{m_St});
+		m_St.dec.SetReader(true, WalkReader{m_St});
+	}
+	void Value(BufferIterator_t &itr, mpp::compact::Type, mpp::StrValue v)
+	{
+		copy(itr, v.offset, v.size);
+	}
+	void Value(BufferIterator_t &itr, mpp::compact::Type, mpp::BinValue v)
+	{
+		copy(itr, v.offset, v.size);
+	}
+	void Value(BufferIterator_t &itr, mpp::compact::Type, mpp::ExtValue v)
+	{
+		copy(itr, v.offset, v.size);
+	}
+	template <class T>
+	void Value(const BufferIterator_t&, mpp::compact::Type, T&& v)
+	{
+		m_St.objects++;
+		if constexpr (std::is_arithmetic_v<std::decay_t<T>>)
+			m_St.checksum += static_cast<uint64_t>(v);
+	}
+
+private:
+	void copy(BufferIterator_t &itr, size_t offset, size_t size)
+	{
+		m_St.objects++;
+		BufferIterator_t walker = itr;
+		walker += offset;
+		m_St.buf.get(walker, m_St.str, size);
+		m_St.checksum += size;
+	}
+
+	WalkState<BUFFER> &m_St;
+};
+
+enum {
+	SOME_ENUM_VALUE = 42,
+};
+
+template <class BUFFER>
+static void
+encodeScalars(mpp::Enc<BUFFER> &enc)
+{
+	for (size_t i = 0; i < BATCH / 16; i++) {
+		enc.add(nullptr);
+		enc.add(true);
+		enc.add(false);
+		enc.add(uint8_t(i));
+		enc.add(uint8_t(200));
+		enc.add(uint16_t(2000 + i));
+		enc.add(uint32_t(2000000 + i));
+		enc.add(uint64_t(20000000000ull + i));
+		enc.add(-1);
+		enc.add(int8_t(-100));
+		enc.add(int16_t(-1000));
+		enc.add(int32_t(-100000));
+		enc.add(int64_t(-10000000000ll));
+		enc.add(SOME_ENUM_VALUE);
+		enc.add(1.5f);
+		enc.add(2.5);
+	}
+}
+
+/** Enc doesn't support MP_EXT yet, so ext is written by hand. */
+template <class BUFFER>
+static void
+addExt(BUFFER &buf, int8_t type, const std::string &data)
+{
+	if (data.size() <= UINT8_MAX) {
+		buf.addBack('\xc7');
+		buf.addBack(uint8_t(data.size()));
+	} else if (data.size() <= UINT16_MAX) {
+		buf.addBack('\xc8');
+		buf.addBack(mpp::bswap(uint16_t(data.size())));
+	} else {
+		buf.addBack('\xc9');
+		buf.addBack(mpp::bswap(uint32_t(data.size())));
+	}
+	buf.addBack(type);
+	buf.addBack(wrap::Data{data.data(), data.size()});
+}
+
+template <class BUFFER>
+static void
+encodeStrings(BUFFER &buf, mpp::Enc<BUFFER> &enc, const std::string &str)
+{
+	for (size_t i = 0; i < BATCH / 4; i++) {
+		enc.add(str);
+		enc.add(str.c_str());
+		enc.add(mpp::as_bin(str));
+		addExt(buf, 1, str);
+	}
+}
+
+template <class BUFFER>
+static void
+encodeNested(mpp::Enc<BUFFER> &enc)
+{
+	for (size_t i = 0; i < BATCH / 16; i++) {
+		enc.add(std::make_tuple(
+			i, "name",
+			mpp::as_map(std::forward_as_tuple(
+				1, std::make_tuple(1, 2, 3),
+				2, mpp::as_map(std::forward_as_tuple(
+					"key", -1, "flag", true)),
+				3, std::make_tuple(std::make_tuple(1.5, nullptr),
+						   std::make_tuple("a", "b"))))));
+	}
+}
+
+/** Count of msgpack objects (including nested) in one encodeNested() item. */
+constexpr size_t NESTED_OBJECTS = 23;
+
+template <class BUFFER>
+static size_t
+bufSize(BUFFER &buf)
+{
+	return buf.template end<true>() - buf.template begin<true>();
+}
+
+template <class BUFFER>
+static void
+BM_EncodeScalars(benchmark::State& state)
+{
+	BUFFER buf;
+	mpp::Enc<BUFFER> enc(buf);
+	size_t bytes = 0;
+	for (auto _ : state) {
+		encodeScalars(enc);
+		bytes += bufSize(buf);
+		buf.flush();
+	}
+	state.SetItemsProcessed(state.iterations() * BATCH);
+	state.SetBytesProcessed(bytes);
+}
+
+template <class BUFFER>
+static void
+BM_EncodeStrings(benchmark::State& state)
+{
+	BUFFER buf;
+	mpp::Enc<BUFFER> enc(buf);
+	std::string str(state.range(0), 'x');
+	size_t bytes = 0;
+	for (auto _ : state) {
+		encodeStrings(buf, enc, str);
+		bytes += bufSize(buf);
+		buf.flush();
+	}
+	state.SetItemsProcessed(state.iterations() * BATCH);
+	state.SetBytesProcessed(bytes);
+}
+
+template <class BUFFER>
+static void
+BM_EncodeNested(benchmark::State& state)
+{
+	BUFFER buf;
+	mpp::Enc<BUFFER> enc(buf);
+	size_t bytes = 0;
+	for (auto _ : state) {
+		encodeNested(enc);
+		bytes += bufSize(buf);
+		buf.flush();
+	}
+	state.SetItemsProcessed(state.iterations() * BATCH / 16 *
+				NESTED_OBJECTS);
+	state.SetBytesProcessed(bytes);
+}
+
+template <class BUFFER>
+static void
+BM_EncodeSelect(benchmark::State& state)
+{
+	BUFFER buf;
+	RequestEncoder<BUFFER> enc(buf);
+	size_t bytes = 0;
+	for (auto _ : state) {
+		for (size_t i = 0; i < BATCH; i++)
+			bytes += enc.encodeSelect(std::make_tuple(i), 512, 0,
+						  100, 0, EQ);
+		buf.flush();
+	}
+	state.SetItemsProcessed(state.iterations() * BATCH);
+	state.SetBytesProcessed(bytes);
+}
+
+template <class BUFFER>
+static void
+BM_EncodeReplace(benchmark::State& state)
+{
+	BUFFER buf;
+	RequestEncoder<BUFFER> enc(buf);
+	std::string str(state.range(0), 'x');
+	size_t bytes = 0;
+	for (auto _ : state) {
+		for (size_t i = 0; i < BATCH; i++)
+			bytes += enc.encodeReplace(
+				std::forward_as_tuple(i, str, 3.14), 512);
+		buf.flush();
+	}
+	state.SetItemsProcessed(state.iterations() * BATCH);
+	state.SetBytesProcessed(bytes);
+}
+
+/**
+ * Decode @a count top level objects, which were encoded in @a buf, walking
+ * all nested objects.
+ */
+template <class BUFFER>
+static void
+decodeAll(benchmark::State& state, BUFFER &buf, size_t count)
+{
+	mpp::Dec<BUFFER> dec(buf);
+	auto *st = new WalkState<BUFFER>{dec, buf};
+	typename BUFFER::iterator begin = buf.begin();
+	size_t bytes = bufSize(buf);
+	for (auto _ : state) {
+		dec.SetPosition(begin);
+		for (size_t i = 0; i < count; i++) {
+			dec.SetReader(false, WalkReader<BUFFER>{*st});
+			if (dec.Read() != mpp::READ_SUCCESS) {
+				state.SkipWithError("Failed to decode");
+				break;
+			}
+		}
+	}
+	benchmark::DoNotOptimize(st->checksum);
+	state.SetItemsProcessed(st->objects);
+	state.SetBytesProcessed(state.iterations() * bytes);
+	delete st;
+}
+
+template <class BUFFER>
+static void
+BM_DecodeScalars(benchmark::State& state)
+{
+	BUFFER buf;
+	mpp::Enc<BUFFER> enc(buf);
+	encodeScalars(enc);
+	decodeAll(state, buf, BATCH);
+}
+
+template <class BUFFER>
+static void
+BM_DecodeStrings(benchmark::State& state)
+{
+	BUFFER buf;
+	mpp::Enc<BUFFER> enc(buf);
+	std::string str(state.range(0), 'x');
+	encodeStrings(buf, enc, str);
+	decodeAll(state, buf, BATCH);
+}
+
+template <class BUFFER>
+static void
+BM_DecodeNested(benchmark::State& state)
+{
+	BUFFER buf;
+	mpp::Enc<BUFFER> enc(buf);
+	encodeNested(enc);
+	decodeAll(state, buf, BATCH / 16);
+}
+
+/** Skip big array of integers, which is as a whole of no interest. */
+template <class BUFFER>
+static void
+BM_DecodeSkip(benchmark::State& state)
+{
+	BUFFER buf;
+	mpp::Enc<BUFFER> enc(buf);
+	std::vector<uint64_t> arr(BIG_ARR_SIZE);
+	for (size_t i = 0; i < BIG_ARR_SIZE; i++)
+		arr[i] = i * i;
+	enc.add(arr);
+	size_t bytes = bufSize(buf);
+
+	mpp::Dec<BUFFER> dec(buf);
+	typename BUFFER::iterator begin = buf.begin();
+	for (auto _ : state) {
+		dec.SetPosition(begin);
+		dec.Skip();
+		if (dec.Read() != mpp::READ_SUCCESS) {
+			state.SkipWithError("Failed to skip");
+			break;
+		}
+	}
+	if (dec.getPosition() != buf.end())
+		state.SkipWithError("Wrong end of skipped array");
+	state.SetItemsProcessed(state.iterations() * BIG_ARR_SIZE);
+	state.SetBytesProcessed(state.iterations() * bytes);
+}
+
+#define MPP_BENCHMARK(func) \
+	BENCHMARK_TEMPLATE(func, tnt::Buffer<128>); \
+	BENCHMARK_TEMPLATE(func, tnt::Buffer<1024>); \
+	BENCHMARK_TEMPLATE(func, tnt::Buffer<16 * 1024>)
+
+#define MPP_BENCHMARK_STR(func) \
+	BENCHMARK_TEMPLATE(func, tnt::Buffer<128>)->Arg(8)->Arg(100)->Arg(1000); \
+	BENCHMARK_TEMPLATE(func, tnt::Buffer<1024>)->Arg(8)->Arg(100)->Arg(1000); \
+	BENCHMARK_TEMPLATE(func, tnt::Buffer<16 * 1024>)->Arg(8)->Arg(100)->Arg(1000)->Arg(50000)
+
+MPP_BENCHMARK(BM_EncodeScalars);
+MPP_BENCHMARK_STR(BM_EncodeStrings);
+MPP_BENCHMARK(BM_EncodeNested);
+MPP_BENCHMARK(BM_EncodeSelect);
+MPP_BENCHMARK_STR(BM_EncodeReplace);
+MPP_BENCHMARK(BM_DecodeScalars);
+MPP_BENCHMARK_STR(BM_DecodeStrings);
+MPP_BENCHMARK(BM_DecodeNested);
+MPP_BENCHMARK(BM_DecodeSkip);
+
+BENCHMARK_MAIN();
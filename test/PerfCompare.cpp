@@ -0,0 +1,84 @@
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <string_view>
+
+#include "Utils/PerfReport.hpp"
+
+/**
+ * Usage: PerfCompare [--threshold=PERCENT] BASELINE.json RESULT.json
+ * Compare results of perf tests (written with --json=FILE option or by
+ * google benchmark with --benchmark_out=FILE --benchmark_out_format=json)
+ * and exit with non-zero code if any result regressed more than the
+ * threshold (5% by default). Results should be repeated (--repeat=N or
+ * --benchmark_repetitions=N) so that noise can be told from regressions.
+ */
+int main(int argc, char **argv)
+{
+	double threshold = 5;
+	const char *files[2];
+	size_t file_count = 0;
+	for (int i = 1; i < argc; i++) {
+		std::string_view arg = argv[i];
+		if (arg.substr(0, 12) == "--threshold=") {
+			threshold = atof(argv[i] + 12);
+		} else if (arg.substr(0, 2) != "--" && file_count < 2) {
+			files[file_count++] = argv[i];
+		} else {
+			std::cerr << "Unknown option " << arg << std::endl;
+			return 2;
+		}
+	}
+	if (file_count != 2) {
+		std::cerr << "Usage: " << argv[0] <<
+			" [--threshold=PERCENT] BASELINE.json RESULT.json" <<
+			std::endl;
+		return 2;
+	}
+	PerfReport reports[2];
+	for (size_t i = 0; i < 2; i++) {
+		if (reports[i].readFile(files[i]) != 0) {
+			std::cerr << "Failed to read perf results from " <<
+				files[i] << std::endl;
+			return 2;
+		}
+	}
+	size_t regressions = perfCompare(reports[0], reports[1], threshold,
+					 std::cout);
+	if (regressions != 0) {
+		std::cout << regressions << " results regressed more than " <<
+			threshold << "%" << std::endl;
+		return 1;
+	}
+	return 0;
+}
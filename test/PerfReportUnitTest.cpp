@@ -0,0 +1,183 @@
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "Utils/PerfReport.hpp"
+#include "Utils/Helpers.hpp"
+
+#include <sstream>
+
+void
+test_summary()
+{
+	TEST_INIT(0);
+	PerfReport report;
+	PerfResult::Config_t config = {{"buffer", "128"}};
+	for (double v : {3., 1., 4., 1., 5.})
+		report.add("rps", config, "rps", PerfResult::HIGHER, v);
+	report.add("rps", {{"buffer", "4096"}}, "rps", PerfResult::HIGHER, 7);
+	fail_unless(report.results().size() == 2);
+	const PerfResult &r = report.results()[0];
+	fail_unless(r.key() == "rps{buffer=128}");
+	fail_unless(r.samples.size() == 5);
+	fail_unless(r.median() == 3);
+	fail_unless(r.min() == 1);
+	fail_unless(r.max() == 5);
+	fail_unless(std::abs(r.stddev() - 1.7888544) < 1e-6);
+	report.add("rps", config, "rps", PerfResult::HIGHER, 2);
+	fail_unless(r.median() == 2.5);
+	fail_unless(report.results()[1].stddev() == 0);
+}
+
+void
+test_json()
+{
+	TEST_INIT(0);
+	PerfReport report;
+	PerfResult::Config_t config = {{"provider", "epoll"},
+				       {"request", "SELECT \"quoted\""}};
+	report.add("rps", config, "rps", PerfResult::HIGHER, 1.5e6);
+	report.add("rps", config, "rps", PerfResult::HIGHER, 1.25e6);
+	report.add("p99", config, "us", PerfResult::LOWER, 123.25);
+	std::stringstream ss;
+	report.write(ss);
+
+	PerfReport parsed;
+	fail_unless(parsed.read(ss) == 0);
+	fail_unless(parsed.results().size() == 2);
+	const PerfResult &rps = parsed.results()[0];
+	fail_unless(rps.key() == report.results()[0].key());
+	fail_unless(rps.better == PerfResult::HIGHER);
+	fail_unless(rps.unit == "rps");
+	fail_unless(rps.samples == report.results()[0].samples);
+	const PerfResult &p99 = parsed.results()[1];
+	fail_unless(p99.better == PerfResult::LOWER);
+	fail_unless(p99.median() == 123.25);
+
+	std::stringstream bad("{\"results\": [");
+	fail_unless(PerfReport().read(bad) != 0);
+}
+
+void
+test_gbench_json()
+{
+	TEST_INIT(0);
+	std::stringstream all(R"({
+	  "context": {"num_cpus": 1},
+	  "benchmarks": [
+	    {"name": "BM_A/8", "run_name": "BM_A/8", "run_type": "iteration",
+	     "real_time": 10.0, "time_unit": "ns"},
+	    {"name": "BM_A/8", "run_name": "BM_A/8", "run_type": "iteration",
+	     "real_time": 12.0, "time_unit": "ns"},
+	    {"name": "BM_A/8_median", "run_name": "BM_A/8",
+	     "run_type": "aggregate", "aggregate_name": "median",
+	     "real_time": 11.0, "time_unit": "ns"}
+	  ]})");
+	PerfReport report;
+	fail_unless(report.read(all) == 0);
+	fail_unless(report.results().size() == 1);
+	fail_unless(report.results()[0].key() == "real_time{benchmark=BM_A/8}");
+	fail_unless(report.results()[0].samples.size() == 2);
+	fail_unless(report.results()[0].better == PerfResult::LOWER);
+
+	std::stringstream aggregates(R"({"benchmarks": [
+	    {"name": "BM_A/8_mean", "run_name": "BM_A/8",
+	     "run_type": "aggregate", "aggregate_name": "mean",
+	     "real_time": 15.0, "time_unit": "ns"},
+	    {"name": "BM_A/8_median", "run_name": "BM_A/8",
+	     "run_type": "aggregate", "aggregate_name": "median",
+	     "real_time": 11.0, "time_unit": "ns"}]})");
+	PerfReport agg_report;
+	fail_unless(agg_report.read(aggregates) == 0);
+	fail_unless(agg_report.results().size() == 1);
+	fail_unless(agg_report.results()[0].median() == 11);
+}
+
+void
+test_compare()
+{
+	TEST_INIT(0);
+	PerfReport base;
+	base.add("rps", {}, "rps", PerfResult::HIGHER, 100);
+	base.add("p99", {}, "us", PerfResult::LOWER, 100);
+	base.add("gone", {}, "us", PerfResult::LOWER, 1);
+	std::stringstream out;
+
+	TEST_CASE("within threshold");
+	PerfReport same;
+	same.add("rps", {}, "rps", PerfResult::HIGHER, 96);
+	same.add("p99", {}, "us", PerfResult::LOWER, 104);
+	same.add("new", {}, "us", PerfResult::LOWER, 1);
+	fail_unless(perfCompare(base, same, 5, out) == 0);
+
+	TEST_CASE("improvement");
+	PerfReport better;
+	better.add("rps", {}, "rps", PerfResult::HIGHER, 200);
+	better.add("p99", {}, "us", PerfResult::LOWER, 50);
+	fail_unless(perfCompare(base, better, 5, out) == 0);
+
+	TEST_CASE("regression");
+	PerfReport worse;
+	worse.add("rps", {}, "rps", PerfResult::HIGHER, 90);
+	worse.add("p99", {}, "us", PerfResult::LOWER, 110);
+	fail_unless(perfCompare(base, worse, 5, out) == 2);
+	fail_unless(perfCompare(base, worse, 20, out) == 0);
+	fail_unless(out.str().find("REGRESSION") != std::string::npos);
+	fail_unless(out.str().find("MISSING") != std::string::npos);
+
+	TEST_CASE("overlapping spread is noise");
+	PerfReport base_rep, noisy, slow;
+	for (double v : {100., 90., 110.})
+		base_rep.add("rps", {}, "rps", PerfResult::HIGHER, v);
+	for (double v : {80., 85., 95.})
+		noisy.add("rps", {}, "rps", PerfResult::HIGHER, v);
+	for (double v : {80., 85., 89.})
+		slow.add("rps", {}, "rps", PerfResult::HIGHER, v);
+	fail_unless(perfCompare(base_rep, noisy, 5, out) == 0);
+	fail_unless(perfCompare(base_rep, slow, 5, out) == 1);
+
+	TEST_CASE("outlier doesn't hide regression");
+	PerfReport base_out, slow_out;
+	for (double v : {100., 101., 99., 100., 150.})
+		base_out.add("p99", {}, "us", PerfResult::LOWER, v);
+	for (double v : {135., 136., 134., 135., 90.})
+		slow_out.add("p99", {}, "us", PerfResult::LOWER, v);
+	fail_unless(base_out.results()[0].mad() == 1);
+	fail_unless(perfCompare(base_out, slow_out, 5, out) == 1);
+}
+
+int main()
+{
+	test_summary();
+	test_json();
+	test_gbench_json();
+	test_compare();
+	return 0;
+}
@@ -0,0 +1,273 @@
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include "Utils/Helpers.hpp"
+#include "Utils/Helpers.hpp"
+#include "Utils/TupleReader.hpp"
+#include "Utils/MockServer.hpp"
+
+#include "../src/Client/LibevNetProvider.hpp"
+#include "../src/Client/ReplicationStream.hpp"
+
+static const char *localhost = "127.0.0.1";
+static constexpr unsigned port = 3307;
+static constexpr uint32_t space_id = 512;
+static constexpr size_t ROW_CNT = 10000;
+static constexpr int POLL_TIMEOUT = 100; //milliseconds
+static constexpr size_t MAX_POLLS = 10000;
+static const char *instance_uuid = "0d5bd431-7f3e-4695-a5c2-82de0a9cbc95";
+
+using Net_t = DefaultNetProvider<Buf_t, NetworkEngine>;
+
+template <class BUFFER>
+static UserTuple
+decodeRowTuple(BUFFER &buf, iterator_t<BUFFER> &itr)
+{
+	UserTuple tuple;
+	mpp::Dec dec(buf);
+	dec.SetPosition(itr);
+	dec.SetReader(false, ArrayReader<BUFFER>{dec, tuple});
+	mpp::ReadResult_t res = dec.Read();
+	fail_unless(res == mpp::READ_SUCCESS);
+	return tuple;
+}
+
+/**
+ * Check that rows are REPLACE statements of the mock server which go
+ * one after another starting from lsn @a next.
+ */
+template <class BUFFER, class NetProvider>
+struct RowChecker {
+	size_t operator()(Row<BUFFER> *rows, size_t count)
+	{
+		fail_unless(count > 0 && count <= max_batch);
+		batches++;
+		size_t consumed = consume_max < count ? consume_max : count;
+		for (size_t i = 0; i < consumed; i++) {
+			Row<BUFFER> &row = rows[i];
+			fail_unless(row.header.type == Iproto::REPLACE);
+			fail_unless(row.header.replica_id == 1);
+			fail_unless(row.header.lsn == (int64_t)next);
+			fail_unless(row.header.tsn == row.header.lsn);
+			fail_unless(row.header.isCommit());
+			fail_unless(row.header.timestamp == 1.0);
+			fail_unless(row.body.space_id == space_id);
+			fail_unless(row.body.tuple != std::nullopt);
+			fail_unless(row.body.key == std::nullopt);
+			UserTuple t = decodeRowTuple(stream.connection().getInBuf(),
+						     *row.body.tuple);
+			fail_unless(t.field1 == next);
+			fail_unless(t.field3 == 1.01);
+			next++;
+		}
+		return consumed;
+	}
+	ReplicationStream<BUFFER, NetProvider> &stream;
+	size_t next;
+	size_t max_batch;
+	size_t consume_max = SIZE_MAX;
+	size_t batches = 0;
+};
+
+template <class BUFFER, class NetProvider>
+static void
+pollTill(ReplicationStream<BUFFER, NetProvider> &stream,
+	 RowChecker<BUFFER, NetProvider> &checker, size_t last_lsn)
+{
+	for (size_t i = 0; i < MAX_POLLS; i++) {
+		if (stream.vclock().get(1) == (int64_t)last_lsn)
+			break;
+		fail_unless(stream.poll(checker, POLL_TIMEOUT) >= 0);
+	}
+	fail_unless(stream.vclock().get(1) == (int64_t)last_lsn);
+	fail_unless(checker.next == last_lsn + 1);
+}
+
+/** Wait for the heartbeat which makes stream ack its position. */
+template <class BUFFER, class NetProvider>
+static void
+waitAck(ReplicationStream<BUFFER, NetProvider> &stream,
+	RowChecker<BUFFER, NetProvider> &checker, MockServer &server,
+	size_t lsn)
+{
+	for (size_t i = 0; i < MAX_POLLS && server.ackedLsn() != lsn; i++)
+		fail_unless(stream.poll(checker, POLL_TIMEOUT) >= 0);
+	fail_unless(server.acks() > 0);
+	fail_unless(server.ackedLsn() == lsn);
+}
+
+template <class BUFFER, class NetProvider = Net_t>
+void
+subscribe()
+{
+	TEST_INIT(0);
+	MockServerConfig cfg;
+	cfg.port = port;
+	cfg.replication_rows = ROW_CNT;
+	MockServer server(cfg);
+	fail_unless(server.start() == 0);
+
+	ReplicationOptions opts;
+	opts.instance_uuid = instance_uuid;
+	opts.batch_size = 256;
+	ReplicationStream<BUFFER, NetProvider> stream(opts);
+	fail_unless(stream.connect(localhost, port) == 0);
+	fail_unless(stream.subscribe(Vclock{}) == 0);
+	fail_unless(stream.state() == stream.SUBSCRIBED);
+
+	TEST_CASE("Stream all rows");
+	RowChecker<BUFFER, NetProvider> checker{stream, 1, opts.batch_size};
+	pollTill(stream, checker, ROW_CNT);
+	fail_unless(checker.batches >= ROW_CNT / opts.batch_size);
+	fail_unless(stream.serverVclock().get(1) == (int64_t)ROW_CNT);
+	fail_unless(stream.vclock().size() == 1);
+
+	TEST_CASE("Ack on heartbeat");
+	waitAck(stream, checker, server, ROW_CNT);
+	fail_unless(stream.state() == stream.SUBSCRIBED);
+}
+
+/** Rows which are not consumed by handler are passed again. */
+template <class BUFFER, class NetProvider = Net_t>
+void
+backpressure()
+{
+	TEST_INIT(0);
+	MockServerConfig cfg;
+	cfg.port = port;
+	cfg.replication_rows = ROW_CNT;
+	MockServer server(cfg);
+	fail_unless(server.start() == 0);
+
+	ReplicationOptions opts;
+	opts.instance_uuid = instance_uuid;
+	opts.batch_size = 100;
+	ReplicationStream<BUFFER, NetProvider> stream(opts);
+	fail_unless(stream.connect(localhost, port) == 0);
+	fail_unless(stream.subscribe(Vclock{}) == 0);
+
+	RowChecker<BUFFER, NetProvider> checker{stream, 1, opts.batch_size};
+	checker.consume_max = 7;
+	pollTill(stream, checker, ROW_CNT);
+	fail_unless(checker.batches >= ROW_CNT / checker.consume_max);
+	/* Heartbeat is processed only after all the rows are consumed. */
+	waitAck(stream, checker, server, ROW_CNT);
+}
+
+/** Subscribe from the middle of the log. */
+template <class BUFFER, class NetProvider = Net_t>
+void
+resume()
+{
+	TEST_INIT(0);
+	MockServerConfig cfg;
+	cfg.port = port;
+	cfg.replication_rows = ROW_CNT;
+	MockServer server(cfg);
+	fail_unless(server.start() == 0);
+
+	ReplicationOptions opts;
+	opts.instance_uuid = instance_uuid;
+	ReplicationStream<BUFFER, NetProvider> stream(opts);
+	fail_unless(stream.connect(localhost, port) == 0);
+	Vclock from;
+	fail_unless(from.set(1, ROW_CNT / 2) == 0);
+	fail_unless(stream.subscribe(from) == 0);
+
+	RowChecker<BUFFER, NetProvider> checker{stream, ROW_CNT / 2 + 1,
+		opts.batch_size};
+	pollTill(stream, checker, ROW_CNT);
+	waitAck(stream, checker, server, ROW_CNT);
+}
+
+/** Join fetches snapshot, after that the stream can be subscribed. */
+template <class BUFFER, class NetProvider = Net_t>
+void
+join()
+{
+	TEST_INIT(0);
+	MockServerConfig cfg;
+	cfg.port = port;
+	cfg.replication_rows = ROW_CNT;
+	MockServer server(cfg);
+	fail_unless(server.start() == 0);
+
+	ReplicationStream<BUFFER, NetProvider> stream;
+	fail_unless(stream.connect(localhost, port) == 0);
+	/* Instance UUID is mandatory. */
+	fail_unless(stream.join() != 0);
+	fail_unless(stream.state() == stream.IDLE);
+
+	ReplicationOptions opts;
+	opts.instance_uuid = instance_uuid;
+	ReplicationStream<BUFFER, NetProvider> stream2(opts);
+	fail_unless(stream2.connect(localhost, port) == 0);
+	fail_unless(stream2.join() == 0);
+	/* SUBSCRIBE is allowed only after the join is completed. */
+	fail_unless(stream2.subscribe(Vclock{}) != 0);
+
+	size_t rows = 0;
+	auto handler = [&](Row<BUFFER> *row, size_t count) -> size_t {
+		for (size_t i = 0; i < count; i++) {
+			fail_unless(row[i].header.type == Iproto::INSERT);
+			fail_unless(row[i].header.lsn == 0);
+			fail_unless(row[i].body.tuple != std::nullopt);
+			UserTuple t = decodeRowTuple(stream2.connection().getInBuf(),
+						     *row[i].body.tuple);
+			fail_unless(t.field1 == ++rows);
+		}
+		return count;
+	};
+	for (size_t i = 0; i < MAX_POLLS && stream2.state() != stream2.JOINED; i++)
+		fail_unless(stream2.poll(handler, POLL_TIMEOUT) >= 0);
+	fail_unless(stream2.state() == stream2.JOINED);
+	fail_unless(rows == ROW_CNT);
+	fail_unless(stream2.vclock().get(1) == (int64_t)ROW_CNT);
+
+	TEST_CASE("Subscribe after join");
+	fail_unless(stream2.subscribe(stream2.vclock()) == 0);
+	RowChecker<BUFFER, NetProvider> checker{stream2, ROW_CNT + 1,
+		opts.batch_size};
+	waitAck(stream2, checker, server, ROW_CNT);
+	fail_unless(checker.batches == 0);
+}
+
+int main()
+{
+	subscribe<Buf_t>();
+	backpressure<Buf_t>();
+	resume<Buf_t>();
+	join<Buf_t>();
+
+	using NetLibEv_t = LibevNetProvider<Buf_t, NetworkEngine>;
+	subscribe<Buf_t, NetLibEv_t>();
+	backpressure<Buf_t, NetLibEv_t>();
+	return 0;
+}
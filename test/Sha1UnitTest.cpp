@@ -0,0 +1,115 @@
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include "Utils/Helpers.hpp"
+#include "../src/Utils/Sha1.hpp"
+
+#include <algorithm>
+#include <string>
+
+#include "Utils/Helpers.hpp"
+
+static std::string
+toHex(const uint8_t *digest)
+{
+	const char *hex = "0123456789abcdef";
+	std::string res;
+	for (size_t i = 0; i < tnt::Sha1::DIGEST_SIZE; i++) {
+		res.push_back(hex[digest[i] >> 4]);
+		res.push_back(hex[digest[i] & 0xf]);
+	}
+	return res;
+}
+
+static std::string
+sha1Hex(const std::string &data)
+{
+	uint8_t digest[tnt::Sha1::DIGEST_SIZE];
+	tnt::sha1(data.data(), data.size(), digest);
+	return toHex(digest);
+}
+
+/** Vectors of FIPS 180 examples. */
+static void
+known_vectors()
+{
+	TEST_INIT(0);
+	fail_unless(sha1Hex("") == "da39a3ee5e6b4b0d3255bfef95601890afd80709");
+	fail_unless(sha1Hex("abc") == "a9993e364706816aba3e25717850c26c9cd0d89d");
+	fail_unless(sha1Hex("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq") ==
+		    "84983e441c3bd26ebaae4aa1f95129e5e54670f1");
+
+	TEST_CASE("Million of 'a' in odd chunks");
+	std::string chunk(997, 'a');
+	tnt::Sha1 sha;
+	size_t left = 1000000;
+	while (left > 0) {
+		size_t size = std::min(left, chunk.size());
+		sha.update(chunk.data(), size);
+		left -= size;
+	}
+	uint8_t digest[tnt::Sha1::DIGEST_SIZE];
+	sha.finish(digest);
+	fail_unless(toHex(digest) == "34aa973cd4c4daa4f61eeb2bdbad27316534016f");
+}
+
+/** Hardware and portable implementations agree on any length. */
+static void
+hw_matches_soft()
+{
+	TEST_INIT(0);
+#ifdef TNT_SHA1_HW
+	if (!tnt::sha1_details::hasHw()) {
+		std::cout << "SHA-NI is not supported, skipped" << std::endl;
+		return;
+	}
+	constexpr size_t MAX_BLOCKS = 5;
+	uint8_t data[MAX_BLOCKS * tnt::sha1_details::BLOCK_SIZE];
+	uint32_t seed = 1;
+	for (uint8_t &c : data) {
+		seed = seed * 1103515245 + 12345;
+		c = seed >> 16;
+	}
+	for (size_t blocks = 1; blocks <= MAX_BLOCKS; blocks++) {
+		uint32_t soft[5] = {1, 2, 3, 4, 5};
+		uint32_t hw[5] = {1, 2, 3, 4, 5};
+		tnt::sha1_details::sha1Soft(soft, data, blocks);
+		tnt::sha1_details::sha1Hw(hw, data, blocks);
+		for (size_t i = 0; i < 5; i++)
+			fail_unless(soft[i] == hw[i]);
+	}
+#endif
+}
+
+int main()
+{
+	known_vectors();
+	hw_matches_soft();
+}
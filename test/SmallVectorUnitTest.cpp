@@ -0,0 +1,144 @@
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "../src/Utils/SmallVector.hpp"
+
+#include <memory>
+
+#include "Utils/Helpers.hpp"
+
+/** Counts alive objects to check that every element is destroyed. */
+struct Obj {
+	static inline int alive = 0;
+	explicit Obj(int v) : val(v) { alive++; }
+	Obj(Obj &&other) : val(other.val) { other.val = -1; alive++; }
+	Obj(const Obj &) = delete;
+	~Obj() { alive--; }
+	int val;
+};
+
+template <size_t N>
+void
+check(const tnt::SmallVector<Obj, N> &v, int count)
+{
+	fail_unless(v.size() == (size_t)count);
+	fail_unless(v.empty() == (count == 0));
+	int i = 0;
+	for (const Obj &o : v)
+		fail_unless(o.val == i++);
+	fail_unless(i == count);
+}
+
+void
+test_basic()
+{
+	TEST_INIT(0);
+	{
+		tnt::SmallVector<Obj, 4> v;
+		check(v, 0);
+		fail_unless(v.capacity() == 4);
+		fail_unless(v.isInline());
+		for (int i = 0; i < 4; i++)
+			fail_unless(v.emplace_back(i).val == i);
+		check(v, 4);
+		fail_unless(v.isInline());
+		TEST_CASE("grow to heap");
+		for (int i = 4; i < 100; i++)
+			v.emplace_back(i);
+		check(v, 100);
+		fail_unless(!v.isInline());
+		fail_unless(v.capacity() >= 100);
+		fail_unless(v.front().val == 0 && v.back().val == 99);
+		fail_unless(v[42].val == 42);
+		fail_unless(Obj::alive == 100);
+		TEST_CASE("clear keeps memory");
+		size_t cap = v.capacity();
+		v.clear();
+		check(v, 0);
+		fail_unless(v.capacity() == cap);
+		fail_unless(Obj::alive == 0);
+		v.emplace_back(0);
+		v.pop_back();
+		fail_unless(Obj::alive == 0);
+	}
+	fail_unless(Obj::alive == 0);
+}
+
+template <int COUNT>
+void
+test_move()
+{
+	TEST_INIT(1, COUNT);
+	{
+		tnt::SmallVector<Obj, 4> a;
+		for (int i = 0; i < COUNT; i++)
+			a.emplace_back(i);
+		tnt::SmallVector<Obj, 4> b(std::move(a));
+		check(a, 0);
+		check(b, COUNT);
+		fail_unless(a.isInline());
+		fail_unless(b.isInline() == (COUNT <= 4));
+
+		tnt::SmallVector<Obj, 4> c;
+		for (int i = 0; i < 10; i++)
+			c.emplace_back(i);
+		c = std::move(b);
+		check(b, 0);
+		check(c, COUNT);
+		fail_unless(Obj::alive == COUNT);
+		/* Moved-from vector is usable. */
+		b.emplace_back(0);
+		check(b, 1);
+	}
+	fail_unless(Obj::alive == 0);
+}
+
+void
+test_unique_ptr()
+{
+	TEST_INIT(0);
+	tnt::SmallVector<std::unique_ptr<int>, 2> v;
+	for (int i = 0; i < 10; i++)
+		v.push_back(std::make_unique<int>(i));
+	for (int i = 0; i < 10; i++)
+		fail_unless(*v[i] == i);
+}
+
+int main()
+{
+	test_basic();
+	test_move<0>();
+	test_move<3>();
+	test_move<4>();
+	test_move<20>();
+	test_unique_ptr();
+	return 0;
+}
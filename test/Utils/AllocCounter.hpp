@@ -0,0 +1,219 @@
+#pragma once
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/**
+ * Test-only allocation counter: replaces global operator new/delete and,
+ * with glibc, interposes malloc family, so every heap allocation made by
+ * the current thread is counted. Counters are thread local: allocations
+ * of other threads (e.g. mock server) don't affect the measurement.
+ * The header defines global functions, so it must be included in exactly
+ * one translation unit of a test executable.
+ *
+ * Usage:
+ *	AllocScope scope;
+ *	... code under test ...
+ *	fail_unless(scope.allocs() == 0);
+ */
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+namespace alloc_counter {
+
+/** Plain thread local counters: safe to touch inside malloc. */
+inline thread_local size_t tAllocs = 0;
+inline thread_local size_t tBytes = 0;
+
+inline void
+account(size_t size)
+{
+	tAllocs++;
+	tBytes += size;
+}
+
+} // namespace alloc_counter
+
+/** Counts allocations made by current thread since its construction. */
+class AllocScope {
+public:
+	AllocScope() { reset(); }
+	void reset()
+	{
+		m_Allocs = alloc_counter::tAllocs;
+		m_Bytes = alloc_counter::tBytes;
+	}
+	size_t allocs() const { return alloc_counter::tAllocs - m_Allocs; }
+	size_t bytes() const { return alloc_counter::tBytes - m_Bytes; }
+
+private:
+	size_t m_Allocs;
+	size_t m_Bytes;
+};
+
+#ifdef __GLIBC__
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *ptr);
+
+void *
+malloc(size_t size)
+{
+	alloc_counter::account(size);
+	return __libc_malloc(size);
+}
+
+void *
+calloc(size_t n, size_t size)
+{
+	alloc_counter::account(n * size);
+	return __libc_calloc(n, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+	alloc_counter::account(size);
+	return __libc_realloc(ptr, size);
+}
+
+void *
+memalign(size_t alignment, size_t size)
+{
+	alloc_counter::account(size);
+	return __libc_memalign(alignment, size);
+}
+
+void *
+aligned_alloc(size_t alignment, size_t size)
+{
+	alloc_counter::account(size);
+	return __libc_memalign(alignment, size);
+}
+
+int
+posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+	alloc_counter::account(size);
+	void *res = __libc_memalign(alignment, size);
+	if (res == nullptr)
+		return ENOMEM;
+	*ptr = res;
+	return 0;
+}
+
+void
+free(void *ptr)
+{
+	__libc_free(ptr);
+}
+} // extern "C"
+
+namespace alloc_counter {
+/* malloc is counted already. */
+inline void *rawAlloc(size_t size) { return malloc(size); }
+inline void *rawAlignedAlloc(size_t alignment, size_t size)
+{
+	return memalign(alignment, size);
+}
+} // namespace alloc_counter
+#else
+namespace alloc_counter {
+inline void *rawAlloc(size_t size)
+{
+	account(size);
+	return std::malloc(size);
+}
+inline void *rawAlignedAlloc(size_t alignment, size_t size)
+{
+	account(size);
+	return std::aligned_alloc(alignment, (size + alignment - 1) /
+					     alignment * alignment);
+}
+} // namespace alloc_counter
+#endif
+
+void *
+operator new(size_t size)
+{
+	void *res = alloc_counter::rawAlloc(size == 0 ? 1 : size);
+	if (res == nullptr)
+		throw std::bad_alloc();
+	return res;
+}
+
+void *
+operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void *
+operator new(size_t size, const std::nothrow_t &) noexcept
+{
+	return alloc_counter::rawAlloc(size == 0 ? 1 : size);
+}
+
+void *
+operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+	return alloc_counter::rawAlloc(size == 0 ? 1 : size);
+}
+
+void *
+operator new(size_t size, std::align_val_t al)
+{
+	void *res = alloc_counter::rawAlignedAlloc(static_cast<size_t>(al),
+						   size == 0 ? 1 : size);
+	if (res == nullptr)
+		throw std::bad_alloc();
+	return res;
+}
+
+void *
+operator new[](size_t size, std::align_val_t al)
+{
+	return operator new(size, al);
+}
+
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete[](void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { free(ptr); }
+void operator delete(void *ptr, std::align_val_t) noexcept { free(ptr); }
+void operator delete[](void *ptr, std::align_val_t) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept { free(ptr); }
+void operator delete[](void *ptr, size_t, std::align_val_t) noexcept { free(ptr); }
@@ -0,0 +1,1317 @@
+#pragma once
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../../src/Client/IprotoConstants.hpp"
+
+/**
+ * Tiny iproto server which allows to run client tests and benchmarks
+ * without Tarantool. It sends the greeting and answers PING, SELECT,
+ * REPLACE and CALL requests with either canned or echo bodies. JOIN and
+ * SUBSCRIBE are answered with a stream of rows (see replication_rows).
+ * CALL of function "push" with argument n sends n IPROTO_CHUNK messages
+ * with canned tuples 1..n before the response, like box.session.push().
+ * WATCH is answered with IPROTO_EVENT carrying the value set by
+ * broadcast(); next event is sent on update after acknowledgement.
+ * SELECT can scan a space of canned tuples (see space_rows).
+ * Requests of other types are answered with an error. Authentication
+ * is checked only if auth_user is set.
+ * The server is single threaded and (unless delay is set) doesn't allocate
+ * memory in steady state, so its own cost is small and stable.
+ */
+struct MockServerConfig {
+	/** TCP port to listen on 127.0.0.1; 0 - don't listen TCP. */
+	unsigned port = 3301;
+	/** Path of Unix socket to listen on; empty - don't listen. */
+	std::string unix_path;
+	/** Length of the string field of canned tuples. */
+	size_t response_size = 3;
+	/** Each response is sent not earlier than in delay_us after request. */
+	unsigned delay_us = 0;
+	/** Connections above the limit are closed right after accept. */
+	size_t max_connections = 1024;
+	/**
+	 * If set, SELECT answers with its key, REPLACE with its tuple and
+	 * CALL with its arguments. Otherwise they answer with the canned
+	 * tuple [<first key part>, <string of response_size>, 1.01].
+	 */
+	bool echo = false;
+	/**
+	 * Count of rows in the log of the mock: REPLACE of canned tuples
+	 * [lsn, ...] into space 512 by replica 1 with lsn 1, 2, ... JOIN
+	 * sends them all as a snapshot; SUBSCRIBE sends those following
+	 * the requested vclock and a heartbeat.
+	 */
+	size_t replication_rows = 0;
+	/**
+	 * If set, SELECT scans space of canned tuples with keys
+	 * 1..space_rows (any space and index) honouring the first key part,
+	 * iterator, offset, limit and IPROTO_AFTER_POSITION. Position of a
+	 * tuple is its key in decimal.
+	 */
+	size_t space_rows = 0;
+	/**
+	 * Version in the greeting; the default one is high enough for the
+	 * client to use all features.
+	 */
+	std::string version = "2.11.0";
+	/**
+	 * If set, AUTH is accepted only for this user with auth_scramble
+	 * (chap-sha1 of the password for salt of the mock which is 32 zero
+	 * bytes). Other requests don't require authentication.
+	 */
+	std::string auth_user;
+	std::string auth_scramble;
+	/**
+	 * Range of vshard buckets stored by the mock; 0 - none. CALL of
+	 * vshard.storage.buckets_discovery returns {buckets = [...]},
+	 * vshard.storage.call of other bucket fails with WRONG_BUCKET.
+	 * Can be changed by setBuckets() to emulate rebalancing.
+	 */
+	uint32_t bucket_first = 0;
+	uint32_t bucket_last = 0;
+};
+
+/**
+ * Minimal msgpack reader and writer working on contiguous memory.
+ * The mock intentionally doesn't use mpp: it must not share bugs with
+ * the client code under test.
+ */
+namespace mock_mp {
+
+inline bool
+readUint(const char *&p, const char *end, uint64_t &val)
+{
+	if (p >= end)
+		return false;
+	uint8_t c = *p;
+	size_t len;
+	if (c <= 0x7f) {
+		val = c;
+		p++;
+		return true;
+	}
+	switch (c) {
+	case 0xcc: len = 1; break;
+	case 0xcd: len = 2; break;
+	case 0xce: len = 4; break;
+	case 0xcf: len = 8; break;
+	default: return false;
+	}
+	if (end - p < (ptrdiff_t)(1 + len))
+		return false;
+	val = 0;
+	for (size_t i = 1; i <= len; i++)
+		val = (val << 8) | (uint8_t)p[i];
+	p += 1 + len;
+	return true;
+}
+
+/** Read header of array or map; @a is_map sets the expected type. */
+inline bool
+readContainer(const char *&p, const char *end, bool is_map, uint32_t &size)
+{
+	if (p >= end)
+		return false;
+	uint8_t c = *p;
+	uint8_t fix = is_map ? 0x80 : 0x90;
+	uint8_t c16 = is_map ? 0xde : 0xdc;
+	if ((c & 0xf0) == fix) {
+		size = c & 0x0f;
+		p++;
+		return true;
+	}
+	size_t len = c == c16 ? 2 : c == c16 + 1 ? 4 : 0;
+	if (len == 0 || end - p < (ptrdiff_t)(1 + len))
+		return false;
+	size = 0;
+	for (size_t i = 1; i <= len; i++)
+		size = (size << 8) | (uint8_t)p[i];
+	p += 1 + len;
+	return true;
+}
+
+inline bool
+readStr(const char *&p, const char *end, std::string_view &str)
+{
+	if (p >= end)
+		return false;
+	uint8_t c = *p;
+	size_t hdr, size = 0;
+	if ((c & 0xe0) == 0xa0) {
+		hdr = 1;
+		size = c & 0x1f;
+	} else if (c >= 0xd9 && c <= 0xdb) {
+		hdr = 1 + (1u << (c - 0xd9));
+		if (end - p < (ptrdiff_t)hdr)
+			return false;
+		for (size_t i = 1; i < hdr; i++)
+			size = (size << 8) | (uint8_t)p[i];
+	} else {
+		return false;
+	}
+	if ((size_t)(end - p) < hdr + size)
+		return false;
+	str = std::string_view(p + hdr, size);
+	p += hdr + size;
+	return true;
+}
+
+inline bool
+readBin(const char *&p, const char *end, std::string_view &bin)
+{
+	if (end - p < 2 || (uint8_t)*p != 0xc4)
+		return false;
+	size_t size = (uint8_t)p[1];
+	if ((size_t)(end - p) < 2 + size)
+		return false;
+	bin = std::string_view(p + 2, size);
+	p += 2 + size;
+	return true;
+}
+
+inline bool
+readBool(const char *&p, const char *end, bool &val)
+{
+	if (p >= end || ((uint8_t)*p != 0xc2 && (uint8_t)*p != 0xc3))
+		return false;
+	val = *p == '\xc3';
+	p++;
+	return true;
+}
+
+/** Skip one object including all nested ones. */
+inline bool
+skip(const char *&p, const char *end)
+{
+	size_t count = 1;
+	while (count > 0) {
+		if (p >= end)
+			return false;
+		count--;
+		uint8_t c = *p;
+		/* Size of header, size of data and count of nested objects. */
+		size_t hdr = 1, data = 0, nested = 0, len = 0;
+		if (c <= 0x7f || c >= 0xe0 || (c >= 0xc0 && c <= 0xc3)) {
+		} else if ((c & 0xf0) == 0x80) {
+			nested = 2 * (c & 0x0f);
+		} else if ((c & 0xf0) == 0x90) {
+			nested = c & 0x0f;
+		} else if ((c & 0xe0) == 0xa0) {
+			data = c & 0x1f;
+		} else {
+			switch (c) {
+			case 0xc4: case 0xc7: case 0xd9: len = 1; break;
+			case 0xc5: case 0xc8: case 0xda: len = 2; break;
+			case 0xc6: case 0xc9: case 0xdb: len = 4; break;
+			case 0xcc: case 0xd0: data = 1; break;
+			case 0xcd: case 0xd1: data = 2; break;
+			case 0xca: case 0xce: case 0xd2: data = 4; break;
+			case 0xcb: case 0xcf: case 0xd3: data = 8; break;
+			case 0xd4: data = 2; break;
+			case 0xd5: data = 3; break;
+			case 0xd6: data = 5; break;
+			case 0xd7: data = 9; break;
+			case 0xd8: data = 17; break;
+			case 0xdc: case 0xde: len = 2; break;
+			case 0xdd: case 0xdf: len = 4; break;
+			default: return false;
+			}
+			if (end - p < (ptrdiff_t)(1 + len))
+				return false;
+			size_t val = 0;
+			for (size_t i = 1; i <= len; i++)
+				val = (val << 8) | (uint8_t)p[i];
+			hdr += len;
+			if (c == 0xdc || c == 0xdd)
+				nested = val;
+			else if (c == 0xde || c == 0xdf)
+				nested = 2 * val;
+			else if (c >= 0xc7 && c <= 0xc9)
+				data = val + 1; /* ext type. */
+			else if (len != 0)
+				data = val;
+		}
+		if ((size_t)(end - p) < hdr + data)
+			return false;
+		p += hdr + data;
+		count += nested;
+	}
+	return true;
+}
+
+inline void
+putBE(std::string &out, uint64_t val, size_t len)
+{
+	for (size_t i = len; i > 0; i--)
+		out.push_back((char)(val >> (8 * (i - 1))));
+}
+
+inline void
+putUint(std::string &out, uint64_t val)
+{
+	if (val <= 0x7f) {
+		out.push_back((char)val);
+	} else if (val <= UINT8_MAX) {
+		out.push_back('\xcc');
+		putBE(out, val, 1);
+	} else if (val <= UINT16_MAX) {
+		out.push_back('\xcd');
+		putBE(out, val, 2);
+	} else if (val <= UINT32_MAX) {
+		out.push_back('\xce');
+		putBE(out, val, 4);
+	} else {
+		out.push_back('\xcf');
+		putBE(out, val, 8);
+	}
+}
+
+inline void
+putContainer(std::string &out, bool is_map, uint32_t size)
+{
+	if (size <= 15) {
+		out.push_back((char)((is_map ? 0x80 : 0x90) | size));
+	} else if (size <= UINT16_MAX) {
+		out.push_back(is_map ? '\xde' : '\xdc');
+		putBE(out, size, 2);
+	} else {
+		out.push_back(is_map ? '\xdf' : '\xdd');
+		putBE(out, size, 4);
+	}
+}
+
+inline void
+putStrHeader(std::string &out, uint32_t size)
+{
+	if (size <= 31) {
+		out.push_back((char)(0xa0 | size));
+	} else if (size <= UINT8_MAX) {
+		out.push_back('\xd9');
+		putBE(out, size, 1);
+	} else if (size <= UINT16_MAX) {
+		out.push_back('\xda');
+		putBE(out, size, 2);
+	} else {
+		out.push_back('\xdb');
+		putBE(out, size, 4);
+	}
+}
+
+inline void
+putStr(std::string &out, std::string_view str)
+{
+	putStrHeader(out, str.size());
+	out.append(str);
+}
+
+inline void
+putDouble(std::string &out, double val)
+{
+	uint64_t u;
+	memcpy(&u, &val, sizeof(u));
+	out.push_back('\xcb');
+	putBE(out, u, 8);
+}
+
+/** Read vclock map and return LSN of replica 1 in @a lsn. */
+inline bool
+readVclockLsn(const char *&p, const char *end, uint64_t &lsn)
+{
+	uint32_t size;
+	if (!readContainer(p, end, true, size))
+		return false;
+	for (uint32_t i = 0; i < size; i++) {
+		uint64_t id, val;
+		if (!readUint(p, end, id) || !readUint(p, end, val))
+			return false;
+		if (id == 1)
+			lsn = val;
+	}
+	return true;
+}
+
+/** Reserve room for the size of packet: 0xce + uint32. */
+inline size_t
+beginPacket(std::string &out)
+{
+	size_t start = out.size();
+	out.append(5, '\0');
+	return start;
+}
+
+inline void
+endPacket(std::string &out, size_t start)
+{
+	size_t len = out.size() - start - 5;
+	out[start] = '\xce';
+	for (size_t i = 0; i < 4; i++)
+		out[start + 1 + i] = (char)(len >> (8 * (3 - i)));
+}
+
+} // namespace mock_mp {
+
+class MockServer {
+public:
+	explicit MockServer(const MockServerConfig &cfg = MockServerConfig{})
+		: m_Cfg(cfg), m_DelayUs(cfg.delay_us),
+		  m_BucketFirst(cfg.bucket_first),
+		  m_BucketLast(cfg.bucket_last) {}
+	~MockServer() { stop(); }
+	MockServer(const MockServer &) = delete;
+	MockServer &operator=(const MockServer &) = delete;
+
+	/** Bind sockets and start serving in a background thread. */
+	int start();
+	/** Stop serving and close all the sockets. */
+	void stop();
+	/** Count of requests answered since start. */
+	size_t requests() const { return m_Requests.load(std::memory_order_relaxed); }
+	/** Count of currently open client connections. */
+	size_t connections() const { return m_ConnCount.load(std::memory_order_relaxed); }
+	/** Count of replication acks (vclocks sent by replicas). */
+	size_t acks() const { return m_Acks.load(std::memory_order_relaxed); }
+	/** LSN of replica 1 in the last ack. */
+	uint64_t ackedLsn() const { return m_AckedLsn.load(std::memory_order_relaxed); }
+	/** Set value of key like box.broadcast() does. Thread safe. */
+	void broadcast(const std::string &key, uint64_t value);
+	/** Count of WATCH requests including acknowledgements. */
+	size_t watches() const { return m_Watches.load(std::memory_order_relaxed); }
+	/** Close all client connections like a crashed server. Thread safe. */
+	void dropConnections();
+	/** Change delay of responses to new requests. Thread safe. */
+	void setDelay(unsigned delay_us) { m_DelayUs.store(delay_us); }
+	/** Emulate DDL: change schema version of responses. Thread safe. */
+	void setSchemaVersion(uint64_t version) { m_SchemaVersion.store(version); }
+	/** Change range of stored buckets. Thread safe. */
+	void setBuckets(uint32_t first, uint32_t last)
+	{
+		m_BucketFirst.store(first);
+		m_BucketLast.store(last);
+	}
+	/** Count of AUTH requests (both accepted and rejected). */
+	size_t auths() const { return m_Auths.load(std::memory_order_relaxed); }
+	/** Count of tuples visited by SELECTs of space_rows (incl. offset). */
+	size_t scanned() const { return m_Scanned.load(std::memory_order_relaxed); }
+
+private:
+	struct Watch {
+		/** Event is sent, waiting for acknowledgement. */
+		bool is_sent;
+		/** Value is updated while waiting for acknowledgement. */
+		bool is_dirty;
+	};
+	struct Conn {
+		int fd;
+		std::string in;
+		std::string out;
+		bool want_write;
+		std::unordered_map<std::string, Watch> watches;
+	};
+	struct Delayed {
+		uint64_t conn_id;
+		std::chrono::steady_clock::time_point due;
+		std::string data;
+	};
+	static constexpr uint64_t LISTEN_TCP_ID = 0;
+	static constexpr uint64_t LISTEN_UNIX_ID = 1;
+	static constexpr uint64_t STOP_ID = 2;
+	static constexpr uint64_t BROADCAST_ID = 3;
+	static constexpr uint64_t FIRST_CONN_ID = 4;
+	static constexpr size_t READ_SIZE = 64 * 1024;
+
+	int listenTCP();
+	int listenUNIX();
+	void run();
+	void acceptConn(int listen_fd);
+	void closeConn(uint64_t id);
+	bool readConn(uint64_t id, Conn &conn);
+	bool writeConn(uint64_t id, Conn &conn);
+	void updateEvents(uint64_t id, Conn &conn);
+	bool processRequest(Conn &conn, const char *p, const char *end,
+			    std::string &out);
+	void event(std::string &out, const std::string &key);
+	void watch(Conn &conn, const std::string &key, std::string &out);
+	void applyBroadcasts();
+	void cannedTuple(std::string &out, uint64_t key);
+	bool checkAuth(std::string_view user, std::string_view tuple);
+	bool hasBucket(uint64_t bucket_id) const
+	{
+		return bucket_id != 0 && bucket_id >= m_BucketFirst.load() &&
+		       bucket_id <= m_BucketLast.load();
+	}
+	void selectRows(std::string &out, std::string_view key,
+			uint64_t iterator, uint64_t offset, uint64_t limit,
+			std::string_view after, bool fetch_position);
+	void replicate(std::string &out, uint64_t type, uint64_t sync,
+		       uint64_t from);
+	void vclockRow(std::string &out, uint64_t sync);
+	uint64_t getRps();
+	int delayedTimeout();
+	void flushDelayed();
+
+	MockServerConfig m_Cfg;
+	int m_ListenTCP = -1;
+	int m_ListenUNIX = -1;
+	int m_Epoll = -1;
+	int m_StopFd = -1;
+	int m_BroadcastFd = -1;
+	std::mutex m_BroadcastMutex;
+	std::vector<std::pair<std::string, uint64_t>> m_Broadcasts;
+	/** Values of broadcast keys; absent key is nil. */
+	std::unordered_map<std::string, uint64_t> m_Values;
+	std::atomic<size_t> m_Watches{0};
+	std::atomic<size_t> m_Scanned{0};
+	std::atomic<size_t> m_Auths{0};
+	std::atomic<bool> m_DropConns{false};
+	std::atomic<unsigned> m_DelayUs;
+	std::atomic<uint32_t> m_BucketFirst;
+	std::atomic<uint32_t> m_BucketLast;
+	std::atomic<uint64_t> m_SchemaVersion{1};
+	std::thread m_Thread;
+	std::unordered_map<uint64_t, Conn> m_Conns;
+	uint64_t m_NextConnId = FIRST_CONN_ID;
+	std::deque<Delayed> m_Delayed;
+	std::string m_Padding;
+	std::string m_Responses;
+	char m_ReadBuf[READ_SIZE];
+	std::atomic<size_t> m_Requests{0};
+	std::atomic<size_t> m_ConnCount{0};
+	std::atomic<size_t> m_Acks{0};
+	std::atomic<uint64_t> m_AckedLsn{0};
+	size_t m_RpsRequests = 0;
+	std::chrono::steady_clock::time_point m_RpsTime;
+};
+
+inline int
+MockServer::listenTCP()
+{
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (fd < 0)
+		return -1;
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	struct sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(m_Cfg.port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+	    listen(fd, SOMAXCONN) != 0) {
+		std::cerr << "Mock server: failed to listen port " <<
+			m_Cfg.port << ": " << strerror(errno) << std::endl;
+		close(fd);
+		return -1;
+	}
+	m_ListenTCP = fd;
+	return 0;
+}
+
+inline int
+MockServer::listenUNIX()
+{
+	struct sockaddr_un addr = {};
+	if (m_Cfg.unix_path.size() >= sizeof(addr.sun_path))
+		return -1;
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (fd < 0)
+		return -1;
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, m_Cfg.unix_path.c_str());
+	unlink(m_Cfg.unix_path.c_str());
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+	    listen(fd, SOMAXCONN) != 0) {
+		std::cerr << "Mock server: failed to listen " <<
+			m_Cfg.unix_path << ": " << strerror(errno) << std::endl;
+		close(fd);
+		return -1;
+	}
+	m_ListenUNIX = fd;
+	return 0;
+}
+
+inline int
+MockServer::start()
+{
+	assert(!m_Thread.joinable());
+	m_Padding.assign(m_Cfg.response_size, 'x');
+	if (m_Cfg.port != 0 && listenTCP() != 0)
+		goto err;
+	if (!m_Cfg.unix_path.empty() && listenUNIX() != 0)
+		goto err;
+	if ((m_Epoll = epoll_create1(0)) < 0)
+		goto err;
+	if ((m_StopFd = eventfd(0, EFD_NONBLOCK)) < 0)
+		goto err;
+	if ((m_BroadcastFd = eventfd(0, EFD_NONBLOCK)) < 0)
+		goto err;
+	for (auto [fd, id] : {std::pair{m_ListenTCP, LISTEN_TCP_ID},
+			      std::pair{m_ListenUNIX, LISTEN_UNIX_ID},
+			      std::pair{m_StopFd, STOP_ID},
+			      std::pair{m_BroadcastFd, BROADCAST_ID}}) {
+		if (fd < 0)
+			continue;
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.u64 = id;
+		if (epoll_ctl(m_Epoll, EPOLL_CTL_ADD, fd, &ev) != 0)
+			goto err;
+	}
+	m_RpsTime = std::chrono::steady_clock::now();
+	m_Thread = std::thread([this] { run(); });
+	return 0;
+err:
+	stop();
+	return -1;
+}
+
+inline void
+MockServer::stop()
+{
+	if (m_Thread.joinable()) {
+		uint64_t one = 1;
+		if (write(m_StopFd, &one, sizeof(one)) != sizeof(one))
+			abort();
+		m_Thread.join();
+	}
+	for (auto &[id, conn] : m_Conns)
+		close(conn.fd);
+	m_Conns.clear();
+	m_Delayed.clear();
+	m_ConnCount.store(0, std::memory_order_relaxed);
+	if (m_ListenUNIX >= 0)
+		unlink(m_Cfg.unix_path.c_str());
+	m_Values.clear();
+	m_Broadcasts.clear();
+	for (int *fd : {&m_ListenTCP, &m_ListenUNIX, &m_Epoll, &m_StopFd,
+			&m_BroadcastFd}) {
+		if (*fd >= 0)
+			close(*fd);
+		*fd = -1;
+	}
+}
+
+inline void
+MockServer::run()
+{
+	constexpr int EVENTS_MAX = 64;
+	struct epoll_event events[EVENTS_MAX];
+	while (true) {
+		int count = epoll_wait(m_Epoll, events, EVENTS_MAX,
+				       delayedTimeout());
+		if (count < 0 && errno != EINTR)
+			abort();
+		for (int i = 0; i < count; i++) {
+			uint64_t id = events[i].data.u64;
+			if (id == STOP_ID)
+				return;
+			if (id == BROADCAST_ID) {
+				applyBroadcasts();
+				if (m_DropConns.exchange(false)) {
+					while (!m_Conns.empty())
+						closeConn(m_Conns.begin()->first);
+					m_Delayed.clear();
+				}
+				continue;
+			}
+			if (id == LISTEN_TCP_ID) {
+				acceptConn(m_ListenTCP);
+				continue;
+			}
+			if (id == LISTEN_UNIX_ID) {
+				acceptConn(m_ListenUNIX);
+				continue;
+			}
+			auto itr = m_Conns.find(id);
+			if (itr == m_Conns.end())
+				continue;
+			Conn &conn = itr->second;
+			bool ok = true;
+			if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+				ok = readConn(id, conn);
+			if (ok && (events[i].events & EPOLLOUT))
+				ok = writeConn(id, conn);
+			if (!ok)
+				closeConn(id);
+		}
+		flushDelayed();
+	}
+}
+
+inline void
+MockServer::acceptConn(int listen_fd)
+{
+	int fd;
+	while ((fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK)) >= 0) {
+		if (m_Conns.size() >= m_Cfg.max_connections) {
+			close(fd);
+			continue;
+		}
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		uint64_t id = m_NextConnId++;
+		Conn &conn = m_Conns[id];
+		conn.fd = fd;
+		conn.want_write = false;
+		std::string line1 = "Tarantool " + m_Cfg.version +
+				    " (Binary) "
+				    "00000000-0000-0000-0000-000000000000";
+		std::string line2(Iproto::GREETING_MAX_SALT_SIZE - 1, 'A');
+		line2.push_back('=');
+		line1.resize(Iproto::GREETING_LINE1_SIZE - 1, ' ');
+		line2.resize(Iproto::GREETING_LINE2_SIZE - 1, ' ');
+		conn.out = line1 + "\n" + line2 + "\n";
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.u64 = id;
+		if (epoll_ctl(m_Epoll, EPOLL_CTL_ADD, fd, &ev) != 0 ||
+		    !writeConn(id, conn)) {
+			closeConn(id);
+			continue;
+		}
+		m_ConnCount.store(m_Conns.size(), std::memory_order_relaxed);
+	}
+}
+
+inline void
+MockServer::closeConn(uint64_t id)
+{
+	auto itr = m_Conns.find(id);
+	assert(itr != m_Conns.end());
+	close(itr->second.fd);
+	m_Conns.erase(itr);
+	m_ConnCount.store(m_Conns.size(), std::memory_order_relaxed);
+}
+
+inline void
+MockServer::updateEvents(uint64_t id, Conn &conn)
+{
+	bool want_write = !conn.out.empty();
+	if (want_write == conn.want_write)
+		return;
+	struct epoll_event ev;
+	ev.events = want_write ? EPOLLIN | EPOLLOUT : EPOLLIN;
+	ev.data.u64 = id;
+	epoll_ctl(m_Epoll, EPOLL_CTL_MOD, conn.fd, &ev);
+	conn.want_write = want_write;
+}
+
+inline bool
+MockServer::writeConn(uint64_t id, Conn &conn)
+{
+	size_t sent = 0;
+	while (sent < conn.out.size()) {
+		ssize_t rc = send(conn.fd, conn.out.data() + sent,
+				  conn.out.size() - sent, MSG_NOSIGNAL);
+		if (rc < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		sent += rc;
+	}
+	conn.out.erase(0, sent);
+	updateEvents(id, conn);
+	return true;
+}
+
+inline bool
+MockServer::readConn(uint64_t id, Conn &conn)
+{
+	while (true) {
+		ssize_t rc = recv(conn.fd, m_ReadBuf, READ_SIZE, 0);
+		if (rc == 0)
+			return false;
+		if (rc < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		conn.in.append(m_ReadBuf, rc);
+	}
+	std::string &responses = m_Responses;
+	responses.clear();
+	const char *begin = conn.in.data();
+	const char *end = begin + conn.in.size();
+	const char *p = begin;
+	while (p < end) {
+		const char *req = p;
+		uint64_t size;
+		if (!mock_mp::readUint(req, end, size))
+			break;
+		if ((size_t)(end - req) < size)
+			break;
+		if (!processRequest(conn, req, req + size, responses))
+			return false;
+		p = req + size;
+	}
+	conn.in.erase(0, p - begin);
+	if (responses.empty())
+		return true;
+	unsigned delay_us = m_DelayUs.load(std::memory_order_relaxed);
+	if (delay_us != 0) {
+		auto due = std::chrono::steady_clock::now() +
+			std::chrono::microseconds(delay_us);
+		m_Delayed.push_back({id, due, responses});
+		return true;
+	}
+	conn.out.append(responses);
+	return writeConn(id, conn);
+}
+
+inline int
+MockServer::delayedTimeout()
+{
+	if (m_Delayed.empty())
+		return -1;
+	using namespace std::chrono;
+	auto left = m_Delayed.front().due - steady_clock::now();
+	if (left <= steady_clock::duration::zero())
+		return 0;
+	/* Round up so as not to wake up too early. */
+	return duration_cast<milliseconds>(left + milliseconds(1) -
+					   nanoseconds(1)).count();
+}
+
+inline void
+MockServer::flushDelayed()
+{
+	auto now = std::chrono::steady_clock::now();
+	/*
+	 * Delay is changed rarely: responses are not reordered, a response
+	 * delayed less than the previous one just waits for it.
+	 */
+	while (!m_Delayed.empty() && m_Delayed.front().due <= now) {
+		Delayed &d = m_Delayed.front();
+		auto itr = m_Conns.find(d.conn_id);
+		if (itr != m_Conns.end()) {
+			itr->second.out.append(d.data);
+			if (!writeConn(d.conn_id, itr->second))
+				closeConn(d.conn_id);
+		}
+		m_Delayed.pop_front();
+	}
+}
+
+inline uint64_t
+MockServer::getRps()
+{
+	auto now = std::chrono::steady_clock::now();
+	size_t requests = m_Requests.load(std::memory_order_relaxed);
+	double sec = std::chrono::duration<double>(now - m_RpsTime).count();
+	uint64_t rps = sec > 0 ? (requests - m_RpsRequests) / sec : 0;
+	m_RpsRequests = requests;
+	m_RpsTime = now;
+	return rps;
+}
+
+inline void
+MockServer::cannedTuple(std::string &out, uint64_t key)
+{
+	mock_mp::putContainer(out, false, 3);
+	mock_mp::putUint(out, key);
+	mock_mp::putStr(out, m_Padding);
+	mock_mp::putDouble(out, 1.01);
+}
+
+/**
+ * Body of response to SELECT from space_rows. Iterators: EQ = 0,
+ * REQ = 1, ALL = 2, LT = 3, LE = 4, GE = 5, GT = 6; others scan all.
+ */
+inline void
+MockServer::selectRows(std::string &out, std::string_view key,
+		       uint64_t iterator, uint64_t offset, uint64_t limit,
+		       std::string_view after, bool fetch_position)
+{
+	using namespace mock_mp;
+	int64_t rows = m_Cfg.space_rows;
+	bool is_desc = iterator == 1 || iterator == 3 || iterator == 4;
+	int64_t step = is_desc ? -1 : 1;
+	/* Inclusive range of keys in order of scan. */
+	int64_t first = is_desc ? rows : 1;
+	int64_t last = is_desc ? 1 : rows;
+	uint64_t k;
+	uint32_t size;
+	const char *p = key.data();
+	const char *p_end = p + key.size();
+	if (readContainer(p, p_end, false, size) && size > 0 &&
+	    readUint(p, p_end, k)) {
+		int64_t ik = k;
+		if (iterator == 0 || iterator == 1)
+			first = last = ik;
+		else if (iterator == 3)
+			first = ik - 1;
+		else if (iterator == 6)
+			first = ik + 1;
+		else if (iterator == 2 || iterator == 4 || iterator == 5)
+			first = ik;
+	}
+	if (!after.empty()) {
+		int64_t pos = std::strtoll(std::string(after).c_str(), nullptr, 10);
+		first = is_desc ? std::min(first, pos - 1) :
+				  std::max(first, pos + 1);
+	}
+	first = is_desc ? std::min(first, rows) : std::max<int64_t>(first, 1);
+	last = is_desc ? std::max<int64_t>(last, 1) : std::min(last, rows);
+	uint64_t available = 0;
+	if ((last - first) * step >= 0)
+		available = (last - first) * step + 1;
+	uint64_t skipped = std::min(offset, available);
+	uint64_t count = std::min(limit, available - skipped);
+	m_Scanned.fetch_add(skipped + count, std::memory_order_relaxed);
+	int64_t start = first + step * (int64_t)skipped;
+	bool has_position = fetch_position && count > 0;
+	putContainer(out, true, has_position ? 2 : 1);
+	putUint(out, Iproto::DATA);
+	putContainer(out, false, count);
+	for (uint64_t i = 0; i < count; i++)
+		cannedTuple(out, start + step * (int64_t)i);
+	if (has_position) {
+		putUint(out, Iproto::POSITION);
+		putStr(out, std::to_string(start + step * (int64_t)(count - 1)));
+	}
+}
+
+/** Check AUTH of @a user with tuple ["chap-sha1", scramble]. */
+inline bool
+MockServer::checkAuth(std::string_view user, std::string_view tuple)
+{
+	using namespace mock_mp;
+	if (m_Cfg.auth_user.empty())
+		return true;
+	const char *p = tuple.data();
+	const char *end = p + tuple.size();
+	uint32_t size;
+	std::string_view mechanism, scramble;
+	if (!readContainer(p, end, false, size) || size != 2 ||
+	    !readStr(p, end, mechanism) || !readBin(p, end, scramble))
+		return false;
+	return user == m_Cfg.auth_user && mechanism == "chap-sha1" &&
+	       scramble == m_Cfg.auth_scramble;
+}
+
+/** OK row with vclock {1: replication_rows} in its body. */
+inline void
+MockServer::vclockRow(std::string &out, uint64_t sync)
+{
+	using namespace mock_mp;
+	size_t start = beginPacket(out);
+	putContainer(out, true, 2);
+	putUint(out, Iproto::REQUEST_TYPE);
+	putUint(out, Iproto::OK);
+	putUint(out, Iproto::SYNC);
+	putUint(out, sync);
+	putContainer(out, true, 1);
+	putUint(out, Iproto::VCLOCK);
+	putContainer(out, true, 1);
+	putUint(out, 1);
+	putUint(out, m_Cfg.replication_rows);
+	endPacket(out, start);
+}
+
+/**
+ * Answer JOIN with the whole log as a snapshot and SUBSCRIBE with rows
+ * having lsn greater than @a from. The stream ends with a heartbeat,
+ * next rows would be sent as soon as they appear in the log (never).
+ */
+inline void
+MockServer::replicate(std::string &out, uint64_t type, uint64_t sync,
+		      uint64_t from)
+{
+	using namespace mock_mp;
+	vclockRow(out, sync);
+	bool is_join = type == Iproto::JOIN;
+	for (uint64_t lsn = from + 1; lsn <= m_Cfg.replication_rows; lsn++) {
+		size_t start = beginPacket(out);
+		if (is_join) {
+			/* Rows of snapshot don't belong to any replica. */
+			putContainer(out, true, 1);
+			putUint(out, Iproto::REQUEST_TYPE);
+			putUint(out, Iproto::INSERT);
+		} else {
+			putContainer(out, true, 4);
+			putUint(out, Iproto::REQUEST_TYPE);
+			putUint(out, Iproto::REPLACE);
+			putUint(out, Iproto::REPLICA_ID);
+			putUint(out, 1);
+			putUint(out, Iproto::LSN);
+			putUint(out, lsn);
+			putUint(out, Iproto::TIMESTAMP);
+			putDouble(out, 1.0);
+		}
+		putContainer(out, true, 2);
+		putUint(out, Iproto::SPACE_ID);
+		putUint(out, 512);
+		putUint(out, Iproto::TUPLE);
+		cannedTuple(out, lsn);
+		endPacket(out, start);
+	}
+	if (is_join) {
+		/* End of initial and final join: nothing is written meanwhile. */
+		vclockRow(out, sync);
+		vclockRow(out, sync);
+		return;
+	}
+	size_t start = beginPacket(out);
+	putContainer(out, true, 3);
+	putUint(out, Iproto::REQUEST_TYPE);
+	putUint(out, Iproto::OK);
+	putUint(out, Iproto::REPLICA_ID);
+	putUint(out, 1);
+	putUint(out, Iproto::TIMESTAMP);
+	putDouble(out, 1.0);
+	endPacket(out, start);
+}
+
+inline void
+MockServer::broadcast(const std::string &key, uint64_t value)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_BroadcastMutex);
+		m_Broadcasts.emplace_back(key, value);
+	}
+	uint64_t one = 1;
+	if (write(m_BroadcastFd, &one, sizeof(one)) != sizeof(one))
+		abort();
+}
+
+inline void
+MockServer::dropConnections()
+{
+	m_DropConns.store(true);
+	/* Wake up the server thread as broadcast does. */
+	uint64_t one = 1;
+	if (write(m_BroadcastFd, &one, sizeof(one)) != sizeof(one))
+		abort();
+}
+
+/** IPROTO_EVENT with the current value of @a key. */
+inline void
+MockServer::event(std::string &out, const std::string &key)
+{
+	using namespace mock_mp;
+	auto itr = m_Values.find(key);
+	size_t start = beginPacket(out);
+	putContainer(out, true, 2);
+	putUint(out, Iproto::REQUEST_TYPE);
+	putUint(out, Iproto::EVENT);
+	putUint(out, Iproto::SYNC);
+	putUint(out, 0);
+	/* Nil value is omitted. */
+	putContainer(out, true, itr == m_Values.end() ? 1 : 2);
+	putUint(out, Iproto::EVENT_KEY);
+	putStr(out, key);
+	if (itr != m_Values.end()) {
+		putUint(out, Iproto::EVENT_DATA);
+		putUint(out, itr->second);
+	}
+	endPacket(out, start);
+}
+
+/** The first WATCH subscribes, the next ones acknowledge events. */
+inline void
+MockServer::watch(Conn &conn, const std::string &key, std::string &out)
+{
+	m_Watches.fetch_add(1, std::memory_order_relaxed);
+	auto [itr, is_new] = conn.watches.try_emplace(key, Watch{false, false});
+	Watch &w = itr->second;
+	if (!is_new && w.is_sent && !w.is_dirty) {
+		w.is_sent = false;
+		return;
+	}
+	event(out, key);
+	w.is_sent = true;
+	w.is_dirty = false;
+}
+
+inline void
+MockServer::applyBroadcasts()
+{
+	uint64_t cnt;
+	if (read(m_BroadcastFd, &cnt, sizeof(cnt)) != sizeof(cnt))
+		return;
+	std::vector<std::pair<std::string, uint64_t>> broadcasts;
+	{
+		std::lock_guard<std::mutex> lock(m_BroadcastMutex);
+		broadcasts.swap(m_Broadcasts);
+	}
+	std::vector<uint64_t> failed;
+	for (auto &[key, value] : broadcasts) {
+		m_Values[key] = value;
+		for (auto &[id, conn] : m_Conns) {
+			auto itr = conn.watches.find(key);
+			if (itr == conn.watches.end())
+				continue;
+			Watch &w = itr->second;
+			if (w.is_sent) {
+				w.is_dirty = true;
+				continue;
+			}
+			event(conn.out, key);
+			w.is_sent = true;
+			if (!writeConn(id, conn))
+				failed.push_back(id);
+		}
+	}
+	for (uint64_t id : failed) {
+		if (m_Conns.count(id) != 0)
+			closeConn(id);
+	}
+}
+
+/**
+ * Parse request located in [p, end) and append response to @a out.
+ * Return false if request is malformed.
+ */
+inline bool
+MockServer::processRequest(Conn &conn, const char *p, const char *end,
+			   std::string &out)
+{
+	using namespace mock_mp;
+	uint64_t type = UINT64_MAX, sync = 0;
+	uint32_t size;
+	if (!readContainer(p, end, true, size))
+		return false;
+	for (uint32_t i = 0; i < size; i++) {
+		uint64_t key;
+		if (!readUint(p, end, key))
+			return false;
+		bool ok;
+		if (key == Iproto::REQUEST_TYPE)
+			ok = readUint(p, end, type);
+		else if (key == Iproto::SYNC)
+			ok = readUint(p, end, sync);
+		else
+			ok = skip(p, end);
+		if (!ok)
+			return false;
+	}
+	/* Raw msgpack of request's key or tuple; function name of CALL. */
+	std::string_view payload;
+	std::string_view func;
+	/* LSN of replica 1 in vclock of SUBSCRIBE or ack. */
+	uint64_t lsn = 0;
+	std::string_view event_key;
+	std::string_view user;
+	/* Arguments of SELECT. */
+	uint64_t iterator = 0, offset = 0, limit = UINT64_MAX;
+	std::string_view after;
+	bool fetch_position = false;
+	if (p < end) {
+		if (!readContainer(p, end, true, size))
+			return false;
+		for (uint32_t i = 0; i < size; i++) {
+			uint64_t key;
+			if (!readUint(p, end, key))
+				return false;
+			const char *value = p;
+			bool ok;
+			if (key == Iproto::FUNCTION_NAME)
+				ok = readStr(p, end, func);
+			else if (key == Iproto::VCLOCK)
+				ok = readVclockLsn(p, end, lsn);
+			else if (key == Iproto::EVENT_KEY)
+				ok = readStr(p, end, event_key);
+			else if (key == Iproto::USER_NAME)
+				ok = readStr(p, end, user);
+			else if (key == Iproto::ITERATOR)
+				ok = readUint(p, end, iterator);
+			else if (key == Iproto::OFFSET)
+				ok = readUint(p, end, offset);
+			else if (key == Iproto::LIMIT)
+				ok = readUint(p, end, limit);
+			else if (key == Iproto::AFTER_POSITION)
+				ok = readStr(p, end, after);
+			else if (key == Iproto::FETCH_POSITION)
+				ok = readBool(p, end, fetch_position);
+			else
+				ok = skip(p, end);
+			if (!ok)
+				return false;
+			if (key == Iproto::KEY || key == Iproto::TUPLE)
+				payload = std::string_view(value, p - value);
+		}
+	}
+	if (type == Iproto::OK) {
+		/* Replica acknowledges its position: no response. */
+		m_AckedLsn.store(lsn, std::memory_order_relaxed);
+		m_Acks.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+	if (type == Iproto::WATCH) {
+		watch(conn, std::string(event_key), out);
+		return true;
+	}
+	if (type == Iproto::UNWATCH) {
+		conn.watches.erase(std::string(event_key));
+		return true;
+	}
+	if (type == Iproto::JOIN || type == Iproto::SUBSCRIBE) {
+		replicate(out, type, sync, type == Iproto::JOIN ? 0 : lsn);
+		m_Requests.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+	if (type == Iproto::CALL && func == "push") {
+		uint64_t count = 0;
+		const char *a = payload.data();
+		const char *a_end = a + payload.size();
+		if (readContainer(a, a_end, false, size) && size > 0)
+			readUint(a, a_end, count);
+		for (uint64_t i = 1; i <= count; i++) {
+			size_t start = beginPacket(out);
+			putContainer(out, true, 2);
+			putUint(out, Iproto::REQUEST_TYPE);
+			putUint(out, Iproto::CHUNK);
+			putUint(out, Iproto::SYNC);
+			putUint(out, sync);
+			putContainer(out, true, 1);
+			putUint(out, Iproto::DATA);
+			putContainer(out, false, 1);
+			cannedTuple(out, i);
+			endPacket(out, start);
+		}
+	}
+	size_t start = beginPacket(out);
+	bool is_known = type == Iproto::PING || type == Iproto::SELECT ||
+			type == Iproto::REPLACE || type == Iproto::CALL ||
+			type == Iproto::AUTH;
+	uint64_t errcode = 0;
+	std::string errmsg;
+	if (!is_known) {
+		/* ER_UNKNOWN_REQUEST_TYPE */
+		errcode = 48;
+		errmsg = "Unknown request type";
+	} else if (type == Iproto::AUTH) {
+		m_Auths.fetch_add(1, std::memory_order_relaxed);
+		if (!checkAuth(user, payload)) {
+			/* ER_CREDS_MISMATCH */
+			errcode = 47;
+			errmsg = "User not found or supplied credentials are "
+				 "invalid";
+		}
+	} else if (type == Iproto::CALL && func == "vshard.storage.call") {
+		/* Arguments: bucket_id, mode, function, its arguments. */
+		uint64_t bucket_id = 0;
+		const char *a = payload.data();
+		const char *a_end = a + payload.size();
+		if (readContainer(a, a_end, false, size) && size > 0)
+			readUint(a, a_end, bucket_id);
+		if (!hasBucket(bucket_id)) {
+			/* ER_PROC_LUA */
+			errcode = 32;
+			errmsg = "Cannot perform action with bucket " +
+				 std::to_string(bucket_id) +
+				 ", reason: WRONG_BUCKET";
+		}
+	}
+	putContainer(out, true, 3);
+	putUint(out, Iproto::REQUEST_TYPE);
+	putUint(out, errcode != 0 ? 0x8000 | errcode : 0);
+	putUint(out, Iproto::SYNC);
+	putUint(out, sync);
+	putUint(out, Iproto::SCHEMA_VERSION);
+	putUint(out, m_SchemaVersion.load());
+	if (errcode != 0) {
+		putContainer(out, true, 1);
+		putUint(out, Iproto::ERROR_24);
+		putStr(out, errmsg);
+	} else if (type == Iproto::PING || type == Iproto::AUTH) {
+		putContainer(out, true, 0);
+	} else if (type == Iproto::SELECT && m_Cfg.space_rows > 0) {
+		selectRows(out, payload, iterator, offset, limit, after,
+			   fetch_position);
+	} else {
+		putContainer(out, true, 1);
+		putUint(out, Iproto::DATA);
+		if (type == Iproto::CALL && func == "get_rps") {
+			putContainer(out, false, 1);
+			putUint(out, getRps());
+		} else if (type == Iproto::CALL &&
+			   func == "vshard.storage.buckets_discovery") {
+			uint64_t first = m_BucketFirst.load();
+			uint64_t last = m_BucketLast.load();
+			uint64_t count = first == 0 ? 0 : last - first + 1;
+			putContainer(out, false, 1);
+			putContainer(out, true, 1);
+			putStr(out, "buckets");
+			putContainer(out, false, count);
+			for (uint64_t b = first; count > 0 && b <= last; b++)
+				putUint(out, b);
+		} else if (m_Cfg.echo && payload.empty()) {
+			putContainer(out, false, 0);
+		} else if (m_Cfg.echo && type == Iproto::CALL) {
+			/* Function returns its arguments. */
+			out.append(payload);
+		} else if (m_Cfg.echo) {
+			putContainer(out, false, 1);
+			out.append(payload);
+		} else {
+			/* Take the first part of the key if it's uint. */
+			uint64_t key = 0;
+			const char *k = payload.data();
+			const char *k_end = k + payload.size();
+			if (readContainer(k, k_end, false, size) && size > 0)
+				readUint(k, k_end, key);
+			putContainer(out, false, 1);
+			cannedTuple(out, key);
+		}
+	}
+	endPacket(out, start);
+	m_Requests.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
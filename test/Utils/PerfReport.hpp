@@ -0,0 +1,525 @@
+#pragma once
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Structured results of performance tests. Every result is identified by
+ * the metric name and the configuration it was measured in (buffer size,
+ * net provider, request type etc); values of repeated runs are kept as
+ * samples and summarized with median and spread. Reports are written as
+ * JSON, so results of different versions can be compared by PerfCompare:
+ *
+ * {"results": [{"metric": "rps", "config": {"buffer": "4096", ...},
+ *   "unit": "rps", "better": "higher", "repeats": 3, "median": 1.5e6,
+ *   "min": 1.4e6, "max": 1.6e6, "stddev": 1e5, "samples": [...]}, ...]}
+ */
+struct PerfResult {
+	enum Better { HIGHER, LOWER };
+	using Config_t = std::map<std::string, std::string>;
+
+	std::string metric;
+	Config_t config;
+	std::string unit;
+	Better better = HIGHER;
+	std::vector<double> samples;
+
+	/** Unique name of the result: metric{key=value,...}. */
+	std::string key() const
+	{
+		std::string res = metric + "{";
+		for (auto &[k, v] : config) {
+			if (res.back() != '{')
+				res += ",";
+			res += k + "=" + v;
+		}
+		return res + "}";
+	}
+	double median() const
+	{
+		if (samples.empty())
+			return 0;
+		std::vector<double> s = samples;
+		std::sort(s.begin(), s.end());
+		size_t n = s.size();
+		return n % 2 == 1 ? s[n / 2] : (s[n / 2 - 1] + s[n / 2]) / 2;
+	}
+	/** Median absolute deviation: spread which ignores outliers. */
+	double mad() const
+	{
+		double m = median();
+		PerfResult dev;
+		for (double v : samples)
+			dev.samples.push_back(std::fabs(v - m));
+		return dev.median();
+	}
+	double min() const
+	{
+		return samples.empty() ? 0 :
+		       *std::min_element(samples.begin(), samples.end());
+	}
+	double max() const
+	{
+		return samples.empty() ? 0 :
+		       *std::max_element(samples.begin(), samples.end());
+	}
+	double stddev() const
+	{
+		size_t n = samples.size();
+		if (n < 2)
+			return 0;
+		double mean = 0;
+		for (double v : samples)
+			mean += v;
+		mean /= n;
+		double sum = 0;
+		for (double v : samples)
+			sum += (v - mean) * (v - mean);
+		return std::sqrt(sum / (n - 1));
+	}
+};
+
+class PerfReport {
+public:
+	/** Add a sample of the result; new result is created if needed. */
+	void add(std::string_view metric, const PerfResult::Config_t &config,
+		 std::string_view unit, PerfResult::Better better, double value)
+	{
+		PerfResult r;
+		r.metric = metric;
+		r.config = config;
+		std::string key = r.key();
+		auto it = m_Index.find(key);
+		if (it == m_Index.end()) {
+			r.unit = unit;
+			r.better = better;
+			it = m_Index.emplace(key, m_Results.size()).first;
+			m_Results.push_back(std::move(r));
+		}
+		m_Results[it->second].samples.push_back(value);
+	}
+	const std::vector<PerfResult> &results() const { return m_Results; }
+	bool empty() const { return m_Results.empty(); }
+
+	void write(std::ostream &out) const;
+	/** Return 0 on success, -1 if the file can't be written. */
+	int writeFile(const std::string &path) const;
+	/**
+	 * Parse results written by write() or by the JSON reporter of
+	 * google benchmark (real_time of every benchmark run, lower
+	 * is better). Return 0 on success, -1 on error.
+	 */
+	int read(std::istream &in);
+	int readFile(const std::string &path);
+
+private:
+	std::vector<PerfResult> m_Results;
+	std::map<std::string, size_t> m_Index;
+};
+
+/**
+ * Minimal JSON DOM: just enough to read perf reports back.
+ */
+namespace perf_json {
+
+struct Value {
+	enum Type { NUL, BOOL, NUMBER, STRING, ARRAY, OBJECT };
+	Type type = NUL;
+	bool boolean = false;
+	double number = 0;
+	std::string str;
+	std::vector<Value> arr;
+	std::vector<std::pair<std::string, Value>> obj;
+
+	const Value *get(std::string_view name) const
+	{
+		for (auto &[k, v] : obj)
+			if (k == name)
+				return &v;
+		return nullptr;
+	}
+	std::string getStr(std::string_view name) const
+	{
+		const Value *v = get(name);
+		return v != nullptr && v->type == STRING ? v->str : "";
+	}
+};
+
+class Parser {
+public:
+	explicit Parser(std::string_view text) : m_Text(text) {}
+	/** Return 0 on success, -1 on syntax error. */
+	int parse(Value &res)
+	{
+		if (parseValue(res) != 0)
+			return -1;
+		skipSpace();
+		return m_Pos == m_Text.size() ? 0 : -1;
+	}
+
+private:
+	void skipSpace()
+	{
+		while (m_Pos < m_Text.size() &&
+		       strchr(" \t\r\n", m_Text[m_Pos]) != nullptr)
+			m_Pos++;
+	}
+	bool accept(char c)
+	{
+		skipSpace();
+		if (m_Pos < m_Text.size() && m_Text[m_Pos] == c) {
+			m_Pos++;
+			return true;
+		}
+		return false;
+	}
+	bool acceptWord(std::string_view word)
+	{
+		if (m_Text.substr(m_Pos, word.size()) != word)
+			return false;
+		m_Pos += word.size();
+		return true;
+	}
+	int parseString(std::string &res)
+	{
+		if (!accept('"'))
+			return -1;
+		while (m_Pos < m_Text.size() && m_Text[m_Pos] != '"') {
+			char c = m_Text[m_Pos++];
+			if (c != '\\') {
+				res += c;
+				continue;
+			}
+			if (m_Pos == m_Text.size())
+				return -1;
+			c = m_Text[m_Pos++];
+			switch (c) {
+			case 'b': res += '\b'; break;
+			case 'f': res += '\f'; break;
+			case 'n': res += '\n'; break;
+			case 'r': res += '\r'; break;
+			case 't': res += '\t'; break;
+			case 'u':
+				/* Names and configs are ASCII. */
+				if (m_Pos + 4 > m_Text.size())
+					return -1;
+				res += '?';
+				m_Pos += 4;
+				break;
+			default: res += c; break;
+			}
+		}
+		if (m_Pos == m_Text.size())
+			return -1;
+		m_Pos++;
+		return 0;
+	}
+	int parseValue(Value &res)
+	{
+		skipSpace();
+		if (m_Pos == m_Text.size())
+			return -1;
+		char c = m_Text[m_Pos];
+		if (c == '"') {
+			res.type = Value::STRING;
+			return parseString(res.str);
+		}
+		if (c == '[') {
+			m_Pos++;
+			res.type = Value::ARRAY;
+			if (accept(']'))
+				return 0;
+			do {
+				res.arr.emplace_back();
+				if (parseValue(res.arr.back()) != 0)
+					return -1;
+			} while (accept(','));
+			return accept(']') ? 0 : -1;
+		}
+		if (c == '{') {
+			m_Pos++;
+			res.type = Value::OBJECT;
+			if (accept('}'))
+				return 0;
+			do {
+				res.obj.emplace_back();
+				if (parseString(res.obj.back().first) != 0 ||
+				    !accept(':') ||
+				    parseValue(res.obj.back().second) != 0)
+					return -1;
+			} while (accept(','));
+			return accept('}') ? 0 : -1;
+		}
+		if (acceptWord("null"))
+			return 0;
+		if (acceptWord("true") || acceptWord("false")) {
+			res.type = Value::BOOL;
+			res.boolean = c == 't';
+			return 0;
+		}
+		std::string num(m_Text.substr(m_Pos, 64));
+		char *end;
+		res.number = strtod(num.c_str(), &end);
+		if (end == num.c_str())
+			return -1;
+		res.type = Value::NUMBER;
+		m_Pos += end - num.c_str();
+		return 0;
+	}
+
+	std::string_view m_Text;
+	size_t m_Pos = 0;
+};
+
+static inline void
+writeString(std::ostream &out, std::string_view str)
+{
+	out << '"';
+	for (char c : str) {
+		if (c == '"' || c == '\\')
+			out << '\\' << c;
+		else if ((unsigned char)c < 0x20)
+			out << ' ';
+		else
+			out << c;
+	}
+	out << '"';
+}
+
+static inline void
+writeNumber(std::ostream &out, double v)
+{
+	/* JSON has no representation for NaN and infinity. */
+	if (std::isfinite(v))
+		out << v;
+	else
+		out << "null";
+}
+
+} // namespace perf_json
+
+inline void
+PerfReport::write(std::ostream &out) const
+{
+	using namespace perf_json;
+	std::ios_base::fmtflags flags = out.flags();
+	std::streamsize precision = out.precision(10);
+	out << "{\"results\": [";
+	for (size_t i = 0; i < m_Results.size(); i++) {
+		const PerfResult &r = m_Results[i];
+		out << (i == 0 ? "\n" : ",\n") << "  {\"metric\": ";
+		writeString(out, r.metric);
+		out << ", \"config\": {";
+		bool first = true;
+		for (auto &[k, v] : r.config) {
+			if (!first)
+				out << ", ";
+			first = false;
+			writeString(out, k);
+			out << ": ";
+			writeString(out, v);
+		}
+		out << "}, \"unit\": ";
+		writeString(out, r.unit);
+		out << ", \"better\": \"" <<
+			(r.better == PerfResult::HIGHER ? "higher" : "lower") <<
+			"\", \"repeats\": " << r.samples.size() << ", \"median\": ";
+		writeNumber(out, r.median());
+		out << ", \"min\": ";
+		writeNumber(out, r.min());
+		out << ", \"max\": ";
+		writeNumber(out, r.max());
+		out << ", \"stddev\": ";
+		writeNumber(out, r.stddev());
+		out << ", \"samples\": [";
+		for (size_t j = 0; j < r.samples.size(); j++) {
+			if (j != 0)
+				out << ", ";
+			writeNumber(out, r.samples[j]);
+		}
+		out << "]}";
+	}
+	out << "\n]}\n";
+	out.precision(precision);
+	out.flags(flags);
+}
+
+inline int
+PerfReport::writeFile(const std::string &path) const
+{
+	std::ofstream out(path);
+	if (!out)
+		return -1;
+	write(out);
+	out.close();
+	return out ? 0 : -1;
+}
+
+inline int
+PerfReport::read(std::istream &in)
+{
+	using namespace perf_json;
+	std::stringstream ss;
+	ss << in.rdbuf();
+	std::string text = ss.str();
+	Value root;
+	if (Parser(text).parse(root) != 0 || root.type != Value::OBJECT)
+		return -1;
+	if (const Value *results = root.get("results"); results != nullptr) {
+		if (results->type != Value::ARRAY)
+			return -1;
+		for (const Value &r : results->arr) {
+			PerfResult::Config_t config;
+			if (const Value *c = r.get("config"); c != nullptr)
+				for (auto &[k, v] : c->obj)
+					config[k] = v.str;
+			PerfResult::Better better = r.getStr("better") == "lower" ?
+				PerfResult::LOWER : PerfResult::HIGHER;
+			const Value *samples = r.get("samples");
+			const Value *median = r.get("median");
+			if (samples != nullptr && !samples->arr.empty()) {
+				for (const Value &v : samples->arr)
+					if (v.type == Value::NUMBER)
+						add(r.getStr("metric"), config,
+						    r.getStr("unit"), better,
+						    v.number);
+			} else if (median != nullptr &&
+				   median->type == Value::NUMBER) {
+				add(r.getStr("metric"), config,
+				    r.getStr("unit"), better, median->number);
+			}
+		}
+		return 0;
+	}
+	const Value *benchmarks = root.get("benchmarks");
+	if (benchmarks == nullptr || benchmarks->type != Value::ARRAY)
+		return -1;
+	/*
+	 * Google benchmark: take runs of every repetition; if only
+	 * aggregates are reported, take the median.
+	 */
+	bool has_iterations = false;
+	for (const Value &b : benchmarks->arr)
+		if (b.getStr("run_type") != "aggregate")
+			has_iterations = true;
+	for (const Value &b : benchmarks->arr) {
+		bool is_aggregate = b.getStr("run_type") == "aggregate";
+		if (has_iterations ? is_aggregate :
+		    b.getStr("aggregate_name") != "median")
+			continue;
+		const Value *time = b.get("real_time");
+		if (time == nullptr || time->type != Value::NUMBER)
+			continue;
+		std::string name = b.getStr("run_name");
+		if (name.empty())
+			name = b.getStr("name");
+		add("real_time", {{"benchmark", name}}, b.getStr("time_unit"),
+		    PerfResult::LOWER, time->number);
+	}
+	return 0;
+}
+
+inline int
+PerfReport::readFile(const std::string &path)
+{
+	std::ifstream in(path);
+	if (!in)
+		return -1;
+	return read(in);
+}
+
+/**
+ * Compare medians of results present in both reports and print the
+ * table of changes to @a out. A result is regressed if it has become worse
+ * by more than @a threshold percent and, when both results are repeated,
+ * the change exceeds the sum of median absolute deviations of the runs
+ * (otherwise it's considered to be noise). Unlike min..max ranges, MAD
+ * isn't widened by a single outlier. Return count of regressions.
+ */
+static inline size_t
+perfCompare(const PerfReport &base, const PerfReport &next, double threshold,
+	    std::ostream &out)
+{
+	std::map<std::string, const PerfResult *> base_results;
+	for (const PerfResult &r : base.results())
+		base_results[r.key()] = &r;
+	size_t regressions = 0;
+	std::ios_base::fmtflags flags = out.flags();
+	std::streamsize precision = out.precision(4);
+	for (const PerfResult &r : next.results()) {
+		auto it = base_results.find(r.key());
+		if (it == base_results.end()) {
+			out << "NEW         " << r.key() << ": " << r.median() <<
+				" " << r.unit << std::endl;
+			continue;
+		}
+		const PerfResult &b = *it->second;
+		double old_v = b.median();
+		double new_v = r.median();
+		double change = old_v == 0 ? 0 : (new_v - old_v) / old_v * 100;
+		double worse = r.better == PerfResult::HIGHER ? -change : change;
+		bool is_noise = b.samples.size() > 1 && r.samples.size() > 1 &&
+				std::fabs(new_v - old_v) <= b.mad() + r.mad();
+		const char *status = "OK         ";
+		if (worse > threshold && is_noise) {
+			status = "NOISE      ";
+		} else if (worse > threshold) {
+			status = "REGRESSION ";
+			regressions++;
+		} else if (-worse > threshold) {
+			status = "IMPROVEMENT";
+		}
+		out << status << " " << r.key() << ": " << old_v << " -> " <<
+			new_v << " " << r.unit << " (" << std::showpos <<
+			change << std::noshowpos << "%, spread " << r.min() <<
+			".." << r.max() << ", mad " << r.mad() << ")" <<
+			std::endl;
+		base_results.erase(it);
+	}
+	for (auto &[key, r] : base_results)
+		out << "MISSING     " << key << ": " << r->median() << " " <<
+			r->unit << std::endl;
+	out.precision(precision);
+	out.flags(flags);
+	return regressions;
+}
@@ -32,6 +32,7 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <wait.h>
 #include <sys/prctl.h>
 
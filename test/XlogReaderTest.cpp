@@ -0,0 +1,400 @@
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include "Utils/Helpers.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "Utils/Helpers.hpp"
+#include "Utils/TupleReader.hpp"
+
+#include "../src/Client/XlogReader.hpp"
+
+static const char *xlog_path = "XlogReaderTest.xlog";
+static const char *instance_uuid = "0d5bd431-7f3e-4695-a5c2-82de0a9cbc95";
+static constexpr uint32_t space_id = 512;
+static constexpr size_t TX_CNT = 500;
+static constexpr size_t MAX_TX_ROWS = 4;
+
+/** Minimal msgpack encoding of Tarantool's xlog writer. */
+static void
+mpUint(std::string &out, uint64_t v)
+{
+	if (v < 0x80) {
+		out.push_back((char) v);
+		return;
+	}
+	size_t size = v <= UINT8_MAX ? 1 : v <= UINT16_MAX ? 2 :
+		      v <= UINT32_MAX ? 4 : 8;
+	out.push_back((char) (0xcc + __builtin_ctz(size)));
+	for (size_t i = size; i > 0; i--)
+		out.push_back((char) (v >> ((i - 1) * 8)));
+}
+
+static void
+mpStr(std::string &out, const std::string &str)
+{
+	assert(str.size() < 32);
+	out.push_back((char) (0xa0 + str.size()));
+	out += str;
+}
+
+static void
+mpDouble(std::string &out, double d)
+{
+	uint64_t v;
+	memcpy(&v, &d, sizeof(v));
+	out.push_back((char) 0xcb);
+	for (size_t i = 8; i > 0; i--)
+		out.push_back((char) (v >> ((i - 1) * 8)));
+}
+
+static void
+mpBe32(std::string &out, uint32_t v)
+{
+	for (size_t i = 4; i > 0; i--)
+		out.push_back((char) (v >> ((i - 1) * 8)));
+}
+
+static UserTuple
+rowTuple(int64_t lsn)
+{
+	return UserTuple{(uint64_t) lsn, "str" + std::to_string(lsn), lsn * 0.5};
+}
+
+/**
+ * Row of tx starting with @a tsn; NOP rows (every 7th lsn) have
+ * no body.
+ */
+static void
+encodeRow(std::string &out, int64_t lsn, int64_t tsn, bool is_commit,
+	  bool is_multi)
+{
+	bool is_nop = lsn % 7 == 0;
+	out.push_back((char) (0x80 + (is_multi ? 5 : 3)));
+	mpUint(out, Iproto::REQUEST_TYPE);
+	mpUint(out, is_nop ? Iproto::NOP : Iproto::REPLACE);
+	mpUint(out, Iproto::REPLICA_ID);
+	mpUint(out, 1);
+	mpUint(out, Iproto::LSN);
+	mpUint(out, lsn);
+	if (is_multi) {
+		mpUint(out, Iproto::TSN);
+		mpUint(out, tsn);
+		mpUint(out, Iproto::FLAGS);
+		mpUint(out, is_commit ? Iproto::FLAG_COMMIT : 0);
+	}
+	if (is_nop)
+		return;
+	UserTuple t = rowTuple(lsn);
+	out.push_back((char) 0x82);
+	mpUint(out, Iproto::SPACE_ID);
+	mpUint(out, space_id);
+	mpUint(out, Iproto::TUPLE);
+	out.push_back((char) 0x93);
+	mpUint(out, t.field1);
+	mpStr(out, t.field2);
+	mpDouble(out, t.field3);
+}
+
+static void
+encodeTx(std::string &out, const std::string &data, uint32_t magic)
+{
+	size_t start = out.size();
+	mpBe32(out, magic);
+	mpUint(out, data.size());
+	mpUint(out, 0);
+	mpUint(out, tnt::crc32c(0, data.data(), data.size()));
+	size_t padding = Iproto::XLOG_FIXHEADER_SIZE - (out.size() - start);
+	if (padding > 0) {
+		out.push_back((char) (0xa0 + padding - 1));
+		out.append(padding - 1, '\0');
+	}
+	out += data;
+}
+
+struct XlogFile {
+	std::string content;
+	/** Offset of data of each tx. */
+	std::vector<size_t> tx_offsets;
+	size_t row_cnt = 0;
+	int64_t lsn_sum = 0;
+};
+
+static XlogFile
+makeXlog(bool with_eof = true)
+{
+	XlogFile file;
+	std::string &out = file.content;
+	out += "XLOG\n0.13\nVersion: 2.11.0\n";
+	out += std::string("Instance: ") + instance_uuid + "\n";
+	out += "VClock: {1: 1, 2: 42}\nPrevVClock: {}\n\n";
+	int64_t lsn = 1;
+	for (size_t i = 0; i < TX_CNT; i++) {
+		size_t rows = 1 + i % MAX_TX_ROWS;
+		std::string data;
+		int64_t tsn = lsn;
+		for (size_t j = 0; j < rows; j++, lsn++) {
+			encodeRow(data, lsn, tsn, j + 1 == rows, rows > 1);
+			file.row_cnt++;
+			file.lsn_sum += lsn;
+		}
+		encodeTx(out, data, Iproto::XLOG_ROW_MARKER);
+		file.tx_offsets.push_back(out.size() - data.size());
+	}
+	if (with_eof)
+		mpBe32(out, Iproto::XLOG_EOF_MARKER);
+	return file;
+}
+
+static void
+writeFile(const std::string &content)
+{
+	std::ofstream f(xlog_path, std::ios::binary | std::ios::trunc);
+	f.write(content.data(), content.size());
+	fail_unless(f.good());
+}
+
+/** Check rows of xlog written by makeXlog(). */
+struct RowChecker {
+	RowChecker(XlogReader &r) : reader(r) {}
+
+	void operator()(const XlogReader::Row_t &row)
+	{
+		const RowHeader &header = row.header;
+		fail_unless(header.replica_id == 1);
+		int64_t lsn = header.lsn;
+		fail_unless(lsn > 0);
+		fail_unless(header.tsn <= lsn);
+		if (lsn % 7 == 0) {
+			fail_unless(header.type == Iproto::NOP);
+			fail_unless(row.body.tuple == std::nullopt);
+		} else {
+			fail_unless(header.type == Iproto::REPLACE);
+			fail_unless(row.body.space_id == space_id);
+			fail_unless(row.body.tuple != std::nullopt);
+			XlogReader::Buffer_t &buf = reader.buffer();
+			XlogReader::Buffer_t::iterator itr = *row.body.tuple;
+			/* Tuples are not copied. */
+			fail_unless(itr.data() >= buf.begin().data());
+			fail_unless(itr.data() < buf.end().data());
+			UserTuple tuple;
+			mpp::Dec dec(buf);
+			dec.SetPosition(itr);
+			dec.SetReader(false, ArrayReader<XlogReader::Buffer_t>{dec, tuple});
+			fail_unless(dec.Read() == mpp::READ_SUCCESS);
+			UserTuple expected = rowTuple(lsn);
+			fail_unless(tuple.field1 == expected.field1);
+			fail_unless(tuple.field2 == expected.field2);
+			fail_unless(tuple.field3 == expected.field3);
+		}
+		if (header.isCommit())
+			commits++;
+		rows++;
+		lsn_sum += lsn;
+	}
+
+	XlogReader &reader;
+	std::atomic<size_t> rows{0};
+	std::atomic<size_t> commits{0};
+	std::atomic<int64_t> lsn_sum{0};
+};
+
+static void
+test_crc32c()
+{
+	TEST_INIT(0);
+	/* Standard check value of CRC32C (with inversions). */
+	const char *check = "123456789";
+	fail_unless(~tnt::crc32c(~0u, check, strlen(check)) == 0xe3069283);
+	fail_unless(tnt::crc32c(0, check, 0) == 0);
+
+	std::string data;
+	for (size_t i = 0; i < 1000; i++)
+		data.push_back((char) (i * 31 + 7));
+	for (size_t size : {1, 7, 8, 9, 63, 64, 65, 999, 1000}) {
+		uint32_t crc = tnt::crc32c(0, data.data(), size);
+		uint32_t soft = tnt::crc32c_details::crc32cSoft(0, data.data(), size);
+		fail_unless(crc == soft);
+		/* Checksum of parts is the same as of the whole. */
+		size_t half = size / 2;
+		uint32_t parts = tnt::crc32c(0, data.data(), half);
+		parts = tnt::crc32c(parts, data.data() + half, size - half);
+		fail_unless(parts == crc);
+	}
+}
+
+static void
+test_read()
+{
+	TEST_INIT(0);
+	XlogFile file = makeXlog();
+	writeFile(file.content);
+
+	XlogReader reader;
+	fail_unless(reader.open(xlog_path) == 0);
+	const XlogMeta &meta = reader.meta();
+	fail_unless(meta.filetype == "XLOG");
+	fail_unless(meta.version == "0.13");
+	fail_unless(meta.server_version == "2.11.0");
+	fail_unless(meta.instance_uuid == instance_uuid);
+	fail_unless(meta.vclock.size() == 2);
+	fail_unless(meta.vclock.get(1) == 1);
+	fail_unless(meta.vclock.get(2) == 42);
+	fail_unless(meta.prev_vclock.empty());
+
+	RowChecker checker(reader);
+	int64_t rows = reader.readRows(checker);
+	fail_unless(rows == (int64_t) file.row_cnt);
+	fail_unless(checker.rows == file.row_cnt);
+	fail_unless(checker.commits == TX_CNT);
+	fail_unless(checker.lsn_sum == file.lsn_sum);
+	fail_unless(reader.hasEof());
+
+	/* Rows are passed in order. */
+	int64_t prev_lsn = 0;
+	rows = reader.readRows([&](const XlogReader::Row_t &row) {
+		fail_unless(row.header.lsn == prev_lsn + 1);
+		prev_lsn = row.header.lsn;
+	});
+	fail_unless(rows == (int64_t) file.row_cnt);
+
+	std::vector<XlogTx> txs;
+	fail_unless(reader.scan(txs) == 0);
+	fail_unless(txs.size() == TX_CNT);
+	for (size_t i = 0; i < TX_CNT; i++)
+		fail_unless(txs[i].offset == file.tx_offsets[i]);
+	reader.close();
+	fail_if(reader.isOpen());
+
+	/* File which is not closed yet has no EOF marker. */
+	file = makeXlog(false);
+	writeFile(file.content);
+	fail_unless(reader.open(xlog_path) == 0);
+	RowChecker checker2(reader);
+	fail_unless(reader.readRows(checker2) == (int64_t) file.row_cnt);
+	fail_if(reader.hasEof());
+}
+
+static void
+test_parallel()
+{
+	TEST_INIT(0);
+	XlogFile file = makeXlog();
+	writeFile(file.content);
+
+	XlogReader reader;
+	fail_unless(reader.open(xlog_path) == 0);
+	for (size_t threads : {1, 2, 3, 4, 16, 1000}) {
+		RowChecker checker(reader);
+		int64_t rows = reader.readRowsParallel(checker, threads);
+		fail_unless(rows == (int64_t) file.row_cnt);
+		fail_unless(checker.rows == file.row_cnt);
+		fail_unless(checker.commits == TX_CNT);
+		fail_unless(checker.lsn_sum == file.lsn_sum);
+		fail_unless(reader.hasEof());
+	}
+}
+
+static void
+test_corrupted()
+{
+	TEST_INIT(0);
+	XlogFile file = makeXlog();
+	XlogReader reader;
+
+	TEST_CASE("checksum mismatch");
+	std::string content = file.content;
+	content[file.tx_offsets[TX_CNT / 2] + 3] ^= 0x10;
+	writeFile(content);
+	fail_unless(reader.open(xlog_path) == 0);
+	size_t rows = 0;
+	auto count = [&](const XlogReader::Row_t &) { rows++; };
+	fail_unless(reader.readRows(count) == -1);
+	fail_unless(reader.getError().find("Checksum") != std::string::npos);
+	/* Rows of preceding tx blocks are read. */
+	fail_unless(rows > 0 && rows < file.row_cnt);
+	std::atomic<size_t> parallel_rows{0};
+	auto parallel_count = [&](const XlogReader::Row_t &) { parallel_rows++; };
+	fail_unless(reader.readRowsParallel(parallel_count, 4) == -1);
+	fail_unless(reader.getError().find("Checksum") != std::string::npos);
+
+	TEST_CASE("invalid magic");
+	content = file.content;
+	content[file.tx_offsets[1] - Iproto::XLOG_FIXHEADER_SIZE] = 0;
+	writeFile(content);
+	fail_unless(reader.open(xlog_path) == 0);
+	fail_unless(reader.readRows(count) == -1);
+	fail_unless(reader.getError().find("magic") != std::string::npos);
+	/* Blocks are validated before any row is passed. */
+	parallel_rows = 0;
+	fail_unless(reader.readRowsParallel(parallel_count, 4) == -1);
+	fail_unless(parallel_rows == 0);
+
+	TEST_CASE("truncated tx");
+	content = file.content.substr(0, file.content.size() - 10);
+	writeFile(content);
+	fail_unless(reader.open(xlog_path) == 0);
+	fail_unless(reader.readRows(count) == -1);
+	fail_unless(reader.getError().find("Truncated") != std::string::npos);
+
+	TEST_CASE("compressed tx");
+	content = file.content.substr(0, file.tx_offsets[0] -
+					 Iproto::XLOG_FIXHEADER_SIZE);
+	encodeTx(content, "zstd", Iproto::XLOG_ZROW_MARKER);
+	writeFile(content);
+	fail_unless(reader.open(xlog_path) == 0);
+	fail_unless(reader.readRows(count) == -1);
+	fail_unless(reader.getError().find("Compressed") != std::string::npos);
+
+	TEST_CASE("invalid meta");
+	writeFile("XLOG\n0.13\nVClock: {1 2}\n\n");
+	fail_unless(reader.open(xlog_path) == -1);
+	writeFile("XLOG\n0.11\n\n");
+	fail_unless(reader.open(xlog_path) == -1);
+	writeFile("XLOG\n0.13\nVersion: 2.11.0\n");
+	fail_unless(reader.open(xlog_path) == -1);
+	fail_unless(reader.open("/nonexistent/file.xlog") == -1);
+	fail_if(reader.isOpen());
+}
+
+int main()
+{
+	test_crc32c();
+	test_read();
+	test_parallel();
+	test_corrupted();
+	std::remove(xlog_path);
+	return 0;
+}
@@ -0,0 +1,261 @@
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include "Utils/AllocCounter.hpp"
+#include "Utils/Helpers.hpp"
+#include "Utils/MockServer.hpp"
+
+#include "../src/Client/LibevNetProvider.hpp"
+#include "../src/Client/Connector.hpp"
+#include "../src/Buffer/Buffer.hpp"
+
+/*
+ * Once warmed up, request pipeline must not allocate memory: encoding of
+ * requests, network provider wait(), decoding of responses and getting
+ * them from futures reuse memory of previous requests.
+ */
+
+static const char *localhost = "127.0.0.1";
+static constexpr unsigned port = 3306;
+static constexpr uint32_t space_id = 512;
+static constexpr int WAIT_TIMEOUT = 1000; //milliseconds
+/** Requests in flight in each round. */
+static constexpr size_t BATCH = 100;
+static constexpr size_t WARMUP_ROUNDS = 10;
+static constexpr size_t ROUNDS = 100;
+
+using Buffer_t = tnt::Buffer<16 * 1024>;
+using DefaultNet_t = DefaultNetProvider<Buffer_t, NetworkEngine>;
+using LibevNet_t = LibevNetProvider<Buffer_t, NetworkEngine>;
+
+template <class BUFFER>
+static size_t
+encodeRequest(RequestEncoder<BUFFER> &enc, int request_type, int key)
+{
+	switch (request_type) {
+		case Iproto::PING:
+			return enc.encodePing();
+		case Iproto::SELECT:
+			return enc.encodeSelect(std::make_tuple(key), space_id);
+		case Iproto::REPLACE:
+			return enc.encodeReplace(std::make_tuple(key, "str", 1.01),
+						 space_id);
+		default:
+			abort();
+	}
+}
+
+template <class BUFFER, class NetProvider>
+static rid_t
+executeRequest(Connection<BUFFER, NetProvider> &conn, int request_type, int key)
+{
+	switch (request_type) {
+		case Iproto::PING:
+			return conn.ping();
+		case Iproto::SELECT:
+			return conn.space[space_id].select(std::make_tuple(key));
+		case Iproto::REPLACE:
+			return conn.space[space_id].replace(
+				std::make_tuple(key, "str", 1.01));
+		default:
+			abort();
+	}
+}
+
+/** Response as it comes from the server: with @a tuple_count tuples. */
+static std::string
+makeResponse(uint64_t sync, size_t tuple_count)
+{
+	using namespace mock_mp;
+	std::string body;
+	putContainer(body, true, 3);
+	putUint(body, Iproto::REQUEST_TYPE);
+	putUint(body, 0);
+	putUint(body, Iproto::SYNC);
+	putUint(body, sync);
+	putUint(body, Iproto::SCHEMA_VERSION);
+	putUint(body, 1);
+	if (tuple_count == 0) {
+		putContainer(body, true, 0);
+	} else {
+		putContainer(body, true, 1);
+		putUint(body, Iproto::DATA);
+		putContainer(body, false, tuple_count);
+		for (size_t i = 0; i < tuple_count; i++) {
+			putContainer(body, false, 3);
+			putUint(body, i);
+			putStr(body, "str");
+			putDouble(body, 1.01);
+		}
+	}
+	std::string res(1, '\xce');
+	putBE(res, body.size(), 4);
+	return res + body;
+}
+
+template <class BUFFER>
+void
+test_encoder(int request_type)
+{
+	TEST_INIT(1, request_type);
+	BUFFER buf;
+	RequestEncoder<BUFFER> enc(buf);
+	for (size_t round = 0; round < WARMUP_ROUNDS + ROUNDS; round++) {
+		AllocScope scope;
+		size_t size = 0;
+		for (size_t i = 0; i < BATCH; i++)
+			size += encodeRequest(enc, request_type, i);
+		buf.dropFront(size);
+		if (round >= WARMUP_ROUNDS)
+			fail_unless(scope.allocs() == 0);
+	}
+}
+
+/** Responses are put right into the input buffer of the connection. */
+template <class BUFFER>
+void
+test_decoder(size_t tuple_count)
+{
+	TEST_INIT(1, tuple_count);
+	Connector<BUFFER, DefaultNet_t> client;
+	Connection<BUFFER, DefaultNet_t> conn(client);
+	std::string responses;
+	for (size_t i = 0; i < BATCH; i++)
+		responses += makeResponse(i, tuple_count);
+	for (size_t round = 0; round < WARMUP_ROUNDS + ROUNDS; round++) {
+		AllocScope scope;
+		conn.getInBuf().addBack(wrap::Data{responses.data(),
+						   responses.size()});
+		for (size_t i = 0; i < BATCH; i++)
+			fail_unless(decodeResponse(conn) == DECODE_SUCC);
+		for (size_t i = 0; i < BATCH; i++) {
+			std::optional<Response<BUFFER>> response =
+				conn.getResponse(i);
+			fail_unless(response != std::nullopt);
+			if (tuple_count == 0)
+				continue;
+			fail_unless(response->body.data != std::nullopt);
+			fail_unless(response->body.data->tuples.size() ==
+				    tuple_count);
+		}
+		/* Responses with more tuples than fit inline do allocate. */
+		if (round >= WARMUP_ROUNDS &&
+		    tuple_count <= Data<BUFFER>::INLINE_TUPLES)
+			fail_unless(scope.allocs() == 0);
+	}
+}
+
+/**
+ * Whole pipeline over network: requests are answered by mock server.
+ * With @a is_reconnect idempotent requests are copied to be replayed.
+ */
+template <class BUFFER, class NetProvider>
+void
+test_pipeline(int request_type, bool is_reconnect)
+{
+	TEST_INIT(2, request_type, is_reconnect);
+	Connector<BUFFER, NetProvider> client;
+	Connection<BUFFER, NetProvider> conn(client);
+	fail_unless(client.connect(conn, localhost, port) == 0);
+	if (is_reconnect)
+		conn.setReconnect();
+	for (size_t round = 0; round < WARMUP_ROUNDS + ROUNDS; round++) {
+		rid_t futures[BATCH];
+		AllocScope encode_scope;
+		for (size_t i = 0; i < BATCH; i++)
+			futures[i] = executeRequest(conn, request_type, i);
+		size_t encode_allocs = encode_scope.allocs();
+		AllocScope wait_scope;
+		client.waitAll(conn, futures, BATCH, WAIT_TIMEOUT);
+		size_t wait_allocs = wait_scope.allocs();
+		AllocScope response_scope;
+		for (size_t i = 0; i < BATCH; i++) {
+			std::optional<Response<BUFFER>> response =
+				conn.getResponse(futures[i]);
+			fail_unless(response != std::nullopt);
+			fail_unless(response->header.code == 0);
+		}
+		size_t response_allocs = response_scope.allocs();
+		if (round < WARMUP_ROUNDS)
+			continue;
+		fail_unless(encode_allocs == 0);
+		fail_unless(wait_allocs == 0);
+		fail_unless(response_allocs == 0);
+	}
+	client.close(conn);
+}
+
+/** Prevents compiler from eliding allocations of test_counter(). */
+static void *volatile alloc_sink;
+
+/** Make sure the counter works at all. */
+void
+test_counter()
+{
+	TEST_INIT(0);
+	AllocScope scope;
+	int *p = new int(1);
+	alloc_sink = p;
+	delete p;
+	void *m = malloc(10);
+	alloc_sink = m;
+	free(m);
+	std::string s(1000, 'x');
+	alloc_sink = s.data();
+	fail_unless(scope.allocs() == 3);
+	fail_unless(scope.bytes() >= 1000 + 10 + sizeof(int));
+	AllocScope nested;
+	fail_unless(nested.allocs() == 0);
+}
+
+int main()
+{
+	/* Debug logs are not the subject of the test. */
+	gLogger.setLogLevel(WARNING);
+	test_counter();
+	for (int type : {Iproto::PING, Iproto::SELECT, Iproto::REPLACE})
+		test_encoder<Buffer_t>(type);
+	for (size_t tuple_count : {0, 1, 4, 10})
+		test_decoder<Buffer_t>(tuple_count);
+
+	MockServerConfig cfg;
+	cfg.port = port;
+	MockServer server(cfg);
+	fail_unless(server.start() == 0);
+	for (int type : {Iproto::PING, Iproto::SELECT, Iproto::REPLACE}) {
+		for (bool is_reconnect : {false, true}) {
+			test_pipeline<Buffer_t, DefaultNet_t>(type,
+							      is_reconnect);
+			test_pipeline<Buffer_t, LibevNet_t>(type, is_reconnect);
+		}
+	}
+	server.stop();
+	return 0;
+}